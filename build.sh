@@ -15,11 +15,21 @@ exceptions="-Wno-unused-function -Wno-writable-strings -Wno-gnu-zero-variadic-ma
 mkdir -p "$buildDir"
 
 pushd "$buildDir" > /dev/null
-    clang++ $flags $exceptions "$codeDir/flac_decode.cpp" -o flacdecode -lasound
+    clang++ $flags $exceptions "$codeDir/flac_decode.cpp" -o flacdecode -lasound -lpthread
+    clang++ $flags $exceptions "$codeDir/flac_bench.cpp" -o flacbench -lpthread
+    clang++ $flags $exceptions "$codeDir/flac_encode.cpp" -o flacencode -lpthread
+    clang++ $flags $exceptions "$codeDir/flac_encode_test.cpp" -o flacencode-test -lpthread
+    clang++ $flags $exceptions "$codeDir/flac_stream_test.cpp" -o flacstream-test -lpthread
+    clang++ $flags $exceptions "$codeDir/flac_ogg_test.cpp" -o flacogg-test -lpthread
+    clang++ $flags $exceptions "$codeDir/flac_wide_test.cpp" -o flacwide-test -lpthread
+    clang++ $flags $exceptions "$codeDir/flac_split.cpp" -o flacsplit -lpthread
     clang++ $flags $exceptions "$codeDir/mp3_decode.cpp" -o mp3decode -lasound
-    clang++ $flags $exceptions "$codeDir/wav_decode.cpp" -o wavdecode -lasound
+    clang++ $flags $exceptions "$codeDir/mp3_cut.cpp" -o mp3cut
+    clang++ $flags $exceptions "$codeDir/mp3_test.cpp" -o mp3decode-test
+    clang++ $flags $exceptions "$codeDir/catalog.cpp" -o catalog -lpthread
+    clang++ $flags $exceptions "$codeDir/wav_decode.cpp" -o wavdecode -lasound -lpthread
     clang++ $flags $exceptions "$codeDir/sound.cpp" -o make-sound -lasound
-    clang++ $flags $exceptions "$codeDir/wav_float2int.cpp" -o wav-convert
-    clang++ $flags $exceptions "$codeDir/wav_generator.cpp" -o wav-generate
+    clang++ $flags $exceptions "$codeDir/wav_float2int.cpp" -o wav-convert -lpthread
+    clang++ $flags $exceptions "$codeDir/wav_generator.cpp" -o wav-generate -lpthread
 popd > /dev/null
 
@@ -0,0 +1,1396 @@
+#include "../libberdip/platform.h"
+#include "../libberdip/bitstreamer.h"
+#include "../libberdip/std_memory.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <x86intrin.h>
+
+global MemoryAllocator gMemoryAllocator_;
+global MemoryAllocator *gMemoryAllocator = &gMemoryAllocator_;
+
+global FileAPI gFileApi_;
+global FileAPI *gFileApi = &gFileApi_;
+
+#ifndef FLAC_DEBUG_LEVEL
+#define FLAC_DEBUG_LEVEL  0
+#endif
+
+#include "flac.h"
+#include "wav.h"
+#include "mp3.h"
+#include "mp3_tables.h"
+#include "mp3_fixed.h"
+#include "mp3_stream.h"
+#include "id3.h"
+#include "catalog.h"
+
+#include "../libberdip/std_memory.cpp"
+#include "../libberdip/std_file.c"
+#include "../libberdip/crc.cpp"
+
+#include "../libberdip/bitstreamer.cpp"
+#include "flac.cpp"
+#include "mp3.cpp"
+#include "mp3_stream.cpp"
+#include "id3.cpp"
+
+// NOTE(michiel): Walks directory trees and probes the audio files in them, only the headers and tags are
+// read. Every worker has its own job deque, it takes the newest job from its own end and steals the oldest
+// job from the other end of another worker's deque when it runs dry. Directories are jobs as well, a big
+// tree spreads itself over the workers. Files with the same size and modification time as in the previous
+// index are copied from it without opening them.
+
+#define CATALOG_MAX_WORKERS    64
+#define CATALOG_STRING_BLOCK   kilobytes(64)
+#define CATALOG_MAX_TAG_BLOCK  megabytes(1)   // NOTE(michiel): Larger comment blocks or LIST chunks are skipped
+#define CATALOG_MAX_TAG_SIZE   1024           // NOTE(michiel): Decoded tag values are cut off after this
+#define CATALOG_MPEG_WINDOW    kilobytes(16)  // NOTE(michiel): Searched for the first frame after the ID3v2 tag
+
+struct CatalogJob
+{
+    String path;                // NOTE(michiel): Zero terminated
+    b32 isDirectory;
+};
+
+struct CatalogQueue
+{
+    pthread_mutex_t lock;
+    u32 first;
+    u32 count;
+    u32 capacity;               // NOTE(michiel): Power of two, the jobs wrap around
+    CatalogJob *jobs;
+};
+
+struct CatalogEntry
+{
+    String path;
+    String tags[CatalogTag_Count];
+    CatalogRecord record;       // NOTE(michiel): The strings are filled in when the index is written
+};
+
+struct Catalog;
+
+struct CatalogWorker
+{
+    Catalog *catalog;
+    u32 index;
+    u32 randomState;
+    CatalogQueue queue;
+    
+    u8 *stringAt;               // NOTE(michiel): Paths and tags, never freed before the index is written
+    umm stringRemaining;
+    
+    u8 *scratch;                // NOTE(michiel): Tag blocks and the mpeg window
+    umm scratchSize;
+    
+    u32 entryCount;
+    u32 entryCapacity;
+    CatalogEntry *entries;
+    
+    u32 probedCount;
+    u32 unchangedCount;
+    u32 stolenCount;
+    u64 bytesRead;
+};
+
+struct Catalog
+{
+    MemoryAllocator *allocator;
+    CatalogIndex previous;
+    b32 fullScan;
+    
+    u32 pendingJobs;            // NOTE(michiel): Queued or running, a job's children are added before it is done
+    u32 workerCount;
+    CatalogWorker workers[CATALOG_MAX_WORKERS];
+};
+
+struct CatalogTagKey
+{
+    char *key;
+    CatalogTagKind kind;
+};
+
+// NOTE(michiel): Vorbis comment and APE item keys, matched without case
+global CatalogTagKey gCatalogTagKeys[] =
+{
+    {"title",        CatalogTag_Title},
+    {"artist",       CatalogTag_Artist},
+    {"album",        CatalogTag_Album},
+    {"albumartist",  CatalogTag_AlbumArtist},
+    {"album artist", CatalogTag_AlbumArtist},
+    {"tracknumber",  CatalogTag_Track},
+    {"track",        CatalogTag_Track},
+    {"date",         CatalogTag_Year},
+    {"year",         CatalogTag_Year},
+    {"genre",        CatalogTag_Genre},
+};
+
+struct CatalogId3Key
+{
+    Id3FrameKind id3Kind;
+    CatalogTagKind kind;
+};
+
+global CatalogId3Key gCatalogId3Keys[] =
+{
+    {Id3Kind_Title,       CatalogTag_Title},
+    {Id3Kind_Artist,      CatalogTag_Artist},
+    {Id3Kind_Album,       CatalogTag_Album},
+    {Id3Kind_AlbumArtist, CatalogTag_AlbumArtist},
+    {Id3Kind_Track,       CatalogTag_Track},
+    {Id3Kind_Year,        CatalogTag_Year},
+    {Id3Kind_Genre,       CatalogTag_Genre},
+};
+
+struct CatalogInfoKey
+{
+    u32 id;
+    CatalogTagKind kind;
+};
+
+// NOTE(michiel): Sub chunks of a RIFF LIST/INFO chunk
+global CatalogInfoKey gCatalogInfoKeys[] =
+{
+    {MAKE_MAGIC('I', 'N', 'A', 'M'), CatalogTag_Title},
+    {MAKE_MAGIC('I', 'A', 'R', 'T'), CatalogTag_Artist},
+    {MAKE_MAGIC('I', 'P', 'R', 'D'), CatalogTag_Album},
+    {MAKE_MAGIC('I', 'T', 'R', 'K'), CatalogTag_Track},
+    {MAKE_MAGIC('I', 'P', 'R', 'T'), CatalogTag_Track},
+    {MAKE_MAGIC('I', 'C', 'R', 'D'), CatalogTag_Year},
+    {MAKE_MAGIC('I', 'G', 'N', 'R'), CatalogTag_Genre},
+};
+
+global char *gCatalogFormatNames[CatalogFormat_Count] =
+{
+    "?",
+    "flac",
+    "mpeg",
+    "wav",
+};
+
+global char *gCatalogTagNames[CatalogTag_Count] =
+{
+    "title",
+    "artist",
+    "album",
+    "album artist",
+    "track",
+    "year",
+    "genre",
+};
+
+//
+// NOTE(michiel): Index file
+//
+
+internal b32
+open_catalog_index(String fileName, CatalogIndex *index)
+{
+    // NOTE(michiel): Maps the index read only, the records and strings are used straight from the mapping
+    *index = {};
+    char fileNameZ[4096];
+    snprintf(fileNameZ, sizeof(fileNameZ), "%.*s", STR_FMT(fileName));
+    s32 fd = open(fileNameZ, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    
+    b32 result = false;
+    struct stat fileStat;
+    if ((fstat(fd, &fileStat) == 0) && ((umm)fileStat.st_size >= sizeof(CatalogHeader)))
+    {
+        void *mapping = mmap(0, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            index->file.size = fileStat.st_size;
+            index->file.data = (u8 *)mapping;
+            index->header = (CatalogHeader *)mapping;
+            index->records = (CatalogRecord *)(index->file.data + sizeof(CatalogHeader));
+            index->strings = index->file.data + index->header->stringOffset;
+            
+            CatalogHeader *header = index->header;
+            umm recordEnd = sizeof(CatalogHeader) + (umm)header->recordCount * sizeof(CatalogRecord);
+            result = ((header->magic == CATALOG_MAGIC) &&
+                      (header->version == CATALOG_VERSION) &&
+                      (header->recordSize == sizeof(CatalogRecord)) &&
+                      (recordEnd <= header->stringOffset) &&
+                      (header->stringOffset <= index->file.size) &&
+                      (header->stringSize <= (index->file.size - header->stringOffset)));
+            if (!result)
+            {
+                munmap(mapping, fileStat.st_size);
+                *index = {};
+            }
+        }
+    }
+    close(fd);
+    
+    return result;
+}
+
+internal void
+close_catalog_index(CatalogIndex *index)
+{
+    if (index->file.data)
+    {
+        munmap(index->file.data, index->file.size);
+    }
+    *index = {};
+}
+
+internal String
+get_catalog_string(CatalogIndex *index, CatalogString source)
+{
+    String result = {};
+    if (((u64)source.offset + source.size) <= index->header->stringSize)
+    {
+        result.size = source.size;
+        result.data = index->strings + source.offset;
+    }
+    return result;
+}
+
+internal s32
+compare_catalog_paths(String a, String b)
+{
+    s32 result = memcmp(a.data, b.data, minimum(a.size, b.size));
+    if (result == 0)
+    {
+        result = (a.size < b.size) ? -1 : ((a.size > b.size) ? 1 : 0);
+    }
+    return result;
+}
+
+internal CatalogRecord *
+find_catalog_record(CatalogIndex *index, String path)
+{
+    CatalogRecord *result = 0;
+    if (index->header)
+    {
+        u32 low = 0;
+        u32 high = index->header->recordCount;
+        while (low < high)
+        {
+            u32 middle = low + (high - low) / 2;
+            CatalogRecord *record = index->records + middle;
+            s32 compare = compare_catalog_paths(get_catalog_string(index, record->path), path);
+            if (compare == 0)
+            {
+                result = record;
+                break;
+            }
+            else if (compare < 0)
+            {
+                low = middle + 1;
+            }
+            else
+            {
+                high = middle;
+            }
+        }
+    }
+    return result;
+}
+
+internal void
+sort_catalog_entries(u32 count, CatalogEntry **entries, CatalogEntry **temp)
+{
+    // NOTE(michiel): Bottom up merge sort on the path, ends up in entries
+    CatalogEntry **source = entries;
+    CatalogEntry **dest = temp;
+    for (u32 width = 1; width < count; width *= 2)
+    {
+        for (u32 start = 0; start < count; start += 2 * width)
+        {
+            u32 middle = minimum(start + width, count);
+            u32 end = minimum(start + 2 * width, count);
+            u32 left = start;
+            u32 right = middle;
+            for (u32 at = start; at < end; ++at)
+            {
+                if ((left < middle) &&
+                    ((right >= end) || (compare_catalog_paths(source[left]->path, source[right]->path) <= 0)))
+                {
+                    dest[at] = source[left++];
+                }
+                else
+                {
+                    dest[at] = source[right++];
+                }
+            }
+        }
+        CatalogEntry **swap = source;
+        source = dest;
+        dest = swap;
+    }
+    
+    if (source != entries)
+    {
+        memcpy(entries, source, count * sizeof(CatalogEntry *));
+    }
+}
+
+internal CatalogString
+put_catalog_string(String source, u8 *strings, u64 *stringSize)
+{
+    CatalogString result = {};
+    result.offset = (u32)*stringSize;
+    result.size = (u32)source.size;
+    if (source.size)
+    {
+        memcpy(strings + *stringSize, source.data, source.size);
+    }
+    *stringSize += source.size;
+    return result;
+}
+
+internal b32
+write_catalog_index(MemoryAllocator *allocator, String fileName, u32 count, CatalogEntry **entries)
+{
+    // NOTE(michiel): The entries are sorted, so the files of an album follow each other. A tag with the
+    // same value as the one of the previous entry reuses its string, that takes care of most of the
+    // artist, album, year and genre repeats.
+    u64 maxStringSize = 0;
+    for (u32 entryIdx = 0; entryIdx < count; ++entryIdx)
+    {
+        CatalogEntry *entry = entries[entryIdx];
+        maxStringSize += entry->path.size;
+        for (u32 tagIdx = 0; tagIdx < CatalogTag_Count; ++tagIdx)
+        {
+            maxStringSize += entry->tags[tagIdx].size;
+        }
+    }
+    
+    CatalogRecord *records = allocate_array(allocator, CatalogRecord, maximum(count, 1u), default_memory_alloc());
+    u8 *strings = (u8 *)allocate_size(allocator, maximum(maxStringSize, 1ull), default_memory_alloc());
+    u64 stringSize = 0;
+    for (u32 entryIdx = 0; entryIdx < count; ++entryIdx)
+    {
+        CatalogEntry *entry = entries[entryIdx];
+        CatalogRecord *record = records + entryIdx;
+        *record = entry->record;
+        record->path = put_catalog_string(entry->path, strings, &stringSize);
+        for (u32 tagIdx = 0; tagIdx < CatalogTag_Count; ++tagIdx)
+        {
+            String tag = entry->tags[tagIdx];
+            if (entryIdx && (tag == entries[entryIdx - 1]->tags[tagIdx]))
+            {
+                record->tags[tagIdx] = records[entryIdx - 1].tags[tagIdx];
+            }
+            else
+            {
+                record->tags[tagIdx] = put_catalog_string(tag, strings, &stringSize);
+            }
+        }
+    }
+    i_expect(stringSize <= U32_MAX);
+    
+    CatalogHeader header = {};
+    header.magic = CATALOG_MAGIC;
+    header.version = CATALOG_VERSION;
+    header.recordCount = count;
+    header.recordSize = sizeof(CatalogRecord);
+    header.stringOffset = sizeof(CatalogHeader) + (u64)count * sizeof(CatalogRecord);
+    header.stringSize = stringSize;
+    
+    // NOTE(michiel): Written next to the old index and renamed over it, a running reader (or the rescan
+    // that still has the old one mapped) keeps seeing the old file.
+    u8 tempNameData[4096];
+    String tempName = string_fmt(sizeof(tempNameData), tempNameData, "%.*s.tmp", STR_FMT(fileName));
+    ApiFile file = gFileApi->open_file(tempName, FileOpen_Write);
+    gFileApi->write_to_file(&file, sizeof(CatalogHeader), &header);
+    gFileApi->write_to_file(&file, (umm)count * sizeof(CatalogRecord), records);
+    gFileApi->write_to_file(&file, stringSize, strings);
+    gFileApi->close_file(&file);
+    
+    b32 result = no_file_errors(&file);
+    if (result)
+    {
+        char fileNameZ[4096];
+        snprintf(fileNameZ, sizeof(fileNameZ), "%.*s", STR_FMT(fileName));
+        result = (rename((char *)tempName.data, fileNameZ) == 0);
+    }
+    
+    deallocate(allocator, strings);
+    deallocate(allocator, records);
+    return result;
+}
+
+//
+// NOTE(michiel): Work queues
+//
+
+internal u32
+get_catalog_random(CatalogWorker *worker)
+{
+    // NOTE(michiel): xorshift32, only used to pick a worker to steal from
+    u32 x = worker->randomState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    worker->randomState = x;
+    return x;
+}
+
+internal void
+push_catalog_job(CatalogWorker *worker, String path, b32 isDirectory)
+{
+    __sync_fetch_and_add(&worker->catalog->pendingJobs, 1);
+    
+    CatalogQueue *queue = &worker->queue;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count == queue->capacity)
+    {
+        u32 newCapacity = queue->capacity * 2;
+        CatalogJob *newJobs = allocate_array(worker->catalog->allocator, CatalogJob, newCapacity, default_memory_alloc());
+        for (u32 jobIdx = 0; jobIdx < queue->count; ++jobIdx)
+        {
+            newJobs[jobIdx] = queue->jobs[(queue->first + jobIdx) & (queue->capacity - 1)];
+        }
+        deallocate(worker->catalog->allocator, queue->jobs);
+        queue->jobs = newJobs;
+        queue->capacity = newCapacity;
+        queue->first = 0;
+    }
+    CatalogJob *job = queue->jobs + ((queue->first + queue->count) & (queue->capacity - 1));
+    job->path = path;
+    job->isDirectory = isDirectory;
+    ++queue->count;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+internal b32
+pop_catalog_job(CatalogQueue *queue, b32 oldest, CatalogJob *job)
+{
+    b32 result = false;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->count)
+    {
+        if (oldest)
+        {
+            *job = queue->jobs[queue->first];
+            queue->first = (queue->first + 1) & (queue->capacity - 1);
+        }
+        else
+        {
+            *job = queue->jobs[(queue->first + queue->count - 1) & (queue->capacity - 1)];
+        }
+        --queue->count;
+        result = true;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return result;
+}
+
+internal b32
+get_catalog_job(CatalogWorker *worker, CatalogJob *job)
+{
+    // NOTE(michiel): Only gives up when no job is queued or running anywhere, a running directory job can
+    // still add more.
+    Catalog *catalog = worker->catalog;
+    b32 result = pop_catalog_job(&worker->queue, false, job);
+    while (!result && __atomic_load_n(&catalog->pendingJobs, __ATOMIC_ACQUIRE))
+    {
+        u32 start = get_catalog_random(worker) % catalog->workerCount;
+        for (u32 step = 0; !result && (step < catalog->workerCount); ++step)
+        {
+            u32 victim = (start + step) % catalog->workerCount;
+            if (victim != worker->index)
+            {
+                result = pop_catalog_job(&catalog->workers[victim].queue, true, job);
+            }
+        }
+        
+        if (result)
+        {
+            ++worker->stolenCount;
+        }
+        else
+        {
+            sched_yield();
+        }
+    }
+    return result;
+}
+
+//
+// NOTE(michiel): Entries
+//
+
+internal String
+push_catalog_string(CatalogWorker *worker, String source)
+{
+    // NOTE(michiel): Always zero terminated, the paths are passed to open
+    if (worker->stringRemaining < (source.size + 1))
+    {
+        umm blockSize = maximum(CATALOG_STRING_BLOCK, source.size + 1);
+        worker->stringAt = (u8 *)allocate_size(worker->catalog->allocator, blockSize, default_memory_alloc());
+        worker->stringRemaining = blockSize;
+    }
+    
+    String result = {source.size, worker->stringAt};
+    memcpy(result.data, source.data, source.size);
+    result.data[source.size] = 0;
+    worker->stringAt += source.size + 1;
+    worker->stringRemaining -= source.size + 1;
+    return result;
+}
+
+internal u8 *
+get_catalog_scratch(CatalogWorker *worker, umm size)
+{
+    if (worker->scratchSize < size)
+    {
+        if (worker->scratch)
+        {
+            deallocate(worker->catalog->allocator, worker->scratch);
+        }
+        worker->scratchSize = maximum(size, (umm)CATALOG_MPEG_WINDOW);
+        worker->scratch = (u8 *)allocate_size(worker->catalog->allocator, worker->scratchSize, default_memory_alloc());
+    }
+    return worker->scratch;
+}
+
+internal b32
+read_catalog_bytes(CatalogWorker *worker, s32 fd, umm offset, umm size, void *dest)
+{
+    b32 result = read_tag_bytes(fd, offset, size, (u8 *)dest);
+    if (result)
+    {
+        worker->bytesRead += size;
+    }
+    return result;
+}
+
+internal u32
+get_catalog_le32(u8 *data)
+{
+    return (u32)data[0] | ((u32)data[1] << 8) | ((u32)data[2] << 16) | ((u32)data[3] << 24);
+}
+
+internal b32
+get_catalog_tag_kind(String key, CatalogTagKind *kind)
+{
+    b32 result = false;
+    for (u32 keyIdx = 0; !result && (keyIdx < array_count(gCatalogTagKeys)); ++keyIdx)
+    {
+        String test = string(gCatalogTagKeys[keyIdx].key);
+        if (test.size == key.size)
+        {
+            result = true;
+            for (u32 charIdx = 0; result && (charIdx < key.size); ++charIdx)
+            {
+                u8 c = key.data[charIdx];
+                if ((c >= 'A') && (c <= 'Z'))
+                {
+                    c += 'a' - 'A';
+                }
+                result = (c == test.data[charIdx]);
+            }
+            *kind = gCatalogTagKeys[keyIdx].kind;
+        }
+    }
+    return result;
+}
+
+internal String
+get_catalog_genre(String value)
+{
+    // NOTE(michiel): ID3 genres can be an ID3v1 genre number, "17" or "(17)" (optionally followed by a
+    // refinement that is dropped here).
+    String result = value;
+    String number = value;
+    if (number.size && (number.data[0] == '('))
+    {
+        u8 *close = (u8 *)memchr(number.data, ')', number.size);
+        number = close ? string(close - number.data - 1, number.data + 1) : String{};
+    }
+    
+    b32 isNumber = (number.size > 0) && (number.size <= 3);
+    for (u32 charIdx = 0; isNumber && (charIdx < number.size); ++charIdx)
+    {
+        isNumber = (number.data[charIdx] >= '0') && (number.data[charIdx] <= '9');
+    }
+    if (isNumber)
+    {
+        s64 genreIdx = number_from_string(number);
+        if ((genreIdx < (s64)array_count(gID3v1Genres)) && gID3v1Genres[genreIdx].size)
+        {
+            result = gID3v1Genres[genreIdx];
+        }
+    }
+    return result;
+}
+
+internal void
+set_catalog_tag(CatalogWorker *worker, CatalogEntry *entry, CatalogTagKind kind, String value)
+{
+    // NOTE(michiel): The first source with a value wins. Fixed size fields (ID3v1, RIFF INFO) end at a zero
+    // or are padded with spaces.
+    u8 *zero = (u8 *)memchr(value.data, 0, value.size);
+    if (zero)
+    {
+        value.size = zero - value.data;
+    }
+    while (value.size && (value.data[value.size - 1] == ' '))
+    {
+        --value.size;
+    }
+    value.size = minimum(value.size, (umm)CATALOG_MAX_TAG_SIZE);
+    
+    if (value.size && !entry->tags[kind].size)
+    {
+        entry->tags[kind] = push_catalog_string(worker, value);
+    }
+}
+
+//
+// NOTE(michiel): Probing
+//
+
+internal CatalogFormat
+get_catalog_format(String path)
+{
+    CatalogFormat result = CatalogFormat_Unknown;
+    u8 extension[8] = {};
+    umm extensionSize = 0;
+    for (umm at = path.size; at > 0; --at)
+    {
+        u8 c = path.data[at - 1];
+        if ((c == '.') || (c == '/') || ((path.size - at) >= sizeof(extension)))
+        {
+            if (c == '.')
+            {
+                extensionSize = path.size - at;
+                for (umm charIdx = 0; charIdx < extensionSize; ++charIdx)
+                {
+                    c = path.data[at + charIdx];
+                    extension[charIdx] = ((c >= 'A') && (c <= 'Z')) ? c + ('a' - 'A') : c;
+                }
+            }
+            break;
+        }
+    }
+    
+    String test = string(extensionSize, extension);
+    if (test == string("flac"))
+    {
+        result = CatalogFormat_Flac;
+    }
+    else if ((test == string("mp3")) || (test == string("mp2")))
+    {
+        result = CatalogFormat_Mpeg;
+    }
+    else if ((test == string("wav")) || (test == string("bwf")))
+    {
+        result = CatalogFormat_Wav;
+    }
+    return result;
+}
+
+internal void
+parse_catalog_vorbis_comments(CatalogWorker *worker, CatalogEntry *entry, Buffer block)
+{
+    // NOTE(michiel): Same layout as parse_metadata reads, but the values are used where they are instead
+    // of copying every comment.
+    u8 *at = block.data;
+    u8 *end = block.data + block.size;
+    u32 commentCount = 0;
+    if ((end - at) >= 4)
+    {
+        u32 vendorSize = get_catalog_le32(at);
+        at += 4;
+        if (((umm)vendorSize + 4) <= (umm)(end - at))
+        {
+            at += vendorSize;
+            commentCount = get_catalog_le32(at);
+            at += 4;
+        }
+    }
+    
+    for (u32 commentIdx = 0; (commentIdx < commentCount) && ((end - at) >= 4); ++commentIdx)
+    {
+        u32 commentSize = get_catalog_le32(at);
+        at += 4;
+        if (commentSize > (umm)(end - at))
+        {
+            break;
+        }
+        
+        u8 *equals = (u8 *)memchr(at, '=', commentSize);
+        CatalogTagKind kind;
+        if (equals && get_catalog_tag_kind(string(equals - at, at), &kind))
+        {
+            set_catalog_tag(worker, entry, kind, string(at + commentSize - equals - 1, equals + 1));
+        }
+        at += commentSize;
+    }
+}
+
+internal b32
+probe_catalog_flac(CatalogWorker *worker, s32 fd, CatalogEntry *entry)
+{
+    // NOTE(michiel): Walks the metadata block headers, only STREAMINFO and VORBIS_COMMENT are read.
+    // Pictures and padding are skipped without reading them.
+    b32 result = false;
+    CatalogRecord *record = &entry->record;
+    u8 header[4];
+    if (read_catalog_bytes(worker, fd, 0, 4, header) && (string(4, header) == string(4, "fLaC")))
+    {
+        umm offset = 4;
+        b32 isLast = false;
+        while (!isLast && ((offset + 4) <= record->fileSize) && read_catalog_bytes(worker, fd, offset, 4, header))
+        {
+            isLast = header[0] & 0x80;
+            FlacMetadataType kind = (FlacMetadataType)(header[0] & 0x7F);
+            u32 blockSize = ((u32)header[1] << 16) | ((u32)header[2] << 8) | (u32)header[3];
+            offset += 4;
+            
+            if ((kind == FlacMetadata_StreamInfo) && (blockSize == 34))
+            {
+                u8 infoData[34];
+                if (read_catalog_bytes(worker, fd, offset, sizeof(infoData), infoData))
+                {
+                    BitStreamer bitStream = create_bitstreamer({sizeof(infoData), infoData}, BitStream_BigEndian);
+                    FlacInfo info = parse_info_stream(&bitStream);
+                    record->sampleRate = info.sampleRate;
+                    record->sampleCount = info.totalSamples;
+                    record->channelCount = (u8)info.channelCount;
+                    record->bitsPerSample = (u8)info.bitsPerSample;
+                    result = true;
+                }
+            }
+            else if ((kind == FlacMetadata_VorbisComment) && (blockSize <= CATALOG_MAX_TAG_BLOCK))
+            {
+                u8 *block = get_catalog_scratch(worker, blockSize);
+                if (read_catalog_bytes(worker, fd, offset, blockSize, block))
+                {
+                    parse_catalog_vorbis_comments(worker, entry, {blockSize, block});
+                }
+            }
+            offset += blockSize;
+        }
+        
+        if (result && record->sampleCount && (offset < record->fileSize))
+        {
+            record->bitRate = (u32)(((record->fileSize - offset) * 8 * record->sampleRate) /
+                                    (record->sampleCount * 1000));
+        }
+    }
+    return result;
+}
+
+internal void
+parse_catalog_ape_tag(CatalogWorker *worker, CatalogEntry *entry, Buffer tag)
+{
+    // NOTE(michiel): tag runs from the header (if there is one) up to and including the footer
+    u8 *footer = tag.data + tag.size - APE_TAG_FOOTER_SIZE;
+    u32 itemCount = get_catalog_le32(footer + 16);
+    u32 tagFlags = get_catalog_le32(footer + 20);
+    u8 *at = tag.data + ((tagFlags & APE_TAG_HAS_HEADER) ? APE_TAG_FOOTER_SIZE : 0);
+    for (u32 itemIdx = 0; (itemIdx < itemCount) && ((at + 8) < footer); ++itemIdx)
+    {
+        u32 valueSize = get_catalog_le32(at);
+        u32 itemFlags = get_catalog_le32(at + 4);
+        u8 *key = at + 8;
+        u8 *keyEnd = (u8 *)memchr(key, 0, footer - key);
+        if (!keyEnd || (valueSize > (umm)(footer - keyEnd - 1)))
+        {
+            break;
+        }
+        
+        // NOTE(michiel): Bits 1-2 of the flags give the item type, 0 is UTF-8 text
+        CatalogTagKind kind;
+        if ((((itemFlags >> 1) & 0x3) == 0) && get_catalog_tag_kind(string(keyEnd - key, key), &kind))
+        {
+            set_catalog_tag(worker, entry, kind, string(valueSize, keyEnd + 1));
+        }
+        at = keyEnd + 1 + valueSize;
+    }
+}
+
+internal b32
+probe_catalog_mpeg(CatalogWorker *worker, s32 fd, CatalogEntry *entry)
+{
+    // NOTE(michiel): The tags from both ends of the file (ID3v2 first, then APE and ID3v1 for anything
+    // still missing), then a window at the start of the audio for the first frame and its Xing/VBRI
+    // header. Without a frame count the length is estimated from the bit rate of the first frame.
+    b32 result = false;
+    MemoryAllocator *allocator = worker->catalog->allocator;
+    CatalogRecord *record = &entry->record;
+    
+    MpegTagProbe probe;
+    probe_mpeg_file_tags(allocator, fd, record->fileSize, &probe);
+    worker->bytesRead += probe.bytesRead;
+    
+    Id3Tag id3Tag;
+    if (probe.id3v2.size && parse_id3v2_tag(allocator, probe.id3v2, &id3Tag))
+    {
+        for (u32 keyIdx = 0; keyIdx < array_count(gCatalogId3Keys); ++keyIdx)
+        {
+            CatalogId3Key *key = gCatalogId3Keys + keyIdx;
+            Id3Frame *frame = find_id3_frame(&id3Tag, key->id3Kind);
+            if (frame)
+            {
+                u8 valueData[CATALOG_MAX_TAG_SIZE];
+                String value = decode_id3_text(get_id3_text(frame), sizeof(valueData), valueData);
+                if (key->kind == CatalogTag_Genre)
+                {
+                    value = get_catalog_genre(value);
+                }
+                set_catalog_tag(worker, entry, key->kind, value);
+            }
+        }
+        free_id3v2_tag(&id3Tag);
+    }
+    
+    if (probe.ape.size)
+    {
+        parse_catalog_ape_tag(worker, entry, probe.ape);
+    }
+    
+    if (probe.id3v1.size)
+    {
+        u8 *tag = probe.id3v1.data;
+        set_catalog_tag(worker, entry, CatalogTag_Title, string(30, tag + 3));
+        set_catalog_tag(worker, entry, CatalogTag_Artist, string(30, tag + 33));
+        set_catalog_tag(worker, entry, CatalogTag_Album, string(30, tag + 63));
+        set_catalog_tag(worker, entry, CatalogTag_Year, string(4, tag + 93));
+        if ((tag[125] == 0) && tag[126])
+        {
+            // NOTE(michiel): ID3v1.1, the last byte of the comment is the track number
+            u8 trackData[4];
+            set_catalog_tag(worker, entry, CatalogTag_Track, string_fmt(sizeof(trackData), trackData, "%u", tag[126]));
+        }
+        set_catalog_tag(worker, entry, CatalogTag_Genre, gID3v1Genres[tag[127]]);
+    }
+    
+    umm windowSize = minimum((umm)CATALOG_MPEG_WINDOW, probe.audioEnd - probe.audioStart);
+    u8 *window = get_catalog_scratch(worker, windowSize);
+    if (windowSize && read_catalog_bytes(worker, fd, probe.audioStart, windowSize, window))
+    {
+        u8 *windowEnd = window + windowSize;
+        u8 *first = find_mpeg_frame(window, windowEnd);
+        if (first)
+        {
+            MpegFrameHeader header;
+            parse_mpeg_frame_header(first, &header);
+            record->sampleRate = header.sampleRate;
+            record->channelCount = (u8)header.channelCount;
+            
+            u64 audioBytes = probe.audioEnd - probe.audioStart - (first - window);
+            MpegVbrInfo vbr;
+            if ((header.frameByteCount <= (umm)(windowEnd - first)) &&
+                parse_mpeg_vbr_header(first, &header, &vbr) && (vbr.flags & MpegXing_Frames))
+            {
+                // NOTE(michiel): Without the encoder delay and padding, like get_mpeg_duration
+                record->sampleCount = (u64)vbr.frameCount * header.sampleCount;
+                if (vbr.hasLame)
+                {
+                    u32 trimmed = vbr.lame.encoderDelay + vbr.lame.encoderPadding;
+                    record->sampleCount = (record->sampleCount > trimmed) ? record->sampleCount - trimmed : 0;
+                }
+                if ((vbr.flags & MpegXing_Bytes) && (vbr.byteCount <= audioBytes))
+                {
+                    audioBytes = vbr.byteCount;
+                }
+            }
+            else if (header.bitRate)
+            {
+                record->flags |= CatalogFlag_EstimatedLength;
+                record->sampleCount = (audioBytes * 8 * header.sampleRate) / ((u64)header.bitRate * 1000);
+            }
+            
+            record->bitRate = header.bitRate;
+            if (record->sampleCount)
+            {
+                record->bitRate = (u32)((audioBytes * 8 * header.sampleRate) / (record->sampleCount * 1000));
+            }
+            result = true;
+        }
+    }
+    
+    free_mpeg_tag_probe(&probe);
+    return result;
+}
+
+internal void
+parse_catalog_info_list(CatalogWorker *worker, CatalogEntry *entry, Buffer list)
+{
+    // NOTE(michiel): list starts after the "INFO" list type, every sub chunk is a zero terminated string
+    u8 *at = list.data;
+    u8 *end = list.data + list.size;
+    while ((end - at) >= (smm)sizeof(RiffChunk))
+    {
+        u32 id = get_catalog_le32(at);
+        u32 size = get_catalog_le32(at + 4);
+        at += sizeof(RiffChunk);
+        if (size > (umm)(end - at))
+        {
+            break;
+        }
+        
+        for (u32 keyIdx = 0; keyIdx < array_count(gCatalogInfoKeys); ++keyIdx)
+        {
+            if (gCatalogInfoKeys[keyIdx].id == id)
+            {
+                set_catalog_tag(worker, entry, gCatalogInfoKeys[keyIdx].kind, string(size, at));
+                break;
+            }
+        }
+        at += minimum(((umm)size + 1) & ~1, (umm)(end - at));
+    }
+}
+
+internal b32
+probe_catalog_wav(CatalogWorker *worker, s32 fd, CatalogEntry *entry)
+{
+    // NOTE(michiel): Reads the chunk headers one by one, only fmt and a LIST/INFO chunk are read in full.
+    // The data chunk is often followed by the LIST chunk, so the walk goes on to the end of the file.
+    b32 result = false;
+    CatalogRecord *record = &entry->record;
+    RiffHeader header;
+    if (read_catalog_bytes(worker, fd, 0, sizeof(RiffHeader), &header) &&
+        (header.magic == MAKE_MAGIC('R', 'I', 'F', 'F')) &&
+        (header.fileType == MAKE_MAGIC('W', 'A', 'V', 'E')))
+    {
+        u64 dataSize = 0;
+        u32 blockAlign = 0;
+        umm offset = sizeof(RiffHeader);
+        RiffChunk chunk;
+        while (((offset + sizeof(RiffChunk)) <= record->fileSize) &&
+               read_catalog_bytes(worker, fd, offset, sizeof(RiffChunk), &chunk))
+        {
+            offset += sizeof(RiffChunk);
+            switch (chunk.magic)
+            {
+                case MAKE_MAGIC('f', 'm', 't', ' '):
+                {
+                    WavFormat format = {};
+                    u32 readSize = minimum(chunk.size, (u32)(sizeof(WavFormat) - sizeof(RiffChunk)));
+                    if ((readSize >= 16) &&
+                        read_catalog_bytes(worker, fd, offset, readSize, (u8 *)&format + sizeof(RiffChunk)))
+                    {
+                        record->sampleRate = format.sampleRate;
+                        record->channelCount = (u8)minimum(format.channelCount, (u16)255);
+                        record->bitsPerSample = (u8)minimum(format.sampleSize, (u16)255);
+                        if ((format.formatCode == WavFormat_Extensible) && (readSize >= 24) &&
+                            format.extensionCount && format.validSampleSize)
+                        {
+                            record->bitsPerSample = (u8)minimum(format.validSampleSize, (u16)255);
+                        }
+                        blockAlign = format.blockAlign;
+                        result = true;
+                    }
+                } break;
+                
+                case MAKE_MAGIC('d', 'a', 't', 'a'):
+                {
+                    dataSize = minimum((u64)chunk.size, (u64)(record->fileSize - offset));
+                } break;
+                
+                case MAKE_MAGIC('L', 'I', 'S', 'T'):
+                {
+                    if ((chunk.size >= 4) && (chunk.size <= CATALOG_MAX_TAG_BLOCK))
+                    {
+                        u8 *list = get_catalog_scratch(worker, chunk.size);
+                        if (read_catalog_bytes(worker, fd, offset, chunk.size, list) &&
+                            (get_catalog_le32(list) == MAKE_MAGIC('I', 'N', 'F', 'O')))
+                        {
+                            parse_catalog_info_list(worker, entry, {chunk.size - 4, list + 4});
+                        }
+                    }
+                } break;
+                
+                default: {} break;
+            }
+            offset += ((umm)chunk.size + 1) & ~1;
+        }
+        
+        if (result && blockAlign)
+        {
+            record->sampleCount = dataSize / blockAlign;
+            record->bitRate = (u32)(((u64)record->sampleRate * blockAlign * 8) / 1000);
+        }
+    }
+    return result;
+}
+
+internal void
+catalog_file(CatalogWorker *worker, String path)
+{
+    Catalog *catalog = worker->catalog;
+    struct stat fileStat;
+    if (stat((char *)path.data, &fileStat) != 0)
+    {
+        fprintf(stderr, "Could not stat '%.*s'\n", STR_FMT(path));
+        return;
+    }
+    
+    if (worker->entryCount == worker->entryCapacity)
+    {
+        u32 newCapacity = maximum(worker->entryCapacity * 2, 256u);
+        CatalogEntry *newEntries = allocate_array(catalog->allocator, CatalogEntry, newCapacity, default_memory_alloc());
+        if (worker->entries)
+        {
+            memcpy(newEntries, worker->entries, worker->entryCount * sizeof(CatalogEntry));
+            deallocate(catalog->allocator, worker->entries);
+        }
+        worker->entries = newEntries;
+        worker->entryCapacity = newCapacity;
+    }
+    
+    CatalogEntry *entry = worker->entries + worker->entryCount++;
+    *entry = {};
+    entry->path = path;
+    entry->record.fileSize = fileStat.st_size;
+    entry->record.modifiedTime = (u64)fileStat.st_mtim.tv_sec * 1000000000ull + fileStat.st_mtim.tv_nsec;
+    
+    CatalogRecord *previous = catalog->fullScan ? 0 : find_catalog_record(&catalog->previous, path);
+    if (previous &&
+        (previous->fileSize == entry->record.fileSize) &&
+        (previous->modifiedTime == entry->record.modifiedTime))
+    {
+        // NOTE(michiel): The strings stay in the mapping of the previous index until the new one is written
+        entry->record = *previous;
+        for (u32 tagIdx = 0; tagIdx < CatalogTag_Count; ++tagIdx)
+        {
+            entry->tags[tagIdx] = get_catalog_string(&catalog->previous, previous->tags[tagIdx]);
+        }
+        ++worker->unchangedCount;
+        return;
+    }
+    
+    entry->record.format = get_catalog_format(path);
+    b32 probed = false;
+    s32 fd = open((char *)path.data, O_RDONLY);
+    if (fd >= 0)
+    {
+        switch (entry->record.format)
+        {
+            case CatalogFormat_Flac: { probed = probe_catalog_flac(worker, fd, entry); } break;
+            case CatalogFormat_Mpeg: { probed = probe_catalog_mpeg(worker, fd, entry); } break;
+            case CatalogFormat_Wav:  { probed = probe_catalog_wav(worker, fd, entry); } break;
+            default: { probed = false; } break;
+        }
+        close(fd);
+    }
+    
+    if (!probed)
+    {
+        fprintf(stderr, "Could not read the %s header of '%.*s'\n",
+                gCatalogFormatNames[entry->record.format], STR_FMT(path));
+        entry->record.flags |= CatalogFlag_ProbeFailed;
+    }
+    ++worker->probedCount;
+}
+
+internal void
+scan_catalog_directory(CatalogWorker *worker, String path)
+{
+    DIR *dir = opendir((char *)path.data);
+    if (!dir)
+    {
+        fprintf(stderr, "Could not open directory '%.*s'\n", STR_FMT(path));
+        return;
+    }
+    
+    struct dirent *dirEntry;
+    while ((dirEntry = readdir(dir)) != 0)
+    {
+        // NOTE(michiel): Skips '.' and '..', and with them all hidden files and directories
+        if (dirEntry->d_name[0] == '.')
+        {
+            continue;
+        }
+        
+        u8 childData[4096];
+        String child = string_fmt(sizeof(childData), childData, "%.*s/%s", STR_FMT(path), dirEntry->d_name);
+        u32 type = dirEntry->d_type;
+        if ((type == DT_UNKNOWN) || (type == DT_LNK))
+        {
+            // NOTE(michiel): Links to files are followed, links to directories are not (no loops)
+            struct stat childStat;
+            if (stat((char *)child.data, &childStat) == 0)
+            {
+                if (S_ISREG(childStat.st_mode))
+                {
+                    type = DT_REG;
+                }
+                else if (S_ISDIR(childStat.st_mode) && (type == DT_UNKNOWN))
+                {
+                    type = DT_DIR;
+                }
+            }
+        }
+        
+        if (type == DT_DIR)
+        {
+            push_catalog_job(worker, push_catalog_string(worker, child), true);
+        }
+        else if ((type == DT_REG) && (get_catalog_format(child) != CatalogFormat_Unknown))
+        {
+            push_catalog_job(worker, push_catalog_string(worker, child), false);
+        }
+    }
+    closedir(dir);
+}
+
+internal void *
+catalog_worker(void *data)
+{
+    CatalogWorker *worker = (CatalogWorker *)data;
+    CatalogJob job;
+    while (get_catalog_job(worker, &job))
+    {
+        if (job.isDirectory)
+        {
+            scan_catalog_directory(worker, job.path);
+        }
+        else
+        {
+            catalog_file(worker, job.path);
+        }
+        __sync_fetch_and_sub(&worker->catalog->pendingJobs, 1);
+    }
+    return 0;
+}
+
+internal void
+print_catalog_index(CatalogIndex *index)
+{
+    for (u32 recordIdx = 0; recordIdx < index->header->recordCount; ++recordIdx)
+    {
+        CatalogRecord *record = index->records + recordIdx;
+        u64 seconds = record->sampleRate ? record->sampleCount / record->sampleRate : 0;
+        u32 format = record->format;
+        if (format >= CatalogFormat_Count)
+        {
+            format = CatalogFormat_Unknown;
+        }
+        fprintf(stdout, "%.*s\n", STR_FMT(get_catalog_string(index, record->path)));
+        fprintf(stdout, "    %s, %u Hz, %u channels, %u bits, %u kbit/s, %lu:%02lu%s%s\n",
+                gCatalogFormatNames[format], record->sampleRate, record->channelCount, record->bitsPerSample,
+                record->bitRate, seconds / 60, seconds % 60,
+                (record->flags & CatalogFlag_EstimatedLength) ? " (estimated)" : "",
+                (record->flags & CatalogFlag_ProbeFailed) ? " (unreadable)" : "");
+        for (u32 tagIdx = 0; tagIdx < CatalogTag_Count; ++tagIdx)
+        {
+            String tag = get_catalog_string(index, record->tags[tagIdx]);
+            if (tag.size)
+            {
+                fprintf(stdout, "    %-12s: %.*s\n", gCatalogTagNames[tagIdx], STR_FMT(tag));
+            }
+        }
+    }
+}
+
+internal void
+print_usage(char *program)
+{
+    fprintf(stderr, "Usage: %s [options] <directory>...\n"
+            "  -o | --output <file>   Index file (default: catalog.idx)\n"
+            "  -j | --threads <n>     Worker threads (default: one per cpu)\n"
+            "  -f | --full            Probe every file, ignore what the previous index has\n"
+            "  -l | --list            Only print the index\n",
+            program);
+}
+
+s32 main(s32 argc, char **argv)
+{
+    std_file_api(gFileApi);
+    initialize_std_allocator(0, gMemoryAllocator);
+    
+    String indexFile = static_string("catalog.idx");
+    u32 threadCount = (u32)maximum(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+    b32 fullScan = false;
+    b32 listOnly = false;
+    b32 badArguments = false;
+    u32 rootCount = 0;
+    char *roots[256];
+    
+    s32 index = 1;
+    while (index < argc)
+    {
+        String arg = string(argv[index++]);
+        if (((arg == string("--output")) || (arg == string("-o"))) && (index < argc))
+        {
+            indexFile = string(argv[index++]);
+        }
+        else if (((arg == string("--threads")) || (arg == string("-j"))) && (index < argc))
+        {
+            threadCount = number_from_string(string(argv[index++]));
+        }
+        else if ((arg == string("--full")) || (arg == string("-f")))
+        {
+            fullScan = true;
+        }
+        else if ((arg == string("--list")) || (arg == string("-l")))
+        {
+            listOnly = true;
+        }
+        else if (rootCount < array_count(roots))
+        {
+            roots[rootCount++] = argv[index - 1];
+        }
+        else
+        {
+            badArguments = true;
+        }
+    }
+    
+    if (listOnly && !badArguments)
+    {
+        CatalogIndex catalogIndex;
+        if (!open_catalog_index(indexFile, &catalogIndex))
+        {
+            fprintf(stderr, "Could not open index '%.*s'\n", STR_FMT(indexFile));
+            return 1;
+        }
+        print_catalog_index(&catalogIndex);
+        close_catalog_index(&catalogIndex);
+        return 0;
+    }
+    
+    if (badArguments || !rootCount)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    Catalog *catalog = allocate_struct(gMemoryAllocator, Catalog, default_memory_alloc());
+    *catalog = {};
+    catalog->allocator = gMemoryAllocator;
+    catalog->fullScan = fullScan;
+    catalog->workerCount = clamp(1u, threadCount, (u32)CATALOG_MAX_WORKERS);
+    if (!fullScan)
+    {
+        open_catalog_index(indexFile, &catalog->previous);
+    }
+    
+    // NOTE(michiel): Lazily built otherwise, which would race between the workers
+    init_id3_frame_hash();
+    
+    for (u32 workerIdx = 0; workerIdx < catalog->workerCount; ++workerIdx)
+    {
+        CatalogWorker *worker = catalog->workers + workerIdx;
+        worker->catalog = catalog;
+        worker->index = workerIdx;
+        worker->randomState = 0x9E3779B9 * (workerIdx + 1);
+        pthread_mutex_init(&worker->queue.lock, 0);
+        worker->queue.capacity = 256;
+        worker->queue.jobs = allocate_array(catalog->allocator, CatalogJob, worker->queue.capacity, default_memory_alloc());
+    }
+    
+    for (u32 rootIdx = 0; rootIdx < rootCount; ++rootIdx)
+    {
+        // NOTE(michiel): Spread over the workers, the stealing evens it out from there
+        CatalogWorker *worker = catalog->workers + (rootIdx % catalog->workerCount);
+        String root = string(roots[rootIdx]);
+        while ((root.size > 1) && (root.data[root.size - 1] == '/'))
+        {
+            --root.size;
+        }
+        
+        struct stat rootStat;
+        if (stat(roots[rootIdx], &rootStat) != 0)
+        {
+            fprintf(stderr, "Could not find '%.*s'\n", STR_FMT(root));
+        }
+        else if (S_ISDIR(rootStat.st_mode))
+        {
+            push_catalog_job(worker, push_catalog_string(worker, root), true);
+        }
+        else if (get_catalog_format(root) == CatalogFormat_Unknown)
+        {
+            // NOTE(michiel): Same as in scan_catalog_directory, only known extensions are probed
+            fprintf(stderr, "Skipping '%.*s', not a known audio file\n", STR_FMT(root));
+        }
+        else
+        {
+            push_catalog_job(worker, push_catalog_string(worker, root), false);
+        }
+    }
+    
+    struct timespec startTime;
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    
+    pthread_t threads[CATALOG_MAX_WORKERS];
+    u32 startedCount = 0;
+    for (u32 workerIdx = 1; workerIdx < catalog->workerCount; ++workerIdx)
+    {
+        if (pthread_create(threads + startedCount, 0, catalog_worker, catalog->workers + workerIdx) == 0)
+        {
+            ++startedCount;
+        }
+    }
+    catalog_worker(catalog->workers);
+    for (u32 threadIdx = 0; threadIdx < startedCount; ++threadIdx)
+    {
+        pthread_join(threads[threadIdx], 0);
+    }
+    
+    u32 entryCount = 0;
+    u32 probedCount = 0;
+    u32 unchangedCount = 0;
+    u32 stolenCount = 0;
+    u64 bytesRead = 0;
+    for (u32 workerIdx = 0; workerIdx < catalog->workerCount; ++workerIdx)
+    {
+        CatalogWorker *worker = catalog->workers + workerIdx;
+        entryCount += worker->entryCount;
+        probedCount += worker->probedCount;
+        unchangedCount += worker->unchangedCount;
+        stolenCount += worker->stolenCount;
+        bytesRead += worker->bytesRead;
+    }
+    
+    CatalogEntry **entries = allocate_array(catalog->allocator, CatalogEntry *, maximum(entryCount, 1u) * 2, default_memory_alloc());
+    u32 entryIdx = 0;
+    for (u32 workerIdx = 0; workerIdx < catalog->workerCount; ++workerIdx)
+    {
+        CatalogWorker *worker = catalog->workers + workerIdx;
+        for (u32 workerEntryIdx = 0; workerEntryIdx < worker->entryCount; ++workerEntryIdx)
+        {
+            entries[entryIdx++] = worker->entries + workerEntryIdx;
+        }
+    }
+    sort_catalog_entries(entryCount, entries, entries + entryCount);
+    
+    // NOTE(michiel): The same file reached through two roots is only kept once
+    u32 uniqueCount = 0;
+    for (entryIdx = 0; entryIdx < entryCount; ++entryIdx)
+    {
+        if (!uniqueCount || !(entries[entryIdx]->path == entries[uniqueCount - 1]->path))
+        {
+            entries[uniqueCount++] = entries[entryIdx];
+        }
+    }
+    
+    b32 written = write_catalog_index(catalog->allocator, indexFile, uniqueCount, entries);
+    close_catalog_index(&catalog->previous);
+    
+    struct timespec endTime;
+    clock_gettime(CLOCK_MONOTONIC, &endTime);
+    f64 seconds = (f64)(endTime.tv_sec - startTime.tv_sec) + (f64)(endTime.tv_nsec - startTime.tv_nsec) * 1.0e-9;
+    
+    if (!written)
+    {
+        fprintf(stderr, "Could not write index '%.*s'\n", STR_FMT(indexFile));
+        return 1;
+    }
+    
+    fprintf(stdout, "Catalogued %u files (%u probed, %u unchanged) with %u threads in %.3f seconds\n",
+            uniqueCount, probedCount, unchangedCount, catalog->workerCount, seconds);
+    fprintf(stdout, "Read %lu bytes of headers and tags, %u jobs were stolen\n", bytesRead, stolenCount);
+    
+    return 0;
+}
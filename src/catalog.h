@@ -0,0 +1,77 @@
+// NOTE(michiel): Binary index of an audio library, written by catalog. The file is made to be mapped and
+// used as is: the header, the records sorted by path, then a block with all strings. Strings are stored as
+// an offset into that block, records can be binary searched on their path without parsing anything.
+
+#define CATALOG_MAGIC          MAKE_MAGIC('A', 'C', 'A', 'T')
+#define CATALOG_VERSION        1
+
+enum CatalogFormat
+{
+    CatalogFormat_Unknown,
+    CatalogFormat_Flac,
+    CatalogFormat_Mpeg,
+    CatalogFormat_Wav,
+    
+    CatalogFormat_Count,
+};
+
+enum CatalogFlags
+{
+    CatalogFlag_EstimatedLength = 0x01, // NOTE(michiel): Mpeg stream without a frame count, length from the bit rate
+    CatalogFlag_ProbeFailed     = 0x02, // NOTE(michiel): Kept in the index, so a rescan doesn't try it again
+};
+
+enum CatalogTagKind
+{
+    CatalogTag_Title,
+    CatalogTag_Artist,
+    CatalogTag_Album,
+    CatalogTag_AlbumArtist,
+    CatalogTag_Track,
+    CatalogTag_Year,
+    CatalogTag_Genre,
+    
+    CatalogTag_Count,
+};
+
+struct CatalogString
+{
+    u32 offset;                 // NOTE(michiel): From the start of the string block
+    u32 size;
+};
+
+struct CatalogHeader
+{
+    u32 magic;
+    u32 version;
+    u32 recordCount;
+    u32 recordSize;             // NOTE(michiel): sizeof(CatalogRecord), the records follow the header
+    u64 stringOffset;           // NOTE(michiel): From the start of the file
+    u64 stringSize;
+};
+
+struct CatalogRecord
+{
+    u64 fileSize;
+    u64 modifiedTime;           // NOTE(michiel): Nanoseconds since the epoch
+    u64 sampleCount;            // NOTE(michiel): Per channel
+    u32 sampleRate;
+    u32 bitRate;                // NOTE(michiel): Average over the audio data, in kbit/s
+    u8 format;                  // NOTE(michiel): CatalogFormat
+    u8 flags;                   // NOTE(michiel): CatalogFlags
+    u8 channelCount;
+    u8 bitsPerSample;           // NOTE(michiel): 0 for mpeg audio
+    CatalogString path;
+    CatalogString tags[CatalogTag_Count];
+};
+
+compile_expect(sizeof(CatalogHeader) == 32);
+compile_expect(sizeof(CatalogRecord) == 104);
+
+struct CatalogIndex
+{
+    Buffer file;                // NOTE(michiel): The mapping
+    CatalogHeader *header;
+    CatalogRecord *records;
+    u8 *strings;
+};
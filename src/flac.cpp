@@ -1,3 +1,56 @@
+// NOTE(michiel): Every thread counts for itself. A thread that decodes on the side hands its counters to
+// the main thread, which adds them in with merge_flac_stats and merge_flac_errors.
+global thread_local FlacStats gFlacStats;
+global thread_local FlacErrors gFlacErrors;
+
+global char *gFlacErrorNames[FlacError_Count] =
+{
+    "none",
+    "sync code mismatch",
+    "reserved bit set",
+    "invalid block size",
+    "invalid sample rate",
+    "invalid channel assignment",
+    "invalid sample size",
+    "invalid frame number",
+    "header CRC8 mismatch",
+    "invalid subframe type",
+    "invalid residual coding",
+    "invalid LPC parameters",
+    "truncated frame",
+    "frame CRC16 mismatch",
+    "bad or missing Ogg page",
+};
+
+internal inline void
+flac_set_error(u8 *error, FlacDecodeError newError)
+{
+    // NOTE(michiel): Only the first error is kept, everything after it is likely a consequence
+    if (*error == FlacError_None)
+    {
+        *error = newError;
+    }
+}
+
+// NOTE(michiel): The stats cost a well predicted branch per stage when disabled, so they stay
+// compiled in. The timings use rdtsc, so the including file needs <x86intrin.h>.
+internal inline u64
+flac_stats_begin(void)
+{
+    u64 result = gFlacStats.enabled ? __rdtsc() : 0;
+    return result;
+}
+
+internal inline void
+flac_stats_end(FlacStatStage stage, u64 startCycles)
+{
+    if (gFlacStats.enabled)
+    {
+        gFlacStats.stageCycles[stage] += __rdtsc() - startCycles;
+        ++gFlacStats.stageHits[stage];
+    }
+}
+
 static inline b32
 is_flac_file(BitStreamer *bitStream)
 {
@@ -34,25 +87,35 @@ parse_frame_header(BitStreamer *bitStream, FlacInfo *info)
 {
     i_expect(bitStream->remainingBits == 0);
     
+    u64 statStart = flac_stats_begin();
+    
     FlacFrameHeader result = {};
     u8 *crcCheck = bitStream->at;
     u32 dataBlock = get_bits(bitStream, 32);
     result.syncCode = dataBlock >> 18;
     if (result.syncCode != 0x3FFE)
     {
-        fprintf(stderr, "Synccode mismatch: 0x%04X vs 0x3FFE\n", result.syncCode);
+        flac_set_error(&result.error, FlacError_SyncCode);
+    }
+    if (dataBlock & 0x00020000)
+    {
+        flac_set_error(&result.error, FlacError_ReservedBit);
     }
-    i_expect(result.syncCode == 0x3FFE);
-    i_expect((dataBlock & 0x00020000) == 0);
     result.variableBlocks = (dataBlock & 0x00010000) ? 1 : 0;
     
     u32 blockSize = (dataBlock >> 12) & 0x0F;
-    i_expect(blockSize);
+    if (blockSize == 0)
+    {
+        flac_set_error(&result.error, FlacError_BlockSize);
+    }
     
     u32 sampleRate = (dataBlock >> 8) & 0x0F;
     
     result.channelAssignment = (dataBlock >> 4) & 0x0F;
-    i_expect(result.channelAssignment <= FlacChannel_MidSide);
+    if (result.channelAssignment > FlacChannel_MidSide)
+    {
+        flac_set_error(&result.error, FlacError_ChannelAssignment);
+    }
     if (result.channelAssignment < FlacChannel_LeftSide)
     {
         result.channelCount = result.channelAssignment + 1;
@@ -71,12 +134,15 @@ parse_frame_header(BitStreamer *bitStream, FlacInfo *info)
         case 4:  { result.bitsPerSample = 16; } break;
         case 5:  { result.bitsPerSample = 20; } break;
         case 6:  { result.bitsPerSample = 24; } break;
+        case 7:  { result.bitsPerSample = 32; } break;
         case 3:
-        case 7:
-        default: { i_expect(0); } break;
+        default: { flac_set_error(&result.error, FlacError_SampleSize); } break;
     }
     
-    i_expect((dataBlock & 0x01) == 0);
+    if (dataBlock & 0x01)
+    {
+        flac_set_error(&result.error, FlacError_ReservedBit);
+    }
     i_expect(bitStream->remainingBits == 0);
     
     u32 numberByteCount = 0;
@@ -121,7 +187,7 @@ parse_frame_header(BitStreamer *bitStream, FlacInfo *info)
     }
     else
     {
-        fprintf(stderr, "Number byte not properly encoded: %lu\n", number);
+        flac_set_error(&result.error, FlacError_FrameNumber);
     }
     for (u32 byteIndex = 0; byteIndex < numberByteCount; ++byteIndex)
     {
@@ -131,6 +197,10 @@ parse_frame_header(BitStreamer *bitStream, FlacInfo *info)
             number <<= 6;
             number |= (numberByte & 0x3F);
         }
+        else
+        {
+            flac_set_error(&result.error, FlacError_FrameNumber);
+        }
     }
     
     result.frameNumber = number;
@@ -152,11 +222,17 @@ parse_frame_header(BitStreamer *bitStream, FlacInfo *info)
     {
         result.blockSize = get_bits(bitStream, 16) + 1;
     }
-    else
+    else if (blockSize >= 0x8)
     {
         result.blockSize = 256 * (1 << (blockSize - 8));
     }
     
+    if (result.blockSize > info->maxBlockSamples)
+    {
+        // NOTE(michiel): All our sample buffers are sized from the stream info
+        flac_set_error(&result.error, FlacError_BlockSize);
+    }
+    
     switch (sampleRate)
     {
         case 0x0: { result.sampleRate = info->sampleRate; } break;
@@ -189,7 +265,7 @@ parse_frame_header(BitStreamer *bitStream, FlacInfo *info)
         case 0xF:
         default:
         {
-            i_expect(0);
+            flac_set_error(&result.error, FlacError_SampleRate);
         } break;
     }
     
@@ -200,9 +276,10 @@ parse_frame_header(BitStreamer *bitStream, FlacInfo *info)
     result.crc8 = get_bits(bitStream, 8); // (polynomial = x^8 + x^2 + x^1 + x^0, initialized with 0)
     if (result.crc8 != crc8calc)
     {
-        fprintf(stderr, "CRC8 calc: %02X, CRC8 file: %02X\n", crc8calc, result.crc8);
+        flac_set_error(&result.error, FlacError_HeaderCRC);
     }
-    i_expect(result.crc8 == crc8calc);
+    
+    flac_stats_end(FlacStage_Header, statStart);
     
     return result;
 }
@@ -210,12 +287,15 @@ parse_frame_header(BitStreamer *bitStream, FlacInfo *info)
 internal FlacSubframeHeader
 parse_subframe_header(BitStreamer *bitStream, FlacFrameHeader *frameHeader, u32 channelIndex)
 {
-    FlacSubframeHeader result;
+    FlacSubframeHeader result = {};
     u32 testBits = get_bits(bitStream, 8);
     u8 testBit = (testBits & 0x80) >> 7;
-    u8 subframeType = (testBits & 0xFE) >> 1;
+    u8 subframeType = (testBits & 0x7E) >> 1;
     b8 hasWastedBits = testBits & 0x01;
-    i_expect(testBit == 0);
+    if (testBit)
+    {
+        flac_set_error(&result.error, FlacError_ReservedBit);
+    }
     
     if (subframeType < FlacSubframe_Reserved0)
     {
@@ -235,7 +315,7 @@ parse_subframe_header(BitStreamer *bitStream, FlacFrameHeader *frameHeader, u32
             result.type = FlacSubframe_Error;
         }
     }
-    else if ((subframeType > FlacSubframe_Reserved2) &&
+    else if ((subframeType > FlacSubframe_Reserved3) &&
              (subframeType < FlacSubframe_Error))
     {
         result.type = FlacSubframe_LPC;
@@ -247,6 +327,11 @@ parse_subframe_header(BitStreamer *bitStream, FlacFrameHeader *frameHeader, u32
         result.typeOrder = 0;
     }
     
+    if (result.type == FlacSubframe_Error)
+    {
+        flac_set_error(&result.error, FlacError_SubframeType);
+    }
+    
     result.wastedBits = 0;
     if (hasWastedBits)
     {
@@ -254,21 +339,87 @@ parse_subframe_header(BitStreamer *bitStream, FlacFrameHeader *frameHeader, u32
         while (!get_bits(bitStream, 1))
         {
             ++result.wastedBits;
+            if (result.wastedBits >= frameHeader->bitsPerSample)
+            {
+                flac_set_error(&result.error, FlacError_SubframeType);
+                break;
+            }
         }
     }
     
     return result;
 }
 
-internal void
+internal s32
+get_signed32_left(BitStreamer *bitStream, u32 bitCount)
+{
+    i_expect(bitCount);
+    i_expect(bitCount <= 32);
+    s32 result = ((s32)get_bits(bitStream, bitCount) << (32 - bitCount));
+    return result;
+}
+
+internal s32
+get_signed32(BitStreamer *bitStream, u32 bitCount)
+{
+    i_expect(bitCount);
+    i_expect(bitCount <= 32);
+    s32 result = ((s32)get_bits(bitStream, bitCount) << (32 - bitCount));
+    result >>= (32 - bitCount);
+    return result;
+}
+
+internal s64
+get_signed64(BitStreamer *bitStream, u32 bitCount)
+{
+    i_expect(bitCount);
+    i_expect(bitCount <= 64);
+    s64 result = (s64)((u64)get_bits(bitStream, bitCount) << (64 - bitCount));
+    result >>= (64 - bitCount);
+    return result;
+}
+
+template <typename Sample>
+internal inline Sample
+get_signed_sample(BitStreamer *bitStream, u32 bitCount)
+{
+    // NOTE(michiel): The size check is constant, so 32 bit samples keep the 32 bit read
+    Sample result;
+    if (sizeof(Sample) == sizeof(s64))
+    {
+        result = (Sample)get_signed64(bitStream, bitCount);
+    }
+    else
+    {
+        result = (Sample)get_signed32(bitStream, bitCount);
+    }
+    return result;
+}
+
+internal FlacDecodeError
 parse_residual_coding(BitStreamer *bitStream, u32 order, u32 blockSize,
                       Buffer *residual)
 {
+    u64 statStart = flac_stats_begin();
+    
     u8 residualEncoding = get_bits(bitStream, 2);
-    i_expect(residualEncoding < 2);
     u32 partitionOrder = get_bits(bitStream, 4);
     u32 partitionCount = 1 << partitionOrder;
     
+    // NOTE(michiel): Reject partitionings that would walk outside the residual buffer
+    if ((residualEncoding >= 2) ||
+        (((blockSize >> partitionOrder) << partitionOrder) != blockSize) ||
+        ((blockSize >> partitionOrder) < order))
+    {
+        flac_stats_end(FlacStage_Residual, statStart);
+        return FlacError_Residual;
+    }
+    
+    if (gFlacStats.enabled)
+    {
+        ++gFlacStats.partitionOrders[partitionOrder];
+    }
+    
 #if FLAC_DEBUG_LEVEL > 1
     char *indent = "    ";
     fprintf(stdout, "Rice:\n");
@@ -285,6 +436,11 @@ parse_residual_coding(BitStreamer *bitStream, u32 order, u32 blockSize,
     for (u32 partitionIndex = 0; partitionIndex < partitionCount; ++partitionIndex)
     {
         u32 riceParameter = get_bits(bitStream, nrBitsPerRice);
+        if (gFlacStats.enabled)
+        {
+            ++gFlacStats.riceParameters[riceParameter];
+            gFlacStats.escapePartitions += (riceParameter == riceEscape) ? 1 : 0;
+        }
         
         u32 partitionSamples = ((partitionOrder == 0) || (partitionIndex > 0)) ? nrSamples : nrSamples - order;
 #if FLAC_DEBUG_LEVEL > 1
@@ -292,12 +448,35 @@ parse_residual_coding(BitStreamer *bitStream, u32 order, u32 blockSize,
         fprintf(stdout, "%sparameter: %d\n", indent, riceParameter);
 #endif
         
+        if (bitStream->at > bitStream->end)
+        {
+            flac_stats_end(FlacStage_Residual, statStart);
+            return FlacError_Truncated;
+        }
+        
         if (riceParameter == riceEscape)
         {
             u32 bitsPerSample = get_bits(bitStream, 5);
-            for (u32 i = 0; i < partitionSamples; ++i)
+            if (((u64)partitionSamples * bitsPerSample) > (8 * (u64)(bitStream->end - bitStream->at) + 8))
+            {
+                flac_stats_end(FlacStage_Residual, statStart);
+                return FlacError_Truncated;
+            }
+            
+            if (bitsPerSample)
             {
-                *dest++ = (s32)(get_bits(bitStream, bitsPerSample) >> (32 - bitsPerSample)) << (32 - bitsPerSample);
+                for (u32 i = 0; i < partitionSamples; ++i)
+                {
+                    *dest++ = get_signed32(bitStream, bitsPerSample);
+                }
+            }
+            else
+            {
+                // NOTE(michiel): Zero bits means a partition of only zero residuals
+                for (u32 i = 0; i < partitionSamples; ++i)
+                {
+                    *dest++ = 0;
+                }
             }
         }
         else
@@ -308,7 +487,13 @@ parse_residual_coding(BitStreamer *bitStream, u32 order, u32 blockSize,
                 // TODO(michiel): Optimize check 0
                 while (!get_bits(bitStream, 1))
                 {
-                    ++q;
+                    // NOTE(michiel): Long unary runs only show up in garbage, so only check the end every now and then
+                    if (((++q & 0xFF) == 0) &&
+                        (bitStream->at > bitStream->end))
+                    {
+                        flac_stats_end(FlacStage_Residual, statStart);
+                        return FlacError_Truncated;
+                    }
                 }
                 u32 x = q << riceParameter;
                 x |= get_bits(bitStream, riceParameter);
@@ -321,6 +506,767 @@ parse_residual_coding(BitStreamer *bitStream, u32 order, u32 blockSize,
             }
         }
     }
+    
+    flac_stats_end(FlacStage_Residual, statStart);
+    return FlacError_None;
+}
+
+template <typename Sample>
+internal void
+process_constant(BitStreamer *bitStream, u32 bitsPerSample,
+                 u32 blockCount, Sample *samples)
+{
+    // NOTE(michiel): expects samples[blockCount]
+    //s32 constant = get_signed32_left(bitStream, bitsPerSample);
+    Sample constant = get_signed_sample<Sample>(bitStream, bitsPerSample);
+    
+    u64 statStart = flac_stats_begin();
+    Sample *dst = samples;
+    for (u32 blockIdx = 0; blockIdx < blockCount; ++blockIdx)
+    {
+        *dst++ = constant;
+    }
+    flac_stats_end(FlacStage_Predict, statStart);
+}
+
+template <typename Sample>
+internal FlacDecodeError
+process_verbatim(BitStreamer *bitStream, u32 bitsPerSample,
+                 u32 blockCount, Sample *samples)
+{
+    // NOTE(michiel): expects samples[blockCount]
+    if (((u64)blockCount * bitsPerSample) > (8 * (u64)(bitStream->end - bitStream->at) + 8))
+    {
+        return FlacError_Truncated;
+    }
+    
+    u64 statStart = flac_stats_begin();
+    Sample *dst = samples;
+    for (u32 blockIdx = 0; blockIdx < blockCount; ++blockIdx)
+    {
+        //s32 source = get_signed32_left(bitStream, bitsPerSample);
+        Sample source = get_signed_sample<Sample>(bitStream, bitsPerSample);
+        *dst++ = source;
+    }
+    flac_stats_end(FlacStage_Residual, statStart);
+    return FlacError_None;
+}
+
+template <typename Sample>
+internal FlacDecodeError
+process_fixed(BitStreamer *bitStream, u32 order, u32 bitsPerSample,
+              u32 blockCount, s32 *residualScratch, Sample *samples)
+{
+    // NOTE(michiel): expects samples[blockCount] and residualScratch[blockCount]
+    for (u32 warmupIdx = 0; warmupIdx < order; ++warmupIdx)
+    {
+        samples[warmupIdx] = get_signed_sample<Sample>(bitStream, bitsPerSample);
+    }
+    
+    Buffer residual;
+    residual.size = (blockCount - order) * sizeof(s32);
+    residual.data = (u8 *)residualScratch;
+    FlacDecodeError error = parse_residual_coding(bitStream, order, blockCount, &residual);
+    if (error != FlacError_None)
+    {
+        return error;
+    }
+    
+    s32 *res = residualScratch;
+    
+    u64 statStart = flac_stats_begin();
+    switch (order)
+    {
+        case 0:
+        {
+            for (u32 blockIdx = order; blockIdx < blockCount; ++blockIdx)
+            {
+                samples[blockIdx] = *res++;
+            }
+        } break;
+        
+        case 1:
+        {
+            for (u32 blockIdx = order; blockIdx < blockCount; ++blockIdx)
+            {
+                samples[blockIdx] = *res++ + samples[blockIdx - 1];
+            }
+        } break;
+        
+        case 2:
+        {
+            for (u32 blockIdx = order; blockIdx < blockCount; ++blockIdx)
+            {
+                samples[blockIdx] = *res++ + 2*samples[blockIdx - 1] - samples[blockIdx - 2];
+            }
+        } break;
+        
+        case 3:
+        {
+            for (u32 blockIdx = order; blockIdx < blockCount; ++blockIdx)
+            {
+                samples[blockIdx] = *res++ + 3*samples[blockIdx - 1] - 3*samples[blockIdx - 2] + samples[blockIdx - 3];
+            }
+        } break;
+        
+        case 4:
+        {
+            for (u32 blockIdx = order; blockIdx < blockCount; ++blockIdx)
+            {
+                samples[blockIdx] = *res++ + 4*samples[blockIdx - 1] - 6*samples[blockIdx - 2] + 4*samples[blockIdx - 3] - samples[blockIdx - 4];
+            }
+        } break;
+        
+        INVALID_DEFAULT_CASE;
+    }
+    flac_stats_end(FlacStage_Predict, statStart);
+
+#if 0    
+    for (u32 blockIdx = 0; blockIdx < blockCount; ++blockIdx)
+    {
+        samples[blockIdx] = samples[blockIdx] << (32 - bitsPerSample);
+    }
+#endif
+
+    return FlacError_None;
+}
+
+template <typename Sample>
+internal FlacDecodeError
+process_lpc(BitStreamer *bitStream, u32 order, u32 bitsPerSample,
+            u32 blockCount, s32 *residualScratch, Sample *samples)
+{
+    // NOTE(michiel): expects samples[blockCount] and residualScratch[blockCount]
+    for (u32 warmupIdx = 0; warmupIdx < order; ++warmupIdx)
+    {
+        samples[warmupIdx] = get_signed_sample<Sample>(bitStream, bitsPerSample);
+    }
+    u32 precision = get_bits(bitStream, 4) + 1;
+    s32 quantize  = get_signed32(bitStream, 5);
+    if ((precision == 16) || (quantize < 0))
+    {
+        return FlacError_LPCParameters;
+    }
+    
+    s32 coefficients[32];
+    for (u32 coefIdx = 0; coefIdx < order; ++coefIdx)
+    {
+        coefficients[coefIdx] = get_signed32(bitStream, precision);
+    }
+    
+    Buffer residual;
+    residual.size = (blockCount - order) * sizeof(s32);
+    residual.data = (u8 *)residualScratch;
+    FlacDecodeError error = parse_residual_coding(bitStream, order, blockCount, &residual);
+    if (error != FlacError_None)
+    {
+        return error;
+    }
+    
+    s32 *res = residualScratch;
+    u64 statStart = flac_stats_begin();
+    for (u32 blockIdx = order; blockIdx < blockCount; ++blockIdx)
+    {
+        s64 value = 0;
+        for (u32 coef = 0; coef < order; ++coef)
+        {
+            value += (s64)coefficients[coef] * (s64)samples[blockIdx - coef - 1];
+        }
+        samples[blockIdx] = *res++ + (Sample)(value >> quantize);
+    }
+    flac_stats_end(FlacStage_Predict, statStart);
+
+#if 0    
+    for (u32 blockIdx = 0; blockIdx < blockCount; ++blockIdx)
+    {
+        samples[blockIdx] = samples[blockIdx] << (32 - bitsPerSample);
+    }
+#endif
+
+    return FlacError_None;
+}
+
+template <typename Sample>
+internal void
+interleave_samples(FlacFrameHeader *frameHeader, Sample *samplesIn, s32 *samplesOut)
+{
+    // NOTE(michiel): The output is always 32 bit and left aligned, only the side channel of a 32 bit
+    // stream needs the wide input. The wasted bits of every subframe are restored in the same shift.
+    // Left/side and side/right are linear, so they are done in modulo 2^32 after the shift, mid/side
+    // needs the full values for the halving.
+    u64 statStart = flac_stats_begin();
+    
+    u32 channelAssignment = frameHeader->channelAssignment;
+    u32 sampleCount = frameHeader->blockSize;
+    u32 outShift = 32 - frameHeader->bitsPerSample;
+    u8 *wastedBits = frameHeader->wastedBits;
+    
+    if (channelAssignment > FlacChannel_FrontLRCSubBackLRSideLR)
+    {
+        // NOTE(michiel): Calc and interleave
+        Sample *first = samplesIn;
+        Sample *second = samplesIn + sampleCount;
+        u32 firstShift = outShift + wastedBits[0];
+        u32 secondShift = outShift + wastedBits[1];
+        switch (channelAssignment)
+        {
+            case FlacChannel_LeftSide:
+            {
+                for (u32 sampleIdx = 0; sampleIdx < sampleCount; ++sampleIdx)
+                {
+                    u32 left = (u32)first[sampleIdx] << firstShift;
+                    u32 diff = (u32)second[sampleIdx] << secondShift;
+                    
+                    //samplesOut[sampleIdx * 2 + 0] = left;
+                    //samplesOut[sampleIdx * 2 + 1] = ((left >> 1) - diff) << 1;
+                    samplesOut[sampleIdx * 2 + 0] = (s32)left;
+                    samplesOut[sampleIdx * 2 + 1] = (s32)(left - diff);
+                }
+            } break;
+            
+            case FlacChannel_SideRight:
+            {
+                for (u32 sampleIdx = 0; sampleIdx < sampleCount; ++sampleIdx)
+                {
+                    u32 diff  = (u32)first[sampleIdx] << firstShift;
+                    u32 right = (u32)second[sampleIdx] << secondShift;
+                    
+                    //samplesOut[sampleIdx * 2 + 0] = ((right >> 1) - diff) << 1;
+                    //samplesOut[sampleIdx * 2 + 1] = right;
+                    
+                    samplesOut[sampleIdx * 2 + 0] = (s32)(right + diff);
+                    samplesOut[sampleIdx * 2 + 1] = (s32)right;
+                }
+            } break;
+            
+            case FlacChannel_MidSide:
+            {
+                u32 midWasted = wastedBits[0];
+                u32 sideWasted = wastedBits[1];
+                for (u32 sampleIdx = 0; sampleIdx < sampleCount; ++sampleIdx)
+                {
+                    Sample mid  = (Sample)((u64)first[sampleIdx] << midWasted);
+                    Sample side = (Sample)((u64)second[sampleIdx] << sideWasted);
+                    
+                    //samplesOut[sampleIdx * 2 + 0] = mid + (side >> 1);
+                    //samplesOut[sampleIdx * 2 + 1] = mid - (side >> 1);
+                    
+                    mid = (Sample)((u64)mid << 1);
+                    mid |= (side & 0x01); // NOTE(michiel): Is side odd
+                    samplesOut[sampleIdx * 2 + 0] = (s32)((u32)((mid + side) >> 1) << outShift);
+                    samplesOut[sampleIdx * 2 + 1] = (s32)((u32)((mid - side) >> 1) << outShift);
+                }
+            } break;
+            
+            INVALID_DEFAULT_CASE;
+        }
+    }
+    else
+    {
+        // NOTE(michiel): Just interleave
+        u32 channelCount = channelAssignment + 1;
+        for (u32 channelIdx = 0; channelIdx < channelCount; ++channelIdx)
+        {
+            Sample *source = samplesIn + channelIdx * sampleCount;
+            s32 *dest = samplesOut + channelIdx;
+            u32 shift = outShift + wastedBits[channelIdx];
+            for (u32 sampleIdx = 0; sampleIdx < sampleCount; ++sampleIdx)
+            {
+                *dest = (s32)((u32)source[sampleIdx] << shift);
+                dest += channelCount;
+            }
+        }
+    }
+    
+    flac_stats_end(FlacStage_Interleave, statStart);
+}
+
+internal u32
+subframe_bits_per_sample(FlacFrameHeader *frameHeader, u32 channelIndex)
+{
+    u32 result = frameHeader->bitsPerSample;
+    if ((((frameHeader->channelAssignment == FlacChannel_LeftSide) ||
+          (frameHeader->channelAssignment == FlacChannel_MidSide)) &&
+         (channelIndex == 1)) ||
+        ((frameHeader->channelAssignment == FlacChannel_SideRight) &&
+         (channelIndex == 0)))
+    {
+        // NOTE(michiel): Not in spec, but the side channel (L - R) is 1 bit larger to account for overflows.
+        ++result;
+    }
+    return result;
+}
+
+template <typename Sample>
+internal FlacSubframeHeader
+decode_subframe(BitStreamer *bitStream, FlacFrameHeader *frameHeader, u32 channelIndex,
+                s32 *residualScratch, Sample *samples)
+{
+    // NOTE(michiel): expects samples[blockSize] and residualScratch[blockSize]
+    u64 statStart = flac_stats_begin();
+    FlacSubframeHeader result = parse_subframe_header(bitStream, frameHeader, channelIndex);
+    flac_stats_end(FlacStage_Header, statStart);
+    
+    if (gFlacStats.enabled)
+    {
+        switch (result.type)
+        {
+            case FlacSubframe_Constant: { ++gFlacStats.constantSubframes; } break;
+            case FlacSubframe_Verbatim: { ++gFlacStats.verbatimSubframes; } break;
+            case FlacSubframe_Fixed:    { ++gFlacStats.fixedOrders[result.typeOrder]; } break;
+            case FlacSubframe_LPC:      { ++gFlacStats.lpcOrders[result.typeOrder]; } break;
+            default: {} break;
+        }
+        if (result.wastedBits)
+        {
+            ++gFlacStats.wastedBitsSubframes;
+            ++gFlacStats.wastedBits[minimum(result.wastedBits, 32u)];
+        }
+        gFlacStats.sampleCount += frameHeader->blockSize;
+    }
+
+#if FLAC_DEBUG_LEVEL > 1
+    char *subframeType = "";
+    switch (result.type)
+    {
+        case FlacSubframe_Constant: { subframeType = "constant"; } break;
+        case FlacSubframe_Verbatim: { subframeType = "verbatim"; } break;
+        case FlacSubframe_Fixed: { subframeType = "fixed"; } break;
+        case FlacSubframe_LPC: { subframeType = "lpc"; } break;
+        case FlacSubframe_Error: { subframeType = "error"; } break;
+        default: { subframeType = "reserved"; } break;
+    }
+    fprintf(stdout, "Subframe type: %s (%u)\n", subframeType, result.typeOrder);
+    fprintf(stdout, "Wasted bits: %s (%u)\n", (result.wastedBits) ? "true" : "false", result.wastedBits);
+#endif
+
+    u32 bps = subframe_bits_per_sample(frameHeader, channelIndex);
+    // NOTE(michiel): The wasted bits are not stored, so the kernels run at the reduced width. They are
+    // shifted back up by interleave_samples, together with the left alignment.
+    bps -= result.wastedBits;
+    frameHeader->wastedBits[channelIndex] = result.wastedBits;
+    if (result.typeOrder > frameHeader->blockSize)
+    {
+        flac_set_error(&result.error, FlacError_SubframeType);
+    }
+    if (result.error != FlacError_None)
+    {
+        return result;
+    }
+    
+    FlacDecodeError error = FlacError_None;
+    switch (result.type)
+    {
+        case FlacSubframe_Constant:
+        {
+            process_constant(bitStream, bps, frameHeader->blockSize, samples);
+        } break;
+        
+        case FlacSubframe_Verbatim:
+        {
+            error = process_verbatim(bitStream, bps, frameHeader->blockSize, samples);
+        } break;
+        
+        case FlacSubframe_Fixed:
+        {
+            error = process_fixed(bitStream, result.typeOrder, bps,
+                                  frameHeader->blockSize, residualScratch, samples);
+        } break;
+        
+        case FlacSubframe_LPC:
+        {
+            error = process_lpc(bitStream, result.typeOrder, bps,
+                                frameHeader->blockSize, residualScratch, samples);
+        } break;
+        
+        INVALID_DEFAULT_CASE;
+    }
+    flac_set_error(&result.error, error);
+    
+    return result;
+}
+
+internal FlacDecodeError
+parse_frame_footer(BitStreamer *bitStream, u8 *frameStart)
+{
+    // NOTE(michiel): Byte align and check the CRC16 over the whole frame (header included)
+    u64 statStart = flac_stats_begin();
+    
+    bitStream->remainingBits = 0;
+    bitStream->remainingData = 0;
+    
+    if ((bitStream->at + 2) > bitStream->end)
+    {
+        flac_stats_end(FlacStage_CRC, statStart);
+        return FlacError_Truncated;
+    }
+    
+    u16 crcTable[256];
+    crc16_init_table(0x8005, crcTable);
+    u16 crcCheck = crc16_calc_crc(crcTable, bitStream->at - frameStart, frameStart);
+    u16 crcFile = get_bits(bitStream, 16);
+    
+    FlacDecodeError result = FlacError_None;
+    if (crcFile != crcCheck)
+    {
+        result = FlacError_FrameCRC;
+    }
+    else if (gFlacStats.enabled)
+    {
+        ++gFlacStats.frameCount;
+    }
+    flac_stats_end(FlacStage_CRC, statStart);
+    
+    return result;
+}
+
+template <typename Sample>
+internal FlacDecodeError
+decode_frame(BitStreamer *bitStream, FlacInfo *info, FlacFrameHeader *frameHeader,
+             s32 *residualScratch, Sample *samples)
+{
+    // NOTE(michiel): expects samples[channelCount * maxBlockSamples] and residualScratch[maxBlockSamples],
+    // the channels are stored one after the other (not interleaved).
+    if ((bitStream->end - bitStream->at) < 8)
+    {
+        return FlacError_Truncated;
+    }
+    
+    u8 *frameStart = bitStream->at;
+    *frameHeader = parse_frame_header(bitStream, info);
+    
+    if ((frameHeader->error == FlacError_None) &&
+        (frameHeader->channelCount != info->channelCount))
+    {
+        frameHeader->error = FlacError_ChannelAssignment;
+    }
+    if ((frameHeader->error == FlacError_None) &&
+        (sizeof(Sample) == sizeof(s32)) && (frameHeader->bitsPerSample > FLAC_MAX_NARROW_BITS))
+    {
+        // NOTE(michiel): The side channel and the fixed predictor would overflow the 32 bit kernels
+        frameHeader->error = FlacError_SampleSize;
+    }
+    if (frameHeader->error != FlacError_None)
+    {
+        return (FlacDecodeError)frameHeader->error;
+    }
+    
+    Sample *channelSamples = samples;
+    for (u32 channelIdx = 0; channelIdx < frameHeader->channelCount; ++channelIdx)
+    {
+        FlacSubframeHeader subframeHeader = decode_subframe(bitStream, frameHeader, channelIdx,
+                                                            residualScratch, channelSamples);
+        if (subframeHeader.error != FlacError_None)
+        {
+            return (FlacDecodeError)subframeHeader.error;
+        }
+        channelSamples += frameHeader->blockSize;
+    }
+    
+    return parse_frame_footer(bitStream, frameStart);
+}
+
+internal b32
+flac_needs_wide_samples(FlacInfo *info)
+{
+    return info->bitsPerSample > FLAC_MAX_NARROW_BITS;
+}
+
+internal FlacDecodeError
+decode_frame(BitStreamer *bitStream, FlacInfo *info, FlacFrameHeader *frameHeader,
+             s32 *residualScratch, s32 *samples, s64 *wideSamples)
+{
+    // NOTE(michiel): Uses the 64 bit kernels if wideSamples is given, samples is not touched then.
+    // Callers only allocate wideSamples when flac_needs_wide_samples says so.
+    FlacDecodeError result;
+    if (wideSamples)
+    {
+        result = decode_frame(bitStream, info, frameHeader, residualScratch, wideSamples);
+    }
+    else
+    {
+        result = decode_frame(bitStream, info, frameHeader, residualScratch, samples);
+    }
+    return result;
+}
+
+internal void
+interleave_samples(FlacFrameHeader *frameHeader, s32 *samplesIn, s64 *wideSamplesIn, s32 *samplesOut)
+{
+    if (wideSamplesIn)
+    {
+        interleave_samples(frameHeader, wideSamplesIn, samplesOut);
+    }
+    else
+    {
+        interleave_samples(frameHeader, samplesIn, samplesOut);
+    }
+}
+
+internal u8 *
+find_next_frame(BitStreamer *bitStream, FlacInfo *info, u8 *searchStart)
+{
+    // NOTE(michiel): Scans for the next byte aligned sync code that is followed by a sane frame header.
+    // A valid header is not a guarantee (8 bits of CRC), the frame CRC16 has the final say.
+    u8 *result = 0;
+    u8 *at = searchStart;
+    while (!result && ((at + 1) < bitStream->end))
+    {
+        at = (u8 *)memchr(at, 0xFF, bitStream->end - at - 1);
+        if (!at)
+        {
+            break;
+        }
+        
+        if ((at[1] & 0xFE) == 0xF8)
+        {
+            BitStreamer probe = *bitStream;
+            probe.at = at;
+            probe.remainingBits = 0;
+            probe.remainingData = 0;
+            
+            if ((probe.end - probe.at) >= 8)
+            {
+                FlacFrameHeader header = parse_frame_header(&probe, info);
+                if ((header.error == FlacError_None) &&
+                    (header.channelCount == info->channelCount) &&
+                    (header.bitsPerSample == info->bitsPerSample))
+                {
+                    result = at;
+                }
+            }
+        }
+        ++at;
+    }
+    
+    return result;
+}
+
+internal void
+report_flac_error(FlacDecodeError error, u64 frameNumber, umm offset)
+{
+    ++gFlacErrors.errorCount;
+    ++gFlacErrors.errorKinds[error];
+    fprintf(stderr, "FLAC error in frame %lu at offset %lu: %s\n", frameNumber, (u64)offset, gFlacErrorNames[error]);
+}
+
+internal void
+print_flac_errors(void)
+{
+    if (gFlacErrors.errorCount)
+    {
+        fprintf(stderr, "FLAC errors: %lu\n", gFlacErrors.errorCount);
+        for (u32 errorIdx = 1; errorIdx < FlacError_Count; ++errorIdx)
+        {
+            if (gFlacErrors.errorKinds[errorIdx])
+            {
+                fprintf(stderr, "    %-26s: %lu\n", gFlacErrorNames[errorIdx], gFlacErrors.errorKinds[errorIdx]);
+            }
+        }
+        fprintf(stderr, "    skipped bytes             : %lu\n", gFlacErrors.skippedBytes);
+        fprintf(stderr, "    concealed samples         : %lu\n", gFlacErrors.concealedSamples);
+    }
+}
+
+internal void
+merge_flac_errors(FlacErrors *dest, FlacErrors *source)
+{
+    dest->errorCount += source->errorCount;
+    for (u32 errorIdx = 0; errorIdx < FlacError_Count; ++errorIdx)
+    {
+        dest->errorKinds[errorIdx] += source->errorKinds[errorIdx];
+    }
+    dest->skippedBytes += source->skippedBytes;
+    dest->concealedSamples += source->concealedSamples;
+}
+
+internal String
+copy_cue_string(BitStreamer *bitStream, MemoryAllocator *allocator, u32 size)
+{
+    // NOTE(michiel): Fixed size ASCII fields, padded with zeros
+    u8 *data = (u8 *)allocate_size(allocator, size, default_memory_alloc());
+    String result = copy_to_string(bitStream, size, data);
+    while (result.size && (result.data[result.size - 1] == 0))
+    {
+        --result.size;
+    }
+    return result;
+}
+
+internal void
+parse_cue_sheet(BitStreamer *bitStream, MemoryAllocator *allocator, u32 totalSize, FlacCueSheet *cueSheet)
+{
+    // NOTE(michiel): The track and index counts are checked against the block size, a broken cue
+    // sheet ends up with fewer tracks instead of reading past the block.
+    *cueSheet = {};
+    u32 consumed = 0;
+    if (totalSize >= 396)
+    {
+        cueSheet->catalogNumber = copy_cue_string(bitStream, allocator, 128);
+        cueSheet->leadInSamples = get_bits(bitStream, 64);
+        cueSheet->isCompactDisc = get_bits(bitStream, 1);
+        get_bits(bitStream, 7);
+        void_bytes(bitStream, 258);
+        u32 trackCount = get_bits(bitStream, 8);
+        consumed = 396;
+        
+        cueSheet->tracks = allocate_array(allocator, FlacCueTrack, trackCount, default_memory_alloc());
+        for (u32 trackIdx = 0; (trackIdx < trackCount) && ((consumed + 36) <= totalSize); ++trackIdx)
+        {
+            FlacCueTrack *track = cueSheet->tracks + trackIdx;
+            track->offset = get_bits(bitStream, 64);
+            track->number = get_bits(bitStream, 8);
+            track->isrc = copy_cue_string(bitStream, allocator, 12);
+            track->isAudio = get_bits(bitStream, 1) == 0;
+            track->preEmphasis = get_bits(bitStream, 1);
+            get_bits(bitStream, 6);
+            void_bytes(bitStream, 13);
+            u32 indexCount = get_bits(bitStream, 8);
+            consumed += 36;
+            
+            if ((consumed + indexCount * 12) > totalSize)
+            {
+                break;
+            }
+            
+            track->indices = allocate_array(allocator, FlacCueIndex, indexCount, default_memory_alloc());
+            for (u32 indexIdx = 0; indexIdx < indexCount; ++indexIdx)
+            {
+                FlacCueIndex *index = track->indices + indexIdx;
+                index->offset = get_bits(bitStream, 64);
+                index->number = get_bits(bitStream, 8);
+                void_bytes(bitStream, 3);
+            }
+            track->indexCount = indexCount;
+            consumed += indexCount * 12;
+            ++cueSheet->trackCount;
+        }
+    }
+    
+    if (consumed < totalSize)
+    {
+        void_bytes(bitStream, totalSize - consumed);
+    }
+}
+
+internal u64
+get_cue_track_start(FlacCueTrack *track)
+{
+    // NOTE(michiel): A track starts at index 1, the pregap (index 0) belongs to the previous track
+    u64 result = track->offset;
+    for (u32 indexIdx = 0; indexIdx < track->indexCount; ++indexIdx)
+    {
+        if (track->indices[indexIdx].number == 1)
+        {
+            result += track->indices[indexIdx].offset;
+            break;
+        }
+    }
+    return result;
+}
+
+internal void
+parse_metadata(BitStreamer *bitStream, MemoryAllocator *allocator, FlacMetadata *metadata)
+{
+    metadata->isLast = get_bits(bitStream, 1);
+    metadata->kind = (FlacMetadataType)get_bits(bitStream, 7);
+    metadata->totalSize = get_bits(bitStream, 24);
+    i_expect(bitStream->remainingBits == 0);
+    
+    switch (metadata->kind)
+    {
+        case FlacMetadata_StreamInfo:
+        {
+            i_expect(metadata->totalSize == 34);
+            metadata->info = parse_info_stream(bitStream);
+        } break;
+        
+        case FlacMetadata_Padding:
+        {
+            metadata->padding.count = metadata->totalSize;
+            void_bytes(bitStream, metadata->totalSize);
+        } break;
+        
+        case FlacMetadata_Application:
+        {
+            metadata->application.ID = get_bits(bitStream, 32);
+            void_bytes(bitStream, metadata->totalSize - 4);
+        } break;
+        
+        case FlacMetadata_SeekTable:
+        {
+            metadata->seekTable.count = metadata->totalSize / 18;
+            i_expect((metadata->totalSize % 18) == 0);
+            
+            metadata->seekTable.entries =
+                allocate_array(allocator, FlacSeekEntry, metadata->seekTable.count, default_memory_alloc());
+            
+            for (u32 seekTableIndex = 0;
+                 seekTableIndex < metadata->seekTable.count;
+                 ++seekTableIndex)
+            {
+                FlacSeekEntry *entry = metadata->seekTable.entries + seekTableIndex;
+                entry->firstSample = get_bits(bitStream, 64);
+                entry->offsetBytes = get_bits(bitStream, 64);
+                entry->samples = get_bits(bitStream, 16);
+            }
+        } break;
+        
+        case FlacMetadata_VorbisComment:
+        {
+            // TODO(michiel): Handle switch to little endian...
+            u32 vendorSize = get_le_u32(bitStream);
+            u8 *vendorData = (u8 *)allocate_size(allocator, vendorSize, default_memory_alloc());
+            metadata->vorbisComments.vendor = copy_to_string(bitStream, vendorSize, vendorData);
+            
+            metadata->vorbisComments.commentCount = get_le_u32(bitStream);
+            metadata->vorbisComments.comments =
+                allocate_array(allocator, String, metadata->vorbisComments.commentCount, default_memory_alloc());
+            
+            for (u32 i = 0; i < metadata->vorbisComments.commentCount; ++i)
+            {
+                String *comment = metadata->vorbisComments.comments + i;
+                
+                u32 commentSize = get_le_u32(bitStream);
+                u8 *commentData = (u8 *)allocate_size(allocator, commentSize, default_memory_alloc());
+                *comment = copy_to_string(bitStream, commentSize, commentData);
+            }
+        } break;
+        
+        case FlacMetadata_CueSheet:
+        {
+            parse_cue_sheet(bitStream, allocator, metadata->totalSize, &metadata->cueSheet);
+        } break;
+        
+        case FlacMetadata_Picture:
+        {
+            metadata->picture.type = (FlacPictureType)get_bits(bitStream, 32);
+            
+            u32 mimeSize = get_bits(bitStream, 32);
+            u8 *mimeData = (u8 *)allocate_size(allocator, mimeSize, default_memory_alloc());
+            metadata->picture.mime = copy_to_string(bitStream, mimeSize, mimeData);
+            
+            u32 descSize = get_bits(bitStream, 32);
+            u8 *descData = (u8 *)allocate_size(allocator, descSize, default_memory_alloc());
+            metadata->picture.description = copy_to_string(bitStream, descSize, descData);
+            
+            metadata->picture.width = get_bits(bitStream, 32);
+            metadata->picture.height = get_bits(bitStream, 32);
+            metadata->picture.bitsPerPixel = get_bits(bitStream, 32);
+            metadata->picture.indexedColours = get_bits(bitStream, 32);
+            
+            u32 imageSize = get_bits(bitStream, 32);
+            u8 *imageData = (u8 *)allocate_size(allocator, imageSize, default_memory_alloc());
+            metadata->picture.image = copy_to_bytes(bitStream, imageSize, imageData);
+        } break;
+        
+        case FlacMetadata_Invalid:
+        default:
+        {
+            // NOTE(michiel): Skip the unknown block, the size is always valid
+            void_bytes(bitStream, metadata->totalSize);
+        } break;
+    }
 }
 
 static void
@@ -336,4 +1282,134 @@ print_info_stream(FlacInfo *info, char *indent = "")
     fprintf(stdout, "%stotal samples : %lu\n", indent, info->totalSamples);
     fprintf(stdout, "%sMD5 signature : 0x%016lX%016lX\n", indent,
             info->md5signature.high, info->md5signature.low);
-}
\ No newline at end of file
+}
+internal void
+print_cue_sheet(FlacCueSheet *cueSheet, u32 sampleRate, char *indent = "")
+{
+    fprintf(stdout, "%scatalog number: %.*s\n", indent, STR_FMT(cueSheet->catalogNumber));
+    fprintf(stdout, "%slead-in       : %lu samples\n", indent, cueSheet->leadInSamples);
+    fprintf(stdout, "%scompact disc  : %s\n", indent, cueSheet->isCompactDisc ? "yes" : "no");
+    for (u32 trackIdx = 0; trackIdx < cueSheet->trackCount; ++trackIdx)
+    {
+        FlacCueTrack *track = cueSheet->tracks + trackIdx;
+        u64 seconds = sampleRate ? track->offset / sampleRate : 0;
+        fprintf(stdout, "%strack %3u: offset %12lu (%02lu:%02lu) %s%s ISRC %.*s\n", indent, track->number,
+                track->offset, seconds / 60, seconds % 60, track->isAudio ? "audio" : "data",
+                track->preEmphasis ? " pre-emphasis" : "", STR_FMT(track->isrc));
+        for (u32 indexIdx = 0; indexIdx < track->indexCount; ++indexIdx)
+        {
+            FlacCueIndex *index = track->indices + indexIdx;
+            fprintf(stdout, "%s    index %2u: offset %12lu\n", indent, index->number, index->offset);
+        }
+    }
+}
+
+internal void
+print_flac_histogram(char *name, u32 count, u64 *histogram, char *indent)
+{
+    u64 total = 0;
+    for (u32 index = 0; index < count; ++index)
+    {
+        total += histogram[index];
+    }
+    
+    if (total)
+    {
+        fprintf(stderr, "%s%s:\n", indent, name);
+        for (u32 index = 0; index < count; ++index)
+        {
+            if (histogram[index])
+            {
+                fprintf(stderr, "%s%s%2u: %12lu (%5.1f%%)\n", indent, indent, index, histogram[index],
+                        100.0 * (f64)histogram[index] / (f64)total);
+            }
+        }
+    }
+}
+
+internal void
+print_flac_stats(void)
+{
+    char *indent = "    ";
+    FlacStats *stats = &gFlacStats;
+    
+    fflush(stdout);
+    fprintf(stderr, "Flac decode statistics:\n");
+    fprintf(stderr, "%sframes            : %lu\n", indent, stats->frameCount);
+    fprintf(stderr, "%ssamples           : %lu (per channel)\n", indent, stats->sampleCount);
+    fprintf(stderr, "%sconstant subframes: %lu\n", indent, stats->constantSubframes);
+    fprintf(stderr, "%sverbatim subframes: %lu\n", indent, stats->verbatimSubframes);
+    print_flac_histogram("fixed orders", array_count(stats->fixedOrders), stats->fixedOrders, indent);
+    print_flac_histogram("lpc orders", array_count(stats->lpcOrders), stats->lpcOrders, indent);
+    print_flac_histogram("partition orders", array_count(stats->partitionOrders), stats->partitionOrders, indent);
+    print_flac_histogram("rice parameters", array_count(stats->riceParameters), stats->riceParameters, indent);
+    fprintf(stderr, "%sescape partitions : %lu\n", indent, stats->escapePartitions);
+    fprintf(stderr, "%swasted bits       : %lu subframes\n", indent, stats->wastedBitsSubframes);
+    print_flac_histogram("wasted bit counts", array_count(stats->wastedBits), stats->wastedBits, indent);
+    
+    char *stageNames[FlacStage_Count] = {"header", "residual", "predict", "interleave", "crc"};
+    u64 totalCycles = 0;
+    for (u32 stage = 0; stage < FlacStage_Count; ++stage)
+    {
+        totalCycles += stats->stageCycles[stage];
+    }
+    
+    fprintf(stderr, "%sstage cycles:\n", indent);
+    for (u32 stage = 0; stage < FlacStage_Count; ++stage)
+    {
+        u64 cycles = stats->stageCycles[stage];
+        fprintf(stderr, "%s%s%-10s: %14lu cycles (%5.1f%%), %10lu calls, %8.3f cycles/sample\n", indent, indent,
+                stageNames[stage], cycles, totalCycles ? (100.0 * (f64)cycles / (f64)totalCycles) : 0.0,
+                stats->stageHits[stage], stats->sampleCount ? ((f64)cycles / (f64)stats->sampleCount) : 0.0);
+    }
+    fprintf(stderr, "%s%s%-10s: %14lu cycles, %8.3f cycles/sample\n", indent, indent, "total", totalCycles,
+            stats->sampleCount ? ((f64)totalCycles / (f64)stats->sampleCount) : 0.0);
+}
+
+internal void
+merge_flac_stats(FlacStats *dest, FlacStats *source)
+{
+    // NOTE(michiel): Adds the counters, dest keeps its own enabled flag
+    dest->frameCount += source->frameCount;
+    dest->sampleCount += source->sampleCount;
+    dest->constantSubframes += source->constantSubframes;
+    dest->verbatimSubframes += source->verbatimSubframes;
+    for (u32 index = 0; index < array_count(dest->fixedOrders); ++index)
+    {
+        dest->fixedOrders[index] += source->fixedOrders[index];
+    }
+    for (u32 index = 0; index < array_count(dest->lpcOrders); ++index)
+    {
+        dest->lpcOrders[index] += source->lpcOrders[index];
+    }
+    for (u32 index = 0; index < array_count(dest->partitionOrders); ++index)
+    {
+        dest->partitionOrders[index] += source->partitionOrders[index];
+    }
+    for (u32 index = 0; index < array_count(dest->riceParameters); ++index)
+    {
+        dest->riceParameters[index] += source->riceParameters[index];
+    }
+    dest->escapePartitions += source->escapePartitions;
+    dest->wastedBitsSubframes += source->wastedBitsSubframes;
+    for (u32 index = 0; index < array_count(dest->wastedBits); ++index)
+    {
+        dest->wastedBits[index] += source->wastedBits[index];
+    }
+    for (u32 stage = 0; stage < FlacStage_Count; ++stage)
+    {
+        dest->stageCycles[stage] += source->stageCycles[stage];
+        dest->stageHits[stage] += source->stageHits[stage];
+    }
+}
+
+internal void
+enable_flac_stats(void)
+{
+    // NOTE(michiel): Gather from here on and dump the summary when the process exits
+    if (!gFlacStats.enabled)
+    {
+        gFlacStats.enabled = true;
+        atexit(print_flac_stats);
+    }
+}
@@ -1,3 +1,6 @@
+#define FLAC_MAX_CHANNELS 8
+#define FLAC_MAX_NARROW_BITS 24  // NOTE(michiel): Streams with more bits per sample are decoded with 64 bit intermediates
+
 struct FlacInfo
 {
     // NOTE(michiel): FLAC specifies a minimum block size of 16 and a maximum block size of 65535, 
@@ -50,10 +53,32 @@ struct FlacVorbisComments
     String *comments;
 };
 
+struct FlacCueIndex
+{
+    u64 offset;         // NOTE(michiel): In samples, relative to the track offset
+    u32 number;         // NOTE(michiel): 0 is the pregap, 1 the start of the track proper
+};
+
+struct FlacCueTrack
+{
+    u64 offset;         // NOTE(michiel): In samples, relative to the start of the stream
+    u32 number;         // NOTE(michiel): 1-99 for CD-DA, the lead-out is 170 (CD-DA) or 255
+    String isrc;
+    b32 isAudio;
+    b32 preEmphasis;
+    
+    u32 indexCount;
+    FlacCueIndex *indices;
+};
+
 struct FlacCueSheet
 {
-    // TODO(michiel): implement
-    u32 size;
+    String catalogNumber;
+    u64 leadInSamples;
+    b32 isCompactDisc;
+    
+    u32 trackCount;     // NOTE(michiel): Including the lead-out track, which is always the last one
+    FlacCueTrack *tracks;
 };
 
 enum FlacPictureType
@@ -143,6 +168,37 @@ enum FlacChannelAssignment
     //                                                                                              right = c0 - (c1 / 2)
 };
 
+enum FlacDecodeError
+{
+    FlacError_None,
+    FlacError_SyncCode,
+    FlacError_ReservedBit,
+    FlacError_BlockSize,
+    FlacError_SampleRate,
+    FlacError_ChannelAssignment,
+    FlacError_SampleSize,
+    FlacError_FrameNumber,
+    FlacError_HeaderCRC,
+    FlacError_SubframeType,
+    FlacError_Residual,
+    FlacError_LPCParameters,
+    FlacError_Truncated,
+    FlacError_FrameCRC,
+    FlacError_OggPage,
+    
+    FlacError_Count,
+};
+
+struct FlacErrors
+{
+    b32 resilient;          // NOTE(michiel): Report, resync and conceal instead of stopping at the damage
+    
+    u64 errorCount;
+    u64 errorKinds[FlacError_Count];
+    u64 skippedBytes;       // NOTE(michiel): Bytes thrown away while searching for the next frame
+    u64 concealedSamples;   // NOTE(michiel): Inter-channel samples replaced by silence
+};
+
 struct FlacFrameHeader
 {
     u16 syncCode;
@@ -153,12 +209,15 @@ struct FlacFrameHeader
     u8  channelCount;
     u8  channelAssignment;
     u8  crc8;
+    enum8(FlacDecodeError) error;
     
     union
     {
         u64 sampleNumber;
         u64 frameNumber;
     };
+    
+    u8 wastedBits[FLAC_MAX_CHANNELS];  // NOTE(michiel): Set by decode_subframe, restored by interleave_samples
 };
 
 enum FlacSubframeType
@@ -177,6 +236,7 @@ enum FlacSubframeType
 struct FlacSubframeHeader
 {
     enum8(FlacSubframeType) type;
+    enum8(FlacDecodeError) error;
     u8 typeOrder;
     u32 wastedBits;
 };
@@ -259,6 +319,44 @@ struct FlacFrame
     };
 };
 
+//
+// NOTE(michiel): Decode statistics, compiled in but only gathered when enabled at runtime
+//
+
+enum FlacStatStage
+{
+    FlacStage_Header,     // NOTE(michiel): Frame and subframe headers
+    FlacStage_Residual,   // NOTE(michiel): Rice decoding and verbatim samples
+    FlacStage_Predict,    // NOTE(michiel): Fixed/LPC reconstruction and constant fill
+    FlacStage_Interleave,
+    FlacStage_CRC,
+    
+    FlacStage_Count,
+};
+
+struct FlacStats
+{
+    b32 enabled;
+    
+    u64 frameCount;
+    u64 sampleCount;            // NOTE(michiel): Samples per channel
+    
+    u64 constantSubframes;
+    u64 verbatimSubframes;
+    u64 fixedOrders[5];
+    u64 lpcOrders[33];
+    
+    u64 partitionOrders[16];
+    u64 riceParameters[32];
+    u64 escapePartitions;
+    
+    u64 wastedBitsSubframes;
+    u64 wastedBits[33];
+    
+    u64 stageCycles[FlacStage_Count];
+    u64 stageHits[FlacStage_Count];
+};
+
 // TODO(michiel): Parse the whole stream into a single flac struct?
 // Or just make a block processor that can decode a single block...
 // It could be just given data and start looking for a sync frame...
@@ -0,0 +1,757 @@
+#include "../libberdip/platform.h"
+#include "../libberdip/bitstreamer.h"
+#include "../libberdip/random.h"
+#include "../libberdip/std_memory.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+#include <x86intrin.h>
+
+global MemoryAllocator gMemoryAllocator_;
+global MemoryAllocator *gMemoryAllocator = &gMemoryAllocator_;
+
+global FileAPI gFileApi_;
+global FileAPI *gFileApi = &gFileApi_;
+
+#ifndef FLAC_DEBUG_LEVEL
+#define FLAC_DEBUG_LEVEL  0
+#endif
+
+#include "flac.h"
+#include "flac_encoder.h"
+#include "flac_stream.h"
+
+#include "../libberdip/std_memory.cpp"
+#include "../libberdip/std_file.c"
+#include "../libberdip/crc.cpp"
+
+#include "../libberdip/bitstreamer.cpp"
+#include "flac.cpp"
+#include "flac_encoder.cpp"
+#include "flac_stream.cpp"
+
+// NOTE(michiel): Decodes a set of flac streams N times from memory without any sound output and
+// reports the throughput, both for the whole frame loop and split out per subframe type.
+// The synthetic streams are generated in memory, so every subframe kernel gets exercised, even
+// if there is no real file around that uses it.
+
+enum FlacBenchCategory
+{
+    FlacBench_Constant,
+    FlacBench_Verbatim,
+    FlacBench_Fixed0,
+    FlacBench_Fixed1,
+    FlacBench_Fixed2,
+    FlacBench_Fixed3,
+    FlacBench_Fixed4,
+    FlacBench_LPC1to4,
+    FlacBench_LPC5to8,
+    FlacBench_LPC9to12,
+    FlacBench_LPC13to16,
+    FlacBench_LPC17to32,
+    
+    FlacBench_Count,
+};
+
+global char *gFlacBenchCategoryNames[FlacBench_Count] =
+{
+    "constant",
+    "verbatim",
+    "fixed-0",
+    "fixed-1",
+    "fixed-2",
+    "fixed-3",
+    "fixed-4",
+    "lpc-1-4",
+    "lpc-5-8",
+    "lpc-9-12",
+    "lpc-13-16",
+    "lpc-17-32",
+};
+
+struct FlacBenchCounter
+{
+    u64 subframeCount;
+    u64 sampleCount;    // NOTE(michiel): Samples per channel, so a stereo frame of 4096 counts 8192
+    u64 bitCount;       // NOTE(michiel): Compressed bits consumed
+    u64 cycles;
+};
+
+struct FlacBenchResult
+{
+    u32 iterations;
+    u64 frameCount;
+    u64 sampleCount;    // NOTE(michiel): Samples per channel, for all iterations
+    u64 byteCount;      // NOTE(michiel): Compressed frame bytes, for all iterations
+    u64 cycles;
+    f64 seconds;
+    
+    FlacBenchCounter categories[FlacBench_Count];
+};
+
+internal u64
+get_wall_clock_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    u64 result = (u64)now.tv_sec * 1000000000ULL + (u64)now.tv_nsec;
+    return result;
+}
+
+internal u64
+bit_position(BitStreamer *bitStream, u8 *base)
+{
+    u64 result = (u64)(bitStream->at - base) * 8 - bitStream->remainingBits;
+    return result;
+}
+
+internal FlacBenchCategory
+bench_category(FlacSubframeHeader *header)
+{
+    FlacBenchCategory result = FlacBench_Constant;
+    switch (header->type)
+    {
+        case FlacSubframe_Constant: { result = FlacBench_Constant; } break;
+        case FlacSubframe_Verbatim: { result = FlacBench_Verbatim; } break;
+        case FlacSubframe_Fixed:    { result = (FlacBenchCategory)(FlacBench_Fixed0 + header->typeOrder); } break;
+        case FlacSubframe_LPC:
+        {
+            if (header->typeOrder <= 4)       { result = FlacBench_LPC1to4; }
+            else if (header->typeOrder <= 8)  { result = FlacBench_LPC5to8; }
+            else if (header->typeOrder <= 12) { result = FlacBench_LPC9to12; }
+            else if (header->typeOrder <= 16) { result = FlacBench_LPC13to16; }
+            else                              { result = FlacBench_LPC17to32; }
+        } break;
+        INVALID_DEFAULT_CASE;
+    }
+    return result;
+}
+
+//
+// NOTE(michiel): Synthetic stream generation
+//
+
+internal void
+put_residual(FlacBitWriter *writer, u32 order, u32 blockSize, s32 *residual)
+{
+    u32 partitionOrder = 4;
+    u32 partitionCount = 1 << partitionOrder;
+    u32 nrSamples = blockSize >> partitionOrder;
+    
+    put_bits(writer, 2, 0);
+    put_bits(writer, 4, partitionOrder);
+    
+    s32 *source = residual;
+    for (u32 partitionIndex = 0; partitionIndex < partitionCount; ++partitionIndex)
+    {
+        u32 partitionSamples = (partitionIndex > 0) ? nrSamples : nrSamples - order;
+        
+        u64 sum = 0;
+        for (u32 i = 0; i < partitionSamples; ++i)
+        {
+            u32 folded = ((u32)source[i] << 1) ^ (u32)(source[i] >> 31);
+            sum += folded;
+        }
+        u32 riceParameter = 0;
+        u64 mean = partitionSamples ? (sum / partitionSamples) : 0;
+        while ((riceParameter < 14) && ((2ULL << riceParameter) <= mean))
+        {
+            ++riceParameter;
+        }
+        
+        put_bits(writer, 4, riceParameter);
+        for (u32 i = 0; i < partitionSamples; ++i)
+        {
+            put_rice(writer, riceParameter, *source++);
+        }
+    }
+}
+
+enum SyntheticKind
+{
+    Synthetic_Constant,
+    Synthetic_Verbatim,
+    Synthetic_Fixed,
+    Synthetic_LPC,
+};
+
+struct SyntheticStream
+{
+    SyntheticKind kind;
+    u32 order;
+    char *name;
+};
+
+global SyntheticStream gSyntheticStreams[] =
+{
+    {Synthetic_Constant, 0, "synthetic-constant"},
+    {Synthetic_Verbatim, 0, "synthetic-verbatim"},
+    {Synthetic_Fixed,    0, "synthetic-fixed-0"},
+    {Synthetic_Fixed,    1, "synthetic-fixed-1"},
+    {Synthetic_Fixed,    2, "synthetic-fixed-2"},
+    {Synthetic_Fixed,    3, "synthetic-fixed-3"},
+    {Synthetic_Fixed,    4, "synthetic-fixed-4"},
+    {Synthetic_LPC,      4, "synthetic-lpc-4"},
+    {Synthetic_LPC,      8, "synthetic-lpc-8"},
+    {Synthetic_LPC,     12, "synthetic-lpc-12"},
+    {Synthetic_LPC,     16, "synthetic-lpc-16"},
+    {Synthetic_LPC,     32, "synthetic-lpc-32"},
+};
+
+internal Buffer
+generate_synthetic_flac(MemoryAllocator *allocator, SyntheticStream *stream, u32 frameCount)
+{
+    // NOTE(michiel): 16 bit stereo at 44.1kHz, fixed block size of 4096, independent channels.
+    u32 blockSize = 4096;
+    u32 channelCount = 2;
+    u32 bitsPerSample = 16;
+    
+    // NOTE(michiel): Worst case is verbatim, add some slack for the headers and the rice overflow
+    umm maxSize = 4 + 4 + 34 + (umm)frameCount * (32 + channelCount * (blockSize * 3 + 64));
+    Buffer output = {};
+    output.data = (u8 *)allocate_size(allocator, maxSize, default_memory_alloc());
+    output.size = maxSize;
+    
+    u8 crc8Table[256];
+    crc8_init_table(0x07, crc8Table);
+    u16 crc16Table[256];
+    crc16_init_table(0x8005, crc16Table);
+    
+    FlacBitWriter writer_ = create_bitwriter(output);
+    FlacBitWriter *writer = &writer_;
+    
+    put_bits(writer, 8, 'f');
+    put_bits(writer, 8, 'L');
+    put_bits(writer, 8, 'a');
+    put_bits(writer, 8, 'C');
+    
+    put_bits(writer, 1, 1);       // NOTE(michiel): Last metadata block
+    put_bits(writer, 7, FlacMetadata_StreamInfo);
+    put_bits(writer, 24, 34);
+    put_bits(writer, 16, blockSize);
+    put_bits(writer, 16, blockSize);
+    put_bits(writer, 24, 0);
+    put_bits(writer, 24, 0);
+    put_bits(writer, 20, 44100);
+    put_bits(writer, 3, channelCount - 1);
+    put_bits(writer, 5, bitsPerSample - 1);
+    put_bits(writer, 4, 0);
+    put_bits(writer, 32, (u64)frameCount * blockSize);
+    for (u32 md5Idx = 0; md5Idx < 4; ++md5Idx)
+    {
+        put_bits(writer, 32, 0);
+    }
+    
+    s32 *samples = allocate_array(allocator, s32, blockSize, default_memory_alloc());
+    s32 *residual = allocate_array(allocator, s32, blockSize, default_memory_alloc());
+    
+    s32 lpcShift = 12;
+    u32 lpcPrecision = 15;
+    s32 lpcCoefficients[32] = {};
+    lpcCoefficients[0] = 2 << lpcShift;
+    lpcCoefficients[1] = -(1 << lpcShift);
+    
+    RandomSeriesPCG random = random_seed_pcg(0x4D595DF4D0F33173ULL, 0x4F1BBCDCBFA54015ULL);
+    f64 phase[2] = {0.0, 0.25};
+    f64 phaseStep = 441.0 / 44100.0;
+    
+    for (u32 frameIdx = 0; frameIdx < frameCount; ++frameIdx)
+    {
+        u8 *frameStart = writer->at;
+        put_bits(writer, 14, 0x3FFE);
+        put_bits(writer, 1, 0);
+        put_bits(writer, 1, 0);     // NOTE(michiel): Fixed block size
+        put_bits(writer, 4, 0xC);   // NOTE(michiel): 256 * 2^4 = 4096
+        put_bits(writer, 4, 0x9);   // NOTE(michiel): 44.1kHz
+        put_bits(writer, 4, FlacChannel_LeftRight);
+        put_bits(writer, 3, 4);     // NOTE(michiel): 16 bits
+        put_bits(writer, 1, 0);
+        put_utf8_number(writer, frameIdx);
+        i_expect(writer->bitCount == 0);
+        put_bits(writer, 8, crc8_calc_crc(crc8Table, writer->at - frameStart, frameStart));
+        
+        for (u32 channelIdx = 0; channelIdx < channelCount; ++channelIdx)
+        {
+            for (u32 sampleIdx = 0; sampleIdx < blockSize; ++sampleIdx)
+            {
+                f64 sine = 12000.0 * sin_pi(F64_TAU * phase[channelIdx]);
+                s32 noise = (s32)(random_next_u32(&random) & 0x3F) - 32;
+                samples[sampleIdx] = (s32)round64(sine) + noise;
+                phase[channelIdx] += phaseStep;
+                if (phase[channelIdx] >= 1.0)
+                {
+                    phase[channelIdx] -= 1.0;
+                }
+            }
+            
+            u32 order = stream->order;
+            switch (stream->kind)
+            {
+                case Synthetic_Constant:
+                {
+                    put_bits(writer, 8, FlacSubframe_Constant << 1);
+                    put_signed(writer, bitsPerSample, samples[0] >> 8);
+                } break;
+                
+                case Synthetic_Verbatim:
+                {
+                    put_bits(writer, 8, FlacSubframe_Verbatim << 1);
+                    for (u32 sampleIdx = 0; sampleIdx < blockSize; ++sampleIdx)
+                    {
+                        put_signed(writer, bitsPerSample, samples[sampleIdx]);
+                    }
+                } break;
+                
+                case Synthetic_Fixed:
+                {
+                    put_bits(writer, 8, (FlacSubframe_Fixed | order) << 1);
+                    for (u32 warmupIdx = 0; warmupIdx < order; ++warmupIdx)
+                    {
+                        put_signed(writer, bitsPerSample, samples[warmupIdx]);
+                    }
+                    
+                    s32 *res = residual;
+                    for (u32 sampleIdx = order; sampleIdx < blockSize; ++sampleIdx)
+                    {
+                        s32 *x = samples + sampleIdx;
+                        switch (order)
+                        {
+                            case 0: { *res++ = x[0]; } break;
+                            case 1: { *res++ = x[0] - x[-1]; } break;
+                            case 2: { *res++ = x[0] - 2*x[-1] + x[-2]; } break;
+                            case 3: { *res++ = x[0] - 3*x[-1] + 3*x[-2] - x[-3]; } break;
+                            case 4: { *res++ = x[0] - 4*x[-1] + 6*x[-2] - 4*x[-3] + x[-4]; } break;
+                            INVALID_DEFAULT_CASE;
+                        }
+                    }
+                    put_residual(writer, order, blockSize, residual);
+                } break;
+                
+                case Synthetic_LPC:
+                {
+                    put_bits(writer, 8, (FlacSubframe_LPC | (order - 1)) << 1);
+                    for (u32 warmupIdx = 0; warmupIdx < order; ++warmupIdx)
+                    {
+                        put_signed(writer, bitsPerSample, samples[warmupIdx]);
+                    }
+                    put_bits(writer, 4, lpcPrecision - 1);
+                    put_signed(writer, 5, lpcShift);
+                    for (u32 coefIdx = 0; coefIdx < order; ++coefIdx)
+                    {
+                        put_signed(writer, lpcPrecision, lpcCoefficients[coefIdx]);
+                    }
+                    
+                    s32 *res = residual;
+                    for (u32 sampleIdx = order; sampleIdx < blockSize; ++sampleIdx)
+                    {
+                        s64 value = 0;
+                        for (u32 coefIdx = 0; coefIdx < order; ++coefIdx)
+                        {
+                            value += (s64)lpcCoefficients[coefIdx] * (s64)samples[sampleIdx - coefIdx - 1];
+                        }
+                        *res++ = samples[sampleIdx] - (s32)(value >> lpcShift);
+                    }
+                    put_residual(writer, order, blockSize, residual);
+                } break;
+                
+                INVALID_DEFAULT_CASE;
+            }
+        }
+        
+        align_bitwriter(writer);
+        put_bits(writer, 16, crc16_calc_crc(crc16Table, writer->at - frameStart, frameStart));
+    }
+    
+    output.size = writer->at - output.data;
+    return output;
+}
+
+//
+// NOTE(michiel): Benchmark
+//
+
+internal b32
+bench_flac_stream(Buffer flacData, u32 iterations, FlacBenchResult *result)
+{
+    b32 success = false;
+    
+    BitStreamer bitStream_ = create_bitstreamer(flacData, BitStream_BigEndian);
+    BitStreamer *bitStream = &bitStream_;
+    
+    if ((flacData.size > 4) && is_flac_file(bitStream))
+    {
+        bitStream->at += 4;
+        
+        FlacMetadata metadata = {};
+        FlacInfo info = {};
+        do
+        {
+            parse_metadata(bitStream, gMemoryAllocator, &metadata);
+            if (metadata.kind == FlacMetadata_StreamInfo)
+            {
+                info = metadata.info;
+            }
+        } while (!metadata.isLast);
+        
+        if (info.maxBlockSamples)
+        {
+            Buffer frameData = {};
+            frameData.data = bitStream->at;
+            frameData.size = flacData.size - (bitStream->at - flacData.data);
+            
+            u32 totalSampleCount = (u32)info.maxBlockSamples * info.channelCount;
+            s32 *channelSamples = 0;
+            s64 *wideSamples = 0;
+            if (flac_needs_wide_samples(&info))
+            {
+                wideSamples = allocate_array(gMemoryAllocator, s64, totalSampleCount, default_memory_alloc());
+            }
+            else
+            {
+                channelSamples = allocate_array(gMemoryAllocator, s32, totalSampleCount, default_memory_alloc());
+            }
+            s32 *interleaved = allocate_array(gMemoryAllocator, s32, totalSampleCount, default_memory_alloc());
+            s32 *residualSamples = allocate_array(gMemoryAllocator, s32, info.maxBlockSamples, default_memory_alloc());
+            
+            *result = {};
+            result->iterations = iterations;
+            
+            u64 startNs = get_wall_clock_ns();
+            u64 startCycles = __rdtsc();
+            for (u32 iteration = 0; iteration < iterations; ++iteration)
+            {
+                bitStream_ = create_bitstreamer(frameData, BitStream_BigEndian);
+                
+                while (bitStream->at != bitStream->end)
+                {
+                    u8 *frameStart = bitStream->at;
+                    FlacFrameHeader frameHeader = parse_frame_header(bitStream, &info);
+                    i_expect(frameHeader.error == FlacError_None);
+                    
+                    u32 channelOffset = 0;
+                    for (u32 channelIdx = 0; channelIdx < frameHeader.channelCount; ++channelIdx)
+                    {
+                        u64 bitStart = bit_position(bitStream, frameData.data);
+                        u64 subframeStart = __rdtsc();
+                        FlacSubframeHeader subframeHeader;
+                        if (wideSamples)
+                        {
+                            subframeHeader = decode_subframe(bitStream, &frameHeader, channelIdx,
+                                                             residualSamples, wideSamples + channelOffset);
+                        }
+                        else
+                        {
+                            subframeHeader = decode_subframe(bitStream, &frameHeader, channelIdx,
+                                                             residualSamples, channelSamples + channelOffset);
+                        }
+                        u64 subframeCycles = __rdtsc() - subframeStart;
+                        i_expect(subframeHeader.error == FlacError_None);
+                        
+                        FlacBenchCounter *counter = result->categories + bench_category(&subframeHeader);
+                        ++counter->subframeCount;
+                        counter->sampleCount += frameHeader.blockSize;
+                        counter->bitCount += bit_position(bitStream, frameData.data) - bitStart;
+                        counter->cycles += subframeCycles;
+                        
+                        channelOffset += frameHeader.blockSize;
+                    }
+                    
+                    FlacDecodeError footerError = parse_frame_footer(bitStream, frameStart);
+                    i_expect(footerError == FlacError_None);
+                    interleave_samples(&frameHeader, channelSamples, wideSamples, interleaved);
+                    
+                    ++result->frameCount;
+                    result->sampleCount += (u64)frameHeader.blockSize * frameHeader.channelCount;
+                }
+                
+                result->byteCount += frameData.size;
+            }
+            result->cycles = __rdtsc() - startCycles;
+            result->seconds = (f64)(get_wall_clock_ns() - startNs) * 1.0e-9;
+            
+            deallocate(gMemoryAllocator, residualSamples);
+            deallocate(gMemoryAllocator, interleaved);
+            if (channelSamples)
+            {
+                deallocate(gMemoryAllocator, channelSamples);
+            }
+            if (wideSamples)
+            {
+                deallocate(gMemoryAllocator, wideSamples);
+            }
+            
+            success = true;
+        }
+        else
+        {
+            fprintf(stderr, "Missing stream info\n");
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Not a flac stream\n");
+    }
+    
+    return success;
+}
+
+internal void
+add_bench_result(FlacBenchResult *total, FlacBenchResult *result)
+{
+    total->iterations = result->iterations;
+    total->frameCount += result->frameCount;
+    total->sampleCount += result->sampleCount;
+    total->byteCount += result->byteCount;
+    total->cycles += result->cycles;
+    total->seconds += result->seconds;
+    for (u32 categoryIdx = 0; categoryIdx < FlacBench_Count; ++categoryIdx)
+    {
+        FlacBenchCounter *dest = total->categories + categoryIdx;
+        FlacBenchCounter *source = result->categories + categoryIdx;
+        dest->subframeCount += source->subframeCount;
+        dest->sampleCount += source->sampleCount;
+        dest->bitCount += source->bitCount;
+        dest->cycles += source->cycles;
+    }
+}
+
+internal void
+print_bench_line(b32 machineReadable, const char *name, const char *category, u64 count,
+                 u64 sampleCount, u64 byteCount, u64 cycles, f64 cyclesPerSecond)
+{
+    f64 seconds = cycles ? ((f64)cycles / cyclesPerSecond) : 0.0;
+    f64 mbPerSecond = (seconds > 0.0) ? ((f64)byteCount / (1024.0 * 1024.0 * seconds)) : 0.0;
+    f64 samplesPerSecond = (seconds > 0.0) ? ((f64)sampleCount / seconds) : 0.0;
+    f64 cyclesPerSample = sampleCount ? ((f64)cycles / (f64)sampleCount) : 0.0;
+    
+    if (machineReadable)
+    {
+        fprintf(stdout, "%s\t%s\t%lu\t%lu\t%lu\t%lu\t%.3f\t%.0f\t%.3f\n", name, category, count,
+                sampleCount, byteCount, cycles, mbPerSecond, samplesPerSecond, cyclesPerSample);
+    }
+    else
+    {
+        fprintf(stdout, "    %-10s %10lu %12lu %10.2f %12.2f %10.3f\n", category, count,
+                sampleCount, mbPerSecond, samplesPerSecond * 1.0e-6, cyclesPerSample);
+    }
+}
+
+internal void
+print_bench_result(b32 machineReadable, char *name, FlacBenchResult *result)
+{
+    f64 cyclesPerSecond = (result->seconds > 0.0) ? ((f64)result->cycles / result->seconds) : 1.0;
+    
+    if (!machineReadable)
+    {
+        fprintf(stdout, "%s: %u iterations, %lu frames, %.3f sec, %.2f GHz\n", name, result->iterations,
+                result->frameCount, result->seconds, cyclesPerSecond * 1.0e-9);
+        fprintf(stdout, "    %-10s %10s %12s %10s %12s %10s\n", "type", "count", "samples",
+                "MB/s", "Msamples/s", "cyc/sample");
+    }
+    
+    print_bench_line(machineReadable, name, "overall", result->frameCount, result->sampleCount,
+                     result->byteCount, result->cycles, cyclesPerSecond);
+    for (u32 categoryIdx = 0; categoryIdx < FlacBench_Count; ++categoryIdx)
+    {
+        FlacBenchCounter *counter = result->categories + categoryIdx;
+        if (counter->subframeCount)
+        {
+            print_bench_line(machineReadable, name, gFlacBenchCategoryNames[categoryIdx],
+                             counter->subframeCount, counter->sampleCount, counter->bitCount / 8,
+                             counter->cycles, cyclesPerSecond);
+        }
+    }
+}
+
+internal void
+bench_flac_scrub(b32 machineReadable, char *name, Buffer flacData, u32 iterations, umm cacheBytes)
+{
+    // NOTE(michiel): Mimics an editor scrubbing around a play head, short regions at random offsets
+    // inside a window that slowly moves through the stream. Once without and once with a frame cache.
+    for (u32 pass = 0; pass < 2; ++pass)
+    {
+        FlacFrameCache *cache = pass ? create_flac_cache(gMemoryAllocator, cacheBytes) : 0;
+        FlacStream stream = {};
+        if (open_flac_stream(gMemoryAllocator, flacData, 1, cache, &stream))
+        {
+            FlacFrameIndex *lastFrame = stream.frames + stream.frameCount - 1;
+            u64 totalSamples = lastFrame->firstSample + lastFrame->sampleCount;
+            u32 regionSamples = 2048;
+            u64 windowSamples = 16 * (u64)stream.info.maxBlockSamples;
+            u32 regionCount = iterations * 256;
+            s32 *output = allocate_array(gMemoryAllocator, s32, regionSamples * stream.info.channelCount, default_memory_alloc());
+            
+            // NOTE(michiel): Same seed for both passes, so both decode the exact same regions
+            RandomSeriesPCG random = random_seed_pcg(0x5C2B7E1D05ULL, 0x91A3F0C2ULL);
+            u64 sampleCount = 0;
+            
+            u64 startNs = get_wall_clock_ns();
+            u64 startCycles = __rdtsc();
+            for (u32 regionIdx = 0; regionIdx < regionCount; ++regionIdx)
+            {
+                u64 windowStart = 0;
+                u64 window = totalSamples;
+                if (totalSamples > windowSamples)
+                {
+                    windowStart = (u64)regionIdx * (totalSamples - windowSamples) / regionCount;
+                    window = windowSamples;
+                }
+                u64 firstSample = windowStart + (random_next_u32(&random) % window);
+                sampleCount += decode_flac_region(&stream, firstSample, regionSamples, output);
+            }
+            u64 cycles = __rdtsc() - startCycles;
+            f64 seconds = (f64)(get_wall_clock_ns() - startNs) * 1.0e-9;
+            f64 cyclesPerSecond = (seconds > 0.0) ? ((f64)cycles / seconds) : 1.0;
+            
+            print_bench_line(machineReadable, name, pass ? "scrub-lru" : "scrub", regionCount,
+                             sampleCount * stream.info.channelCount, 0, cycles, cyclesPerSecond);
+            if (cache && !machineReadable)
+            {
+                fprintf(stdout, "    cache: %lu hits, %lu misses, %lu evictions, %.1f MB used\n",
+                        cache->hits, cache->misses, cache->evictions,
+                        (f64)cache->memoryUsed / (1024.0 * 1024.0));
+            }
+            
+            deallocate(gMemoryAllocator, output);
+        }
+        close_flac_stream(&stream);
+        if (cache)
+        {
+            destroy_flac_cache(cache);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std_file_api(gFileApi);
+    initialize_std_allocator(0, gMemoryAllocator);
+    
+    u32 iterations = 10;
+    u32 syntheticFrames = 256;
+    b32 doSynthetic = true;
+    b32 machineReadable = false;
+    umm scrubCacheBytes = 0;
+    
+    u32 fileCount = 0;
+    char **files = allocate_array(gMemoryAllocator, char *, argc, default_memory_alloc());
+    
+    s32 index = 1;
+    while (index < argc)
+    {
+        String arg = string(argv[index++]);
+        if ((arg == string("--iterations")) ||
+            (arg == string("-n")))
+        {
+            i_expect(index < argc);
+            String value = string(argv[index++]);
+            iterations = number_from_string(value);
+        }
+        else if ((arg == string("--frames")) ||
+                 (arg == string("-f")))
+        {
+            i_expect(index < argc);
+            String value = string(argv[index++]);
+            syntheticFrames = number_from_string(value);
+        }
+        else if ((arg == string("--no-synthetic")) ||
+                 (arg == string("-r")))
+        {
+            doSynthetic = false;
+        }
+        else if ((arg == string("--tsv")) ||
+                 (arg == string("-m")))
+        {
+            machineReadable = true;
+        }
+        else if ((arg == string("--scrub")) ||
+                 (arg == string("-c")))
+        {
+            i_expect(index < argc);
+            String value = string(argv[index++]);
+            scrubCacheBytes = (umm)number_from_string(value) * 1024 * 1024;
+        }
+        else if ((arg == string("--stats")) ||
+                 (arg == string("-s")))
+        {
+            enable_flac_stats();
+        }
+        else if (arg.size && (arg.data[0] == '-'))
+        {
+            fprintf(stderr, "Unexpected argument: %.*s\n", STR_FMT(arg));
+            fprintf(stderr,
+                    "Usage: %s [options] [file.flac ...]\n"
+                    "\n"
+                    "  -n | --iterations     Decode every stream this many times\n"
+                    "  -f | --frames         Number of frames in each synthetic stream\n"
+                    "  -r | --no-synthetic   Only benchmark the given files\n"
+                    "  -m | --tsv            Machine readable, tab separated output\n"
+                    "  -c | --scrub <MiB>    Also run a random access scrub, with and without a frame cache of this size\n"
+                    "  -s | --stats          Gather decode statistics and print them at exit\n",
+                    argv[0]);
+            return 1;
+        }
+        else
+        {
+            files[fileCount++] = argv[index - 1];
+        }
+    }
+    i_expect(iterations);
+    
+    if (machineReadable)
+    {
+        fprintf(stdout, "stream\ttype\tcount\tsamples\tbytes\tcycles\tmb_per_sec\tsamples_per_sec\tcycles_per_sample\n");
+    }
+    
+    FlacBenchResult total = {};
+    FlacBenchResult result = {};
+    
+    if (doSynthetic)
+    {
+        for (u32 streamIdx = 0; streamIdx < array_count(gSyntheticStreams); ++streamIdx)
+        {
+            SyntheticStream *stream = gSyntheticStreams + streamIdx;
+            Buffer flacData = generate_synthetic_flac(gMemoryAllocator, stream, syntheticFrames);
+            if (bench_flac_stream(flacData, iterations, &result))
+            {
+                print_bench_result(machineReadable, stream->name, &result);
+                add_bench_result(&total, &result);
+            }
+            if (scrubCacheBytes)
+            {
+                bench_flac_scrub(machineReadable, stream->name, flacData, iterations, scrubCacheBytes);
+            }
+            deallocate(gMemoryAllocator, flacData.data);
+        }
+    }
+    
+    for (u32 fileIdx = 0; fileIdx < fileCount; ++fileIdx)
+    {
+        Buffer flacData = gFileApi->read_entire_file(gMemoryAllocator, string(files[fileIdx]));
+        if (flacData.size)
+        {
+            if (bench_flac_stream(flacData, iterations, &result))
+            {
+                print_bench_result(machineReadable, files[fileIdx], &result);
+                add_bench_result(&total, &result);
+            }
+            if (scrubCacheBytes)
+            {
+                bench_flac_scrub(machineReadable, files[fileIdx], flacData, iterations, scrubCacheBytes);
+            }
+            deallocate(gMemoryAllocator, flacData.data);
+        }
+        else
+        {
+            fprintf(stderr, "Could not read '%s'\n", files[fileIdx]);
+        }
+    }
+    
+    if (total.frameCount)
+    {
+        print_bench_result(machineReadable, "total", &total);
+    }
+    
+    return 0;
+}
@@ -4,6 +4,8 @@
 #include "../libberdip/std_memory.h"
 
 #include <alsa/asoundlib.h>
+#include <x86intrin.h>
+#include <pthread.h>
 
 #include "./platform_sound.h"
 
@@ -27,6 +29,8 @@ global FileAPI *gFileApi = &gFileApi_;
 #endif
 
 #include "flac.h"
+#include "ogg.h"
+#include "flac_ogg.h"
 
 #include "../libberdip/std_memory.cpp"
 #include "../libberdip/std_file.c"
@@ -34,245 +38,11 @@ global FileAPI *gFileApi = &gFileApi_;
 
 #include "../libberdip/bitstreamer.cpp"
 #include "flac.cpp"
+#include "ogg.cpp"
+#include "flac_ogg.cpp"
 
 #include "truncation.cpp"  // TODO(michiel): TEMP
 
-internal s32
-get_signed32_left(BitStreamer *bitStream, u32 bitCount)
-{
-    i_expect(bitCount);
-    i_expect(bitCount <= 32);
-    s32 result = ((s32)get_bits(bitStream, bitCount) << (32 - bitCount));
-    return result;
-}
-
-internal s32
-get_signed32(BitStreamer *bitStream, u32 bitCount)
-{
-    i_expect(bitCount);
-    i_expect(bitCount <= 32);
-    s32 result = ((s32)get_bits(bitStream, bitCount) << (32 - bitCount));
-    result >>= (32 - bitCount);
-    return result;
-}
-
-internal void
-process_constant(BitStreamer *bitStream, u32 bitsPerSample,
-                 u32 blockCount, s32 *samples)
-{
-    // NOTE(michiel): expects samples[blockCount]
-    //s32 constant = get_signed32_left(bitStream, bitsPerSample);
-    s32 constant = get_signed32(bitStream, bitsPerSample);
-    s32 *dst = samples;
-    for (u32 blockIdx = 0; blockIdx < blockCount; ++blockIdx)
-    {
-        *dst++ = constant;
-    }
-}
-
-internal void
-process_verbatim(BitStreamer *bitStream, u32 bitsPerSample,
-                 u32 blockCount, s32 *samples)
-{
-    // NOTE(michiel): expects samples[blockCount]
-    s32 *dst = samples;
-    for (u32 blockIdx = 0; blockIdx < blockCount; ++blockIdx)
-    {
-        //s32 source = get_signed32_left(bitStream, bitsPerSample);
-        s32 source = get_signed32(bitStream, bitsPerSample);
-        *dst++ = source;
-    }
-}
-
-internal void
-process_fixed(BitStreamer *bitStream, u32 order, u32 bitsPerSample,
-              u32 blockCount, s32 *samples)
-{
-    // NOTE(michiel): expects samples[blockCount]
-    for (u32 warmupIdx = 0; warmupIdx < order; ++warmupIdx)
-    {
-        samples[warmupIdx] = get_signed32(bitStream, bitsPerSample);
-    }
-    
-    Buffer residual;
-    residual.size = (blockCount - order) * sizeof(s32);
-    residual.data = allocate_array(gMemoryAllocator, u8, residual.size, default_memory_alloc());
-    parse_residual_coding(bitStream, order, blockCount, &residual);
-    
-    s32 *res = (s32 *)residual.data;
-    
-    switch (order)
-    {
-        case 0:
-        {
-            for (u32 blockIdx = order; blockIdx < blockCount; ++blockIdx)
-            {
-                samples[blockIdx] = *res++;
-            }
-        } break;
-        
-        case 1:
-        {
-            for (u32 blockIdx = order; blockIdx < blockCount; ++blockIdx)
-            {
-                samples[blockIdx] = *res++ + samples[blockIdx - 1];
-            }
-        } break;
-        
-        case 2:
-        {
-            for (u32 blockIdx = order; blockIdx < blockCount; ++blockIdx)
-            {
-                samples[blockIdx] = *res++ + 2*samples[blockIdx - 1] - samples[blockIdx - 2];
-            }
-        } break;
-        
-        case 3:
-        {
-            for (u32 blockIdx = order; blockIdx < blockCount; ++blockIdx)
-            {
-                samples[blockIdx] = *res++ + 3*samples[blockIdx - 1] - 3*samples[blockIdx - 2] + samples[blockIdx - 3];
-            }
-        } break;
-        
-        case 4:
-        {
-            for (u32 blockIdx = order; blockIdx < blockCount; ++blockIdx)
-            {
-                samples[blockIdx] = *res++ + 4*samples[blockIdx - 1] - 6*samples[blockIdx - 2] + 4*samples[blockIdx - 3] - samples[blockIdx - 4];
-            }
-        } break;
-        
-        INVALID_DEFAULT_CASE;
-    }
-    
-#if 0    
-    for (u32 blockIdx = 0; blockIdx < blockCount; ++blockIdx)
-    {
-        samples[blockIdx] = samples[blockIdx] << (32 - bitsPerSample);
-    }
-#endif
-}
-
-internal void
-process_lpc(BitStreamer *bitStream, u32 order, u32 bitsPerSample,
-            u32 blockCount, s32 *samples)
-{
-    // NOTE(michiel): expects samples[blockCount]
-    for (u32 warmupIdx = 0; warmupIdx < order; ++warmupIdx)
-    {
-        samples[warmupIdx] = get_signed32(bitStream, bitsPerSample);
-    }
-    u32 precision = get_bits(bitStream, 4) + 1;
-    s32 quantize  = get_signed32(bitStream, 5);
-    
-    s32 coefficients[32];
-    for (u32 coefIdx = 0; coefIdx < order; ++coefIdx)
-    {
-        coefficients[coefIdx] = get_signed32(bitStream, precision);
-    }
-    
-    Buffer residual;
-    residual.size = (blockCount - order) * sizeof(s32);
-    residual.data = allocate_array(gMemoryAllocator, u8, residual.size, default_memory_alloc());
-    parse_residual_coding(bitStream, order, blockCount, &residual);
-    
-    s32 *res = (s32 *)residual.data;
-    for (u32 blockIdx = order; blockIdx < blockCount; ++blockIdx)
-    {
-        s64 value = 0;
-        for (u32 coef = 0; coef < order; ++coef)
-        {
-            value += (s64)coefficients[coef] * (s64)samples[blockIdx - coef - 1];
-        }
-        samples[blockIdx] = *res++ + (s32)(value >> quantize);
-    }
-    
-#if 0    
-    for (u32 blockIdx = 0; blockIdx < blockCount; ++blockIdx)
-    {
-        samples[blockIdx] = samples[blockIdx] << (32 - bitsPerSample);
-    }
-#endif
-}
-
-internal void
-interleave_samples(u32 channelAssignment, u32 bitsPerSample, u32 sampleCount, s32 *samplesIn, s32 *samplesOut)
-{
-    if (channelAssignment > FlacChannel_FrontLRCSubBackLRSideLR)
-    {
-        // NOTE(michiel): Calc and interleave
-        switch (channelAssignment)
-        {
-            case FlacChannel_LeftSide:
-            {
-                for (u32 sampleIdx = 0; sampleIdx < sampleCount; ++sampleIdx)
-                {
-                    s32 left = samplesIn[sampleIdx];
-                    s32 diff = samplesIn[sampleIdx + sampleCount];
-                    
-                    //samplesOut[sampleIdx * 2 + 0] = left;
-                    //samplesOut[sampleIdx * 2 + 1] = ((left >> 1) - diff) << 1;
-                    samplesOut[sampleIdx * 2 + 0] = left;
-                    samplesOut[sampleIdx * 2 + 1] = left - diff;
-                }
-            } break;
-            
-            case FlacChannel_SideRight:
-            {
-                for (u32 sampleIdx = 0; sampleIdx < sampleCount; ++sampleIdx)
-                {
-                    s32 diff  = samplesIn[sampleIdx];
-                    s32 right = samplesIn[sampleIdx + sampleCount];
-                    
-                    //samplesOut[sampleIdx * 2 + 0] = ((right >> 1) - diff) << 1;
-                    //samplesOut[sampleIdx * 2 + 1] = right;
-                    
-                    samplesOut[sampleIdx * 2 + 0] = right + diff;
-                    samplesOut[sampleIdx * 2 + 1] = right;
-                }
-            } break;
-            
-            case FlacChannel_MidSide:
-            {
-                for (u32 sampleIdx = 0; sampleIdx < sampleCount; ++sampleIdx)
-                {
-                    s32 mid  = samplesIn[sampleIdx];
-                    s32 side = samplesIn[sampleIdx + sampleCount];
-                    
-                    //samplesOut[sampleIdx * 2 + 0] = mid + (side >> 1);
-                    //samplesOut[sampleIdx * 2 + 1] = mid - (side >> 1);
-                    
-                    mid = ((u32)mid) << 1;
-                    mid |= (side & 0x01); // NOTE(michiel): Is side odd
-                    samplesOut[sampleIdx * 2 + 0] = (mid + side) >> 1;
-                    samplesOut[sampleIdx * 2 + 1] = (mid - side) >> 1;
-                }
-            } break;
-            
-            INVALID_DEFAULT_CASE;
-        }
-    }
-    else
-    {
-        // NOTE(michiel): Just interleave
-        u32 channelCount = channelAssignment + 1;
-        for (u32 sampleIdx = 0; sampleIdx < sampleCount; ++sampleIdx)
-        {
-            for (u32 channelIdx = 0; channelIdx < channelCount; ++channelIdx)
-            {
-                samplesOut[sampleIdx * channelCount + channelIdx] = samplesIn[channelIdx * sampleCount + sampleIdx];
-            }
-        }
-    }
-    
-    for (u32 sampleIdx = 0; sampleIdx < sampleCount; ++sampleIdx)
-    {
-        samplesOut[sampleIdx * 2 + 0] = (samplesOut[sampleIdx * 2 + 0]) << (32 - bitsPerSample);
-        samplesOut[sampleIdx * 2 + 1] = (samplesOut[sampleIdx * 2 + 1]) << (32 - bitsPerSample);
-    }
-}
-
 internal void // TODO(michiel): TEMP
 do_stupid_float_thing(RandomSeriesPCG *series, u32 sampleCount, s32 *samples)
 {
@@ -316,146 +86,69 @@ f32_the_floats(u32 sampleCount, s32 *samplesIn, f32 *samplesOut)
 
 PlatformSoundErrorString *platform_sound_error_string = linux_sound_error_string;
 PlatformSoundInit *platform_sound_init = linux_sound_init;
+PlatformSoundReformat *platform_sound_reformat = linux_sound_reformat;
 PlatformSoundWrite *platform_sound_write = linux_sound_write;
 
-int main(int argc, char **argv)
+// NOTE(michiel): How much of the next track is decoded ahead of time, in inter-channel samples
+#define FLAC_PREFETCH_SAMPLES  (1 << 16)
+
+struct FlacTrack
 {
-    std_file_api(gFileApi);
-    initialize_std_allocator(0, gMemoryAllocator);
+    String fileName;
+    Buffer data;
+    BitStreamer bitStream;
     
-    Buffer flacData = {};
-    if (argc == 2) {
-        flacData = gFileApi->read_entire_file(gMemoryAllocator, string(argv[1]));
-    } else {
-        flacData = gFileApi->read_entire_file(gMemoryAllocator, static_string("data/PinkFloyd-EmptySpaces.flac"));
-    }
-    //Buffer flacData = gFileApi->read_entire_file(gMemoryAllocator, static_string("data/03 On the Run.flac"));
-    //Buffer flacData = read_entire_file(static_string("data/11 Info Dump.flac"));
-    i_expect(flacData.size);
+    b32 isOgg;            // NOTE(michiel): Frames come from Ogg packets instead of bitStream
+    OggFlacStream ogg;
+
+    u32 metadataEntryCount;
+    FlacMetadata *metadataEntries;
+    FlacInfo *info;
     
-    BitStreamer bitStream_ = create_bitstreamer(flacData, BitStream_BigEndian);
-    BitStreamer *bitStream = &bitStream_;
+    s32 *channelSamples;  // NOTE(michiel): Decoded frame, one channel after the other
+    s64 *wideSamples;     // NOTE(michiel): Used instead of channelSamples for streams above FLAC_MAX_NARROW_BITS
+    s32 *residualSamples;
+    s32 *interleaved;     // NOTE(michiel): Decoded frame, interleaved and ready for output
     
-    b32 isFlacFile = is_flac_file(bitStream);
-    i_expect(isFlacFile);
-    bitStream->at += 4;
+    u64 expectedSample;
+    u64 frameCount;
     
-#if FLAC_DEBUG_LEVEL
-    char *indent = "    ";
-#endif
+    u64 startSeconds;     // NOTE(michiel): Where playback starts, set before the track is loaded
+    u32 skipSamples;      // NOTE(michiel): Dropped from the front of the next decoded frame, after a seek
     
-    u32 maxMetadataEntries = 64;
-    u32 metadataEntryCount = 0;
-    FlacMetadata *metadataEntries = allocate_array(gMemoryAllocator, FlacMetadata, maxMetadataEntries, default_memory_alloc());
+    // NOTE(michiel): Output of the last decode step, silence goes before the interleaved samples
+    u64 pendingSilence;
+    u32 pendingSamples;
     
-    for(u32 index = 0; index < maxMetadataEntries; ++index)
-    {
-        FlacMetadata *metadata = metadataEntries + metadataEntryCount++;
-        metadata->isLast = get_bits(bitStream, 1);
-        metadata->kind = (FlacMetadataType)get_bits(bitStream, 7);
-        metadata->totalSize = get_bits(bitStream, 24);
-        i_expect(bitStream->remainingBits == 0);
-        
-        switch (metadata->kind)
-        {
-            case FlacMetadata_StreamInfo:
-            {
-                i_expect(metadata->totalSize == 34);
-                metadata->info = parse_info_stream(bitStream);
-            } break;
-            
-            case FlacMetadata_Padding:
-            {
-                metadata->padding.count = metadata->totalSize;
-                void_bytes(bitStream, metadata->totalSize);
-            } break;
-            
-            case FlacMetadata_Application:
-            {
-                metadata->application.ID = get_bits(bitStream, 32);
-                void_bytes(bitStream, metadata->totalSize - 4);
-            } break;
-            
-            case FlacMetadata_SeekTable:
-            {
-                metadata->seekTable.count = metadata->totalSize / 18;
-                i_expect((metadata->totalSize % 18) == 0);
-                
-                metadata->seekTable.entries =
-                    allocate_array(gMemoryAllocator, FlacSeekEntry, metadata->seekTable.count, default_memory_alloc());
-                
-                for (u32 seekTableIndex = 0;
-                     seekTableIndex < metadata->seekTable.count;
-                     ++seekTableIndex)
-                {
-                    FlacSeekEntry *entry = metadata->seekTable.entries + seekTableIndex;
-                    entry->firstSample = get_bits(bitStream, 64);
-                    entry->offsetBytes = get_bits(bitStream, 64);
-                    entry->samples = get_bits(bitStream, 16);
-                }
-            } break;
-            
-            case FlacMetadata_VorbisComment:
-            {
-                // TODO(michiel): Handle switch to little endian...
-                u32 vendorSize = get_le_u32(bitStream);
-                u8 *vendorData = (u8 *)allocate_size(gMemoryAllocator, vendorSize, default_memory_alloc());
-                metadata->vorbisComments.vendor = copy_to_string(bitStream, vendorSize, vendorData);
-                
-                metadata->vorbisComments.commentCount = get_le_u32(bitStream);
-                metadata->vorbisComments.comments =
-                    allocate_array(gMemoryAllocator, String, metadata->vorbisComments.commentCount, default_memory_alloc());
-                
-                for (u32 i = 0; i < metadata->vorbisComments.commentCount; ++i)
-                {
-                    String *comment = metadata->vorbisComments.comments + i;
-                    
-                    u32 commentSize = get_le_u32(bitStream);
-                    u8 *commentData = (u8 *)allocate_size(gMemoryAllocator, commentSize, default_memory_alloc());
-                    *comment = copy_to_string(bitStream, commentSize, commentData);
-                }
-            } break;
-            
-            case FlacMetadata_CueSheet:
-            {
-                void_bytes(bitStream, metadata->totalSize);
-            } break;
-            
-            case FlacMetadata_Picture:
-            {
-                metadata->picture.type = (FlacPictureType)get_bits(bitStream, 32);
-                
-                u32 mimeSize = get_bits(bitStream, 32);
-                u8 *mimeData = (u8 *)allocate_size(gMemoryAllocator, mimeSize, default_memory_alloc());
-                metadata->picture.mime = copy_to_string(bitStream, mimeSize, mimeData);
-                
-                u32 descSize = get_bits(bitStream, 32);
-                u8 *descData = (u8 *)allocate_size(gMemoryAllocator, descSize, default_memory_alloc());
-                metadata->picture.description = copy_to_string(bitStream, descSize, descData);
-                
-                metadata->picture.width = get_bits(bitStream, 32);
-                metadata->picture.height = get_bits(bitStream, 32);
-                metadata->picture.bitsPerPixel = get_bits(bitStream, 32);
-                metadata->picture.indexedColours = get_bits(bitStream, 32);
-                
-                u32 imageSize = get_bits(bitStream, 32);
-                u8 *imageData = (u8 *)allocate_size(gMemoryAllocator, imageSize, default_memory_alloc());
-                metadata->picture.image = copy_to_bytes(bitStream, imageSize, imageData);
-            } break;
-            
-            case FlacMetadata_Invalid:
-            default:
-            {
-            } break;
-        }
-        
-        if (metadata->isLast)
-        {
-            break;
-        }
-    }
+    // NOTE(michiel): Filled by the prefetch thread, played before anything else of this track
+    u32 prefetchCount;
+    u32 prefetchMaxCount;
+    s32 *prefetchSamples;
+    
+    // NOTE(michiel): The decode counters of the prefetch thread. They go in with the settings of the main
+    // thread and come out with the counts, which the main thread merges after joining.
+    FlacStats prefetchStats;
+    FlacErrors prefetchErrors;
+    
+    b32 damaged;          // NOTE(michiel): Hit a damaged frame without --resilient, the track stops there
+    b32 valid;
+};
+
+struct SoundOutput
+{
+    SoundDevice *device;
+    u32 periodCount;   // NOTE(michiel): Samples per channel of one device write
+    u32 periodFill;
+    s32 *period;       // NOTE(michiel): Collects partial periods, so tracks are spliced without short writes
+    b32 ok;
+};
     
 #if FLAC_DEBUG_LEVEL
+internal void
+print_flac_metadata(u32 metadataEntryCount, FlacMetadata *metadataEntries)
+{
+    char *indent = "    ";
+    
     for(u32 index = 0; index < metadataEntryCount; ++index)
     {
         FlacMetadata *metadata = metadataEntries + index;
@@ -509,7 +202,8 @@ int main(int argc, char **argv)
             
             case FlacMetadata_CueSheet:
             {
-                fprintf(stdout, "Cue sheet metadata (b: %d)\n", metadata->totalSize);
+                fprintf(stdout, "Cue sheet metadata (b: %d):\n", metadata->totalSize);
+                print_cue_sheet(&metadata->cueSheet, metadataEntries[0].info.sampleRate, indent);
             } break;
             
             case FlacMetadata_Picture:
@@ -561,40 +255,215 @@ int main(int argc, char **argv)
             } break;
         }
     }
+}
 #endif
     
-    i_expect(metadataEntries[0].kind == FlacMetadata_StreamInfo);
-    FlacInfo *info = &metadataEntries[0].info;
-    //FlacFrame *frame = allocate_struct(FlacFrame);
-    //init_flac_frame(info);
+internal b32
+load_flac_track(FlacTrack *track)
+{
+    track->data = gFileApi->read_entire_file(gMemoryAllocator, track->fileName);
+    if (!track->data.size)
+    {
+        fprintf(stderr, "Could not read '%.*s'\n", STR_FMT(track->fileName));
+        return false;
+    }
+    
+    track->bitStream = create_bitstreamer(track->data, BitStream_BigEndian);
+    BitStreamer *bitStream = &track->bitStream;
+    
+    if (is_ogg_flac_file(track->data))
+    {
+        if (!open_ogg_flac_stream(gMemoryAllocator, track->data, &track->ogg))
+        {
+            fprintf(stderr, "Invalid Ogg FLAC headers in '%.*s'\n", STR_FMT(track->fileName));
+            return false;
+        }
+        track->isOgg = true;
+        track->metadataEntryCount = track->ogg.metadataEntryCount;
+        track->metadataEntries = track->ogg.metadataEntries;
+    }
+    else
+    {
+        if ((track->data.size < 4) || !is_flac_file(bitStream))
+        {
+            fprintf(stderr, "Not a FLAC file '%.*s'\n", STR_FMT(track->fileName));
+            return false;
+        }
+        bitStream->at += 4;
+    
+        u32 maxMetadataEntries = 64;
+        track->metadataEntryCount = 0;
+        track->metadataEntries = allocate_array(gMemoryAllocator, FlacMetadata, maxMetadataEntries, default_memory_alloc());
+    
+        for(u32 index = 0; index < maxMetadataEntries; ++index)
+        {
+            FlacMetadata *metadata = track->metadataEntries + track->metadataEntryCount++;
+            parse_metadata(bitStream, gMemoryAllocator, metadata);
+        
+            if (metadata->isLast)
+            {
+                break;
+            }
+        }
+    }
+    
+#if FLAC_DEBUG_LEVEL
+    print_flac_metadata(track->metadataEntryCount, track->metadataEntries);
+#endif
+
+    i_expect(track->metadataEntries[0].kind == FlacMetadata_StreamInfo);
+    track->info = &track->metadataEntries[0].info;
+    FlacInfo *info = track->info;
+    i_expect(info->channelCount <= FLAC_MAX_CHANNELS);
     
-    i_expect(info->minBlockSamples == info->maxBlockSamples);
     u32 totalSampleCount = (u32)info->maxBlockSamples * info->channelCount;
-    s32 *testSamples1 = allocate_array(gMemoryAllocator, s32, totalSampleCount, default_memory_alloc());
-    s32 *testSamples2 = allocate_array(gMemoryAllocator, s32, totalSampleCount, default_memory_alloc());
-    f32 *testSamplesF = allocate_array(gMemoryAllocator, f32, totalSampleCount, default_memory_alloc()); // TODO(michiel): TEMP
-    unused(testSamplesF);
+    if (flac_needs_wide_samples(info))
+    {
+        track->wideSamples = allocate_array(gMemoryAllocator, s64, totalSampleCount, default_memory_alloc());
+    }
+    else
+    {
+        track->channelSamples = allocate_array(gMemoryAllocator, s32, totalSampleCount, default_memory_alloc());
+    }
+    track->interleaved = allocate_array(gMemoryAllocator, s32, totalSampleCount, default_memory_alloc());
+    track->residualSamples = allocate_array(gMemoryAllocator, s32, info->maxBlockSamples, default_memory_alloc());
     
-    SoundDevice soundDev_ = {};
-    SoundDevice *soundDev = &soundDev_;
-    soundDev->sampleFrequency = info->sampleRate;
-    soundDev->sampleCount = 512; // info->maxBlockSamples;
-    soundDev->channelCount = info->channelCount;
-    soundDev->format = SoundFormat_s32;
+    track->valid = true;
+    return true;
+}
+
+internal void
+unload_flac_track(FlacTrack *track)
+{
+    if (track->data.data)
+    {
+        deallocate(gMemoryAllocator, track->data.data);
+    }
+    if (track->isOgg)
+    {
+        // NOTE(michiel): The metadata belongs to the Ogg stream
+        close_ogg_flac_stream(&track->ogg);
+        track->metadataEntries = 0;
+    }
+    if (track->metadataEntries)
+    {
+        deallocate(gMemoryAllocator, track->metadataEntries);
+    }
+    if (track->channelSamples)
+    {
+        deallocate(gMemoryAllocator, track->channelSamples);
+    }
+    if (track->wideSamples)
+    {
+        deallocate(gMemoryAllocator, track->wideSamples);
+    }
+    if (track->interleaved)
+    {
+        deallocate(gMemoryAllocator, track->interleaved);
+    }
+    if (track->residualSamples)
+    {
+        deallocate(gMemoryAllocator, track->residualSamples);
+    }
+    if (track->prefetchSamples)
+    {
+        deallocate(gMemoryAllocator, track->prefetchSamples);
+    }
+    *track = {};
+}
+
+internal b32
+decode_track_frame(FlacTrack *track)
+{
+    // NOTE(michiel): Decodes the next good frame into pendingSilence/pendingSamples, returns false
+    // at the end of the track.
+    BitStreamer *bitStream = &track->bitStream;
+    FlacInfo *info = track->info;
     
-    RandomSeriesPCG random = random_seed_pcg(0x102947602914ULL, 0x108926451051924ULL); // TODO(michiel): TEMP
-    unused(random);
+    track->pendingSilence = 0;
+    track->pendingSamples = 0;
     
-    if (platform_sound_init(gMemoryAllocator, soundDev))
+    b32 result = false;
+    while (!result && !track->damaged)
     {
-        while (bitStream->at != bitStream->end)
+        FlacFrameHeader frameHeader = {};
+        FlacDecodeError error = FlacError_None;
+        if (track->isOgg)
         {
-            u8 *crcStart = bitStream->at;
-            FlacFrameHeader frameHeader = parse_frame_header(bitStream, info);
-            //set_flac_frame(frame, info, &frameHeader);
-            i_expect(frameHeader.blockSize <= info->maxBlockSamples);
+            // NOTE(michiel): Every packet is one frame, so a bad frame only costs that packet. Damaged
+            // pages are dropped by the packet reader, together with the packets on them.
+            OggPacketReader *reader = &track->ogg.reader;
+            u32 lostPages = reader->badPages;
+            u64 lostBytes = reader->skippedBytes;
+            
+            Buffer packet = {};
+            b32 hasFrame = next_ogg_flac_frame(&track->ogg, &packet);
+            if (reader->badPages != lostPages)
+            {
+                report_flac_error(FlacError_OggPage, track->frameCount, reader->page.start - track->data.data);
+                gFlacErrors.skippedBytes += reader->skippedBytes - lostBytes;
+                if (!gFlacErrors.resilient)
+                {
+                    track->damaged = true;
+                    break;
+                }
+            }
+            if (!hasFrame)
+            {
+                break;
+            }
+            
+            BitStreamer packetStream = create_bitstreamer(packet, BitStream_BigEndian);
+            error = decode_frame(&packetStream, info, &frameHeader, track->residualSamples, track->channelSamples,
+                                 track->wideSamples);
+            if (error != FlacError_None)
+            {
+                report_flac_error(error, track->frameCount, reader->page.start - track->data.data);
+                gFlacErrors.skippedBytes += packet.size;
+                if (!gFlacErrors.resilient)
+                {
+                    track->damaged = true;
+                    break;
+                }
+            }
+        }
+        else
+        {
+            if (bitStream->at >= bitStream->end)
+            {
+                break;
+            }
+            
+            u8 *frameStart = bitStream->at;
+            error = decode_frame(bitStream, info, &frameHeader, track->residualSamples, track->channelSamples,
+                                 track->wideSamples);
+            if (error != FlacError_None)
+            {
+                report_flac_error(error, track->frameCount, frameStart - track->data.data);
+                if (!gFlacErrors.resilient)
+                {
+                    track->damaged = true;
+                    break;
+                }
+                
+                u8 *nextFrame = find_next_frame(bitStream, info, frameStart + 1);
+                if (!nextFrame)
+                {
+                    nextFrame = bitStream->end;
+                }
+                gFlacErrors.skippedBytes += nextFrame - frameStart;
+                bitStream->at = nextFrame;
+                bitStream->remainingBits = 0;
+                bitStream->remainingData = 0;
+            }
+        }
+        
+        if (error == FlacError_None)
+        {
+            ++track->frameCount;
             
 #if FLAC_DEBUG_LEVEL
+            char *indent = "    ";
             char *channelType = "";
             switch (frameHeader.channelAssignment)
             {
@@ -621,112 +490,399 @@ int main(int argc, char **argv)
             fprintf(stdout, "%schannel assignment: %s\n", indent, channelType);
             fprintf(stdout, "%ssample size       : %d bits\n", indent, frameHeader.bitsPerSample);
 #endif
+
+            u64 frameSample = frameHeader.variableBlocks ? frameHeader.sampleNumber : frameHeader.frameNumber * info->maxBlockSamples;
+            if (info->totalSamples && (frameSample > info->totalSamples))
+            {
+                frameSample = info->totalSamples;
+            }
+            if (frameSample > track->expectedSample)
+            {
+                // NOTE(michiel): Frames went missing, fill the hole so the timing stays intact
+                track->pendingSilence = frameSample - track->expectedSample;
+            }
+            track->expectedSample = frameSample + frameHeader.blockSize;
             
-            u32 testSampleIndex = 0;
-            for (u32 subChannelIndex = 0; subChannelIndex < frameHeader.channelCount; ++subChannelIndex)
+            interleave_samples(&frameHeader, track->channelSamples, track->wideSamples, track->interleaved);
+            //do_stupid_float_thing(&random, frameHeader.blockSize, track->interleaved); // TODO(michiel): TEMP
+            //f32_the_floats(frameHeader.blockSize, track->interleaved, testSamplesF); // TODO(michiel): TEMP
+            track->pendingSamples = frameHeader.blockSize;
+            if (track->skipSamples)
             {
-                FlacSubframeHeader subframeHeader = parse_subframe_header(bitStream, &frameHeader, subChannelIndex);
-                
-#if FLAC_DEBUG_LEVEL > 1
-                char *subframeType = "";
-                switch (subframeHeader.type)
-                {
-                    case FlacSubframe_Constant: { subframeType = "constant"; } break;
-                    case FlacSubframe_Verbatim: { subframeType = "verbatim"; } break;
-                    case FlacSubframe_Fixed: { subframeType = "fixed"; } break;
-                    case FlacSubframe_LPC: { subframeType = "lpc"; } break;
-                    case FlacSubframe_Error: { subframeType = "error"; } break;
-                    default: { subframeType = "reserved"; } break;
-                }
-                fprintf(stdout, "Subframe type: %s (%u)\n", subframeType, subframeHeader.typeOrder);
-                fprintf(stdout, "Wasted bits: %s (%u)\n", (subframeHeader.wastedBits) ? "true" : "false", subframeHeader.wastedBits);
-#endif
-                
-                u32 bps = frameHeader.bitsPerSample;
-                if ((((frameHeader.channelAssignment == FlacChannel_LeftSide) ||
-                      (frameHeader.channelAssignment == FlacChannel_MidSide)) &&
-                     (subChannelIndex == 1)) ||
-                    ((frameHeader.channelAssignment == FlacChannel_SideRight) &&
-                     (subChannelIndex == 0)))
-                {
-                    // NOTE(michiel): Not in spec, but the side channel (L - R) is 1 bit larger to account for overflows.
-                    ++bps;
-                }
-                
-                switch (subframeHeader.type)
+                // NOTE(michiel): A seek lands on the frame holding the start, not on the start itself
+                u32 skipCount = minimum(track->skipSamples, frameHeader.blockSize);
+                u32 channelCount = info->channelCount;
+                memmove(track->interleaved, track->interleaved + skipCount * channelCount,
+                        (frameHeader.blockSize - skipCount) * channelCount * sizeof(s32));
+                track->pendingSamples -= skipCount;
+                track->skipSamples = 0;
+            }
+            result = true;
+        }
+    }
+    
+    if (!result && !track->damaged && (track->expectedSample < info->totalSamples))
+    {
+        // NOTE(michiel): The stream ended early (or the last frames were damaged)
+        track->pendingSilence = info->totalSamples - track->expectedSample;
+        track->expectedSample = info->totalSamples;
+        result = true;
+    }
+    
+    return result;
+}
+
+internal void
+seek_flac_track(FlacTrack *track, u64 targetSample)
+{
+    // NOTE(michiel): Positions the track on the frame that holds targetSample. Ogg streams bisect on the
+    // page granule positions, native streams walk the frame headers from the start.
+    FlacInfo *info = track->info;
+    u64 frameSample = OGG_NO_GRANULE;
+    if (track->isOgg)
+    {
+        frameSample = seek_ogg_flac_stream(&track->ogg, targetSample);
+    }
+    else
+    {
+        BitStreamer *bitStream = &track->bitStream;
+        u8 *at = find_next_frame(bitStream, info, bitStream->at);
+        while (at)
+        {
+            BitStreamer probe = *bitStream;
+            probe.at = at;
+            probe.remainingBits = 0;
+            probe.remainingData = 0;
+            FlacFrameHeader header = parse_frame_header(&probe, info);
+            u64 firstSample = header.variableBlocks ? header.sampleNumber : header.frameNumber * info->maxBlockSamples;
+            if ((firstSample + header.blockSize) > targetSample)
+            {
+                frameSample = firstSample;
+                break;
+            }
+            at = find_next_frame(bitStream, info, at + 1);
+        }
+        
+        bitStream->at = at ? at : bitStream->end;
+        bitStream->remainingBits = 0;
+        bitStream->remainingData = 0;
+    }
+    
+    if (frameSample == OGG_NO_GRANULE)
+    {
+        // NOTE(michiel): Past the end, nothing is left to play
+        track->expectedSample = maximum(info->totalSamples, targetSample);
+    }
+    else
+    {
+        track->expectedSample = frameSample;
+        track->skipSamples = (u32)(maximum(targetSample, frameSample) - frameSample);
+    }
+}
+
+internal void
+prefetch_flac_track(FlacTrack *track)
+{
+    // NOTE(michiel): Loads the track and decodes the start of it, only touches the track it is given
+    if (load_flac_track(track))
+    {
+        if (track->startSeconds)
+        {
+            seek_flac_track(track, track->startSeconds * track->info->sampleRate);
+        }
+        
+        FlacInfo *info = track->info;
+        u32 channelCount = info->channelCount;
+        track->prefetchMaxCount = FLAC_PREFETCH_SAMPLES;
+        track->prefetchSamples = allocate_array(gMemoryAllocator, s32, (umm)track->prefetchMaxCount * channelCount, default_memory_alloc());
+        
+        while (((track->prefetchCount + info->maxBlockSamples) <= track->prefetchMaxCount) &&
+               decode_track_frame(track))
+        {
+            if (track->pendingSilence)
+            {
+                // NOTE(michiel): Leave damaged streams to the playback loop
+                break;
+            }
+            memcpy(track->prefetchSamples + track->prefetchCount * channelCount, track->interleaved,
+                   track->pendingSamples * channelCount * sizeof(s32));
+            track->prefetchCount += track->pendingSamples;
+            track->pendingSamples = 0;
+        }
+    }
+}
+
+internal void *
+prefetch_flac_track_thread(void *data)
+{
+    // NOTE(michiel): The counters are per thread, so this thread starts from the settings it was given and
+    // hands its counts back in the track.
+    FlacTrack *track = (FlacTrack *)data;
+    gFlacStats = track->prefetchStats;
+    gFlacErrors = track->prefetchErrors;
+    
+    prefetch_flac_track(track);
+    
+    track->prefetchStats = gFlacStats;
+    track->prefetchErrors = gFlacErrors;
+    return 0;
+}
+
+internal void
+queue_sound_samples(SoundOutput *output, u32 sampleCount, s32 *samples)
+{
+    // NOTE(michiel): Only whole periods go to the device, what is left waits for the next samples (or track)
+    SoundDevice *device = output->device;
+    u32 channelCount = device->channelCount;
+    s32 *source = samples;
+    while (output->ok && sampleCount)
+    {
+        if ((output->periodFill == 0) && (sampleCount >= output->periodCount))
+        {
+            output->ok = platform_sound_write(device, source);
+            source += output->periodCount * channelCount;
+            sampleCount -= output->periodCount;
+        }
+        else
+        {
+            u32 fillCount = minimum(sampleCount, output->periodCount - output->periodFill);
+            memcpy(output->period + output->periodFill * channelCount, source, fillCount * channelCount * sizeof(s32));
+            output->periodFill += fillCount;
+            source += fillCount * channelCount;
+            sampleCount -= fillCount;
+            
+            if (output->periodFill == output->periodCount)
+            {
+                output->ok = platform_sound_write(device, output->period);
+                output->periodFill = 0;
+            }
+        }
+    }
+    
+    if (!output->ok)
+    {
+        fprintf(stderr, "Sound write failed:\n    ");
+        fprintf(stderr, "%.*s\n\n", STR_FMT(platform_sound_error_string(device)));
+    }
+}
+
+internal void
+queue_sound_silence(SoundOutput *output, u64 sampleCount, u32 maxCount, s32 *scratch)
+{
+    // NOTE(michiel): expects scratch[maxCount * channelCount]
+    u32 channelCount = output->device->channelCount;
+    for (u32 index = 0; index < maxCount * channelCount; ++index)
+    {
+        scratch[index] = 0;
+    }
+    
+    while (output->ok && sampleCount)
+    {
+        u32 writeCount = (u32)minimum(sampleCount, (u64)maxCount);
+        queue_sound_samples(output, writeCount, scratch);
+        sampleCount -= writeCount;
+        gFlacErrors.concealedSamples += writeCount;
+    }
+}
+
+internal void
+flush_sound_output(SoundOutput *output)
+{
+    // NOTE(michiel): Write the last partial period as a shorter write
+    if (output->ok && output->periodFill)
+    {
+        SoundDevice *device = output->device;
+        device->sampleCount = output->periodFill;
+        output->ok = platform_sound_write(device, output->period);
+        device->sampleCount = output->periodCount;
+        output->periodFill = 0;
+    }
+}
+
+internal void
+play_flac_track(SoundOutput *output, FlacTrack *track)
+{
+    queue_sound_samples(output, track->prefetchCount, track->prefetchSamples);
+    
+    while (output->ok)
+    {
+        if (track->pendingSilence)
+        {
+            queue_sound_silence(output, track->pendingSilence, track->info->maxBlockSamples, track->interleaved);
+            track->pendingSilence = 0;
+        }
+        if (track->pendingSamples)
+        {
+            queue_sound_samples(output, track->pendingSamples, track->interleaved);
+            track->pendingSamples = 0;
+        }
+        
+        if (!decode_track_frame(track))
+        {
+            break;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std_file_api(gFileApi);
+    initialize_std_allocator(0, gMemoryAllocator);
+    
+    if (getenv("FLAC_STATS"))
+    {
+        enable_flac_stats();
+    }
+    
+    u32 trackCount = 0;
+    u64 startSeconds = 0;
+    String *trackNames = allocate_array(gMemoryAllocator, String, argc, default_memory_alloc());
+    
+    s32 index = 1;
+    while (index < argc)
+    {
+        String arg = string(argv[index++]);
+        if ((arg == string("--resilient")) ||
+            (arg == string("-r")))
+        {
+            // NOTE(michiel): Keep playing through damaged frames, the damage is replaced by silence
+            gFlacErrors.resilient = true;
+        }
+        else if (((arg == string("--start")) ||
+                  (arg == string("-s"))) && (index < argc))
+        {
+            // NOTE(michiel): Start the first track this many seconds in
+            startSeconds = number_from_string(string(argv[index++]));
+        }
+        else
+        {
+            // NOTE(michiel): Multiple files are played back to back without gaps
+            trackNames[trackCount++] = arg;
+        }
+    }
+    
+    if (trackCount == 0)
+    {
+        trackNames[trackCount++] = static_string("data/PinkFloyd-EmptySpaces.flac");
+        //trackNames[trackCount++] = static_string("data/03 On the Run.flac");
+        //trackNames[trackCount++] = static_string("data/11 Info Dump.flac");
+    }
+    
+    // NOTE(michiel): Two tracks in flight, the one playing and the one being prefetched
+    FlacTrack tracks[2] = {};
+    FlacTrack *current = tracks + 0;
+    FlacTrack *next = tracks + 1;
+    
+    u32 trackIndex = 0;
+    while ((trackIndex < trackCount) && !current->valid)
+    {
+        current->fileName = trackNames[trackIndex++];
+        current->startSeconds = startSeconds;
+        prefetch_flac_track(current);
+        if (!current->valid)
+        {
+            unload_flac_track(current);
+        }
+    }
+    if (!current->valid)
+    {
+        fprintf(stderr, "None of the files could be played\n");
+        return 1;
+    }
+    
+    FlacInfo *info = current->info;
+    
+    SoundDevice soundDev_ = {};
+    SoundDevice *soundDev = &soundDev_;
+    soundDev->sampleFrequency = info->sampleRate;
+    soundDev->sampleCount = 512; // info->maxBlockSamples;
+    soundDev->channelCount = info->channelCount;
+    soundDev->format = SoundFormat_s32;
+    
+    RandomSeriesPCG random = random_seed_pcg(0x102947602914ULL, 0x108926451051924ULL); // TODO(michiel): TEMP
+    unused(random);
+    
+    SoundOutput output = {};
+    output.device = soundDev;
+    output.periodCount = soundDev->sampleCount;
+    output.period = allocate_array(gMemoryAllocator, s32, output.periodCount * FLAC_MAX_CHANNELS, default_memory_alloc());
+    output.ok = true;
+    
+    if (platform_sound_init(gMemoryAllocator, soundDev))
+    {
+        b32 stopped = false;
+        while (output.ok && !stopped && current->valid)
+        {
+            pthread_t prefetchThread;
+            b32 prefetching = false;
+            if (trackIndex < trackCount)
+            {
+                next->fileName = trackNames[trackIndex++];
+                next->prefetchStats = {};
+                next->prefetchStats.enabled = gFlacStats.enabled;
+                next->prefetchErrors = {};
+                next->prefetchErrors.resilient = gFlacErrors.resilient;
+                prefetching = (pthread_create(&prefetchThread, 0, prefetch_flac_track_thread, next) == 0);
+                if (!prefetching)
                 {
-                    case FlacSubframe_Constant:
-                    {
-                        process_constant(bitStream, bps, frameHeader.blockSize, testSamples1 + testSampleIndex);
-                    } break;
-                    
-                    case FlacSubframe_Verbatim:
-                    {
-                        process_verbatim(bitStream, bps, frameHeader.blockSize, testSamples1 + testSampleIndex);
-                    } break;
-                    
-                    case FlacSubframe_Fixed:
-                    {
-                        process_fixed(bitStream, subframeHeader.typeOrder, bps,
-                                      frameHeader.blockSize, testSamples1 + testSampleIndex);
-                    } break;
-                    
-                    case FlacSubframe_LPC:
-                    {
-                        process_lpc(bitStream, subframeHeader.typeOrder, bps,
-                                    frameHeader.blockSize, testSamples1 + testSampleIndex);
-                    } break;
-                    
-                    INVALID_DEFAULT_CASE;
+                    // NOTE(michiel): No thread, so no gapless playback, but at least play it
+                    prefetch_flac_track(next);
                 }
+            }
                 
-                testSampleIndex += frameHeader.blockSize;
+            play_flac_track(&output, current);
+            if (current->damaged)
+            {
+                // NOTE(michiel): Without --resilient the damage ends playback, after what was good
+                fprintf(stderr, "Stopped at a damaged frame in '%.*s', --resilient plays through it\n",
+                        STR_FMT(current->fileName));
+                stopped = true;
             }
             
-            bitStream->remainingBits = 0;
-            bitStream->remainingData = 0;
+            if (prefetching)
+            {
+                pthread_join(prefetchThread, 0);
+                merge_flac_stats(&gFlacStats, &next->prefetchStats);
+                merge_flac_errors(&gFlacErrors, &next->prefetchErrors);
+            }
+            unload_flac_track(current);
             
-            u16 crcTable[256];
-            crc16_init_table(0x8005, crcTable);
-            u16 crcCheck = crc16_calc_crc(crcTable, bitStream->at - crcStart, crcStart);
-            u16 crcFile = get_bits(bitStream, 16);
+            FlacTrack *swap = current;
+            current = next;
+            next = swap;
             
-            if (crcFile != crcCheck)
+            while (!current->valid && current->fileName.size && (trackIndex < trackCount))
             {
-                fprintf(stderr, "CRC16 calc: %04X, CRC16 file: %04X\n", crcCheck, crcFile);
+                // NOTE(michiel): Skip over unreadable files, without prefetching
+                unload_flac_track(current);
+                current->fileName = trackNames[trackIndex++];
+                prefetch_flac_track(current);
+            }
+            if (!current->valid)
+            {
+                // NOTE(michiel): The last file failed as well, or there was none left
+                unload_flac_track(current);
             }
-            i_expect(crcFile == crcCheck);
             
-            interleave_samples(frameHeader.channelAssignment, frameHeader.bitsPerSample, frameHeader.blockSize, testSamples1, testSamples2);
-            //do_stupid_float_thing(&random, frameHeader.blockSize, testSamples2); // TODO(michiel): TEMP
-            //f32_the_floats(frameHeader.blockSize, testSamples2, testSamplesF); // TODO(michiel): TEMP
-            u32 totalCount = frameHeader.blockSize * soundDev->channelCount;
-            s32 *source = testSamples2;
-            u32 frameSize = soundDev->sampleCount * soundDev->channelCount;
-            while (totalCount >= frameSize)
+            if (output.ok && !stopped && current->valid &&
+                ((current->info->sampleRate != soundDev->sampleFrequency) ||
+                 (current->info->channelCount != soundDev->channelCount)))
             {
-                if (platform_sound_write(soundDev, source))
-                    //if (platform_sound_write(soundDev, testSamplesF)) // TODO(michiel): TEMP
-                {
-                    //fprintf(stderr, "A one frame\n");
-                    source += frameSize;
-                    totalCount -= frameSize;
-                }
-                else
+                // NOTE(michiel): Only a format change forces a gap
+                flush_sound_output(&output);
+                soundDev->sampleFrequency = current->info->sampleRate;
+                soundDev->channelCount = current->info->channelCount;
+                output.ok = platform_sound_reformat(soundDev);
+                if (!output.ok)
                 {
-                    fprintf(stderr, "Sound write failed:\n    ");
+                    fprintf(stderr, "Sound reformat failed:\n    ");
                     fprintf(stderr, "%.*s\n\n", STR_FMT(platform_sound_error_string(soundDev)));
-                    break;
                 }
             }
-            
-            if (totalCount)
-            {
-                // NOTE(michiel): Was an error writing to device
-                fprintf(stderr, "Buffer is not a multiple of the sound period size\n");
-                break;
-            }
         }
+        
+        flush_sound_output(&output);
+        print_flac_errors();
     }
     else
     {
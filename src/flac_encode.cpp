@@ -0,0 +1,279 @@
+#include "../libberdip/platform.h"
+#include "../libberdip/bitstreamer.h"
+#include "../libberdip/random.h"
+#include "../libberdip/linux_memory.h"
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <math.h>
+#include <pthread.h>
+#include <x86intrin.h>
+
+#include "wav.h"
+
+global API api;
+global MemoryAPI *gMemoryApi = &api.memory;
+
+#ifndef FLAC_DEBUG_LEVEL
+#define FLAC_DEBUG_LEVEL  0
+#endif
+
+#include "flac.h"
+#include "flac_encoder.h"
+#include "md5.h"
+
+#include "../libberdip/memory.cpp"
+#include "../libberdip/linux_memory.cpp"
+#include "../libberdip/linux_file.c"
+#include "../libberdip/crc.cpp"
+
+#include "../libberdip/bitstreamer.cpp"
+#include "flac.cpp"
+#include "flac_encoder.cpp"
+#include "md5.cpp"
+#include "wav.cpp"
+
+internal void
+print_usage(char *program)
+{
+    fprintf(stderr, "Usage: %s [options] <input.wav> <output.flac>\n"
+            "  -b | --block-size <n>       Samples per frame (default 4096)\n"
+            "  -l | --lpc-order <n>        Maximum LPC order, 0 disables LPC (default 8, max %u)\n"
+            "  -p | --partition-order <n>  Maximum rice partition order (default 6, max %u)\n"
+            "  -e | --exhaustive           Try every LPC order instead of the estimated best one\n"
+            "  -j | --threads <n>          Number of encoder threads (default: all cores)\n"
+            "  -v | --verify               Decode every frame again and compare with the input\n",
+            program, FLAC_MAX_LPC_ORDER, FLAC_MAX_PARTITION_ORDER);
+}
+
+internal void
+update_md5_signature(Md5Context *context, FlacEncoder *encoder, u32 batchStart, u32 batchEnd,
+                     s32 **channelSamples, u8 *packed)
+{
+    // NOTE(michiel): Loads the frames again like the encoder does, so the bits per sample shift and the
+    // unsigned 8 bit flip are applied, and hashes them packed as the signature wants them.
+    // Expects channelSamples[channelCount][blockSize] and packed[blockSize * channelCount * 4].
+    for (u32 frameIndex = batchStart; frameIndex < batchEnd; ++frameIndex)
+    {
+        u32 count = load_frame_samples(encoder, frameIndex, channelSamples);
+        umm byteCount = pack_signature_samples(encoder, count, channelSamples, packed);
+        md5_update(context, byteCount, packed);
+    }
+}
+
+s32 main(s32 argc, char **argv)
+{
+    linux_memory_api(&api.memory);
+    linux_file_api(&api.file);
+    
+    MemoryAllocator platformAlloc = {};
+    initialize_platform_allocator(0, &platformAlloc);
+    
+    FlacEncodeSettings settings = {};
+    settings.blockSize = 4096;
+    settings.maxLpcOrder = 8;
+    settings.maxPartitionOrder = 6;
+    settings.stereoDecorrelation = true;
+    settings.threadCount = (u32)maximum(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+    b32 verify = false;
+    
+    String inputFile = {};
+    String outputFile = {};
+    b32 badArguments = false;
+    
+    s32 index = 1;
+    while (index < argc)
+    {
+        String arg = string(argv[index++]);
+        if (((arg == string("--block-size")) || (arg == string("-b"))) && (index < argc))
+        {
+            settings.blockSize = number_from_string(string(argv[index++]));
+        }
+        else if (((arg == string("--lpc-order")) || (arg == string("-l"))) && (index < argc))
+        {
+            settings.maxLpcOrder = number_from_string(string(argv[index++]));
+        }
+        else if (((arg == string("--partition-order")) || (arg == string("-p"))) && (index < argc))
+        {
+            settings.maxPartitionOrder = number_from_string(string(argv[index++]));
+        }
+        else if ((arg == string("--exhaustive")) || (arg == string("-e")))
+        {
+            settings.exhaustiveLpc = true;
+        }
+        else if (((arg == string("--threads")) || (arg == string("-j"))) && (index < argc))
+        {
+            settings.threadCount = number_from_string(string(argv[index++]));
+        }
+        else if ((arg == string("--verify")) || (arg == string("-v")))
+        {
+            verify = true;
+        }
+        else if (!inputFile.size)
+        {
+            inputFile = arg;
+        }
+        else if (!outputFile.size)
+        {
+            outputFile = arg;
+        }
+        else
+        {
+            badArguments = true;
+        }
+    }
+    
+    if (badArguments || !inputFile.size || !outputFile.size ||
+        (settings.blockSize < 16) || (settings.blockSize > 65535) ||
+        (settings.maxLpcOrder > FLAC_MAX_LPC_ORDER) ||
+        (settings.maxPartitionOrder > FLAC_MAX_PARTITION_ORDER) ||
+        (settings.threadCount == 0))
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    WavReader reader = wav_load_file(inputFile);
+    WavSettings *wavSettings = &reader.settings;
+    if (!reader.dataCount)
+    {
+        fprintf(stderr, "Could not load '%.*s'\n", STR_FMT(inputFile));
+        return 1;
+    }
+    
+    u32 sampleBytes = wavSettings->channelCount ? wavSettings->sampleFrameSize / wavSettings->channelCount : 0;
+    if ((wavSettings->format != WavFormat_PCM) ||
+        (wavSettings->channelCount == 0) || (wavSettings->channelCount > FLAC_MAX_CHANNELS) ||
+        (wavSettings->sampleResolution < 4) || (wavSettings->sampleResolution > 24) ||
+        (sampleBytes == 0) || (sampleBytes > 4) || ((sampleBytes * 8) < wavSettings->sampleResolution) ||
+        (wavSettings->sampleFrequency == 0) || (wavSettings->sampleFrequency > 655350))
+    {
+        // TODO(michiel): 32 bit and float input
+        fprintf(stderr, "Unsupported wav format: %u channels, %u bits, %u Hz, format 0x%04X\n",
+                wavSettings->channelCount, wavSettings->sampleResolution,
+                wavSettings->sampleFrequency, wavSettings->format);
+        return 1;
+    }
+    
+    FlacEncoder encoder = {};
+    encoder.settings = settings;
+    encoder.info.sampleRate = wavSettings->sampleFrequency;
+    encoder.info.channelCount = wavSettings->channelCount;
+    encoder.info.bitsPerSample = wavSettings->sampleResolution;
+    encoder.input = reader.rawData.data + reader.dataOffset;
+    encoder.inputSampleBytes = sampleBytes;
+    encoder.inputUnsigned = (sampleBytes == 1);
+    encoder.totalSamples = reader.dataCount / wavSettings->sampleFrameSize;
+    init_flac_encoder(&platformAlloc, &encoder);
+    
+    fprintf(stdout, "Encoding '%.*s' -> '%.*s'\n", STR_FMT(inputFile), STR_FMT(outputFile));
+    fprintf(stdout, "  %u channels, %u bits, %u Hz, %lu samples in %u frames, %u threads\n",
+            encoder.info.channelCount, encoder.info.bitsPerSample, encoder.info.sampleRate,
+            encoder.totalSamples, encoder.frameCount, encoder.threadCount);
+    
+    ApiFile output = api.file.open_file(outputFile, FileOpen_Write);
+    
+    // NOTE(michiel): Stream info is written again at the end, with the frame sizes and signature filled in
+    u8 headerData[64];
+    FlacBitWriter headerWriter = create_bitwriter({sizeof(headerData), headerData});
+    put_stream_info(&headerWriter, &encoder.info, true);
+    api.file.write_to_file(&output, headerWriter.at - headerWriter.start, headerData);
+    
+    s32 *decoded = 0;
+    s32 *interleaved = 0;
+    s32 *residualScratch = 0;
+    s32 *expected[FLAC_MAX_CHANNELS] = {};
+    if (verify)
+    {
+        decoded = allocate_array(&platformAlloc, s32, encoder.info.channelCount * settings.blockSize, default_memory_alloc());
+        interleaved = allocate_array(&platformAlloc, s32, encoder.info.channelCount * settings.blockSize, default_memory_alloc());
+        residualScratch = allocate_array(&platformAlloc, s32, settings.blockSize, default_memory_alloc());
+        for (u32 channelIdx = 0; channelIdx < encoder.info.channelCount; ++channelIdx)
+        {
+            expected[channelIdx] = allocate_array(&platformAlloc, s32, settings.blockSize, default_memory_alloc());
+        }
+    }
+    
+    s32 *md5Samples[FLAC_MAX_CHANNELS] = {};
+    for (u32 channelIdx = 0; channelIdx < encoder.info.channelCount; ++channelIdx)
+    {
+        md5Samples[channelIdx] = allocate_array(&platformAlloc, s32, settings.blockSize, default_memory_alloc());
+    }
+    u8 *md5Packed = allocate_array(&platformAlloc, u8, settings.blockSize * encoder.info.channelCount * 4, default_memory_alloc());
+    
+    Md5Context md5 = md5_init();
+    u32 minFrameBytes = U32_MAX;
+    u32 maxFrameBytes = 0;
+    u64 totalBytes = headerWriter.at - headerWriter.start;
+    u32 verifyErrors = 0;
+    
+    struct timespec startTime;
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    
+    for (u32 batchStart = 0; batchStart < encoder.frameCount; batchStart += encoder.batchFrameCount)
+    {
+        u32 batchEnd = minimum(batchStart + encoder.batchFrameCount, encoder.frameCount);
+        encode_flac_batch(&encoder, batchStart, batchEnd);
+        
+        for (u32 frameIndex = batchStart; frameIndex < batchEnd; ++frameIndex)
+        {
+            FlacEncodedFrame *frame = encoder.batchFrames + (frameIndex - batchStart);
+            if (verify && !verify_flac_frame(&encoder, frameIndex, frame, decoded, interleaved, residualScratch, expected))
+            {
+                ++verifyErrors;
+            }
+            
+            api.file.write_to_file(&output, frame->byteCount, frame->data.data);
+            minFrameBytes = minimum(minFrameBytes, (u32)frame->byteCount);
+            maxFrameBytes = maximum(maxFrameBytes, (u32)frame->byteCount);
+            totalBytes += frame->byteCount;
+        }
+        
+        update_md5_signature(&md5, &encoder, batchStart, batchEnd, md5Samples, md5Packed);
+    }
+    
+    struct timespec endTime;
+    clock_gettime(CLOCK_MONOTONIC, &endTime);
+    f64 seconds = (f64)(endTime.tv_sec - startTime.tv_sec) + 1.0e-9 * (f64)(endTime.tv_nsec - startTime.tv_nsec);
+    
+    Md5Digest digest = md5_final(&md5);
+    encoder.info.md5signature.high = 0;
+    encoder.info.md5signature.low = 0;
+    for (u32 byteIdx = 0; byteIdx < 8; ++byteIdx)
+    {
+        encoder.info.md5signature.high = (encoder.info.md5signature.high << 8) | digest.bytes[byteIdx];
+        encoder.info.md5signature.low = (encoder.info.md5signature.low << 8) | digest.bytes[byteIdx + 8];
+    }
+    if (encoder.frameCount)
+    {
+        encoder.info.minFrameBytes = minFrameBytes;
+        encoder.info.maxFrameBytes = maxFrameBytes;
+    }
+    
+    headerWriter = create_bitwriter({sizeof(headerData), headerData});
+    put_stream_info(&headerWriter, &encoder.info, true);
+    api.file.set_file_position(&output, 0, FileCursor_StartOfFile);
+    api.file.write_to_file(&output, headerWriter.at - headerWriter.start, headerData);
+    api.file.close_file(&output);
+    
+    f64 audioSeconds = (f64)encoder.totalSamples / (f64)encoder.info.sampleRate;
+    fprintf(stdout, "  %lu -> %lu bytes (%.1f%%), %.3f seconds, %.1fx realtime\n",
+            (u64)reader.dataCount, totalBytes, 100.0 * (f64)totalBytes / (f64)maximum(reader.dataCount, 1u),
+            seconds, (seconds > 0.0) ? audioSeconds / seconds : 0.0);
+    wav_close_file(&reader);
+    
+    if (verify)
+    {
+        if (verifyErrors)
+        {
+            fprintf(stderr, "  Verification failed for %u frames\n", verifyErrors);
+            return 1;
+        }
+        fprintf(stdout, "  Verified %u frames\n", encoder.frameCount);
+    }
+    
+    return 0;
+}
@@ -0,0 +1,245 @@
+#include "../libberdip/platform.h"
+#include "../libberdip/bitstreamer.h"
+#include "../libberdip/random.h"
+#include "../libberdip/linux_memory.h"
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <math.h>
+#include <pthread.h>
+#include <x86intrin.h>
+
+#include "wav.h"
+
+global API api;
+global MemoryAPI *gMemoryApi = &api.memory;
+
+#ifndef FLAC_DEBUG_LEVEL
+#define FLAC_DEBUG_LEVEL  0
+#endif
+
+#include "flac.h"
+#include "flac_encoder.h"
+#include "md5.h"
+
+#include "../libberdip/memory.cpp"
+#include "../libberdip/linux_memory.cpp"
+#include "../libberdip/linux_file.c"
+#include "../libberdip/crc.cpp"
+
+#include "../libberdip/bitstreamer.cpp"
+#include "flac.cpp"
+#include "flac_encoder.cpp"
+#include "md5.cpp"
+
+// NOTE(michiel): Encodes generated signals and decodes every frame again. Ramps and DC leave residuals of
+// only 0 and -1, which end up in escaped partitions.
+// The MD5 signature is checked against digests made outside of this code, for inputs where the wav
+// container is larger than the samples.
+
+enum FlacTestSignal
+{
+    FlacTestSignal_FallingRamp,
+    FlacTestSignal_RisingRamp,
+    FlacTestSignal_MinusOne,
+    FlacTestSignal_Noise,
+    
+    FlacTestSignal_Count,
+};
+
+global char *gFlacTestSignalNames[FlacTestSignal_Count] =
+{
+    "falling ramp",
+    "rising ramp",
+    "dc -1",
+    "noise",
+};
+
+internal s32
+flac_test_sample(FlacTestSignal signal, RandomSeriesPCG *random, u32 bitsPerSample, u32 index, u32 channelIdx)
+{
+    s32 maxValue = (1 << (bitsPerSample - 1)) - 1;
+    s32 result = 0;
+    switch (signal)
+    {
+        case FlacTestSignal_FallingRamp: { result = maxValue - (s32)((index + channelIdx) % (2 * (u32)maxValue)); } break;
+        case FlacTestSignal_RisingRamp:  { result = (s32)((index + channelIdx) % (2 * (u32)maxValue)) - maxValue; } break;
+        case FlacTestSignal_MinusOne:    { result = -1; } break;
+        case FlacTestSignal_Noise:       { result = (s32)(random_next_u32(random) % 5) - 2; } break;
+        INVALID_DEFAULT_CASE;
+    }
+    return result;
+}
+
+internal b32
+test_flac_signal(MemoryAllocator *allocator, FlacTestSignal signal, u32 channelCount, u32 bitsPerSample,
+                 u32 sampleCount)
+{
+    RandomSeriesPCG random = random_seed_pcg(5432198765ULL, 1234567891ULL);
+    u32 sampleBytes = (bitsPerSample + 7) / 8;
+    u8 *input = (u8 *)allocate_size(allocator, (umm)sampleCount * channelCount * sampleBytes, default_memory_alloc());
+    u8 *dest = input;
+    for (u32 index = 0; index < sampleCount; ++index)
+    {
+        for (u32 channelIdx = 0; channelIdx < channelCount; ++channelIdx)
+        {
+            s32 sample = flac_test_sample(signal, &random, bitsPerSample, index, channelIdx);
+            if (sampleBytes == 1)
+            {
+                // NOTE(michiel): 8 bit wav data is unsigned
+                sample += 0x80;
+            }
+            for (u32 byteIdx = 0; byteIdx < sampleBytes; ++byteIdx)
+            {
+                *dest++ = (u8)(((u32)sample << (32 - 8 * sampleBytes)) >> (32 - 8 * (sampleBytes - byteIdx)));
+            }
+        }
+    }
+    
+    FlacEncoder encoder = {};
+    encoder.settings.blockSize = 4096;
+    encoder.settings.maxLpcOrder = 8;
+    encoder.settings.maxPartitionOrder = 6;
+    encoder.settings.stereoDecorrelation = true;
+    encoder.settings.threadCount = 1;
+    encoder.info.sampleRate = 44100;
+    encoder.info.channelCount = channelCount;
+    encoder.info.bitsPerSample = bitsPerSample;
+    encoder.input = input;
+    encoder.inputSampleBytes = sampleBytes;
+    encoder.inputUnsigned = (sampleBytes == 1);
+    encoder.totalSamples = sampleCount;
+    init_flac_encoder(allocator, &encoder);
+    
+    u32 blockSize = encoder.settings.blockSize;
+    s32 *decoded = allocate_array(allocator, s32, channelCount * blockSize, default_memory_alloc());
+    s32 *interleaved = allocate_array(allocator, s32, channelCount * blockSize, default_memory_alloc());
+    s32 *residualScratch = allocate_array(allocator, s32, blockSize, default_memory_alloc());
+    s32 *expected[FLAC_MAX_CHANNELS] = {};
+    for (u32 channelIdx = 0; channelIdx < channelCount; ++channelIdx)
+    {
+        expected[channelIdx] = allocate_array(allocator, s32, blockSize, default_memory_alloc());
+    }
+    
+    u32 failedFrames = 0;
+    for (u32 batchStart = 0; batchStart < encoder.frameCount; batchStart += encoder.batchFrameCount)
+    {
+        u32 batchEnd = minimum(batchStart + encoder.batchFrameCount, encoder.frameCount);
+        encode_flac_batch(&encoder, batchStart, batchEnd);
+        for (u32 frameIndex = batchStart; frameIndex < batchEnd; ++frameIndex)
+        {
+            FlacEncodedFrame *frame = encoder.batchFrames + (frameIndex - batchStart);
+            if (!verify_flac_frame(&encoder, frameIndex, frame, decoded, interleaved, residualScratch, expected))
+            {
+                ++failedFrames;
+            }
+        }
+    }
+    
+    fprintf(stdout, "%-12s %uch %2ubit: %s (%u of %u frames failed)\n", gFlacTestSignalNames[signal],
+            channelCount, bitsPerSample, failedFrames ? "FAIL" : "ok", failedFrames, encoder.frameCount);
+    return failedFrames == 0;
+}
+
+internal b32
+test_flac_signature(MemoryAllocator *allocator, u32 containerBytes, u32 bitsPerSample, char *expectedDigest)
+{
+    // NOTE(michiel): A stereo rising ramp, left justified in the container as wav extensible stores it
+    u32 channelCount = 2;
+    u32 sampleCount = 10000;
+    u8 *input = (u8 *)allocate_size(allocator, (umm)sampleCount * channelCount * containerBytes, default_memory_alloc());
+    u8 *dest = input;
+    for (u32 index = 0; index < sampleCount; ++index)
+    {
+        for (u32 channelIdx = 0; channelIdx < channelCount; ++channelIdx)
+        {
+            s32 sample = flac_test_sample(FlacTestSignal_RisingRamp, 0, bitsPerSample, index, channelIdx);
+            u32 value = (u32)sample << (8 * containerBytes - bitsPerSample);
+            for (u32 byteIdx = 0; byteIdx < containerBytes; ++byteIdx)
+            {
+                *dest++ = (u8)(value >> (8 * byteIdx));
+            }
+        }
+    }
+    
+    FlacEncoder encoder = {};
+    encoder.settings.blockSize = 4096;
+    encoder.settings.maxLpcOrder = 8;
+    encoder.settings.maxPartitionOrder = 6;
+    encoder.settings.threadCount = 1;
+    encoder.info.sampleRate = 44100;
+    encoder.info.channelCount = channelCount;
+    encoder.info.bitsPerSample = bitsPerSample;
+    encoder.input = input;
+    encoder.inputSampleBytes = containerBytes;
+    encoder.totalSamples = sampleCount;
+    init_flac_encoder(allocator, &encoder);
+    
+    // NOTE(michiel): The same steps as update_md5_signature in flac_encode.cpp
+    u32 blockSize = encoder.settings.blockSize;
+    s32 *channelSamples[FLAC_MAX_CHANNELS] = {};
+    for (u32 channelIdx = 0; channelIdx < channelCount; ++channelIdx)
+    {
+        channelSamples[channelIdx] = allocate_array(allocator, s32, blockSize, default_memory_alloc());
+    }
+    u8 *packed = allocate_array(allocator, u8, blockSize * channelCount * 4, default_memory_alloc());
+    
+    Md5Context md5 = md5_init();
+    for (u32 frameIndex = 0; frameIndex < encoder.frameCount; ++frameIndex)
+    {
+        u32 count = load_frame_samples(&encoder, frameIndex, channelSamples);
+        umm byteCount = pack_signature_samples(&encoder, count, channelSamples, packed);
+        md5_update(&md5, byteCount, packed);
+    }
+    Md5Digest digest = md5_final(&md5);
+    
+    char digestText[33];
+    for (u32 byteIdx = 0; byteIdx < 16; ++byteIdx)
+    {
+        snprintf(digestText + 2 * byteIdx, 3, "%02x", digest.bytes[byteIdx]);
+    }
+    b32 result = strcmp(digestText, expectedDigest) == 0;
+    fprintf(stdout, "md5 %2u in %2u bit: %s (%s, expected %s)\n", bitsPerSample, 8 * containerBytes,
+            result ? "ok" : "FAIL", digestText, expectedDigest);
+    return result;
+}
+
+s32 main(s32 argc, char **argv)
+{
+    linux_memory_api(&api.memory);
+    linux_file_api(&api.file);
+    
+    MemoryAllocator platformAlloc = {};
+    initialize_platform_allocator(0, &platformAlloc);
+    
+    u32 bitDepths[] = {8, 16, 24};
+    u32 failures = 0;
+    for (u32 signal = 0; signal < FlacTestSignal_Count; ++signal)
+    {
+        for (u32 depthIdx = 0; depthIdx < array_count(bitDepths); ++depthIdx)
+        {
+            for (u32 channelCount = 1; channelCount <= 2; ++channelCount)
+            {
+                if (!test_flac_signal(&platformAlloc, (FlacTestSignal)signal, channelCount, bitDepths[depthIdx], 50000))
+                {
+                    ++failures;
+                }
+            }
+        }
+    }
+    
+    // NOTE(michiel): Digests of the right justified samples, made with Python's hashlib
+    if (!test_flac_signature(&platformAlloc, 4, 24, "8ab65519ed895eff2410bf8ce99e1bae"))
+    {
+        ++failures;
+    }
+    if (!test_flac_signature(&platformAlloc, 3, 20, "d5e59920905bc46d311c288325d060a0"))
+    {
+        ++failures;
+    }
+    
+    return failures ? 1 : 0;
+}
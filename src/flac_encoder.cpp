@@ -0,0 +1,1136 @@
+//
+// NOTE(michiel): Bit writer
+//
+
+internal FlacBitWriter
+create_bitwriter(Buffer output)
+{
+    FlacBitWriter result = {};
+    result.start = output.data;
+    result.at = output.data;
+    result.end = output.data + output.size;
+    return result;
+}
+
+internal void
+put_bits(FlacBitWriter *writer, u32 bitCount, u64 value)
+{
+    i_expect(bitCount <= 32);
+    if (bitCount)
+    {
+        writer->bitBuffer = (writer->bitBuffer << bitCount) | (value & ((1ULL << bitCount) - 1));
+        writer->bitCount += bitCount;
+        while (writer->bitCount >= 8)
+        {
+            i_expect(writer->at < writer->end);
+            writer->bitCount -= 8;
+            *writer->at++ = (u8)(writer->bitBuffer >> writer->bitCount);
+        }
+    }
+}
+
+internal void
+put_signed(FlacBitWriter *writer, u32 bitCount, s32 value)
+{
+    put_bits(writer, bitCount, (u32)value);
+}
+
+internal void
+put_rice(FlacBitWriter *writer, u32 riceParameter, s32 value)
+{
+    u32 folded = ((u32)value << 1) ^ (u32)(value >> 31);
+    u32 q = folded >> riceParameter;
+    while (q >= 32)
+    {
+        put_bits(writer, 32, 0);
+        q -= 32;
+    }
+    put_bits(writer, q + 1, 1);
+    put_bits(writer, riceParameter, folded);
+}
+
+internal void
+align_bitwriter(FlacBitWriter *writer)
+{
+    if (writer->bitCount)
+    {
+        put_bits(writer, 8 - writer->bitCount, 0);
+    }
+}
+
+internal void
+put_utf8_number(FlacBitWriter *writer, u64 number)
+{
+    if (number < 0x80)
+    {
+        put_bits(writer, 8, number);
+    }
+    else
+    {
+        u32 extraBytes = 1;
+        while ((extraBytes < 6) && (number >= (1ULL << (6 * extraBytes + 6 - extraBytes))))
+        {
+            ++extraBytes;
+        }
+        u32 leadMarker = (0xFF00 >> (extraBytes + 1)) & 0xFF;
+        put_bits(writer, 8, leadMarker | (number >> (6 * extraBytes)));
+        for (u32 byteIdx = extraBytes; byteIdx > 0; --byteIdx)
+        {
+            put_bits(writer, 8, 0x80 | ((number >> (6 * (byteIdx - 1))) & 0x3F));
+        }
+    }
+}
+
+//
+// NOTE(michiel): Residual coding
+//
+
+internal u32
+rice_parameter_for_sum(u64 sum, u32 count, u32 maxParameter, u64 *bitCount)
+{
+    // NOTE(michiel): (sum >> k) is an upper bound for the sum of all (folded >> k), so the estimate
+    // never undershoots the real size.
+    u32 result = 0;
+    u64 bestBits = (u64)count + sum;
+    if (count)
+    {
+        u64 mean = sum / count;
+        BitScanResult msb = find_most_significant_set_bit((u32)minimum(mean, (u64)U32_MAX));
+        u32 guess = msb.found ? msb.index : 0;
+        u32 first = (guess > 0) ? guess - 1 : 0;
+        u32 last = minimum(guess + 1, maxParameter);
+        for (u32 parameter = first; parameter <= last; ++parameter)
+        {
+            u64 bits = (u64)count * (parameter + 1) + (sum >> parameter);
+            if (bits < bestBits)
+            {
+                bestBits = bits;
+                result = parameter;
+            }
+        }
+    }
+    else
+    {
+        bestBits = 0;
+    }
+    *bitCount = bestBits;
+    return result;
+}
+
+internal u32
+signed_bit_width(s32 value)
+{
+    // NOTE(michiel): Bits for value as two's complement, -1 needs 1 and 0 needs none
+    u32 result = 0;
+    if (value)
+    {
+        BitScanResult msb = find_most_significant_set_bit((u32)(value ^ (value >> 31)));
+        result = msb.found ? msb.index + 2 : 1;
+    }
+    return result;
+}
+
+internal u64
+choose_residual_coding(FlacEncodeSettings *settings, FlacEncodeScratch *scratch, s32 *residual,
+                       u32 blockSize, u32 order, FlacSubframeEncoding *encoding)
+{
+    // NOTE(michiel): residual[blockSize - order]. Sums are kept as a binary tree (node n has children
+    // 2n and 2n + 1), so every lower partition order is just a sum of the level below.
+    u32 maxOrder = settings->maxPartitionOrder;
+    while (maxOrder && ((((blockSize >> maxOrder) << maxOrder) != blockSize) ||
+                        ((blockSize >> maxOrder) <= order)))
+    {
+        --maxOrder;
+    }
+    
+    u64 *sums = scratch->partitionSums;
+    s32 *minimums = scratch->partitionMinimums;
+    s32 *maximums = scratch->partitionMaximums;
+    u32 partitionCount = 1 << maxOrder;
+    u32 partitionSize = blockSize >> maxOrder;
+    s32 *source = residual;
+    for (u32 partitionIdx = 0; partitionIdx < partitionCount; ++partitionIdx)
+    {
+        u32 count = (partitionIdx == 0) ? partitionSize - order : partitionSize;
+        u64 sum = 0;
+        s32 lowest = 0;
+        s32 highest = 0;
+        for (u32 index = 0; index < count; ++index)
+        {
+            s32 value = *source++;
+            sum += ((u32)value << 1) ^ (u32)(value >> 31);
+            lowest = minimum(lowest, value);
+            highest = maximum(highest, value);
+        }
+        sums[partitionCount + partitionIdx] = sum;
+        minimums[partitionCount + partitionIdx] = lowest;
+        maximums[partitionCount + partitionIdx] = highest;
+    }
+    for (u32 node = partitionCount - 1; node > 0; --node)
+    {
+        sums[node] = sums[2 * node] + sums[2 * node + 1];
+        minimums[node] = minimum(minimums[2 * node], minimums[2 * node + 1]);
+        maximums[node] = maximum(maximums[2 * node], maximums[2 * node + 1]);
+    }
+    
+    u64 result = U64_MAX;
+    for (u32 partitionOrder = 0; partitionOrder <= maxOrder; ++partitionOrder)
+    {
+        u32 count = 1 << partitionOrder;
+        u64 bits = 2 + 4;
+        u32 maxParameter = 0;
+        u8 parameters[1 << FLAC_MAX_PARTITION_ORDER];
+        u8 escapeBits[1 << FLAC_MAX_PARTITION_ORDER];
+        for (u32 partitionIdx = 0; partitionIdx < count; ++partitionIdx)
+        {
+            u32 node = count + partitionIdx;
+            u32 sampleCount = (blockSize >> partitionOrder) - ((partitionIdx == 0) ? order : 0);
+            
+            u64 riceBits;
+            u32 parameter = rice_parameter_for_sum(sums[node], sampleCount, 30, &riceBits);
+            
+            // NOTE(michiel): An escaped partition stores the residual as plain signed values
+            u32 rawBits = maximum(signed_bit_width(minimums[node]), signed_bit_width(maximums[node]));
+            u64 escapedBits = (rawBits <= 31) ? (5 + (u64)sampleCount * rawBits) : U64_MAX;
+            
+            if (escapedBits < riceBits)
+            {
+                parameters[partitionIdx] = 0xFF;
+                escapeBits[partitionIdx] = rawBits;
+                bits += escapedBits;
+            }
+            else
+            {
+                parameters[partitionIdx] = parameter;
+                maxParameter = maximum(maxParameter, parameter);
+                bits += riceBits;
+            }
+        }
+        bits += count * ((maxParameter > 14) ? 5 : 4);
+        
+        if (bits < result)
+        {
+            result = bits;
+            encoding->partitionOrder = partitionOrder;
+            for (u32 partitionIdx = 0; partitionIdx < count; ++partitionIdx)
+            {
+                encoding->riceParameters[partitionIdx] = parameters[partitionIdx];
+                encoding->escapeBits[partitionIdx] = escapeBits[partitionIdx];
+            }
+        }
+    }
+    
+    return result;
+}
+
+internal void
+put_residual_coding(FlacBitWriter *writer, FlacSubframeEncoding *encoding, u32 blockSize, u32 order,
+                    s32 *residual)
+{
+    u32 partitionCount = 1 << encoding->partitionOrder;
+    u32 method = 0;
+    for (u32 partitionIdx = 0; partitionIdx < partitionCount; ++partitionIdx)
+    {
+        if ((encoding->riceParameters[partitionIdx] != 0xFF) &&
+            (encoding->riceParameters[partitionIdx] > 14))
+        {
+            method = 1;
+        }
+    }
+    u32 parameterBits = method ? 5 : 4;
+    u32 escapeCode = method ? 0x1F : 0xF;
+    
+    put_bits(writer, 2, method);
+    put_bits(writer, 4, encoding->partitionOrder);
+    
+    s32 *source = residual;
+    for (u32 partitionIdx = 0; partitionIdx < partitionCount; ++partitionIdx)
+    {
+        u32 count = (blockSize >> encoding->partitionOrder) - ((partitionIdx == 0) ? order : 0);
+        u32 parameter = encoding->riceParameters[partitionIdx];
+        if (parameter == 0xFF)
+        {
+            u32 rawBits = encoding->escapeBits[partitionIdx];
+            put_bits(writer, parameterBits, escapeCode);
+            put_bits(writer, 5, rawBits);
+            if (rawBits)
+            {
+                for (u32 index = 0; index < count; ++index)
+                {
+                    put_signed(writer, rawBits, *source++);
+                }
+            }
+            else
+            {
+                source += count;
+            }
+        }
+        else
+        {
+            put_bits(writer, parameterBits, parameter);
+            for (u32 index = 0; index < count; ++index)
+            {
+                put_rice(writer, parameter, *source++);
+            }
+        }
+    }
+}
+
+//
+// NOTE(michiel): Prediction
+//
+
+internal b32
+compute_fixed_residual(s32 *samples, u32 count, u32 order, s32 *residual)
+{
+    // NOTE(michiel): Returns false if the residual doesn't fit in 32 bits
+    s64 overflow = 0;
+    s32 *dest = residual;
+    switch (order)
+    {
+        case 0:
+        {
+            for (u32 index = 0; index < count; ++index)
+            {
+                *dest++ = samples[index];
+            }
+        } break;
+        
+        case 1:
+        {
+            for (u32 index = 1; index < count; ++index)
+            {
+                s64 value = (s64)samples[index] - samples[index - 1];
+                overflow |= value ^ (s32)value;
+                *dest++ = (s32)value;
+            }
+        } break;
+        
+        case 2:
+        {
+            for (u32 index = 2; index < count; ++index)
+            {
+                s64 value = (s64)samples[index] - 2*(s64)samples[index - 1] + samples[index - 2];
+                overflow |= value ^ (s32)value;
+                *dest++ = (s32)value;
+            }
+        } break;
+        
+        case 3:
+        {
+            for (u32 index = 3; index < count; ++index)
+            {
+                s64 value = (s64)samples[index] - 3*(s64)samples[index - 1] + 3*(s64)samples[index - 2] - samples[index - 3];
+                overflow |= value ^ (s32)value;
+                *dest++ = (s32)value;
+            }
+        } break;
+        
+        case 4:
+        {
+            for (u32 index = 4; index < count; ++index)
+            {
+                s64 value = (s64)samples[index] - 4*(s64)samples[index - 1] + 6*(s64)samples[index - 2] - 4*(s64)samples[index - 3] + samples[index - 4];
+                overflow |= value ^ (s32)value;
+                *dest++ = (s32)value;
+            }
+        } break;
+        
+        INVALID_DEFAULT_CASE;
+    }
+    return overflow == 0;
+}
+
+internal void
+compute_tukey_window(f32 *window, u32 count)
+{
+    // NOTE(michiel): Tukey window with half of the block tapered (p = 0.5)
+    for (u32 index = 0; index < count; ++index)
+    {
+        window[index] = 1.0f;
+    }
+    if (count > 2)
+    {
+        u32 taperCount = (u32)(0.25f * (f32)(count - 1));
+        for (u32 index = 0; index < taperCount; ++index)
+        {
+            f32 value = (f32)(0.5 - 0.5 * cos(F64_PI * (f64)index / (f64)taperCount));
+            window[index] = value;
+            window[count - 1 - index] = value;
+        }
+    }
+}
+
+internal void
+compute_autocorrelation(f64 *windowed, u32 count, u32 maxLag, f64 *autoc)
+{
+    for (u32 lag = 0; lag <= maxLag; ++lag)
+    {
+        f64 sum = 0.0;
+        for (u32 index = lag; index < count; ++index)
+        {
+            sum += windowed[index] * windowed[index - lag];
+        }
+        autoc[lag] = sum;
+    }
+}
+
+internal u32
+compute_lpc_coefficients(f64 *autoc, u32 maxOrder, f64 lpc[FLAC_MAX_LPC_ORDER][FLAC_MAX_LPC_ORDER],
+                         f64 *errors)
+{
+    // NOTE(michiel): Levinson-Durbin recursion, lpc[order - 1] has the coefficients for each order.
+    // Returns the highest order that could be computed.
+    f64 error = autoc[0];
+    f64 working[FLAC_MAX_LPC_ORDER];
+    u32 result = 0;
+    for (u32 orderIdx = 0; (orderIdx < maxOrder) && (error > 0.0); ++orderIdx)
+    {
+        f64 r = -autoc[orderIdx + 1];
+        for (u32 j = 0; j < orderIdx; ++j)
+        {
+            r -= working[j] * autoc[orderIdx - j];
+        }
+        r /= error;
+        
+        working[orderIdx] = r;
+        u32 half = orderIdx >> 1;
+        for (u32 j = 0; j < half; ++j)
+        {
+            f64 temp = working[j];
+            working[j] += r * working[orderIdx - 1 - j];
+            working[orderIdx - 1 - j] += r * temp;
+        }
+        if (orderIdx & 1)
+        {
+            working[half] += working[half] * r;
+        }
+        
+        error *= (1.0 - r * r);
+        for (u32 j = 0; j <= orderIdx; ++j)
+        {
+            lpc[orderIdx][j] = -working[j];
+        }
+        errors[orderIdx] = error;
+        result = orderIdx + 1;
+    }
+    return result;
+}
+
+internal b32
+quantize_lpc_coefficients(f64 *lpc, u32 order, u32 precision, s32 *coefficients, s32 *shift)
+{
+    // NOTE(michiel): Quantize with error feedback, so the rounding errors don't add up
+    b32 result = false;
+    s32 maxValue = (1 << (precision - 1)) - 1;
+    s32 minValue = -(1 << (precision - 1));
+    
+    f64 maxCoefficient = 0.0;
+    for (u32 coefIdx = 0; coefIdx < order; ++coefIdx)
+    {
+        maxCoefficient = maximum(maxCoefficient, fabs(lpc[coefIdx]));
+    }
+    
+    if (maxCoefficient > 0.0)
+    {
+        s32 exponent;
+        frexp(maxCoefficient, &exponent);
+        // NOTE(michiel): One bit of the precision is the sign
+        s32 shiftValue = (s32)precision - 1 - exponent;
+        if (shiftValue > 15)
+        {
+            shiftValue = 15;
+        }
+        
+        if (shiftValue >= 0)
+        {
+            f64 error = 0.0;
+            for (u32 coefIdx = 0; coefIdx < order; ++coefIdx)
+            {
+                error += lpc[coefIdx] * (f64)(1 << shiftValue);
+                s32 value = (s32)lround(error);
+                value = maximum(minValue, minimum(maxValue, value));
+                error -= value;
+                coefficients[coefIdx] = value;
+            }
+            *shift = shiftValue;
+            result = true;
+        }
+    }
+    
+    return result;
+}
+
+internal b32
+compute_lpc_residual(s32 *samples, u32 count, u32 order, s32 *coefficients, s32 shift, s32 *residual)
+{
+    s64 overflow = 0;
+    s32 *dest = residual;
+    for (u32 index = order; index < count; ++index)
+    {
+        s64 prediction = 0;
+        for (u32 coefIdx = 0; coefIdx < order; ++coefIdx)
+        {
+            prediction += (s64)coefficients[coefIdx] * (s64)samples[index - coefIdx - 1];
+        }
+        s64 value = (s64)samples[index] - (prediction >> shift);
+        overflow |= value ^ (s32)value;
+        *dest++ = (s32)value;
+    }
+    return overflow == 0;
+}
+
+internal u32
+default_lpc_precision(u32 bitsPerSample, u32 blockSize)
+{
+    u32 result = 15;
+    if (bitsPerSample <= 16)
+    {
+        if (blockSize <= 192)       { result = 7; }
+        else if (blockSize <= 384)  { result = 8; }
+        else if (blockSize <= 576)  { result = 9; }
+        else if (blockSize <= 1152) { result = 10; }
+        else if (blockSize <= 2304) { result = 11; }
+        else if (blockSize <= 4608) { result = 12; }
+        else                        { result = 13; }
+    }
+    else
+    {
+        if (blockSize <= 384)       { result = 13; }
+        else if (blockSize <= 1152) { result = 14; }
+    }
+    return result;
+}
+
+//
+// NOTE(michiel): Subframes
+//
+
+internal void
+keep_candidate(FlacEncodeScratch *scratch, FlacSubframeEncoding *best, s32 **bestResidual)
+{
+    *best = scratch->candidate;
+    s32 *swap = *bestResidual;
+    *bestResidual = scratch->candidateResidual;
+    scratch->candidateResidual = swap;
+}
+
+internal void
+analyse_subframe(FlacEncodeSettings *settings, FlacEncodeScratch *scratch, s32 *samples, u32 count,
+                 u32 bitsPerSample, FlacSubframeEncoding *best, s32 **bestResidual)
+{
+    // NOTE(michiel): Finds the smallest encoding, samples are shifted in place if there are wasted bits
+    *best = {};
+    
+    b32 isConstant = true;
+    u32 orBits = 0;
+    for (u32 index = 0; index < count; ++index)
+    {
+        isConstant = isConstant && (samples[index] == samples[0]);
+        orBits |= (u32)samples[index];
+    }
+    
+    if (isConstant)
+    {
+        best->header.type = FlacSubframe_Constant;
+        best->bitsPerSample = bitsPerSample;
+        best->bitCount = 8 + bitsPerSample;
+        return;
+    }
+    
+    BitScanResult lsb = find_least_significant_set_bit(orBits);
+    u32 wastedBits = minimum(lsb.index, bitsPerSample - 1);
+    if (wastedBits)
+    {
+        for (u32 index = 0; index < count; ++index)
+        {
+            samples[index] >>= wastedBits;
+        }
+        bitsPerSample -= wastedBits;
+    }
+    u64 headerBits = 8 + wastedBits;
+    
+    best->header.type = FlacSubframe_Verbatim;
+    best->header.wastedBits = wastedBits;
+    best->bitsPerSample = bitsPerSample;
+    best->bitCount = headerBits + (u64)count * bitsPerSample;
+    
+    FlacSubframeEncoding *candidate = &scratch->candidate;
+    u32 maxFixedOrder = minimum(4u, count - 1);
+    for (u32 order = 0; order <= maxFixedOrder; ++order)
+    {
+        if (compute_fixed_residual(samples, count, order, scratch->candidateResidual))
+        {
+            *candidate = *best;
+            candidate->header.type = FlacSubframe_Fixed;
+            candidate->header.typeOrder = order;
+            candidate->bitCount = headerBits + (u64)order * bitsPerSample +
+                choose_residual_coding(settings, scratch, scratch->candidateResidual, count, order, candidate);
+            if (candidate->bitCount < best->bitCount)
+            {
+                keep_candidate(scratch, best, bestResidual);
+            }
+        }
+    }
+    
+    u32 maxLpcOrder = minimum(settings->maxLpcOrder, count - 1);
+    if (maxLpcOrder)
+    {
+        if (scratch->windowCount != count)
+        {
+            compute_tukey_window(scratch->window, count);
+            scratch->windowCount = count;
+        }
+        for (u32 index = 0; index < count; ++index)
+        {
+            scratch->windowed[index] = (f64)samples[index] * (f64)scratch->window[index];
+        }
+        
+        f64 autoc[FLAC_MAX_LPC_ORDER + 1];
+        f64 lpc[FLAC_MAX_LPC_ORDER][FLAC_MAX_LPC_ORDER];
+        f64 errors[FLAC_MAX_LPC_ORDER];
+        compute_autocorrelation(scratch->windowed, count, maxLpcOrder, autoc);
+        maxLpcOrder = compute_lpc_coefficients(autoc, maxLpcOrder, lpc, errors);
+        
+        u32 precision = settings->lpcPrecision ? settings->lpcPrecision : default_lpc_precision(bitsPerSample, count);
+        
+        // NOTE(michiel): Estimate the residual size of every order from the prediction error
+        u32 estimatedOrder = 0;
+        f64 bestEstimate = 0.0;
+        for (u32 order = 1; order <= maxLpcOrder; ++order)
+        {
+            f64 errorPerSample = errors[order - 1] / (f64)count;
+            f64 bitsPerResidual = (errorPerSample > 1.0) ? 0.5 * log2(errorPerSample) : 0.0;
+            f64 estimate = bitsPerResidual * (f64)(count - order) + (f64)(order * (precision + bitsPerSample));
+            if (!estimatedOrder || (estimate < bestEstimate))
+            {
+                bestEstimate = estimate;
+                estimatedOrder = order;
+            }
+        }
+        
+        u32 firstOrder = settings->exhaustiveLpc ? 1 : estimatedOrder;
+        u32 lastOrder = settings->exhaustiveLpc ? maxLpcOrder : estimatedOrder;
+        for (u32 order = firstOrder; order && (order <= lastOrder); ++order)
+        {
+            *candidate = *best;
+            candidate->header.type = FlacSubframe_LPC;
+            candidate->header.typeOrder = order;
+            candidate->lpcPrecision = precision;
+            if (quantize_lpc_coefficients(lpc[order - 1], order, precision, candidate->lpcCoefficients, &candidate->lpcShift) &&
+                compute_lpc_residual(samples, count, order, candidate->lpcCoefficients, candidate->lpcShift, scratch->candidateResidual))
+            {
+                candidate->bitCount = headerBits + (u64)order * bitsPerSample + 4 + 5 + order * precision +
+                    choose_residual_coding(settings, scratch, scratch->candidateResidual, count, order, candidate);
+                if (candidate->bitCount < best->bitCount)
+                {
+                    keep_candidate(scratch, best, bestResidual);
+                }
+            }
+        }
+    }
+}
+
+internal void
+put_subframe(FlacBitWriter *writer, FlacSubframeEncoding *encoding, s32 *samples, u32 count, s32 *residual)
+{
+    u32 bitsPerSample = encoding->bitsPerSample;
+    u32 order = encoding->header.typeOrder;
+    
+    u32 typeCode = 0;
+    switch (encoding->header.type)
+    {
+        case FlacSubframe_Constant: { typeCode = 0; } break;
+        case FlacSubframe_Verbatim: { typeCode = 1; } break;
+        case FlacSubframe_Fixed:    { typeCode = 8 + order; } break;
+        case FlacSubframe_LPC:      { typeCode = 32 + order - 1; } break;
+        INVALID_DEFAULT_CASE;
+    }
+    
+    put_bits(writer, 1, 0);
+    put_bits(writer, 6, typeCode);
+    put_bits(writer, 1, encoding->header.wastedBits ? 1 : 0);
+    if (encoding->header.wastedBits)
+    {
+        // NOTE(michiel): Unary, wastedBits - 1 zeros and a one
+        put_bits(writer, encoding->header.wastedBits, 1);
+    }
+    
+    switch (encoding->header.type)
+    {
+        case FlacSubframe_Constant:
+        {
+            put_signed(writer, bitsPerSample, samples[0]);
+        } break;
+        
+        case FlacSubframe_Verbatim:
+        {
+            for (u32 index = 0; index < count; ++index)
+            {
+                put_signed(writer, bitsPerSample, samples[index]);
+            }
+        } break;
+        
+        case FlacSubframe_Fixed:
+        {
+            for (u32 index = 0; index < order; ++index)
+            {
+                put_signed(writer, bitsPerSample, samples[index]);
+            }
+            put_residual_coding(writer, encoding, count, order, residual);
+        } break;
+        
+        case FlacSubframe_LPC:
+        {
+            for (u32 index = 0; index < order; ++index)
+            {
+                put_signed(writer, bitsPerSample, samples[index]);
+            }
+            put_bits(writer, 4, encoding->lpcPrecision - 1);
+            put_signed(writer, 5, encoding->lpcShift);
+            for (u32 coefIdx = 0; coefIdx < order; ++coefIdx)
+            {
+                put_signed(writer, encoding->lpcPrecision, encoding->lpcCoefficients[coefIdx]);
+            }
+            put_residual_coding(writer, encoding, count, order, residual);
+        } break;
+        
+        INVALID_DEFAULT_CASE;
+    }
+}
+
+//
+// NOTE(michiel): Frames
+//
+
+internal u32
+load_frame_samples(FlacEncoder *encoder, u32 frameIndex, s32 **channelSamples)
+{
+    // NOTE(michiel): Deinterleaves one block of input, returns the number of samples per channel
+    u64 firstSample = (u64)frameIndex * encoder->settings.blockSize;
+    u32 count = (u32)minimum((u64)encoder->settings.blockSize, encoder->totalSamples - firstSample);
+    u32 channelCount = encoder->info.channelCount;
+    u32 sampleBytes = encoder->inputSampleBytes;
+    u32 downShift = 32 - encoder->info.bitsPerSample;
+    u32 signFlip = encoder->inputUnsigned ? 0x80000000 : 0;
+    
+    u8 *source = encoder->input + firstSample * channelCount * sampleBytes;
+    for (u32 index = 0; index < count; ++index)
+    {
+        for (u32 channelIdx = 0; channelIdx < channelCount; ++channelIdx)
+        {
+            // NOTE(michiel): Left align the container, so any container size works the same
+            u32 value = 0;
+            for (u32 byteIdx = 0; byteIdx < sampleBytes; ++byteIdx)
+            {
+                value |= (u32)source[byteIdx] << (32 - 8 * (sampleBytes - byteIdx));
+            }
+            source += sampleBytes;
+            channelSamples[channelIdx][index] = (s32)(value ^ signFlip) >> downShift;
+        }
+    }
+    return count;
+}
+
+internal umm
+pack_signature_samples(FlacEncoder *encoder, u32 count, s32 **channelSamples, u8 *dest)
+{
+    // NOTE(michiel): The MD5 signature covers the interleaved samples, right justified and signed, in
+    // (bitsPerSample + 7) / 8 little endian bytes each. That is not the container layout of the input.
+    // Expects dest[count * channelCount * 4], returns the number of bytes written.
+    u32 channelCount = encoder->info.channelCount;
+    u32 sampleBytes = (encoder->info.bitsPerSample + 7) / 8;
+    u8 *start = dest;
+    for (u32 index = 0; index < count; ++index)
+    {
+        for (u32 channelIdx = 0; channelIdx < channelCount; ++channelIdx)
+        {
+            s32 value = channelSamples[channelIdx][index];
+            for (u32 byteIdx = 0; byteIdx < sampleBytes; ++byteIdx)
+            {
+                *dest++ = (u8)(value >> (8 * byteIdx));
+            }
+        }
+    }
+    return dest - start;
+}
+
+internal void
+put_frame_header(FlacBitWriter *writer, FlacInfo *info, u8 *crc8Table, b32 variableBlocks, u64 number,
+                 u32 blockSize, u32 channelAssignment)
+{
+    // NOTE(michiel): number is the frame number for fixed block sizes, the first sample number otherwise
+    u8 *headerStart = writer->at;
+    i_expect(writer->bitCount == 0);
+    
+    u32 blockSizeCode = 0;
+    switch (blockSize)
+    {
+        case   192: { blockSizeCode = 0x1; } break;
+        case   576: { blockSizeCode = 0x2; } break;
+        case  1152: { blockSizeCode = 0x3; } break;
+        case  2304: { blockSizeCode = 0x4; } break;
+        case  4608: { blockSizeCode = 0x5; } break;
+        case   256: { blockSizeCode = 0x8; } break;
+        case   512: { blockSizeCode = 0x9; } break;
+        case  1024: { blockSizeCode = 0xA; } break;
+        case  2048: { blockSizeCode = 0xB; } break;
+        case  4096: { blockSizeCode = 0xC; } break;
+        case  8192: { blockSizeCode = 0xD; } break;
+        case 16384: { blockSizeCode = 0xE; } break;
+        case 32768: { blockSizeCode = 0xF; } break;
+        default: { blockSizeCode = (blockSize <= 256) ? 0x6 : 0x7; } break;
+    }
+    
+    u32 sampleRate = info->sampleRate;
+    u32 sampleRateCode = 0;
+    switch (sampleRate)
+    {
+        case  88200: { sampleRateCode = 0x1; } break;
+        case 176400: { sampleRateCode = 0x2; } break;
+        case 192000: { sampleRateCode = 0x3; } break;
+        case   8000: { sampleRateCode = 0x4; } break;
+        case  16000: { sampleRateCode = 0x5; } break;
+        case  22050: { sampleRateCode = 0x6; } break;
+        case  24000: { sampleRateCode = 0x7; } break;
+        case  32000: { sampleRateCode = 0x8; } break;
+        case  44100: { sampleRateCode = 0x9; } break;
+        case  48000: { sampleRateCode = 0xA; } break;
+        case  96000: { sampleRateCode = 0xB; } break;
+        default:
+        {
+            if (((sampleRate % 1000) == 0) && ((sampleRate / 1000) < 256))
+            {
+                sampleRateCode = 0xC;
+            }
+            else if (sampleRate < 65536)
+            {
+                sampleRateCode = 0xD;
+            }
+            else if (((sampleRate % 10) == 0) && ((sampleRate / 10) < 65536))
+            {
+                sampleRateCode = 0xE;
+            }
+        } break;
+    }
+    
+    u32 sampleSizeCode = 0;
+    switch (info->bitsPerSample)
+    {
+        case  8: { sampleSizeCode = 1; } break;
+        case 12: { sampleSizeCode = 2; } break;
+        case 16: { sampleSizeCode = 4; } break;
+        case 20: { sampleSizeCode = 5; } break;
+        case 24: { sampleSizeCode = 6; } break;
+        case 32: { sampleSizeCode = 7; } break;
+        default: { sampleSizeCode = 0; } break;
+    }
+    
+    put_bits(writer, 14, 0x3FFE);
+    put_bits(writer, 1, 0);
+    put_bits(writer, 1, variableBlocks ? 1 : 0);
+    put_bits(writer, 4, blockSizeCode);
+    put_bits(writer, 4, sampleRateCode);
+    put_bits(writer, 4, channelAssignment);
+    put_bits(writer, 3, sampleSizeCode);
+    put_bits(writer, 1, 0);
+    put_utf8_number(writer, number);
+    
+    if (blockSizeCode == 0x6)
+    {
+        put_bits(writer, 8, blockSize - 1);
+    }
+    else if (blockSizeCode == 0x7)
+    {
+        put_bits(writer, 16, blockSize - 1);
+    }
+    
+    if (sampleRateCode == 0xC)
+    {
+        put_bits(writer, 8, sampleRate / 1000);
+    }
+    else if (sampleRateCode == 0xD)
+    {
+        put_bits(writer, 16, sampleRate);
+    }
+    else if (sampleRateCode == 0xE)
+    {
+        put_bits(writer, 16, sampleRate / 10);
+    }
+    
+    put_bits(writer, 8, crc8_calc_crc(crc8Table, writer->at - headerStart, headerStart));
+}
+
+internal umm
+encode_flac_frame(FlacEncoder *encoder, FlacEncodeScratch *scratch, u32 frameIndex, Buffer output)
+{
+    FlacEncodeSettings *settings = &encoder->settings;
+    u32 channelCount = encoder->info.channelCount;
+    u32 bitsPerSample = encoder->info.bitsPerSample;
+    s32 **samples = scratch->channelSamples;
+    s32 **residuals = scratch->residuals;
+    FlacSubframeEncoding *encodings = scratch->encodings;
+    
+    u32 count = load_frame_samples(encoder, frameIndex, samples);
+    
+    u32 channelAssignment = channelCount - 1;
+    u32 channelOrder[FLAC_MAX_CHANNELS];
+    for (u32 channelIdx = 0; channelIdx < channelCount; ++channelIdx)
+    {
+        channelOrder[channelIdx] = channelIdx;
+    }
+    
+    if ((channelCount == 2) && settings->stereoDecorrelation)
+    {
+        // NOTE(michiel): Slot 2 is the side channel (one bit larger), slot 3 the mid channel
+        s32 *left = samples[0];
+        s32 *right = samples[1];
+        s32 *side = samples[2];
+        s32 *mid = samples[3];
+        for (u32 index = 0; index < count; ++index)
+        {
+            side[index] = left[index] - right[index];
+            mid[index] = (left[index] + right[index]) >> 1;
+        }
+        
+        analyse_subframe(settings, scratch, left, count, bitsPerSample, encodings + 0, residuals + 0);
+        analyse_subframe(settings, scratch, right, count, bitsPerSample, encodings + 1, residuals + 1);
+        analyse_subframe(settings, scratch, side, count, bitsPerSample + 1, encodings + 2, residuals + 2);
+        analyse_subframe(settings, scratch, mid, count, bitsPerSample, encodings + 3, residuals + 3);
+        
+        u64 leftRight = encodings[0].bitCount + encodings[1].bitCount;
+        u64 leftSide = encodings[0].bitCount + encodings[2].bitCount;
+        u64 sideRight = encodings[2].bitCount + encodings[1].bitCount;
+        u64 midSide = encodings[3].bitCount + encodings[2].bitCount;
+        
+        u64 bestBits = leftRight;
+        if (leftSide < bestBits)
+        {
+            bestBits = leftSide;
+            channelAssignment = FlacChannel_LeftSide;
+            channelOrder[0] = 0;
+            channelOrder[1] = 2;
+        }
+        if (sideRight < bestBits)
+        {
+            bestBits = sideRight;
+            channelAssignment = FlacChannel_SideRight;
+            channelOrder[0] = 2;
+            channelOrder[1] = 1;
+        }
+        if (midSide < bestBits)
+        {
+            bestBits = midSide;
+            channelAssignment = FlacChannel_MidSide;
+            channelOrder[0] = 3;
+            channelOrder[1] = 2;
+        }
+    }
+    else
+    {
+        for (u32 channelIdx = 0; channelIdx < channelCount; ++channelIdx)
+        {
+            analyse_subframe(settings, scratch, samples[channelIdx], count, bitsPerSample,
+                             encodings + channelIdx, residuals + channelIdx);
+        }
+    }
+    
+    FlacBitWriter writer = create_bitwriter(output);
+    put_frame_header(&writer, &encoder->info, encoder->crc8Table, false, frameIndex, count, channelAssignment);
+    for (u32 channelIdx = 0; channelIdx < channelCount; ++channelIdx)
+    {
+        u32 slot = channelOrder[channelIdx];
+        put_subframe(&writer, encodings + slot, samples[slot], count, residuals[slot]);
+    }
+    align_bitwriter(&writer);
+    put_bits(&writer, 16, crc16_calc_crc(encoder->crc16Table, writer.at - writer.start, writer.start));
+    
+    return writer.at - writer.start;
+}
+
+//
+// NOTE(michiel): Encoder
+//
+
+internal void
+init_flac_encoder(MemoryAllocator *allocator, FlacEncoder *encoder)
+{
+    // NOTE(michiel): Expects the settings, info (sample rate, channels, bits per sample) and input to be set
+    FlacEncodeSettings *settings = &encoder->settings;
+    FlacInfo *info = &encoder->info;
+    i_expect((info->channelCount > 0) && (info->channelCount <= FLAC_MAX_CHANNELS));
+    i_expect((info->bitsPerSample >= 4) && (info->bitsPerSample <= 24));
+    i_expect((settings->blockSize >= 16) && (settings->blockSize <= 65535));
+    i_expect(settings->maxLpcOrder <= FLAC_MAX_LPC_ORDER);
+    i_expect(settings->lpcPrecision <= 15);
+    i_expect(settings->maxPartitionOrder <= FLAC_MAX_PARTITION_ORDER);
+    
+    crc8_init_table(0x07, encoder->crc8Table);
+    crc16_init_table(0x8005, encoder->crc16Table);
+    
+    encoder->frameCount = (u32)((encoder->totalSamples + settings->blockSize - 1) / settings->blockSize);
+    info->minBlockSamples = settings->blockSize;
+    info->maxBlockSamples = settings->blockSize;
+    info->totalSamples = encoder->totalSamples;
+    info->minFrameBytes = 0;
+    info->maxFrameBytes = 0;
+    
+    // NOTE(michiel): A subframe is never bigger than verbatim (plus header), the side channel has one extra bit
+    encoder->maxFrameBytes = 16 + 2 + info->channelCount * (8 + ((umm)settings->blockSize * (info->bitsPerSample + 1) + 7) / 8);
+    
+    encoder->threadCount = maximum(settings->threadCount, 1u);
+    encoder->scratches = allocate_array(allocator, FlacEncodeScratch, encoder->threadCount, default_memory_alloc());
+    for (u32 threadIdx = 0; threadIdx < encoder->threadCount; ++threadIdx)
+    {
+        FlacEncodeScratch *scratch = encoder->scratches + threadIdx;
+        scratch->encoder = encoder;
+        u32 slotCount = maximum(info->channelCount, 4u);
+        for (u32 slot = 0; slot < slotCount; ++slot)
+        {
+            scratch->channelSamples[slot] = allocate_array(allocator, s32, settings->blockSize, default_memory_alloc());
+            scratch->residuals[slot] = allocate_array(allocator, s32, settings->blockSize, default_memory_alloc());
+        }
+        scratch->candidateResidual = allocate_array(allocator, s32, settings->blockSize, default_memory_alloc());
+        scratch->windowed = allocate_array(allocator, f64, settings->blockSize, default_memory_alloc());
+        scratch->window = allocate_array(allocator, f32, settings->blockSize, default_memory_alloc());
+    }
+    
+    // NOTE(michiel): Enough frames per batch to keep every thread busy without holding the whole file
+    encoder->batchFrameCount = encoder->threadCount * 16;
+    encoder->batchFrames = allocate_array(allocator, FlacEncodedFrame, encoder->batchFrameCount, default_memory_alloc());
+    for (u32 frameIdx = 0; frameIdx < encoder->batchFrameCount; ++frameIdx)
+    {
+        FlacEncodedFrame *frame = encoder->batchFrames + frameIdx;
+        frame->data.size = encoder->maxFrameBytes;
+        frame->data.data = (u8 *)allocate_size(allocator, encoder->maxFrameBytes, default_memory_alloc());
+    }
+}
+
+internal void *
+flac_encode_worker(void *data)
+{
+    FlacEncodeScratch *scratch = (FlacEncodeScratch *)data;
+    FlacEncoder *encoder = scratch->encoder;
+    for (;;)
+    {
+        u32 frameIndex = __sync_fetch_and_add(&encoder->nextFrame, 1);
+        if (frameIndex >= encoder->batchEnd)
+        {
+            break;
+        }
+        
+        FlacEncodedFrame *frame = encoder->batchFrames + (frameIndex - encoder->batchStart);
+        frame->byteCount = encode_flac_frame(encoder, scratch, frameIndex, frame->data);
+    }
+    return 0;
+}
+
+internal void
+encode_flac_batch(FlacEncoder *encoder, u32 batchStart, u32 batchEnd)
+{
+    // NOTE(michiel): Frames are independent, so every thread just grabs the next one. The calling
+    // thread helps out, the results end up in batchFrames in stream order.
+    i_expect((batchEnd - batchStart) <= encoder->batchFrameCount);
+    encoder->batchStart = batchStart;
+    encoder->batchEnd = batchEnd;
+    encoder->nextFrame = batchStart;
+    
+    pthread_t threads[256];
+    u32 threadCount = 0;
+    u32 helperCount = minimum(encoder->threadCount - 1, minimum(batchEnd - batchStart, (u32)array_count(threads)));
+    for (u32 threadIdx = 0; threadIdx < helperCount; ++threadIdx)
+    {
+        if (pthread_create(threads + threadCount, 0, flac_encode_worker, encoder->scratches + threadIdx + 1) == 0)
+        {
+            ++threadCount;
+        }
+    }
+    
+    flac_encode_worker(encoder->scratches);
+    
+    for (u32 threadIdx = 0; threadIdx < threadCount; ++threadIdx)
+    {
+        pthread_join(threads[threadIdx], 0);
+    }
+}
+
+internal void
+put_stream_info(FlacBitWriter *writer, FlacInfo *info, b32 isLast)
+{
+    put_bits(writer, 8, 'f');
+    put_bits(writer, 8, 'L');
+    put_bits(writer, 8, 'a');
+    put_bits(writer, 8, 'C');
+    
+    put_bits(writer, 1, isLast ? 1 : 0);
+    put_bits(writer, 7, FlacMetadata_StreamInfo);
+    put_bits(writer, 24, 34);
+    
+    put_bits(writer, 16, info->minBlockSamples);
+    put_bits(writer, 16, info->maxBlockSamples);
+    put_bits(writer, 24, info->minFrameBytes);
+    put_bits(writer, 24, info->maxFrameBytes);
+    put_bits(writer, 20, info->sampleRate);
+    put_bits(writer, 3, info->channelCount - 1);
+    put_bits(writer, 5, info->bitsPerSample - 1);
+    put_bits(writer, 4, info->totalSamples >> 32);
+    put_bits(writer, 32, info->totalSamples & 0xFFFFFFFF);
+    put_bits(writer, 32, info->md5signature.high >> 32);
+    put_bits(writer, 32, info->md5signature.high & 0xFFFFFFFF);
+    put_bits(writer, 32, info->md5signature.low >> 32);
+    put_bits(writer, 32, info->md5signature.low & 0xFFFFFFFF);
+}
+
+//
+// NOTE(michiel): Verification
+//
+
+internal b32
+verify_flac_frame(FlacEncoder *encoder, u32 frameIndex, FlacEncodedFrame *frame,
+                  s32 *decoded, s32 *interleaved, s32 *residualScratch, s32 **expected)
+{
+    FlacInfo *info = &encoder->info;
+    BitStreamer bitStream = create_bitstreamer({frame->byteCount, frame->data.data}, BitStream_BigEndian);
+    FlacFrameHeader frameHeader = {};
+    FlacDecodeError error = decode_frame(&bitStream, info, &frameHeader, residualScratch, decoded);
+    
+    b32 result = (error == FlacError_None);
+    if (!result)
+    {
+        fprintf(stderr, "Frame %u does not decode: %s\n", frameIndex, gFlacErrorNames[error]);
+    }
+    else
+    {
+        u32 sampleCount = load_frame_samples(encoder, frameIndex, expected);
+        result = (frameHeader.blockSize == sampleCount) && (frameHeader.frameNumber == frameIndex) &&
+            ((umm)(bitStream.at - frame->data.data) == frame->byteCount);
+        
+        if (result)
+        {
+            // NOTE(michiel): Goes through interleave_samples, so the check covers the stereo
+            // decorrelation and the wasted bits exactly like playback does.
+            interleave_samples(&frameHeader, decoded, interleaved);
+            u32 downShift = 32 - info->bitsPerSample;
+            for (u32 channelIdx = 0; result && (channelIdx < info->channelCount); ++channelIdx)
+            {
+                for (u32 sampleIdx = 0; sampleIdx < sampleCount; ++sampleIdx)
+                {
+                    s32 sample = interleaved[sampleIdx * info->channelCount + channelIdx] >> downShift;
+                    if (sample != expected[channelIdx][sampleIdx])
+                    {
+                        fprintf(stderr, "Frame %u, channel %u, sample %u: got %d, expected %d\n",
+                                frameIndex, channelIdx, sampleIdx, sample, expected[channelIdx][sampleIdx]);
+                        result = false;
+                        break;
+                    }
+                }
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Frame %u has a bad header or size\n", frameIndex);
+        }
+    }
+    
+    return result;
+}
@@ -0,0 +1,96 @@
+// NOTE(michiel): FLAC encoder, fixed block size, up to 8 channels of 4 to 24 bits.
+// Every subframe is tried as constant, verbatim, fixed (order 0-4) and LPC (autocorrelation with a
+// Tukey window, Levinson-Durbin), the smallest one wins. Residuals use the best Rice partition
+// order, with the best parameter (or an escape) per partition.
+
+#define FLAC_MAX_LPC_ORDER        32
+#define FLAC_MAX_PARTITION_ORDER  8
+
+struct FlacBitWriter
+{
+    u8 *start;
+    u8 *at;
+    u8 *end;
+    
+    u64 bitBuffer;
+    u32 bitCount;
+};
+
+struct FlacEncodeSettings
+{
+    u32 blockSize;          // NOTE(michiel): Samples per channel in each frame
+    u32 maxLpcOrder;        // NOTE(michiel): 0 disables LPC, at most FLAC_MAX_LPC_ORDER
+    u32 lpcPrecision;       // NOTE(michiel): Bits per quantized coefficient (max 15), 0 picks one from the block size
+    u32 maxPartitionOrder;  // NOTE(michiel): At most FLAC_MAX_PARTITION_ORDER
+    b32 exhaustiveLpc;      // NOTE(michiel): Try every LPC order, instead of only the one with the best estimate
+    b32 stereoDecorrelation;
+    u32 threadCount;
+};
+
+struct FlacSubframeEncoding
+{
+    FlacSubframeHeader header;
+    u32 bitsPerSample;      // NOTE(michiel): Of the subframe, after removing the wasted bits
+    u64 bitCount;           // NOTE(michiel): Size of the complete subframe
+    
+    u32 lpcPrecision;
+    s32 lpcShift;
+    s32 lpcCoefficients[FLAC_MAX_LPC_ORDER];
+    
+    u32 partitionOrder;
+    u8 riceParameters[1 << FLAC_MAX_PARTITION_ORDER];
+    u8 escapeBits[1 << FLAC_MAX_PARTITION_ORDER];   // NOTE(michiel): Only used for escaped partitions
+};
+
+struct FlacEncodeScratch
+{
+    // NOTE(michiel): Per thread, sized for one block
+    s32 *channelSamples[FLAC_MAX_CHANNELS + 2];  // NOTE(michiel): Extra two for the side and mid channel
+    s32 *residuals[FLAC_MAX_CHANNELS + 2];       // NOTE(michiel): Residual of the best encoding per channel
+    s32 *candidateResidual;
+    f64 *windowed;
+    f32 *window;
+    u32 windowCount;        // NOTE(michiel): Block size the window was computed for
+    
+    FlacSubframeEncoding encodings[FLAC_MAX_CHANNELS + 2];
+    FlacSubframeEncoding candidate;
+    
+    u64 partitionSums[2 << FLAC_MAX_PARTITION_ORDER];
+    s32 partitionMinimums[2 << FLAC_MAX_PARTITION_ORDER];
+    s32 partitionMaximums[2 << FLAC_MAX_PARTITION_ORDER];
+    
+    struct FlacEncoder *encoder;
+};
+
+struct FlacEncodedFrame
+{
+    Buffer data;            // NOTE(michiel): data.size is the capacity, byteCount the used part
+    umm byteCount;
+};
+
+struct FlacEncoder
+{
+    FlacEncodeSettings settings;
+    FlacInfo info;
+    
+    // NOTE(michiel): Interleaved little endian input, as found in a wav data chunk
+    u8 *input;
+    u32 inputSampleBytes;   // NOTE(michiel): Container bytes per sample
+    b32 inputUnsigned;      // NOTE(michiel): 8 bit wav data is unsigned
+    u64 totalSamples;
+    u32 frameCount;
+    
+    // NOTE(michiel): Frames [batchStart, batchEnd) are encoded by all threads together
+    u32 batchStart;
+    u32 batchEnd;
+    volatile u32 nextFrame;
+    FlacEncodedFrame *batchFrames;
+    u32 batchFrameCount;
+    umm maxFrameBytes;
+    
+    u32 threadCount;
+    FlacEncodeScratch *scratches;
+    
+    u8 crc8Table[256];
+    u16 crc16Table[256];
+};
@@ -0,0 +1,210 @@
+internal b32
+is_ogg_flac_packet(Buffer packet)
+{
+    return ((packet.size >= 13) &&
+            (packet.data[0] == 0x7F) &&
+            (packet.data[1] == 'F') && (packet.data[2] == 'L') &&
+            (packet.data[3] == 'A') && (packet.data[4] == 'C') &&
+            (packet.data[9] == 'f') && (packet.data[10] == 'L') &&
+            (packet.data[11] == 'a') && (packet.data[12] == 'C'));
+}
+
+internal b32
+is_ogg_flac_file(Buffer data)
+{
+    // NOTE(michiel): The first page of an Ogg FLAC stream only holds the mapping header packet
+    b32 result = false;
+    if ((data.size > (OGG_HEADER_SIZE + 1 + 13)) &&
+        (data.data[0] == 'O') && (data.data[1] == 'g') && (data.data[2] == 'g') && (data.data[3] == 'S'))
+    {
+        Buffer packet = {};
+        packet.data = data.data + OGG_HEADER_SIZE + data.data[26];
+        packet.size = data.size - (packet.data - data.data);
+        result = (packet.data < (data.data + data.size)) && is_ogg_flac_packet(packet);
+    }
+    return result;
+}
+
+internal b32
+open_ogg_flac_stream(MemoryAllocator *allocator, Buffer data, OggFlacStream *stream)
+{
+    *stream = {};
+    OggPacketReader *reader = &stream->reader;
+    init_ogg_packet_reader(allocator, data, reader);
+    
+    Buffer packet = {};
+    if (!next_ogg_packet(reader, &packet) || !is_ogg_flac_packet(packet) || (packet.data[5] != 1))
+    {
+        free_ogg_packet_reader(reader);
+        return false;
+    }
+    
+    u32 maxMetadataEntries = 64;
+    stream->metadataEntries = allocate_array(allocator, FlacMetadata, maxMetadataEntries, default_memory_alloc());
+    
+    // NOTE(michiel): The mapping header is followed by the STREAMINFO block, the other metadata blocks
+    // get a packet each. The header packet count is optional, so the last-metadata flag ends it.
+    packet.data += 13;
+    packet.size -= 13;
+    b32 isLast = false;
+    while (!isLast && (stream->metadataEntryCount < maxMetadataEntries))
+    {
+        if ((packet.size < 4) || (packet.data[0] == 0xFF))
+        {
+            break;
+        }
+        
+        BitStreamer bitStream = create_bitstreamer(packet, BitStream_BigEndian);
+        FlacMetadata *metadata = stream->metadataEntries + stream->metadataEntryCount++;
+        parse_metadata(&bitStream, allocator, metadata);
+        isLast = metadata->isLast;
+        
+        if (!isLast && !next_ogg_packet(reader, &packet))
+        {
+            break;
+        }
+    }
+    
+    b32 result = false;
+    if (isLast && stream->metadataEntryCount &&
+        (stream->metadataEntries[0].kind == FlacMetadata_StreamInfo))
+    {
+        stream->info = stream->metadataEntries[0].info;
+        if (reader->segmentIndex < reader->page.segmentCount)
+        {
+            stream->audioStart = reader->page.start;
+            stream->audioSegment = reader->segmentIndex;
+        }
+        else
+        {
+            stream->audioStart = reader->at;
+            stream->audioSegment = 0;
+        }
+        result = true;
+    }
+    else
+    {
+        free_ogg_packet_reader(reader);
+        deallocate(allocator, stream->metadataEntries);
+        stream->metadataEntries = 0;
+        stream->metadataEntryCount = 0;
+    }
+    
+    return result;
+}
+
+internal void
+close_ogg_flac_stream(OggFlacStream *stream)
+{
+    if (stream->metadataEntries)
+    {
+        deallocate(stream->reader.allocator, stream->metadataEntries);
+    }
+    free_ogg_packet_reader(&stream->reader);
+    *stream = {};
+}
+
+internal b32
+next_ogg_flac_frame(OggFlacStream *stream, Buffer *frame)
+{
+    // NOTE(michiel): The frame data points into the file if the packet doesn't span pages
+    b32 result = false;
+    if (stream->hasPendingFrame)
+    {
+        *frame = stream->pendingFrame;
+        stream->hasPendingFrame = false;
+        result = true;
+    }
+    else
+    {
+        while (!result && next_ogg_packet(&stream->reader, frame))
+        {
+            result = (frame->size != 0);
+        }
+    }
+    return result;
+}
+
+internal void
+rewind_ogg_flac_stream(OggFlacStream *stream)
+{
+    OggPacketReader *reader = &stream->reader;
+    seek_ogg_packet_reader(reader, stream->audioStart);
+    stream->hasPendingFrame = false;
+    if (stream->audioSegment && load_next_ogg_page(reader))
+    {
+        while (reader->segmentIndex < stream->audioSegment)
+        {
+            reader->segmentAt += reader->page.lacing[reader->segmentIndex++];
+        }
+    }
+}
+
+internal u64
+seek_ogg_flac_stream(OggFlacStream *stream, u64 targetSample)
+{
+    // NOTE(michiel): Bisects on the page granule positions for the last page that ends before the
+    // target, then walks the frame headers from there. The next frame is the one holding the target.
+    // Returns its first sample, or OGG_NO_GRANULE if the target is past the end.
+    OggPacketReader *reader = &stream->reader;
+    FlacInfo *info = &stream->info;
+    
+    u8 *low = stream->audioStart;
+    u8 *high = reader->data.data + reader->data.size;
+    u8 *best = 0;
+    while (low < high)
+    {
+        u8 *middle = low + (high - low) / 2;
+        OggPage page = {};
+        u8 *pageStart = find_ogg_page(reader, middle, &page);
+        while (pageStart && (pageStart < high) && (page.granulePosition == OGG_NO_GRANULE))
+        {
+            pageStart = find_ogg_page(reader, pageStart + page.size, &page);
+        }
+        
+        if (!pageStart || (pageStart >= high))
+        {
+            high = middle;
+        }
+        else if (page.granulePosition <= targetSample)
+        {
+            best = pageStart;
+            low = pageStart + page.size;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    
+    if (best)
+    {
+        seek_ogg_packet_reader(reader, best);
+        stream->hasPendingFrame = false;
+    }
+    else
+    {
+        rewind_ogg_flac_stream(stream);
+    }
+    
+    u64 result = OGG_NO_GRANULE;
+    Buffer frame = {};
+    while (next_ogg_flac_frame(stream, &frame))
+    {
+        BitStreamer bitStream = create_bitstreamer(frame, BitStream_BigEndian);
+        FlacFrameHeader header = parse_frame_header(&bitStream, info);
+        if (header.error == FlacError_None)
+        {
+            u64 firstSample = header.variableBlocks ? header.sampleNumber : header.frameNumber * info->maxBlockSamples;
+            if ((firstSample + header.blockSize) > targetSample)
+            {
+                stream->pendingFrame = frame;
+                stream->hasPendingFrame = true;
+                result = firstSample;
+                break;
+            }
+        }
+    }
+    
+    return result;
+}
@@ -0,0 +1,20 @@
+// NOTE(michiel): FLAC in Ogg. The first packet holds a small mapping header followed by the native
+// "fLaC" signature and the STREAMINFO block, every other header packet is one metadata block and
+// after that every packet is one FLAC frame. The granule position of a page is the number of
+// samples up to and including the last frame that ends on that page.
+
+struct OggFlacStream
+{
+    OggPacketReader reader;
+    
+    u32 metadataEntryCount;
+    FlacMetadata *metadataEntries;
+    FlacInfo info;
+    
+    u8 *audioStart;             // NOTE(michiel): First page that has audio packets
+    u32 audioSegment;           // NOTE(michiel): Segment of that page where the audio starts
+    
+    // NOTE(michiel): Frame found by a seek, returned by the next call to next_ogg_flac_frame
+    b32 hasPendingFrame;
+    Buffer pendingFrame;
+};
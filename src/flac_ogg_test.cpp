@@ -0,0 +1,293 @@
+#include "../libberdip/platform.h"
+#include "../libberdip/bitstreamer.h"
+#include "../libberdip/random.h"
+#include "../libberdip/linux_memory.h"
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <math.h>
+#include <pthread.h>
+#include <x86intrin.h>
+
+global API api;
+global MemoryAPI *gMemoryApi = &api.memory;
+
+#ifndef FLAC_DEBUG_LEVEL
+#define FLAC_DEBUG_LEVEL  0
+#endif
+
+#include "flac.h"
+#include "flac_encoder.h"
+#include "ogg.h"
+#include "flac_ogg.h"
+
+#include "../libberdip/memory.cpp"
+#include "../libberdip/linux_memory.cpp"
+#include "../libberdip/linux_file.c"
+#include "../libberdip/crc.cpp"
+
+#include "../libberdip/bitstreamer.cpp"
+#include "flac.cpp"
+#include "flac_encoder.cpp"
+#include "ogg.cpp"
+#include "flac_ogg.cpp"
+
+// NOTE(michiel): Encodes a stream, puts it in Ogg pages and seeks around in it. The pages are small, so
+// most frames span pages and some pages end no packet at all.
+
+#define FLAC_OGG_TEST_BLOCK      1024
+#define FLAC_OGG_TEST_FRAMES     40
+#define FLAC_OGG_TEST_SAMPLES    (FLAC_OGG_TEST_BLOCK * FLAC_OGG_TEST_FRAMES - 300)
+#define FLAC_OGG_TEST_PAGE_DATA  1500
+
+struct OggTestWriter
+{
+    u8 *start;
+    u8 *at;
+    u32 sequence;
+    
+    u32 segmentCount;
+    u8 lacing[255];
+    umm dataSize;
+    u8 data[255 * 255];
+    
+    u64 granulePosition;    // NOTE(michiel): OGG_NO_GRANULE until a packet ends on the page
+    b32 continued;          // NOTE(michiel): The page starts in the middle of a packet
+    u32 crcTable[8][256];
+};
+
+internal void
+flush_ogg_test_page(OggTestWriter *writer, u32 flags)
+{
+    u8 *page = writer->at;
+    u8 header[OGG_HEADER_SIZE] = {'O', 'g', 'g', 'S', 0};
+    header[5] = (u8)(flags | (writer->continued ? OggPage_Continued : 0));
+    for (u32 byteIdx = 0; byteIdx < 8; ++byteIdx)
+    {
+        header[6 + byteIdx] = (u8)(writer->granulePosition >> (8 * byteIdx));
+    }
+    u32 serial = 0x4F676746;
+    for (u32 byteIdx = 0; byteIdx < 4; ++byteIdx)
+    {
+        header[14 + byteIdx] = (u8)(serial >> (8 * byteIdx));
+        header[18 + byteIdx] = (u8)(writer->sequence >> (8 * byteIdx));
+    }
+    header[26] = (u8)writer->segmentCount;
+    
+    memcpy(writer->at, header, OGG_HEADER_SIZE);
+    writer->at += OGG_HEADER_SIZE;
+    memcpy(writer->at, writer->lacing, writer->segmentCount);
+    writer->at += writer->segmentCount;
+    memcpy(writer->at, writer->data, writer->dataSize);
+    writer->at += writer->dataSize;
+    
+    u32 crc = ogg_crc32(writer->crcTable, 0, writer->at - page, page);
+    for (u32 byteIdx = 0; byteIdx < 4; ++byteIdx)
+    {
+        page[22 + byteIdx] = (u8)(crc >> (8 * byteIdx));
+    }
+    
+    ++writer->sequence;
+    writer->segmentCount = 0;
+    writer->dataSize = 0;
+    writer->granulePosition = OGG_NO_GRANULE;
+    writer->continued = false;
+}
+
+internal void
+put_ogg_test_packet(OggTestWriter *writer, umm size, u8 *data, u64 endSample)
+{
+    // NOTE(michiel): Splits the packet in lacing segments, a full page is flushed in the middle
+    b32 started = false;
+    b32 done = false;
+    while (!done)
+    {
+        umm segmentSize = minimum(size, (umm)255);
+        if ((writer->segmentCount == 255) || ((writer->dataSize + segmentSize) > FLAC_OGG_TEST_PAGE_DATA))
+        {
+            flush_ogg_test_page(writer, 0);
+            writer->continued = started;
+        }
+        started = true;
+        
+        writer->lacing[writer->segmentCount++] = (u8)segmentSize;
+        memcpy(writer->data + writer->dataSize, data, segmentSize);
+        writer->dataSize += segmentSize;
+        data += segmentSize;
+        size -= segmentSize;
+        
+        if (segmentSize < 255)
+        {
+            writer->granulePosition = endSample;
+            done = true;
+        }
+    }
+}
+
+internal Buffer
+encode_ogg_test_stream(MemoryAllocator *allocator, s32 *expected)
+{
+    // NOTE(michiel): 16 bit mono noise, expected gets the samples left aligned
+    u32 sampleCount = FLAC_OGG_TEST_SAMPLES;
+    u8 *input = (u8 *)allocate_size(allocator, (umm)sampleCount * 2, default_memory_alloc());
+    RandomSeriesPCG random = random_seed_pcg(0x2545F4914F6CDD1DULL, 0x9E3779B97F4A7C15ULL);
+    for (u32 index = 0; index < sampleCount; ++index)
+    {
+        s32 sample = (s32)(random_next_u32(&random) % 4001) - 2000;
+        input[2 * index + 0] = (u8)sample;
+        input[2 * index + 1] = (u8)(sample >> 8);
+        expected[index] = (s32)((u32)sample << 16);
+    }
+    
+    FlacEncoder encoder = {};
+    encoder.settings.blockSize = FLAC_OGG_TEST_BLOCK;
+    encoder.settings.maxLpcOrder = 8;
+    encoder.settings.maxPartitionOrder = 4;
+    encoder.settings.threadCount = 1;
+    encoder.info.sampleRate = 44100;
+    encoder.info.channelCount = 1;
+    encoder.info.bitsPerSample = 16;
+    encoder.input = input;
+    encoder.inputSampleBytes = 2;
+    encoder.totalSamples = sampleCount;
+    init_flac_encoder(allocator, &encoder);
+    
+    OggTestWriter *writer = allocate_struct(allocator, OggTestWriter, default_memory_alloc());
+    umm maxSize = 4096 + (umm)encoder.frameCount * (encoder.maxFrameBytes + 2 * OGG_MAX_PAGE_SIZE / 255);
+    writer->start = (u8 *)allocate_size(allocator, maxSize, default_memory_alloc());
+    writer->at = writer->start;
+    writer->granulePosition = 0;
+    init_ogg_crc_table(writer->crcTable);
+    
+    // NOTE(michiel): Mapping header version 1.0, no header packet count, then the STREAMINFO block
+    u8 headerPacket[64] = {0x7F, 'F', 'L', 'A', 'C', 1, 0, 0, 0};
+    FlacBitWriter headerWriter = create_bitwriter({sizeof(headerPacket) - 9, headerPacket + 9});
+    put_stream_info(&headerWriter, &encoder.info, true);
+    put_ogg_test_packet(writer, headerWriter.at - headerPacket, headerPacket, 0);
+    flush_ogg_test_page(writer, OggPage_FirstPage);
+    
+    for (u32 batchStart = 0; batchStart < encoder.frameCount; batchStart += encoder.batchFrameCount)
+    {
+        u32 batchEnd = minimum(batchStart + encoder.batchFrameCount, encoder.frameCount);
+        encode_flac_batch(&encoder, batchStart, batchEnd);
+        for (u32 frameIndex = batchStart; frameIndex < batchEnd; ++frameIndex)
+        {
+            FlacEncodedFrame *frame = encoder.batchFrames + (frameIndex - batchStart);
+            u64 endSample = minimum((u64)(frameIndex + 1) * FLAC_OGG_TEST_BLOCK, (u64)sampleCount);
+            put_ogg_test_packet(writer, frame->byteCount, frame->data.data, endSample);
+        }
+    }
+    flush_ogg_test_page(writer, OggPage_LastPage);
+    
+    Buffer result = {};
+    result.data = writer->start;
+    result.size = writer->at - writer->start;
+    return result;
+}
+
+internal b32
+test_ogg_seek(OggFlacStream *stream, s32 *expected, u64 targetSample, s32 *residualScratch, s32 *samples)
+{
+    // NOTE(michiel): The seek has to land on the frame holding the target, after that the frames have to
+    // follow each other up to the end of the stream
+    FlacInfo *info = &stream->info;
+    u64 frameSample = seek_ogg_flac_stream(stream, targetSample);
+    u64 expectedFrame = OGG_NO_GRANULE;
+    if (targetSample < FLAC_OGG_TEST_SAMPLES)
+    {
+        expectedFrame = (targetSample / FLAC_OGG_TEST_BLOCK) * FLAC_OGG_TEST_BLOCK;
+    }
+    
+    u32 mismatches = 0;
+    u64 nextSample = frameSample;
+    Buffer frame = {};
+    while ((frameSample != OGG_NO_GRANULE) && next_ogg_flac_frame(stream, &frame))
+    {
+        BitStreamer bitStream = create_bitstreamer(frame, BitStream_BigEndian);
+        FlacFrameHeader header = {};
+        FlacDecodeError error = decode_frame(&bitStream, info, &header, residualScratch, samples, (s64 *)0);
+        u64 firstSample = header.frameNumber * info->maxBlockSamples;
+        if ((error != FlacError_None) || (firstSample != nextSample))
+        {
+            ++mismatches;
+            break;
+        }
+        
+        s32 *interleaved = samples + info->maxBlockSamples;
+        interleave_samples(&header, samples, (s64 *)0, interleaved);
+        for (u32 index = 0; index < header.blockSize; ++index)
+        {
+            if (interleaved[index] != expected[firstSample + index])
+            {
+                ++mismatches;
+            }
+        }
+        nextSample = firstSample + header.blockSize;
+    }
+    
+    b32 result = (frameSample == expectedFrame) && (mismatches == 0) &&
+                 ((frameSample == OGG_NO_GRANULE) || (nextSample == FLAC_OGG_TEST_SAMPLES));
+    fprintf(stdout, "seek to %6lu: %s (frame at %ld, expected %ld, %u mismatches)\n", targetSample,
+            result ? "ok" : "FAIL", (s64)frameSample, (s64)expectedFrame, mismatches);
+    return result;
+}
+
+s32 main(s32 argc, char **argv)
+{
+    linux_memory_api(&api.memory);
+    linux_file_api(&api.file);
+    
+    MemoryAllocator platformAlloc = {};
+    initialize_platform_allocator(0, &platformAlloc);
+    
+    u32 failures = 0;
+    s32 *expected = allocate_array(&platformAlloc, s32, FLAC_OGG_TEST_SAMPLES, default_memory_alloc());
+    Buffer data = encode_ogg_test_stream(&platformAlloc, expected);
+    
+    OggFlacStream stream = {};
+    if (is_ogg_flac_file(data) && open_ogg_flac_stream(&platformAlloc, data, &stream))
+    {
+        s32 *residualScratch = allocate_array(&platformAlloc, s32, FLAC_OGG_TEST_BLOCK, default_memory_alloc());
+        s32 *samples = allocate_array(&platformAlloc, s32, 2 * FLAC_OGG_TEST_BLOCK, default_memory_alloc());
+        
+        u64 targets[] =
+        {
+            0, 1, FLAC_OGG_TEST_BLOCK - 1, FLAC_OGG_TEST_BLOCK, 5000, 17 * FLAC_OGG_TEST_BLOCK + 3, 20000,
+            FLAC_OGG_TEST_SAMPLES - FLAC_OGG_TEST_BLOCK, FLAC_OGG_TEST_SAMPLES - 1, FLAC_OGG_TEST_SAMPLES,
+            3 * FLAC_OGG_TEST_SAMPLES, 0,
+        };
+        for (u32 targetIdx = 0; targetIdx < array_count(targets); ++targetIdx)
+        {
+            if (!test_ogg_seek(&stream, expected, targets[targetIdx], residualScratch, samples))
+            {
+                ++failures;
+            }
+        }
+        
+        if (stream.reader.badPages || stream.reader.lostPackets)
+        {
+            fprintf(stdout, "seeking lost data: FAIL (%u bad pages, %u lost packets)\n",
+                    stream.reader.badPages, stream.reader.lostPackets);
+            ++failures;
+        }
+        close_ogg_flac_stream(&stream);
+    }
+    else
+    {
+        fprintf(stdout, "open Ogg FLAC stream: FAIL\n");
+        ++failures;
+    }
+    
+    if (argc > 1)
+    {
+        // NOTE(michiel): Keep the stream around, to play it with flacdecode
+        ApiFile file = api.file.open_file(string(argv[1]), FileOpen_Write);
+        api.file.write_to_file(&file, data.size, data.data);
+        api.file.close_file(&file);
+    }
+    
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,553 @@
+#include "../libberdip/platform.h"
+#include "../libberdip/bitstreamer.h"
+#include "../libberdip/std_memory.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <x86intrin.h>
+
+global MemoryAllocator gMemoryAllocator_;
+global MemoryAllocator *gMemoryAllocator = &gMemoryAllocator_;
+
+global FileAPI gFileApi_;
+global FileAPI *gFileApi = &gFileApi_;
+
+#ifndef FLAC_DEBUG_LEVEL
+#define FLAC_DEBUG_LEVEL  0
+#endif
+
+#include "flac.h"
+#include "flac_encoder.h"
+#include "flac_stream.h"
+#include "md5.h"
+
+#include "../libberdip/std_memory.cpp"
+#include "../libberdip/std_file.c"
+#include "../libberdip/crc.cpp"
+
+#include "../libberdip/bitstreamer.cpp"
+#include "flac.cpp"
+#include "flac_encoder.cpp"
+#include "flac_stream.cpp"
+#include "md5.cpp"
+
+// NOTE(michiel): Splits a single file album into tracks using its CUESHEET block. Frames that lie
+// completely inside a track are copied as they are, only the frame header is rewritten (variable
+// block size, so the first sample number is stored instead of the frame number). The frame CRC16 is
+// patched without reading the frame data, see crc16_shift. The one frame on each track edge is
+// decoded and written again with verbatim subframes.
+
+struct FlacSplitter
+{
+    FlacStream stream;
+    FlacCueSheet *cueSheet;
+    
+    u8 crc8Table[256];
+    u16 crc16Table[256];
+    
+    s32 *interleaved;       // NOTE(michiel): Decoded edge frames
+    s32 *channelSamples;
+    u8 *frameBuffer;        // NOTE(michiel): Rewritten header, or a complete verbatim frame
+    umm frameBufferSize;
+    
+    b32 computeMd5;
+};
+
+struct FlacSplitOutput
+{
+    ApiFile file;
+    FlacInfo info;
+    u32 frameCount;
+    u32 minBlockSamples;
+    u32 lastBlockSamples;
+    
+    u64 writtenBytes;
+    u64 copiedFrames;
+    u64 verbatimFrames;
+};
+
+//
+// NOTE(michiel): CRC16 patching
+//
+
+internal u16
+crc16_multiply(u16 a, u16 b)
+{
+    // NOTE(michiel): a * b modulo the FLAC CRC16 polynomial (x^16 + x^15 + x^2 + 1)
+    u32 result = 0;
+    for (s32 bit = 15; bit >= 0; --bit)
+    {
+        result <<= 1;
+        if (result & 0x10000)
+        {
+            result ^= 0x18005;
+        }
+        if (b & (1 << bit))
+        {
+            result ^= a;
+        }
+    }
+    return (u16)result;
+}
+
+internal u16
+crc16_shift(u16 crc, umm byteCount)
+{
+    // NOTE(michiel): The FLAC CRC16 has no initial value and no final xor, so it is linear:
+    // crc(A + B) = crc(A) * x^(8 * |B|) ^ crc(B). This computes the first term, which lets us swap
+    // the header of a frame and fix up the CRC in O(log n) instead of running over the whole frame.
+    u16 result = crc;
+    u16 power = 0x0100;  // NOTE(michiel): x^8
+    while (byteCount)
+    {
+        if (byteCount & 1)
+        {
+            result = crc16_multiply(result, power);
+        }
+        power = crc16_multiply(power, power);
+        byteCount >>= 1;
+    }
+    return result;
+}
+
+//
+// NOTE(michiel): Output
+//
+
+internal void
+write_split_bytes(FlacSplitOutput *output, umm size, u8 *data)
+{
+    gFileApi->write_to_file(&output->file, size, data);
+    output->writtenBytes += size;
+}
+
+internal void
+update_split_info(FlacSplitOutput *output, u32 blockSize, umm frameBytes)
+{
+    // NOTE(michiel): The minimum block size doesn't count the last frame, so a frame only counts
+    // once the next one comes in.
+    FlacInfo *info = &output->info;
+    if (output->frameCount)
+    {
+        output->minBlockSamples = minimum(output->minBlockSamples, output->lastBlockSamples);
+    }
+    output->lastBlockSamples = blockSize;
+    ++output->frameCount;
+    
+    info->minBlockSamples = (output->frameCount > 1) ? output->minBlockSamples : blockSize;
+    info->maxBlockSamples = maximum((u32)info->maxBlockSamples, blockSize);
+    info->minFrameBytes = info->minFrameBytes ? minimum(info->minFrameBytes, (u32)frameBytes) : (u32)frameBytes;
+    info->maxFrameBytes = maximum(info->maxFrameBytes, (u32)frameBytes);
+    info->totalSamples += blockSize;
+}
+
+internal b32
+copy_flac_frame(FlacSplitter *splitter, u32 frameIndex, FlacSplitOutput *output)
+{
+    FlacStream *stream = &splitter->stream;
+    FlacFrameIndex *frame = stream->frames + frameIndex;
+    u8 *frameStart = stream->data.data + frame->offset;
+    
+    BitStreamer bitStream = create_bitstreamer(stream->data, BitStream_BigEndian);
+    bitStream.at = frameStart;
+    
+    umm frameSize = 0;
+    if ((frameIndex + 1) < stream->frameCount)
+    {
+        frameSize = stream->frames[frameIndex + 1].offset - frame->offset;
+    }
+    else
+    {
+        // NOTE(michiel): The last frame can be followed by anything (tags for example), so it is
+        // decoded to find the end.
+        FlacFrameHeader checkHeader = {};
+        if (decode_frame(&bitStream, &stream->info, &checkHeader, stream->residualSamples,
+                         stream->channelSamples, stream->wideSamples) != FlacError_None)
+        {
+            return false;
+        }
+        frameSize = bitStream.at - frameStart;
+        bitStream.at = frameStart;
+    }
+    bitStream.remainingBits = 0;
+    bitStream.remainingData = 0;
+    
+    FlacFrameHeader header = parse_frame_header(&bitStream, &stream->info);
+    if (header.error != FlacError_None)
+    {
+        return false;
+    }
+    umm oldHeaderSize = bitStream.at - frameStart;
+    umm bodySize = frameSize - oldHeaderSize - 2;
+    
+    FlacBitWriter writer = create_bitwriter({splitter->frameBufferSize, splitter->frameBuffer});
+    put_frame_header(&writer, &output->info, splitter->crc8Table, true, output->info.totalSamples,
+                     header.blockSize, header.channelAssignment);
+    umm newHeaderSize = writer.at - writer.start;
+    
+    u8 *crcAt = frameStart + frameSize - 2;
+    u16 oldCrc = ((u16)crcAt[0] << 8) | crcAt[1];
+    u16 headerDelta = crc16_calc_crc(splitter->crc16Table, oldHeaderSize, frameStart) ^
+        crc16_calc_crc(splitter->crc16Table, newHeaderSize, writer.start);
+    u16 newCrc = oldCrc ^ crc16_shift(headerDelta, bodySize);
+    u8 crcBytes[2] = {(u8)(newCrc >> 8), (u8)(newCrc & 0xFF)};
+    
+    write_split_bytes(output, newHeaderSize, writer.start);
+    write_split_bytes(output, bodySize, frameStart + oldHeaderSize);
+    write_split_bytes(output, 2, crcBytes);
+    
+    update_split_info(output, header.blockSize, newHeaderSize + bodySize + 2);
+    ++output->copiedFrames;
+    return true;
+}
+
+internal b32
+write_verbatim_frame(FlacSplitter *splitter, u64 firstSample, u32 sampleCount, FlacSplitOutput *output)
+{
+    FlacStream *stream = &splitter->stream;
+    FlacInfo *info = &stream->info;
+    u32 channelCount = info->channelCount;
+    u32 bitsPerSample = info->bitsPerSample;
+    
+    if (decode_flac_region(stream, firstSample, sampleCount, splitter->interleaved) != sampleCount)
+    {
+        return false;
+    }
+    
+    s32 *source = splitter->interleaved;
+    for (u32 sampleIdx = 0; sampleIdx < sampleCount; ++sampleIdx)
+    {
+        for (u32 channelIdx = 0; channelIdx < channelCount; ++channelIdx)
+        {
+            splitter->channelSamples[channelIdx * sampleCount + sampleIdx] = *source++ >> (32 - bitsPerSample);
+        }
+    }
+    
+    FlacBitWriter writer = create_bitwriter({splitter->frameBufferSize, splitter->frameBuffer});
+    put_frame_header(&writer, &output->info, splitter->crc8Table, true, output->info.totalSamples,
+                     sampleCount, channelCount - 1);
+    
+    FlacSubframeEncoding encoding = {};
+    encoding.header.type = FlacSubframe_Verbatim;
+    encoding.bitsPerSample = bitsPerSample;
+    for (u32 channelIdx = 0; channelIdx < channelCount; ++channelIdx)
+    {
+        put_subframe(&writer, &encoding, splitter->channelSamples + channelIdx * sampleCount, sampleCount, 0);
+    }
+    align_bitwriter(&writer);
+    put_bits(&writer, 16, crc16_calc_crc(splitter->crc16Table, writer.at - writer.start, writer.start));
+    
+    umm frameBytes = writer.at - writer.start;
+    write_split_bytes(output, frameBytes, writer.start);
+    update_split_info(output, sampleCount, frameBytes);
+    ++output->verbatimFrames;
+    return true;
+}
+
+internal void
+compute_split_md5(FlacSplitter *splitter, u64 firstSample, u64 sampleCount, FlacInfo *info)
+{
+    // NOTE(michiel): This decodes the whole track, so it is optional
+    FlacStream *stream = &splitter->stream;
+    u32 channelCount = info->channelCount;
+    u32 sampleBytes = (info->bitsPerSample + 7) / 8;
+    u32 blockSize = stream->info.maxBlockSamples;
+    u8 bytes[4 * FLAC_MAX_CHANNELS * 64];
+    
+    Md5Context md5 = md5_init();
+    u64 sample = firstSample;
+    u64 endSample = firstSample + sampleCount;
+    while (sample < endSample)
+    {
+        u32 count = (u32)minimum((u64)blockSize, endSample - sample);
+        count = decode_flac_region(stream, sample, count, splitter->interleaved);
+        if (!count)
+        {
+            break;
+        }
+        
+        s32 *source = splitter->interleaved;
+        u32 remaining = count * channelCount;
+        while (remaining)
+        {
+            u32 chunk = minimum(remaining, (u32)(sizeof(bytes) / 4));
+            u8 *dest = bytes;
+            for (u32 index = 0; index < chunk; ++index)
+            {
+                s32 value = *source++ >> (32 - info->bitsPerSample);
+                for (u32 byteIdx = 0; byteIdx < sampleBytes; ++byteIdx)
+                {
+                    *dest++ = (u8)(value >> (8 * byteIdx));
+                }
+            }
+            md5_update(&md5, dest - bytes, bytes);
+            remaining -= chunk;
+        }
+        sample += count;
+    }
+    
+    Md5Digest digest = md5_final(&md5);
+    for (u32 byteIdx = 0; byteIdx < 8; ++byteIdx)
+    {
+        info->md5signature.high = (info->md5signature.high << 8) | digest.bytes[byteIdx];
+        info->md5signature.low = (info->md5signature.low << 8) | digest.bytes[byteIdx + 8];
+    }
+}
+
+internal b32
+split_flac_track(FlacSplitter *splitter, u64 startSample, u64 endSample, String fileName)
+{
+    FlacStream *stream = &splitter->stream;
+    
+    FlacSplitOutput output = {};
+    output.minBlockSamples = U16_MAX;
+    output.info.sampleRate = stream->info.sampleRate;
+    output.info.channelCount = stream->info.channelCount;
+    output.info.bitsPerSample = stream->info.bitsPerSample;
+    
+    output.file = gFileApi->open_file(fileName, FileOpen_Write);
+    if (!no_file_errors(&output.file))
+    {
+        fprintf(stderr, "Could not open '%.*s' for writing\n", STR_FMT(fileName));
+        return false;
+    }
+    
+    // NOTE(michiel): Placeholder, written again when all frames are known
+    u8 headerData[64];
+    FlacBitWriter headerWriter = create_bitwriter({sizeof(headerData), headerData});
+    put_stream_info(&headerWriter, &output.info, true);
+    write_split_bytes(&output, headerWriter.at - headerWriter.start, headerData);
+    
+    b32 result = true;
+    u64 sample = startSample;
+    while (result && (sample < endSample))
+    {
+        u32 frameIndex = find_flac_frame(stream, sample);
+        if (frameIndex == stream->frameCount)
+        {
+            break;
+        }
+        
+        FlacFrameIndex *frame = stream->frames + frameIndex;
+        u64 frameEnd = frame->firstSample + frame->sampleCount;
+        if (sample >= frameEnd)
+        {
+            // NOTE(michiel): A missing (damaged) frame, continue after the gap
+            if ((frameIndex + 1) == stream->frameCount)
+            {
+                break;
+            }
+            sample = stream->frames[frameIndex + 1].firstSample;
+            continue;
+        }
+        
+        if ((frame->firstSample == sample) && (frameEnd <= endSample))
+        {
+            result = copy_flac_frame(splitter, frameIndex, &output);
+            sample = frameEnd;
+        }
+        else
+        {
+            u64 pieceEnd = minimum(frameEnd, endSample);
+            if (((pieceEnd - sample) < 16) && (pieceEnd < endSample) && ((frameIndex + 1) < stream->frameCount))
+            {
+                // NOTE(michiel): Only the last frame may be shorter than 16 samples, so a small head
+                // takes the next frame along.
+                FlacFrameIndex *nextFrame = frame + 1;
+                if (nextFrame->firstSample == frameEnd)
+                {
+                    pieceEnd = minimum(frameEnd + nextFrame->sampleCount, endSample);
+                    pieceEnd = minimum(pieceEnd, sample + 65535);
+                }
+            }
+            result = write_verbatim_frame(splitter, sample, (u32)(pieceEnd - sample), &output);
+            sample = pieceEnd;
+        }
+    }
+    
+    if (result)
+    {
+        if (splitter->computeMd5)
+        {
+            compute_split_md5(splitter, startSample, output.info.totalSamples, &output.info);
+        }
+        
+        headerWriter = create_bitwriter({sizeof(headerData), headerData});
+        put_stream_info(&headerWriter, &output.info, true);
+        gFileApi->set_file_position(&output.file, 0, FileCursor_StartOfFile);
+        gFileApi->write_to_file(&output.file, headerWriter.at - headerWriter.start, headerData);
+        
+        fprintf(stdout, "  %.*s: %lu samples, %lu bytes, %lu copied and %lu verbatim frames\n",
+                STR_FMT(fileName), output.info.totalSamples, output.writtenBytes,
+                output.copiedFrames, output.verbatimFrames);
+    }
+    else
+    {
+        fprintf(stderr, "Frame error while writing '%.*s'\n", STR_FMT(fileName));
+    }
+    
+    gFileApi->close_file(&output.file);
+    return result;
+}
+
+internal void
+print_usage(char *program)
+{
+    fprintf(stderr, "Usage: %s [options] <album.flac>\n"
+            "  -o | --output <prefix>  Output file prefix, tracks are written as <prefix>NN.flac\n"
+            "                          (default: the input name without extension, followed by '-')\n"
+            "  -t | --track <n>        Only write this track number\n"
+            "  -m | --md5              Decode the tracks to fill in the MD5 signature (otherwise left 0)\n"
+            "  -l | --list             Only print the cue sheet\n",
+            program);
+}
+
+s32 main(s32 argc, char **argv)
+{
+    std_file_api(gFileApi);
+    initialize_std_allocator(0, gMemoryAllocator);
+    
+    FlacSplitter splitter = {};
+    String inputFile = {};
+    String outputPrefix = {};
+    u32 onlyTrack = 0;
+    b32 listOnly = false;
+    b32 badArguments = false;
+    
+    s32 index = 1;
+    while (index < argc)
+    {
+        String arg = string(argv[index++]);
+        if (((arg == string("--output")) || (arg == string("-o"))) && (index < argc))
+        {
+            outputPrefix = string(argv[index++]);
+        }
+        else if (((arg == string("--track")) || (arg == string("-t"))) && (index < argc))
+        {
+            onlyTrack = number_from_string(string(argv[index++]));
+        }
+        else if ((arg == string("--md5")) || (arg == string("-m")))
+        {
+            splitter.computeMd5 = true;
+        }
+        else if ((arg == string("--list")) || (arg == string("-l")))
+        {
+            listOnly = true;
+        }
+        else if (!inputFile.size)
+        {
+            inputFile = arg;
+        }
+        else
+        {
+            badArguments = true;
+        }
+    }
+    
+    if (badArguments || !inputFile.size)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    Buffer data = gFileApi->read_entire_file(gMemoryAllocator, inputFile);
+    BitStreamer bitStream = create_bitstreamer(data, BitStream_BigEndian);
+    if ((data.size < 8) || !is_flac_file(&bitStream))
+    {
+        fprintf(stderr, "Not a FLAC file '%.*s'\n", STR_FMT(inputFile));
+        return 1;
+    }
+    bitStream.at += 4;
+    
+    FlacMetadata metadata = {};
+    do
+    {
+        parse_metadata(&bitStream, gMemoryAllocator, &metadata);
+        if (metadata.kind == FlacMetadata_CueSheet)
+        {
+            splitter.cueSheet = allocate_struct(gMemoryAllocator, FlacCueSheet, default_memory_alloc());
+            *splitter.cueSheet = metadata.cueSheet;
+        }
+    } while (!metadata.isLast && (bitStream.at < bitStream.end));
+    
+    FlacStream *stream = &splitter.stream;
+    if (!open_flac_stream(gMemoryAllocator, data, 1, 0, stream))
+    {
+        fprintf(stderr, "Could not index the frames of '%.*s'\n", STR_FMT(inputFile));
+        return 1;
+    }
+    
+    FlacCueSheet *cueSheet = splitter.cueSheet;
+    if (!cueSheet || (cueSheet->trackCount < 2))
+    {
+        fprintf(stderr, "No cue sheet with tracks in '%.*s'\n", STR_FMT(inputFile));
+        return 1;
+    }
+    
+    if (listOnly)
+    {
+        print_cue_sheet(cueSheet, stream->info.sampleRate);
+        return 0;
+    }
+    
+    if (!outputPrefix.size)
+    {
+        outputPrefix = inputFile;
+        if ((outputPrefix.size > 5) && (string(outputPrefix.size - 5, outputPrefix.data + outputPrefix.size - 5) == string(".flac")))
+        {
+            outputPrefix.size -= 5;
+        }
+        u8 *prefixData = (u8 *)allocate_size(gMemoryAllocator, outputPrefix.size + 1, default_memory_alloc());
+        memcpy(prefixData, outputPrefix.data, outputPrefix.size);
+        prefixData[outputPrefix.size++] = '-';
+        outputPrefix.data = prefixData;
+    }
+    
+    crc8_init_table(0x07, splitter.crc8Table);
+    crc16_init_table(0x8005, splitter.crc16Table);
+    
+    // NOTE(michiel): A verbatim frame can hold two source frames, when a tiny head is merged
+    u32 maxSamples = 65535;
+    FlacInfo *info = &stream->info;
+    splitter.interleaved = allocate_array(gMemoryAllocator, s32, maxSamples * info->channelCount, default_memory_alloc());
+    splitter.channelSamples = allocate_array(gMemoryAllocator, s32, maxSamples * info->channelCount, default_memory_alloc());
+    splitter.frameBufferSize = 32 + info->channelCount * (2 + ((umm)maxSamples * info->bitsPerSample + 7) / 8);
+    splitter.frameBuffer = (u8 *)allocate_size(gMemoryAllocator, splitter.frameBufferSize, default_memory_alloc());
+    
+    fprintf(stdout, "Splitting '%.*s' (%u tracks)\n", STR_FMT(inputFile), cueSheet->trackCount - 1);
+    
+    u64 streamEnd = stream->frameCount ? (stream->frames[stream->frameCount - 1].firstSample +
+                                          stream->frames[stream->frameCount - 1].sampleCount) : 0;
+    u32 failed = 0;
+    for (u32 trackIdx = 0; (trackIdx + 1) < cueSheet->trackCount; ++trackIdx)
+    {
+        FlacCueTrack *track = cueSheet->tracks + trackIdx;
+        if (!track->isAudio || (onlyTrack && (track->number != onlyTrack)))
+        {
+            continue;
+        }
+        
+        u64 startSample = get_cue_track_start(track);
+        u64 endSample = get_cue_track_start(track + 1);
+        if ((trackIdx + 2) == cueSheet->trackCount)
+        {
+            // NOTE(michiel): The lead-out has no index points
+            endSample = track[1].offset;
+        }
+        endSample = minimum(endSample, streamEnd);
+        if (startSample >= endSample)
+        {
+            continue;
+        }
+        
+        u8 nameBuffer[4096];
+        String fileName = string_fmt(array_count(nameBuffer), nameBuffer, "%.*s%02u.flac",
+                                     STR_FMT(outputPrefix), track->number);
+        if (!split_flac_track(&splitter, startSample, endSample, fileName))
+        {
+            ++failed;
+        }
+    }
+    
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,500 @@
+//
+// NOTE(michiel): Decoded frame cache
+//
+
+internal FlacFrameCache *
+create_flac_cache(MemoryAllocator *allocator, umm memoryBudget)
+{
+    FlacFrameCache *result = allocate_struct(allocator, FlacFrameCache, default_memory_alloc());
+    result->allocator = allocator;
+    result->memoryBudget = memoryBudget;
+    
+    // NOTE(michiel): Aim for about one entry per bucket with 4096 sample stereo frames
+    u32 bucketCount = 64;
+    while ((bucketCount < (1 << 20)) &&
+           (((umm)bucketCount * 4096 * 2 * sizeof(s32)) < memoryBudget))
+    {
+        bucketCount <<= 1;
+    }
+    result->hashMask = bucketCount - 1;
+    result->hashTable = allocate_array(allocator, FlacCacheEntry *, bucketCount, default_memory_alloc());
+    
+    result->sentinel.nextLRU = &result->sentinel;
+    result->sentinel.prevLRU = &result->sentinel;
+    
+    return result;
+}
+
+internal u32
+flac_cache_hash(FlacFrameCache *cache, u64 fileId, u64 firstSample)
+{
+    u64 hash = (fileId * 0x9E3779B97F4A7C15ULL) ^ (firstSample * 0xC2B2AE3D27D4EB4FULL);
+    hash ^= hash >> 29;
+    return (u32)hash & cache->hashMask;
+}
+
+internal void
+flac_cache_unlink_lru(FlacCacheEntry *entry)
+{
+    entry->prevLRU->nextLRU = entry->nextLRU;
+    entry->nextLRU->prevLRU = entry->prevLRU;
+}
+
+internal void
+flac_cache_link_lru(FlacFrameCache *cache, FlacCacheEntry *entry)
+{
+    entry->prevLRU = &cache->sentinel;
+    entry->nextLRU = cache->sentinel.nextLRU;
+    entry->prevLRU->nextLRU = entry;
+    entry->nextLRU->prevLRU = entry;
+}
+
+internal void
+flac_cache_remove(FlacFrameCache *cache, FlacCacheEntry *entry)
+{
+    FlacCacheEntry **link = cache->hashTable + flac_cache_hash(cache, entry->fileId, entry->firstSample);
+    while (*link != entry)
+    {
+        link = &(*link)->nextInHash;
+    }
+    *link = entry->nextInHash;
+    
+    flac_cache_unlink_lru(entry);
+    cache->memoryUsed -= entry->size;
+    deallocate(cache->allocator, entry);
+}
+
+internal FlacCacheEntry *
+flac_cache_lookup(FlacFrameCache *cache, u64 fileId, u64 firstSample)
+{
+    FlacCacheEntry *result = cache->hashTable[flac_cache_hash(cache, fileId, firstSample)];
+    while (result && ((result->fileId != fileId) || (result->firstSample != firstSample)))
+    {
+        result = result->nextInHash;
+    }
+    
+    if (result)
+    {
+        ++cache->hits;
+        flac_cache_unlink_lru(result);
+        flac_cache_link_lru(cache, result);
+    }
+    else
+    {
+        ++cache->misses;
+    }
+    
+    return result;
+}
+
+internal FlacCacheEntry *
+flac_cache_insert(FlacFrameCache *cache, u64 fileId, u64 firstSample,
+                  u32 channelCount, u32 sampleCount, s32 *samples)
+{
+    // NOTE(michiel): Copies the interleaved samples, evicting the least recently used frames to stay
+    // within the budget. Returns 0 if the frame alone is bigger than the budget.
+    FlacCacheEntry *result = 0;
+    umm sampleSize = (umm)sampleCount * channelCount * sizeof(s32);
+    umm totalSize = sizeof(FlacCacheEntry) + sampleSize;
+    
+    if (totalSize <= cache->memoryBudget)
+    {
+        while ((cache->memoryUsed + totalSize) > cache->memoryBudget)
+        {
+            FlacCacheEntry *oldest = cache->sentinel.prevLRU;
+            i_expect(oldest != &cache->sentinel);
+            flac_cache_remove(cache, oldest);
+            ++cache->evictions;
+        }
+        
+        result = (FlacCacheEntry *)allocate_size(cache->allocator, totalSize, default_memory_alloc());
+        result->fileId = fileId;
+        result->firstSample = firstSample;
+        result->sampleCount = sampleCount;
+        result->channelCount = channelCount;
+        result->size = totalSize;
+        result->samples = (s32 *)(result + 1);
+        memcpy(result->samples, samples, sampleSize);
+        
+        FlacCacheEntry **bucket = cache->hashTable + flac_cache_hash(cache, fileId, firstSample);
+        result->nextInHash = *bucket;
+        *bucket = result;
+        
+        flac_cache_link_lru(cache, result);
+        cache->memoryUsed += totalSize;
+    }
+    
+    return result;
+}
+
+internal void
+flac_cache_evict_file(FlacFrameCache *cache, u64 fileId)
+{
+    FlacCacheEntry *entry = cache->sentinel.nextLRU;
+    while (entry != &cache->sentinel)
+    {
+        FlacCacheEntry *next = entry->nextLRU;
+        if (entry->fileId == fileId)
+        {
+            flac_cache_remove(cache, entry);
+        }
+        entry = next;
+    }
+}
+
+internal void
+destroy_flac_cache(FlacFrameCache *cache)
+{
+    while (cache->sentinel.nextLRU != &cache->sentinel)
+    {
+        flac_cache_remove(cache, cache->sentinel.nextLRU);
+    }
+    deallocate(cache->allocator, cache->hashTable);
+    deallocate(cache->allocator, cache);
+}
+
+//
+// NOTE(michiel): Stream with random access
+//
+
+internal void
+allocate_flac_stream_scratch(FlacStream *stream)
+{
+    FlacInfo *info = &stream->info;
+    u32 totalSampleCount = (u32)info->maxBlockSamples * info->channelCount;
+    if (flac_needs_wide_samples(info))
+    {
+        stream->wideSamples = allocate_array(stream->allocator, s64, totalSampleCount, default_memory_alloc());
+    }
+    else
+    {
+        stream->channelSamples = allocate_array(stream->allocator, s32, totalSampleCount, default_memory_alloc());
+    }
+    stream->residualSamples = allocate_array(stream->allocator, s32, info->maxBlockSamples, default_memory_alloc());
+}
+
+internal u8 *
+find_flac_frame_end(FlacStream *stream, BitStreamer *bitStream, u8 *frameStart)
+{
+    // NOTE(michiel): The frame ends at the first following sync (or the end of the data) where the CRC16
+    // over the frame, stored CRC included, comes out 0. Sync codes inside the frame data fail that check,
+    // so they are skipped. Returns 0 for a damaged frame.
+    FlacInfo *info = &stream->info;
+    
+    // NOTE(michiel): No valid frame is bigger than its verbatim encoding, the side channel has one extra bit
+    umm maxFrameBytes = 16 + 2 + info->channelCount * (8 + ((umm)info->maxBlockSamples * (info->bitsPerSample + 1) + 7) / 8);
+    u8 *limit = frameStart + minimum(maxFrameBytes, (umm)(bitStream->end - frameStart));
+    
+    u8 *result = 0;
+    u16 crc = 0;
+    u8 *crcAt = frameStart;
+    u8 *searchAt = frameStart + 1;
+    while (!result && (searchAt < limit))
+    {
+        u8 *end = find_next_frame(bitStream, info, searchAt);
+        b32 lastCandidate = !end || (end > limit);
+        if (lastCandidate)
+        {
+            end = limit;
+        }
+        
+        while (crcAt < end)
+        {
+            crc = (crc << 8) ^ stream->crc16Table[(crc >> 8) ^ *crcAt++];
+        }
+        
+        if ((crc == 0) && ((end == bitStream->end) || !lastCandidate))
+        {
+            result = end;
+        }
+        else if (lastCandidate)
+        {
+            // NOTE(michiel): The last frame can be followed by something that is not a frame (a tag), so
+            // it gets decoded to find its end.
+            if (!stream->residualSamples)
+            {
+                allocate_flac_stream_scratch(stream);
+            }
+            
+            BitStreamer probe = *bitStream;
+            probe.at = frameStart;
+            probe.remainingBits = 0;
+            probe.remainingData = 0;
+            FlacFrameHeader checkHeader = {};
+            if ((decode_frame(&probe, info, &checkHeader, stream->residualSamples,
+                              stream->channelSamples, stream->wideSamples) == FlacError_None) &&
+                (probe.at <= limit))
+            {
+                result = probe.at;
+            }
+            break;
+        }
+        searchAt = end + 1;
+    }
+    
+    return result;
+}
+
+internal b32
+open_flac_stream(MemoryAllocator *allocator, Buffer data, u64 fileId, FlacFrameCache *cache,
+                 FlacStream *stream)
+{
+    b32 result = false;
+    *stream = {};
+    stream->allocator = allocator;
+    stream->fileId = fileId;
+    stream->data = data;
+    stream->cache = cache;
+    
+    BitStreamer bitStream_ = create_bitstreamer(data, BitStream_BigEndian);
+    BitStreamer *bitStream = &bitStream_;
+    if ((data.size > 4) && is_flac_file(bitStream))
+    {
+        bitStream->at += 4;
+        
+        // NOTE(michiel): Only the stream info is needed, the rest is skipped without allocating
+        b32 isLast = false;
+        while (!isLast && ((bitStream->at + 4) <= bitStream->end))
+        {
+            isLast = get_bits(bitStream, 1);
+            u32 kind = get_bits(bitStream, 7);
+            u32 size = get_bits(bitStream, 24);
+            if ((kind == FlacMetadata_StreamInfo) && (size == 34))
+            {
+                stream->info = parse_info_stream(bitStream);
+            }
+            else
+            {
+                void_bytes(bitStream, size);
+            }
+        }
+        
+        FlacInfo *info = &stream->info;
+        if (info->maxBlockSamples && info->channelCount)
+        {
+            // NOTE(michiel): Walk all frame headers once. A sync code inside frame data can pass the
+            // header CRC8, so every frame is confirmed by its CRC16 before it goes in the index. The
+            // search for the next frame continues after the end of a confirmed one, a damaged frame is
+            // skipped.
+            u32 frameCapacity = 1024;
+            if (info->totalSamples)
+            {
+                frameCapacity = (u32)minimum(info->totalSamples / info->maxBlockSamples + 2, (u64)U32_MAX);
+            }
+            stream->frames = allocate_array(allocator, FlacFrameIndex, frameCapacity, default_memory_alloc());
+            
+            crc16_init_table(0x8005, stream->crc16Table);
+            
+            u64 nextSample = 0;
+            u8 *at = find_next_frame(bitStream, info, bitStream->at);
+            while (at)
+            {
+                BitStreamer probe = *bitStream;
+                probe.at = at;
+                probe.remainingBits = 0;
+                probe.remainingData = 0;
+                FlacFrameHeader header = parse_frame_header(&probe, info);
+                
+                u64 firstSample = header.variableBlocks ? header.sampleNumber : header.frameNumber * info->maxBlockSamples;
+                u8 *frameEnd = 0;
+                if ((header.error == FlacError_None) && ((stream->frameCount == 0) || (firstSample >= nextSample)))
+                {
+                    frameEnd = find_flac_frame_end(stream, bitStream, at);
+                }
+                
+                if (frameEnd)
+                {
+                    if (stream->frameCount == frameCapacity)
+                    {
+                        u32 newCapacity = frameCapacity * 2;
+                        FlacFrameIndex *newFrames = allocate_array(allocator, FlacFrameIndex, newCapacity, default_memory_alloc());
+                        memcpy(newFrames, stream->frames, frameCapacity * sizeof(FlacFrameIndex));
+                        deallocate(allocator, stream->frames);
+                        stream->frames = newFrames;
+                        frameCapacity = newCapacity;
+                    }
+                    
+                    FlacFrameIndex *frame = stream->frames + stream->frameCount++;
+                    frame->firstSample = firstSample;
+                    frame->offset = at - data.data;
+                    frame->size = (u32)(frameEnd - at);
+                    frame->sampleCount = header.blockSize;
+                    nextSample = firstSample + header.blockSize;
+                    
+                    at = find_next_frame(bitStream, info, frameEnd);
+                }
+                else
+                {
+                    at = find_next_frame(bitStream, info, at + 1);
+                }
+            }
+            
+            u32 totalSampleCount = (u32)info->maxBlockSamples * info->channelCount;
+            if (!stream->residualSamples)
+            {
+                allocate_flac_stream_scratch(stream);
+            }
+            stream->interleaved = allocate_array(allocator, s32, totalSampleCount, default_memory_alloc());
+            
+            result = stream->frameCount > 0;
+        }
+    }
+    
+    return result;
+}
+
+internal void
+close_flac_stream(FlacStream *stream)
+{
+    if (stream->cache)
+    {
+        flac_cache_evict_file(stream->cache, stream->fileId);
+    }
+    if (stream->frames)
+    {
+        deallocate(stream->allocator, stream->frames);
+    }
+    if (stream->channelSamples)
+    {
+        deallocate(stream->allocator, stream->channelSamples);
+    }
+    if (stream->wideSamples)
+    {
+        deallocate(stream->allocator, stream->wideSamples);
+    }
+    if (stream->interleaved)
+    {
+        deallocate(stream->allocator, stream->interleaved);
+    }
+    if (stream->residualSamples)
+    {
+        deallocate(stream->allocator, stream->residualSamples);
+    }
+    *stream = {};
+}
+
+internal u32
+find_flac_frame(FlacStream *stream, u64 sample)
+{
+    // NOTE(michiel): Index of the frame containing sample (frameCount if it is past the end)
+    u32 result = stream->frameCount;
+    if (stream->frameCount && (sample < (stream->frames[stream->frameCount - 1].firstSample +
+                                          stream->frames[stream->frameCount - 1].sampleCount)))
+    {
+        u32 low = 0;
+        u32 high = stream->frameCount - 1;
+        while (low < high)
+        {
+            u32 mid = low + (high - low + 1) / 2;
+            if (stream->frames[mid].firstSample <= sample)
+            {
+                low = mid;
+            }
+            else
+            {
+                high = mid - 1;
+            }
+        }
+        result = low;
+    }
+    return result;
+}
+
+internal s32 *
+get_flac_frame_samples(FlacStream *stream, u32 frameIndex)
+{
+    // NOTE(michiel): Returns the interleaved samples of the frame, from the cache if possible. The
+    // pointer is valid until the next call (or until the entry is evicted). A damaged frame is concealed
+    // with silence when resilient, otherwise it returns 0.
+    i_expect(frameIndex < stream->frameCount);
+    FlacFrameIndex *frame = stream->frames + frameIndex;
+    
+    s32 *result = 0;
+    if (stream->cache)
+    {
+        FlacCacheEntry *entry = flac_cache_lookup(stream->cache, stream->fileId, frame->firstSample);
+        if (entry)
+        {
+            result = entry->samples;
+        }
+    }
+    
+    if (!result)
+    {
+        BitStreamer bitStream = create_bitstreamer(stream->data, BitStream_BigEndian);
+        bitStream.at = stream->data.data + frame->offset;
+        
+        FlacFrameHeader frameHeader = {};
+        FlacDecodeError error = decode_frame(&bitStream, &stream->info, &frameHeader, stream->residualSamples,
+                                             stream->channelSamples, stream->wideSamples);
+        if (error == FlacError_None)
+        {
+            interleave_samples(&frameHeader, stream->channelSamples, stream->wideSamples, stream->interleaved);
+            if (stream->cache)
+            {
+                flac_cache_insert(stream->cache, stream->fileId, frame->firstSample,
+                                  stream->info.channelCount, frame->sampleCount, stream->interleaved);
+            }
+            result = stream->interleaved;
+        }
+        else
+        {
+            report_flac_error(error, frameIndex, frame->offset);
+            if (gFlacErrors.resilient)
+            {
+                // NOTE(michiel): Conceal with silence, but don't cache it
+                u32 sampleCount = frame->sampleCount * stream->info.channelCount;
+                for (u32 sampleIdx = 0; sampleIdx < sampleCount; ++sampleIdx)
+                {
+                    stream->interleaved[sampleIdx] = 0;
+                }
+                gFlacErrors.concealedSamples += frame->sampleCount;
+                result = stream->interleaved;
+            }
+        }
+    }
+    
+    return result;
+}
+
+internal u32
+decode_flac_region(FlacStream *stream, u64 firstSample, u32 sampleCount, s32 *output)
+{
+    // NOTE(michiel): expects output[sampleCount * channelCount], interleaved. Returns the number of
+    // inter-channel samples written, which is less than sampleCount at the end of the stream or at a
+    // damaged frame when not resilient. Frames the index left out are concealed with silence.
+    u32 channelCount = stream->info.channelCount;
+    u32 result = 0;
+    
+    u32 frameIndex = find_flac_frame(stream, firstSample);
+    while ((result < sampleCount) && (frameIndex < stream->frameCount))
+    {
+        FlacFrameIndex *frame = stream->frames + frameIndex;
+        u64 startSample = firstSample + result;
+        if (frame->firstSample > startSample)
+        {
+            u32 gapCount = (u32)minimum(frame->firstSample - startSample, (u64)(sampleCount - result));
+            memset(output + (umm)result * channelCount, 0, (umm)gapCount * channelCount * sizeof(s32));
+            gFlacErrors.concealedSamples += gapCount;
+            result += gapCount;
+        }
+        else
+        {
+            s32 *frameSamples = get_flac_frame_samples(stream, frameIndex);
+            if (!frameSamples)
+            {
+                break;
+            }
+        
+            u32 frameOffset = (u32)minimum(startSample - frame->firstSample, (u64)frame->sampleCount);
+            u32 copyCount = minimum(frame->sampleCount - frameOffset, sampleCount - result);
+            memcpy(output + (umm)result * channelCount, frameSamples + (umm)frameOffset * channelCount,
+                   (umm)copyCount * channelCount * sizeof(s32));
+        
+            result += copyCount;
+            ++frameIndex;
+        }
+    }
+    
+    return result;
+}
@@ -0,0 +1,63 @@
+// NOTE(michiel): Random access on top of the frame decoder. A FlacStream indexes all frames of an in
+// memory flac file once, after that any region can be decoded. Decoded frames can be kept in a
+// FlacFrameCache, so scrubbing back and forth over the same audio only decodes it once.
+
+struct FlacFrameIndex
+{
+    u64 firstSample;  // NOTE(michiel): Inter-channel sample number of the first sample in the frame
+    u64 offset;       // NOTE(michiel): Byte offset of the frame header in the file
+    u32 size;         // NOTE(michiel): Bytes in the frame, its CRC16 included
+    u32 sampleCount;
+};
+
+struct FlacCacheEntry
+{
+    u64 fileId;
+    u64 firstSample;
+    u32 sampleCount;
+    u32 channelCount;
+    umm size;         // NOTE(michiel): Total allocation size, entry included
+    s32 *samples;     // NOTE(michiel): Interleaved, as written by interleave_samples
+    
+    FlacCacheEntry *prevLRU;
+    FlacCacheEntry *nextLRU;
+    FlacCacheEntry *nextInHash;
+};
+
+struct FlacFrameCache
+{
+    MemoryAllocator *allocator;
+    
+    umm memoryBudget;
+    umm memoryUsed;
+    
+    u32 hashMask;
+    FlacCacheEntry **hashTable;
+    
+    // NOTE(michiel): Sentinel of the LRU list, sentinel.nextLRU is the most recently used entry
+    FlacCacheEntry sentinel;
+    
+    u64 hits;
+    u64 misses;
+    u64 evictions;
+};
+
+struct FlacStream
+{
+    MemoryAllocator *allocator;
+    u64 fileId;       // NOTE(michiel): Cache key, must be unique for every file sharing a cache
+    Buffer data;
+    FlacInfo info;
+    
+    u32 frameCount;
+    FlacFrameIndex *frames;
+    
+    s32 *channelSamples;
+    s64 *wideSamples;       // NOTE(michiel): Used instead of channelSamples for streams above FLAC_MAX_NARROW_BITS
+    s32 *residualSamples;
+    s32 *interleaved;
+    
+    u16 crc16Table[256];
+    
+    FlacFrameCache *cache;  // NOTE(michiel): Optional
+};
@@ -0,0 +1,202 @@
+#include "../libberdip/platform.h"
+#include "../libberdip/bitstreamer.h"
+#include "../libberdip/random.h"
+#include "../libberdip/linux_memory.h"
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <math.h>
+#include <pthread.h>
+#include <x86intrin.h>
+
+global API api;
+global MemoryAPI *gMemoryApi = &api.memory;
+
+#ifndef FLAC_DEBUG_LEVEL
+#define FLAC_DEBUG_LEVEL  0
+#endif
+
+#include "flac.h"
+#include "flac_encoder.h"
+#include "flac_stream.h"
+
+#include "../libberdip/memory.cpp"
+#include "../libberdip/linux_memory.cpp"
+#include "../libberdip/linux_file.c"
+#include "../libberdip/crc.cpp"
+
+#include "../libberdip/bitstreamer.cpp"
+#include "flac.cpp"
+#include "flac_encoder.cpp"
+#include "flac_stream.cpp"
+
+// NOTE(michiel): Random access decoding of a stream with damaged frames. One frame is damaged before
+// the stream is opened, so the index leaves it out and regions over it get silence. Another frame is
+// damaged after opening, which stops a region unless resilient.
+
+#define FLAC_STREAM_TEST_BLOCK    256
+#define FLAC_STREAM_TEST_FRAMES   8
+#define FLAC_STREAM_TEST_SAMPLES  (FLAC_STREAM_TEST_BLOCK * FLAC_STREAM_TEST_FRAMES)
+
+struct FlacTestStream
+{
+    Buffer data;
+    u64 frameOffsets[FLAC_STREAM_TEST_FRAMES];
+    umm frameSizes[FLAC_STREAM_TEST_FRAMES];
+    s32 *expected;      // NOTE(michiel): Interleaved and left aligned, as decode_flac_region writes them
+};
+
+internal FlacTestStream
+encode_test_stream(MemoryAllocator *allocator)
+{
+    // NOTE(michiel): 16 bit stereo noise, one small block per frame
+    u32 channelCount = 2;
+    u32 sampleCount = FLAC_STREAM_TEST_SAMPLES;
+    FlacTestStream result = {};
+    result.expected = allocate_array(allocator, s32, sampleCount * channelCount, default_memory_alloc());
+    u8 *input = (u8 *)allocate_size(allocator, (umm)sampleCount * channelCount * 2, default_memory_alloc());
+    
+    RandomSeriesPCG random = random_seed_pcg(0x853C49E6748FEA9BULL, 0xDA3E39CB94B95BDBULL);
+    for (u32 index = 0; index < sampleCount * channelCount; ++index)
+    {
+        s32 sample = (s32)(random_next_u32(&random) % 2001) - 1000;
+        input[2 * index + 0] = (u8)sample;
+        input[2 * index + 1] = (u8)(sample >> 8);
+        result.expected[index] = (s32)((u32)sample << 16);
+    }
+    
+    FlacEncoder encoder = {};
+    encoder.settings.blockSize = FLAC_STREAM_TEST_BLOCK;
+    encoder.settings.maxLpcOrder = 8;
+    encoder.settings.maxPartitionOrder = 4;
+    encoder.settings.stereoDecorrelation = true;
+    encoder.settings.threadCount = 1;
+    encoder.info.sampleRate = 44100;
+    encoder.info.channelCount = channelCount;
+    encoder.info.bitsPerSample = 16;
+    encoder.input = input;
+    encoder.inputSampleBytes = 2;
+    encoder.totalSamples = sampleCount;
+    init_flac_encoder(allocator, &encoder);
+    i_expect(encoder.frameCount == FLAC_STREAM_TEST_FRAMES);
+    
+    umm maxSize = 64 + (umm)encoder.frameCount * encoder.maxFrameBytes;
+    result.data.data = (u8 *)allocate_size(allocator, maxSize, default_memory_alloc());
+    FlacBitWriter headerWriter = create_bitwriter({maxSize, result.data.data});
+    put_stream_info(&headerWriter, &encoder.info, true);
+    u8 *at = headerWriter.at;
+    
+    for (u32 batchStart = 0; batchStart < encoder.frameCount; batchStart += encoder.batchFrameCount)
+    {
+        u32 batchEnd = minimum(batchStart + encoder.batchFrameCount, encoder.frameCount);
+        encode_flac_batch(&encoder, batchStart, batchEnd);
+        for (u32 frameIndex = batchStart; frameIndex < batchEnd; ++frameIndex)
+        {
+            FlacEncodedFrame *frame = encoder.batchFrames + (frameIndex - batchStart);
+            result.frameOffsets[frameIndex] = at - result.data.data;
+            result.frameSizes[frameIndex] = frame->byteCount;
+            memcpy(at, frame->data.data, frame->byteCount);
+            at += frame->byteCount;
+        }
+    }
+    result.data.size = at - result.data.data;
+    
+    return result;
+}
+
+internal void
+damage_test_frame(FlacTestStream *stream, u32 frameIndex)
+{
+    // NOTE(michiel): Flips bytes in the middle of the subframes, the header stays intact
+    u8 *middle = stream->data.data + stream->frameOffsets[frameIndex] + stream->frameSizes[frameIndex] / 2;
+    for (u32 byteIdx = 0; byteIdx < 4; ++byteIdx)
+    {
+        middle[byteIdx] ^= 0x5A;
+    }
+}
+
+internal b32
+check_test_region(FlacStream *stream, FlacTestStream *test, char *name, u64 firstSample, u32 sampleCount,
+                  u32 expectedCount, u32 silentFrame, u32 damagedFrame, s32 *output)
+{
+    // NOTE(michiel): Samples of silentFrame and damagedFrame are expected to be zero
+    u32 channelCount = stream->info.channelCount;
+    u64 concealedBefore = gFlacErrors.concealedSamples;
+    u32 count = decode_flac_region(stream, firstSample, sampleCount, output);
+    
+    u32 mismatches = 0;
+    u32 silentCount = 0;
+    for (u32 index = 0; index < count; ++index)
+    {
+        u64 sample = firstSample + index;
+        u32 frameIndex = (u32)(sample / FLAC_STREAM_TEST_BLOCK);
+        b32 silent = (frameIndex == silentFrame) || (frameIndex == damagedFrame);
+        silentCount += silent ? 1 : 0;
+        for (u32 channelIdx = 0; channelIdx < channelCount; ++channelIdx)
+        {
+            s32 expected = silent ? 0 : test->expected[sample * channelCount + channelIdx];
+            if (output[index * channelCount + channelIdx] != expected)
+            {
+                ++mismatches;
+            }
+        }
+    }
+    
+    u64 concealed = gFlacErrors.concealedSamples - concealedBefore;
+    b32 result = (count == expectedCount) && (mismatches == 0) && (concealed == silentCount);
+    fprintf(stdout, "%-28s: %s (%u of %u samples, %u mismatches, %lu concealed)\n", name, result ? "ok" : "FAIL",
+            count, expectedCount, mismatches, concealed);
+    return result;
+}
+
+s32 main(s32 argc, char **argv)
+{
+    linux_memory_api(&api.memory);
+    linux_file_api(&api.file);
+    
+    MemoryAllocator platformAlloc = {};
+    initialize_platform_allocator(0, &platformAlloc);
+    
+    u32 failures = 0;
+    u32 block = FLAC_STREAM_TEST_BLOCK;
+    u32 total = FLAC_STREAM_TEST_SAMPLES;
+    u32 noFrame = U32_MAX;
+    
+    FlacTestStream test = encode_test_stream(&platformAlloc);
+    damage_test_frame(&test, 2);
+    
+    FlacStream stream = {};
+    if (open_flac_stream(&platformAlloc, test.data, 1, 0, &stream) &&
+        (stream.frameCount == FLAC_STREAM_TEST_FRAMES - 1))
+    {
+        s32 *output = allocate_array(&platformAlloc, s32, total * stream.info.channelCount, default_memory_alloc());
+        
+        gFlacErrors.resilient = false;
+        failures += check_test_region(&stream, &test, "inside the left out frame", 2 * block + 20, 100,
+                                      100, 2, noFrame, output) ? 0 : 1;
+        failures += check_test_region(&stream, &test, "over the left out frame", block + 8, 600,
+                                      600, 2, noFrame, output) ? 0 : 1;
+        failures += check_test_region(&stream, &test, "whole stream", 0, total,
+                                      total, 2, noFrame, output) ? 0 : 1;
+        
+        // NOTE(michiel): Frame 5 is in the index, so it only fails when it is decoded
+        damage_test_frame(&test, 5);
+        failures += check_test_region(&stream, &test, "stop at a damaged frame", 0, total,
+                                      5 * block, 2, noFrame, output) ? 0 : 1;
+        gFlacErrors.resilient = true;
+        failures += check_test_region(&stream, &test, "conceal a damaged frame", 0, total,
+                                      total, 2, 5, output) ? 0 : 1;
+        
+        close_flac_stream(&stream);
+    }
+    else
+    {
+        fprintf(stdout, "open with a damaged frame: FAIL (%u frames indexed)\n", stream.frameCount);
+        ++failures;
+    }
+    
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,334 @@
+#include "../libberdip/platform.h"
+#include "../libberdip/bitstreamer.h"
+#include "../libberdip/random.h"
+#include "../libberdip/linux_memory.h"
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <math.h>
+#include <pthread.h>
+#include <x86intrin.h>
+
+global API api;
+global MemoryAPI *gMemoryApi = &api.memory;
+
+#ifndef FLAC_DEBUG_LEVEL
+#define FLAC_DEBUG_LEVEL  0
+#endif
+
+#include "flac.h"
+#include "flac_encoder.h"
+
+#include "../libberdip/memory.cpp"
+#include "../libberdip/linux_memory.cpp"
+#include "../libberdip/linux_file.c"
+#include "../libberdip/crc.cpp"
+
+#include "../libberdip/bitstreamer.cpp"
+#include "flac.cpp"
+#include "flac_encoder.cpp"
+
+// NOTE(michiel): Decodes a hand written 32 bit stereo stream, the only way to get one as the encoder
+// stops at 24 bits. The samples are close to full scale, so the predictions only fit in 64 bits, and
+// every subframe type shows up with and without wasted bits.
+
+#define FLAC_WIDE_TEST_BLOCK  256
+
+struct WideTestSubframe
+{
+    FlacSubframeType type;
+    u32 order;
+    u32 wastedBits;
+};
+
+// NOTE(michiel): One row per frame, left and right channel
+global WideTestSubframe gWideTestFrames[][2] =
+{
+    {{FlacSubframe_Verbatim, 0, 0}, {FlacSubframe_Verbatim, 0, 4}},
+    {{FlacSubframe_Fixed,    2, 0}, {FlacSubframe_Fixed,    4, 8}},
+    {{FlacSubframe_LPC,      4, 3}, {FlacSubframe_LPC,      8, 0}},
+    {{FlacSubframe_Constant, 0, 0}, {FlacSubframe_Fixed,    1, 1}},
+};
+
+internal void
+put_wide_residual(FlacBitWriter *writer, u32 order, s32 *residual)
+{
+    // NOTE(michiel): Rice coding with 5 bit parameters, the residuals of full scale samples are large
+    u32 partitionOrder = 2;
+    u32 partitionSamples = FLAC_WIDE_TEST_BLOCK >> partitionOrder;
+    put_bits(writer, 2, 1);
+    put_bits(writer, 4, partitionOrder);
+    
+    s32 *source = residual;
+    for (u32 partitionIdx = 0; partitionIdx < (1u << partitionOrder); ++partitionIdx)
+    {
+        u32 count = (partitionIdx == 0) ? (partitionSamples - order) : partitionSamples;
+        u64 sum = 0;
+        for (u32 index = 0; index < count; ++index)
+        {
+            sum += ((u32)source[index] << 1) ^ (u32)(source[index] >> 31);
+        }
+        u64 mean = count ? (sum / count) : 0;
+        u32 riceParameter = 0;
+        while ((riceParameter < 30) && ((2ULL << riceParameter) <= mean))
+        {
+            ++riceParameter;
+        }
+        
+        put_bits(writer, 5, riceParameter);
+        for (u32 index = 0; index < count; ++index)
+        {
+            put_rice(writer, riceParameter, *source++);
+        }
+    }
+}
+
+internal s64
+predict_wide_sample(WideTestSubframe *subframe, s32 *coefficients, u32 shift, s64 *x)
+{
+    // NOTE(michiel): x points at the sample to predict
+    s64 result = 0;
+    if (subframe->type == FlacSubframe_Fixed)
+    {
+        switch (subframe->order)
+        {
+            case 0: { result = 0; } break;
+            case 1: { result = x[-1]; } break;
+            case 2: { result = 2 * x[-1] - x[-2]; } break;
+            case 3: { result = 3 * x[-1] - 3 * x[-2] + x[-3]; } break;
+            case 4: { result = 4 * x[-1] - 6 * x[-2] + 4 * x[-3] - x[-4]; } break;
+            INVALID_DEFAULT_CASE;
+        }
+    }
+    else
+    {
+        for (u32 coefIdx = 0; coefIdx < subframe->order; ++coefIdx)
+        {
+            result += (s64)coefficients[coefIdx] * x[-1 - (s32)coefIdx];
+        }
+        result >>= shift;
+    }
+    return result;
+}
+
+internal Buffer
+build_wide_test_stream(MemoryAllocator *allocator, FlacInfo *info, s32 *expected)
+{
+    // NOTE(michiel): expected gets the interleaved samples of all frames
+    u32 frameCount = array_count(gWideTestFrames);
+    u32 channelCount = 2;
+    umm maxSize = (umm)frameCount * (32 + channelCount * (FLAC_WIDE_TEST_BLOCK * 12 + 128));
+    Buffer result = {};
+    result.data = (u8 *)allocate_size(allocator, maxSize, default_memory_alloc());
+    
+    u8 crc8Table[256];
+    crc8_init_table(0x07, crc8Table);
+    u16 crc16Table[256];
+    crc16_init_table(0x8005, crc16Table);
+    
+    FlacBitWriter writer_ = create_bitwriter({maxSize, result.data});
+    FlacBitWriter *writer = &writer_;
+    
+    s64 samples[FLAC_WIDE_TEST_BLOCK];
+    s32 residual[FLAC_WIDE_TEST_BLOCK];
+    RandomSeriesPCG random = random_seed_pcg(0x6A09E667F3BCC908ULL, 0xBB67AE8584CAA73BULL);
+    
+    for (u32 frameIdx = 0; frameIdx < frameCount; ++frameIdx)
+    {
+        u8 *frameStart = writer->at;
+        put_bits(writer, 14, 0x3FFE);
+        put_bits(writer, 1, 0);
+        put_bits(writer, 1, 0);     // NOTE(michiel): Fixed block size
+        put_bits(writer, 4, 0x8);   // NOTE(michiel): 256 samples
+        put_bits(writer, 4, 0x9);   // NOTE(michiel): 44.1kHz
+        put_bits(writer, 4, FlacChannel_LeftRight);
+        put_bits(writer, 3, 7);     // NOTE(michiel): 32 bits
+        put_bits(writer, 1, 0);
+        put_utf8_number(writer, frameIdx);
+        put_bits(writer, 8, crc8_calc_crc(crc8Table, writer->at - frameStart, frameStart));
+        
+        for (u32 channelIdx = 0; channelIdx < channelCount; ++channelIdx)
+        {
+            WideTestSubframe *subframe = &gWideTestFrames[frameIdx][channelIdx];
+            u32 wasted = subframe->wastedBits;
+            u32 bitCount = 32 - wasted;
+            s64 wastedMask = ((s64)1 << wasted) - 1;
+            
+            // NOTE(michiel): A sine just below full scale with some noise, the low wasted bits cleared
+            for (u32 index = 0; index < FLAC_WIDE_TEST_BLOCK; ++index)
+            {
+                u32 position = frameIdx * FLAC_WIDE_TEST_BLOCK + index;
+                f64 sine = 2130706432.0 * sin(0.0628 * (f64)position + 1.3 * (f64)channelIdx);
+                s64 sample = (s64)sine + (s64)(random_next_u32(&random) & 0xFF) - 128;
+                samples[index] = sample & ~wastedMask;
+            }
+            if (subframe->type == FlacSubframe_Verbatim)
+            {
+                samples[5] = (s64)S32_MIN & ~wastedMask;
+                samples[6] = (s64)S32_MAX & ~wastedMask;
+            }
+            else if (subframe->type == FlacSubframe_Constant)
+            {
+                for (u32 index = 0; index < FLAC_WIDE_TEST_BLOCK; ++index)
+                {
+                    samples[index] = S32_MIN;
+                }
+            }
+            for (u32 index = 0; index < FLAC_WIDE_TEST_BLOCK; ++index)
+            {
+                expected[(frameIdx * FLAC_WIDE_TEST_BLOCK + index) * channelCount + channelIdx] = (s32)samples[index];
+                samples[index] >>= wasted;
+            }
+            
+            u32 typeCode = subframe->type;
+            if (subframe->type == FlacSubframe_Fixed)
+            {
+                typeCode |= subframe->order;
+            }
+            else if (subframe->type == FlacSubframe_LPC)
+            {
+                typeCode |= subframe->order - 1;
+            }
+            put_bits(writer, 8, (typeCode << 1) | (wasted ? 1 : 0));
+            if (wasted)
+            {
+                put_bits(writer, wasted, 1);
+            }
+            
+            switch (subframe->type)
+            {
+                case FlacSubframe_Constant:
+                {
+                    put_signed(writer, bitCount, (s32)samples[0]);
+                } break;
+                
+                case FlacSubframe_Verbatim:
+                {
+                    for (u32 index = 0; index < FLAC_WIDE_TEST_BLOCK; ++index)
+                    {
+                        put_signed(writer, bitCount, (s32)samples[index]);
+                    }
+                } break;
+                
+                case FlacSubframe_Fixed:
+                case FlacSubframe_LPC:
+                {
+                    u32 order = subframe->order;
+                    for (u32 index = 0; index < order; ++index)
+                    {
+                        put_signed(writer, bitCount, (s32)samples[index]);
+                    }
+                    
+                    // NOTE(michiel): Order 4 is the third order fixed predictor, order 8 the second order one
+                    u32 precision = 15;
+                    u32 shift = 12;
+                    s32 coefficients[32] = {};
+                    if (order == 4)
+                    {
+                        coefficients[0] = 3 << shift;
+                        coefficients[1] = -(3 << shift);
+                        coefficients[2] = 1 << shift;
+                    }
+                    else
+                    {
+                        coefficients[0] = 2 << shift;
+                        coefficients[1] = -(1 << shift);
+                    }
+                    if (subframe->type == FlacSubframe_LPC)
+                    {
+                        put_bits(writer, 4, precision - 1);
+                        put_signed(writer, 5, shift);
+                        for (u32 coefIdx = 0; coefIdx < order; ++coefIdx)
+                        {
+                            put_signed(writer, precision, coefficients[coefIdx]);
+                        }
+                    }
+                    
+                    for (u32 index = order; index < FLAC_WIDE_TEST_BLOCK; ++index)
+                    {
+                        s64 value = samples[index] - predict_wide_sample(subframe, coefficients, shift, samples + index);
+                        i_expect((value >= S32_MIN) && (value <= S32_MAX));
+                        residual[index - order] = (s32)value;
+                    }
+                    put_wide_residual(writer, order, residual);
+                } break;
+                
+                INVALID_DEFAULT_CASE;
+            }
+        }
+        
+        align_bitwriter(writer);
+        put_bits(writer, 16, crc16_calc_crc(crc16Table, writer->at - frameStart, frameStart));
+    }
+    result.size = writer->at - result.data;
+    
+    *info = {};
+    info->minBlockSamples = FLAC_WIDE_TEST_BLOCK;
+    info->maxBlockSamples = FLAC_WIDE_TEST_BLOCK;
+    info->sampleRate = 44100;
+    info->channelCount = channelCount;
+    info->bitsPerSample = 32;
+    info->totalSamples = (u64)frameCount * FLAC_WIDE_TEST_BLOCK;
+    return result;
+}
+
+s32 main(s32 argc, char **argv)
+{
+    linux_memory_api(&api.memory);
+    linux_file_api(&api.file);
+    
+    MemoryAllocator platformAlloc = {};
+    initialize_platform_allocator(0, &platformAlloc);
+    enable_flac_stats();
+    
+    u32 frameCount = array_count(gWideTestFrames);
+    u32 channelCount = 2;
+    u32 totalCount = frameCount * FLAC_WIDE_TEST_BLOCK * channelCount;
+    s32 *expected = allocate_array(&platformAlloc, s32, totalCount, default_memory_alloc());
+    FlacInfo info = {};
+    Buffer data = build_wide_test_stream(&platformAlloc, &info, expected);
+    
+    i_expect(flac_needs_wide_samples(&info));
+    s64 *wideSamples = allocate_array(&platformAlloc, s64, FLAC_WIDE_TEST_BLOCK * channelCount, default_memory_alloc());
+    s32 *residualScratch = allocate_array(&platformAlloc, s32, FLAC_WIDE_TEST_BLOCK, default_memory_alloc());
+    s32 *interleaved = allocate_array(&platformAlloc, s32, FLAC_WIDE_TEST_BLOCK * channelCount, default_memory_alloc());
+    
+    u32 failures = 0;
+    BitStreamer bitStream = create_bitstreamer(data, BitStream_BigEndian);
+    for (u32 frameIdx = 0; frameIdx < frameCount; ++frameIdx)
+    {
+        FlacFrameHeader frameHeader = {};
+        FlacDecodeError error = decode_frame(&bitStream, &info, &frameHeader, residualScratch, (s32 *)0, wideSamples);
+        u32 mismatches = 0;
+        if (error == FlacError_None)
+        {
+            interleave_samples(&frameHeader, (s32 *)0, wideSamples, interleaved);
+            s32 *frameExpected = expected + frameIdx * FLAC_WIDE_TEST_BLOCK * channelCount;
+            for (u32 index = 0; index < FLAC_WIDE_TEST_BLOCK * channelCount; ++index)
+            {
+                if (interleaved[index] != frameExpected[index])
+                {
+                    ++mismatches;
+                }
+            }
+        }
+        
+        b32 ok = (error == FlacError_None) && (frameHeader.bitsPerSample == 32) && (mismatches == 0);
+        fprintf(stdout, "32 bit frame %u: %s (%s, %u mismatches)\n", frameIdx, ok ? "ok" : "FAIL",
+                gFlacErrorNames[error], mismatches);
+        failures += ok ? 0 : 1;
+    }
+    
+    // NOTE(michiel): Make sure every kind of subframe went through the decoder
+    b32 covered = ((gFlacStats.constantSubframes == 1) && (gFlacStats.verbatimSubframes == 2) &&
+                   (gFlacStats.fixedOrders[1] == 1) && (gFlacStats.fixedOrders[2] == 1) &&
+                   (gFlacStats.fixedOrders[4] == 1) && (gFlacStats.lpcOrders[4] == 1) &&
+                   (gFlacStats.lpcOrders[8] == 1) && (gFlacStats.wastedBitsSubframes == 4));
+    fprintf(stdout, "32 bit subframe coverage: %s\n", covered ? "ok" : "FAIL");
+    failures += covered ? 0 : 1;
+    
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,765 @@
+//
+// NOTE(michiel): Frame ids
+//
+
+global Id3FrameId gId3FrameIds[] =
+{
+    {"TIT2", Id3Kind_Title},           {"TT2", Id3Kind_Title},
+    {"TIT3", Id3Kind_Subtitle},        {"TT3", Id3Kind_Subtitle},
+    {"TIT1", Id3Kind_Grouping},        {"TT1", Id3Kind_Grouping},
+    {"TPE1", Id3Kind_Artist},          {"TP1", Id3Kind_Artist},
+    {"TPE2", Id3Kind_AlbumArtist},     {"TP2", Id3Kind_AlbumArtist},
+    {"TPE3", Id3Kind_Conductor},       {"TP3", Id3Kind_Conductor},
+    {"TALB", Id3Kind_Album},           {"TAL", Id3Kind_Album},
+    {"TRCK", Id3Kind_Track},           {"TRK", Id3Kind_Track},
+    {"TPOS", Id3Kind_Disc},            {"TPA", Id3Kind_Disc},
+    {"TYER", Id3Kind_Year},            {"TYE", Id3Kind_Year},           {"TDRC", Id3Kind_Year},
+    {"TDOR", Id3Kind_OriginalRelease}, {"TORY", Id3Kind_OriginalRelease}, {"TOR", Id3Kind_OriginalRelease},
+    {"TCON", Id3Kind_Genre},           {"TCO", Id3Kind_Genre},
+    {"TCOM", Id3Kind_Composer},        {"TCM", Id3Kind_Composer},
+    {"TEXT", Id3Kind_Lyricist},        {"TXT", Id3Kind_Lyricist},
+    {"TBPM", Id3Kind_Bpm},             {"TBP", Id3Kind_Bpm},
+    {"TMED", Id3Kind_Media},           {"TMT", Id3Kind_Media},
+    {"TPUB", Id3Kind_Publisher},       {"TPB", Id3Kind_Publisher},
+    {"TSOP", Id3Kind_ArtistSort},
+    {"TSOA", Id3Kind_AlbumSort},
+    {"TSOT", Id3Kind_TitleSort},
+    {"TLAN", Id3Kind_Language},        {"TLA", Id3Kind_Language},
+    {"TENC", Id3Kind_EncodedBy},       {"TEN", Id3Kind_EncodedBy},
+    {"TSSE", Id3Kind_EncoderSettings}, {"TSS", Id3Kind_EncoderSettings},
+    {"TCOP", Id3Kind_Copyright},       {"TCR", Id3Kind_Copyright},
+    {"TLEN", Id3Kind_Length},          {"TLE", Id3Kind_Length},
+    {"TIPL", Id3Kind_InvolvedPeople},  {"IPLS", Id3Kind_InvolvedPeople}, {"IPL", Id3Kind_InvolvedPeople},
+    {"TMCL", Id3Kind_MusicianCredits},
+    {"TXXX", Id3Kind_UserText},        {"TXX", Id3Kind_UserText},
+    {"COMM", Id3Kind_Comment},         {"COM", Id3Kind_Comment},
+    {"USLT", Id3Kind_Lyrics},          {"ULT", Id3Kind_Lyrics},
+    {"APIC", Id3Kind_Picture},         {"PIC", Id3Kind_Picture},
+    {"UFID", Id3Kind_UniqueFileId},    {"UFI", Id3Kind_UniqueFileId},
+    {"PRIV", Id3Kind_Private},
+};
+
+// NOTE(michiel): Perfect hash of the ids above, a multiply and shift gives the slot. The slot holds the id
+// to check against, ids that aren't in the list land on a slot with another (or no) id.
+global b32 gId3HashReady;
+global u32 gId3HashIds[ID3_HASH_SLOTS];
+global u8 gId3HashKinds[ID3_HASH_SLOTS];
+
+internal u32
+get_id3_hash_slot(u32 id)
+{
+    return (u32)(id * ID3_HASH_MULTIPLIER) >> 24;
+}
+
+internal void
+init_id3_frame_hash(void)
+{
+    if (!gId3HashReady)
+    {
+        for (u32 index = 0; index < array_count(gId3FrameIds); ++index)
+        {
+            Id3FrameId *frameId = gId3FrameIds + index;
+            u32 id = 0;
+            for (u32 charIdx = 0; charIdx < 4; ++charIdx)
+            {
+                id = (id << 8) | (u8)frameId->id[charIdx];
+            }
+            
+            u32 slot = get_id3_hash_slot(id);
+            i_expect(gId3HashIds[slot] == 0);
+            gId3HashIds[slot] = id;
+            gId3HashKinds[slot] = (u8)frameId->kind;
+        }
+        gId3HashReady = true;
+    }
+}
+
+internal Id3FrameKind
+get_id3_frame_kind(u32 id)
+{
+    u32 slot = get_id3_hash_slot(id);
+    return (gId3HashIds[slot] == id) ? (Id3FrameKind)gId3HashKinds[slot] : Id3Kind_Unknown;
+}
+
+//
+// NOTE(michiel): Tag parsing
+//
+
+internal u32
+get_id3_big_endian(u8 *data, u32 count)
+{
+    u32 result = 0;
+    for (u32 index = 0; index < count; ++index)
+    {
+        result = (result << 8) | data[index];
+    }
+    return result;
+}
+
+internal u32
+get_id3_syncsafe(u8 *data)
+{
+    // NOTE(michiel): 28 bits in 4 bytes, the top bit of every byte is 0
+    return (((u32)(data[0] & 0x7F) << 21) | ((u32)(data[1] & 0x7F) << 14) |
+            ((u32)(data[2] & 0x7F) <<  7) | ((u32)(data[3] & 0x7F) <<  0));
+}
+
+internal umm
+remove_id3_unsynchronisation(u8 *source, umm size, u8 *dest)
+{
+    // NOTE(michiel): Unsynchronisation puts a zero after every 0xFF, so the tag never has an mpeg sync.
+    // dest can be the same as source, the result is never longer.
+    umm destSize = 0;
+    for (umm index = 0; index < size; ++index)
+    {
+        u8 value = source[index];
+        dest[destSize++] = value;
+        if ((value == 0xFF) && ((index + 1) < size) && (source[index + 1] == 0x00))
+        {
+            ++index;
+        }
+    }
+    return destSize;
+}
+
+internal b32
+is_id3_frame_start(u8 *at, u8 *end, u32 idSize)
+{
+    // NOTE(michiel): The end of the tag and padding count as a frame start too
+    b32 result = false;
+    if ((at == end) || ((at < end) && (at[0] == 0)))
+    {
+        result = true;
+    }
+    else if ((at < end) && ((umm)(end - at) >= idSize))
+    {
+        result = true;
+        for (u32 index = 0; index < idSize; ++index)
+        {
+            u8 c = at[index];
+            result = result && (((c >= 'A') && (c <= 'Z')) || ((c >= '0') && (c <= '9')));
+        }
+    }
+    return result;
+}
+
+internal b32
+parse_id3v2_tag(MemoryAllocator *allocator, Buffer data, Id3Tag *tag)
+{
+    // NOTE(michiel): Returns false if data doesn't start with an ID3v2 tag. Frames that don't fit in the
+    // tag end the frame list, the tag size is still used to skip the tag.
+    *tag = {};
+    tag->allocator = allocator;
+    if ((data.size < ID3_HEADER_SIZE) || !(string(3, data.data) == string(3, "ID3")) ||
+        (data.data[3] < 2) || (data.data[3] > 4))
+    {
+        return false;
+    }
+    init_id3_frame_hash();
+    
+    tag->majorVersion = data.data[3];
+    tag->revision = data.data[4];
+    tag->flags = data.data[5];
+    tag->size = get_id3_syncsafe(data.data + 6);
+    tag->totalSize = ID3_HEADER_SIZE + tag->size;
+    if ((tag->majorVersion == 4) && (tag->flags & Id3Header_Footer))
+    {
+        tag->totalSize += ID3_HEADER_SIZE;
+    }
+    
+    if ((tag->majorVersion == 2) && (tag->flags & Id3Header_ExtendedHeader))
+    {
+        // NOTE(michiel): v2.2 compression was never defined, nothing in the tag can be read
+        return true;
+    }
+    
+    u8 *body = data.data + ID3_HEADER_SIZE;
+    umm bodySize = minimum((umm)tag->size, data.size - ID3_HEADER_SIZE);
+    if ((tag->majorVersion < 4) && (tag->flags & Id3Header_Unsynchronisation))
+    {
+        // NOTE(michiel): Before v2.4 the whole tag is unsynchronised, headers included
+        tag->clean = allocate_array(allocator, u8, bodySize, default_memory_alloc());
+        bodySize = remove_id3_unsynchronisation(body, bodySize, tag->clean);
+        body = tag->clean;
+    }
+    
+    if ((tag->flags & Id3Header_ExtendedHeader) && (bodySize >= 4))
+    {
+        // NOTE(michiel): The v2.3 size leaves out its own 4 bytes, the v2.4 one is syncsafe and doesn't
+        umm extendedSize = (tag->majorVersion == 3) ? get_id3_big_endian(body, 4) + 4 : get_id3_syncsafe(body);
+        extendedSize = minimum(extendedSize, bodySize);
+        body += extendedSize;
+        bodySize -= extendedSize;
+    }
+    
+    u32 idSize = (tag->majorVersion == 2) ? 3 : 4;
+    u32 frameHeaderSize = (tag->majorVersion == 2) ? 6 : 10;
+    u32 frameCapacity = 32;
+    tag->frames = allocate_array(allocator, Id3Frame, frameCapacity, default_memory_alloc());
+    u8 *cleanAt = tag->clean;
+    
+    u8 *at = body;
+    u8 *end = body + bodySize;
+    while (((umm)(end - at) >= frameHeaderSize) && (at[0] != 0) && is_id3_frame_start(at, end, idSize))
+    {
+        u32 id = get_id3_big_endian(at, idSize) << (8 * (4 - idSize));
+        u32 frameSize = 0;
+        u32 flags = 0;
+        if (tag->majorVersion == 2)
+        {
+            frameSize = get_id3_big_endian(at + 3, 3);
+        }
+        else if (tag->majorVersion == 3)
+        {
+            frameSize = get_id3_big_endian(at + 4, 4);
+            u8 format = at[9];
+            // NOTE(michiel): v2.3 compressed frames also start with the decompressed size
+            flags |= (format & 0x80) ? (Id3Frame_Compressed | Id3Frame_DataLength) : 0;
+            flags |= (format & 0x40) ? Id3Frame_Encrypted : 0;
+            flags |= (format & 0x20) ? Id3Frame_Grouping : 0;
+        }
+        else
+        {
+            // NOTE(michiel): Some writers (iTunes) used plain sizes in v2.4 tags, use that when the
+            // syncsafe size doesn't lead to the next frame and the plain one does.
+            frameSize = get_id3_syncsafe(at + 4);
+            u32 plainSize = get_id3_big_endian(at + 4, 4);
+            if ((plainSize != frameSize) &&
+                !is_id3_frame_start(at + frameHeaderSize + frameSize, end, idSize) &&
+                is_id3_frame_start(at + frameHeaderSize + plainSize, end, idSize))
+            {
+                frameSize = plainSize;
+            }
+            flags = at[9] & (Id3Frame_Grouping | Id3Frame_Compressed | Id3Frame_Encrypted |
+                             Id3Frame_Unsynchronised | Id3Frame_DataLength);
+            if (tag->flags & Id3Header_Unsynchronisation)
+            {
+                flags |= Id3Frame_Unsynchronised;
+            }
+        }
+        at += frameHeaderSize;
+        if (frameSize > (umm)(end - at))
+        {
+            break;
+        }
+        
+        Buffer frameData = {frameSize, at};
+        at += frameSize;
+        
+        u32 skip = ((flags & Id3Frame_Grouping) ? 1 : 0) + ((flags & Id3Frame_DataLength) ? 4 : 0);
+        if (skip > frameData.size)
+        {
+            continue;
+        }
+        frameData.data += skip;
+        frameData.size -= skip;
+        
+        if (flags & Id3Frame_Unsynchronised)
+        {
+            if (!tag->clean)
+            {
+                tag->clean = allocate_array(allocator, u8, bodySize, default_memory_alloc());
+                cleanAt = tag->clean;
+            }
+            umm cleanSize = remove_id3_unsynchronisation(frameData.data, frameData.size, cleanAt);
+            frameData.data = cleanAt;
+            frameData.size = cleanSize;
+            cleanAt += cleanSize;
+        }
+        
+        if (tag->frameCount == frameCapacity)
+        {
+            u32 newCapacity = frameCapacity * 2;
+            Id3Frame *newFrames = allocate_array(allocator, Id3Frame, newCapacity, default_memory_alloc());
+            memcpy(newFrames, tag->frames, frameCapacity * sizeof(Id3Frame));
+            deallocate(allocator, tag->frames);
+            tag->frames = newFrames;
+            frameCapacity = newCapacity;
+        }
+        
+        Id3Frame *frame = tag->frames + tag->frameCount++;
+        frame->id = id;
+        frame->flags = flags;
+        frame->data = frameData;
+        // NOTE(michiel): Compressed (zlib) and encrypted contents can't be read, only their id is kept
+        frame->kind = (flags & (Id3Frame_Compressed | Id3Frame_Encrypted)) ? Id3Kind_Unknown : get_id3_frame_kind(id);
+    }
+    
+    return true;
+}
+
+internal void
+free_id3v2_tag(Id3Tag *tag)
+{
+    if (tag->frames)
+    {
+        deallocate(tag->allocator, tag->frames);
+    }
+    if (tag->clean)
+    {
+        deallocate(tag->allocator, tag->clean);
+    }
+    *tag = {};
+}
+
+internal Id3Frame *
+find_id3_frame(Id3Tag *tag, Id3FrameKind kind)
+{
+    Id3Frame *result = 0;
+    for (u32 frameIdx = 0; frameIdx < tag->frameCount; ++frameIdx)
+    {
+        if (tag->frames[frameIdx].kind == kind)
+        {
+            result = tag->frames + frameIdx;
+            break;
+        }
+    }
+    return result;
+}
+
+//
+// NOTE(michiel): Frame contents
+//
+
+internal Id3Encoding
+get_id3_encoding(u8 value)
+{
+    return (value <= Id3Encoding_Utf8) ? (Id3Encoding)value : Id3Encoding_Latin1;
+}
+
+internal Id3Text
+get_id3_text_field(Id3Encoding encoding, u8 **at, u8 *end)
+{
+    // NOTE(michiel): Takes a terminated string from *at and moves *at past the terminator. UTF-16 is
+    // terminated by two zero bytes on a character boundary.
+    u8 *start = *at;
+    u8 *terminator = end;
+    u32 terminatorSize = 1;
+    if ((encoding == Id3Encoding_Utf16) || (encoding == Id3Encoding_Utf16BE))
+    {
+        terminatorSize = 2;
+        for (u8 *scan = start; (scan + 1) < end; scan += 2)
+        {
+            if ((scan[0] == 0) && (scan[1] == 0))
+            {
+                terminator = scan;
+                break;
+            }
+        }
+    }
+    else if (start < end)
+    {
+        u8 *zero = (u8 *)memchr(start, 0, end - start);
+        if (zero)
+        {
+            terminator = zero;
+        }
+    }
+    
+    Id3Text result = {};
+    result.encoding = encoding;
+    result.raw.data = start;
+    result.raw.size = terminator - start;
+    *at = ((umm)(end - terminator) > terminatorSize) ? terminator + terminatorSize : end;
+    return result;
+}
+
+internal Id3Text
+get_id3_text(Id3Frame *frame)
+{
+    // NOTE(michiel): All values of a text frame, v2.4 separates multiple values with terminators
+    Id3Text result = {};
+    if (frame->data.size)
+    {
+        result.encoding = get_id3_encoding(frame->data.data[0]);
+        result.raw.data = frame->data.data + 1;
+        result.raw.size = frame->data.size - 1;
+        
+        // NOTE(michiel): Drop the terminators at the end
+        u32 unitSize = ((result.encoding == Id3Encoding_Utf16) || (result.encoding == Id3Encoding_Utf16BE)) ? 2 : 1;
+        result.raw.size -= result.raw.size % unitSize;
+        while ((result.raw.size >= unitSize) && (result.raw.data[result.raw.size - 1] == 0) &&
+               (result.raw.data[result.raw.size - unitSize] == 0))
+        {
+            result.raw.size -= unitSize;
+        }
+    }
+    return result;
+}
+
+internal b32
+next_id3_text_value(Id3Text *text, Id3Text *value)
+{
+    // NOTE(michiel): Splits the first value off text
+    b32 result = false;
+    if (text->raw.size)
+    {
+        u8 *at = text->raw.data;
+        u8 *end = at + text->raw.size;
+        *value = get_id3_text_field(text->encoding, &at, end);
+        text->raw.size = end - at;
+        text->raw.data = at;
+        result = true;
+    }
+    return result;
+}
+
+internal void
+get_id3_user_text(Id3Frame *frame, Id3Text *description, Id3Text *value)
+{
+    // NOTE(michiel): TXXX, encoding, description and value
+    *description = {};
+    *value = {};
+    if (frame->data.size)
+    {
+        Id3Encoding encoding = get_id3_encoding(frame->data.data[0]);
+        u8 *at = frame->data.data + 1;
+        u8 *end = frame->data.data + frame->data.size;
+        *description = get_id3_text_field(encoding, &at, end);
+        *value = get_id3_text_field(encoding, &at, end);
+    }
+}
+
+internal void
+get_id3_comment(Id3Frame *frame, String *language, Id3Text *description, Id3Text *text)
+{
+    // NOTE(michiel): COMM and USLT, encoding, 3 character language, description and text
+    *language = {};
+    *description = {};
+    *text = {};
+    if (frame->data.size >= 4)
+    {
+        Id3Encoding encoding = get_id3_encoding(frame->data.data[0]);
+        *language = string(3, frame->data.data + 1);
+        u8 *at = frame->data.data + 4;
+        u8 *end = frame->data.data + frame->data.size;
+        *description = get_id3_text_field(encoding, &at, end);
+        *text = get_id3_text_field(encoding, &at, end);
+    }
+}
+
+internal b32
+get_id3_picture(Id3Frame *frame, b32 isVersion22, Id3Picture *picture)
+{
+    *picture = {};
+    b32 result = false;
+    u8 *at = frame->data.data;
+    u8 *end = at + frame->data.size;
+    if ((end - at) >= (isVersion22 ? 5 : 2))
+    {
+        Id3Encoding encoding = get_id3_encoding(*at++);
+        if (isVersion22)
+        {
+            picture->mimeType = string(3, at);
+            at += 3;
+        }
+        else
+        {
+            Id3Text mimeType = get_id3_text_field(Id3Encoding_Latin1, &at, end);
+            picture->mimeType = string(mimeType.raw.size, mimeType.raw.data);
+        }
+        
+        if (at < end)
+        {
+            picture->pictureType = *at++;
+            picture->description = get_id3_text_field(encoding, &at, end);
+            picture->image.data = at;
+            picture->image.size = end - at;
+            result = true;
+        }
+    }
+    return result;
+}
+
+internal void
+get_id3_owner_data(Id3Frame *frame, String *owner, Buffer *ownerData)
+{
+    // NOTE(michiel): UFID and PRIV, a Latin-1 owner and binary data
+    u8 *at = frame->data.data;
+    u8 *end = at + frame->data.size;
+    Id3Text ownerText = get_id3_text_field(Id3Encoding_Latin1, &at, end);
+    *owner = string(ownerText.raw.size, ownerText.raw.data);
+    ownerData->data = at;
+    ownerData->size = end - at;
+}
+
+//
+// NOTE(michiel): Text decoding
+//
+
+internal u32
+put_id3_utf8(u32 codePoint, u8 *dest, umm remaining)
+{
+    // NOTE(michiel): Returns the bytes written, 0 if the character doesn't fit
+    u32 result = 0;
+    if (codePoint < 0x80)
+    {
+        if (remaining >= 1)
+        {
+            dest[0] = (u8)codePoint;
+            result = 1;
+        }
+    }
+    else if (codePoint < 0x800)
+    {
+        if (remaining >= 2)
+        {
+            dest[0] = (u8)(0xC0 | (codePoint >> 6));
+            dest[1] = (u8)(0x80 | (codePoint & 0x3F));
+            result = 2;
+        }
+    }
+    else if (codePoint < 0x10000)
+    {
+        if (remaining >= 3)
+        {
+            dest[0] = (u8)(0xE0 | (codePoint >> 12));
+            dest[1] = (u8)(0x80 | ((codePoint >> 6) & 0x3F));
+            dest[2] = (u8)(0x80 | (codePoint & 0x3F));
+            result = 3;
+        }
+    }
+    else if (remaining >= 4)
+    {
+        dest[0] = (u8)(0xF0 | (codePoint >> 18));
+        dest[1] = (u8)(0x80 | ((codePoint >> 12) & 0x3F));
+        dest[2] = (u8)(0x80 | ((codePoint >> 6) & 0x3F));
+        dest[3] = (u8)(0x80 | (codePoint & 0x3F));
+        result = 4;
+    }
+    return result;
+}
+
+internal String
+decode_id3_text(Id3Text text, umm destSize, u8 *dest)
+{
+    // NOTE(michiel): Converts to UTF-8 in dest. Text that doesn't fit is cut off on a character boundary,
+    // terminators inside the text (multiple values) become '/'.
+    String result = {0, dest};
+    u8 *src = text.raw.data;
+    u8 *end = src + text.raw.size;
+    switch (text.encoding)
+    {
+        case Id3Encoding_Latin1:
+        {
+            for (; src < end; ++src)
+            {
+                u32 written = put_id3_utf8((*src == 0) ? '/' : *src, dest + result.size, destSize - result.size);
+                if (!written)
+                {
+                    break;
+                }
+                result.size += written;
+            }
+        } break;
+        
+        case Id3Encoding_Utf8:
+        {
+            umm size = minimum((umm)(end - src), destSize);
+            if ((size < (umm)(end - src)) && size)
+            {
+                // NOTE(michiel): Don't end in the middle of a character
+                while (size && ((src[size] & 0xC0) == 0x80))
+                {
+                    --size;
+                }
+            }
+            for (umm index = 0; index < size; ++index)
+            {
+                dest[index] = (src[index] == 0) ? '/' : src[index];
+            }
+            result.size = size;
+        } break;
+        
+        case Id3Encoding_Utf16:
+        case Id3Encoding_Utf16BE:
+        {
+            // NOTE(michiel): Every value starts with its own byte order mark, the default is big endian for
+            // encoding 2 and little endian (what writers use) for a missing mark.
+            b32 bigEndian = (text.encoding == Id3Encoding_Utf16BE);
+            while ((src + 1) < end)
+            {
+                u32 unit = bigEndian ? ((u32)src[0] << 8) | src[1] : ((u32)src[1] << 8) | src[0];
+                src += 2;
+                if ((unit == 0xFEFF) || (unit == 0xFFFE))
+                {
+                    if (unit == 0xFFFE)
+                    {
+                        bigEndian = !bigEndian;
+                    }
+                    continue;
+                }
+                
+                u32 codePoint = unit;
+                if ((unit >= 0xD800) && (unit < 0xDC00) && ((src + 1) < end))
+                {
+                    u32 low = bigEndian ? ((u32)src[0] << 8) | src[1] : ((u32)src[1] << 8) | src[0];
+                    if ((low >= 0xDC00) && (low < 0xE000))
+                    {
+                        codePoint = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+                        src += 2;
+                    }
+                }
+                if (codePoint == 0)
+                {
+                    codePoint = '/';
+                    bigEndian = (text.encoding == Id3Encoding_Utf16BE);
+                }
+                
+                u32 written = put_id3_utf8(codePoint, dest + result.size, destSize - result.size);
+                if (!written)
+                {
+                    break;
+                }
+                result.size += written;
+            }
+        } break;
+        
+        INVALID_DEFAULT_CASE;
+    }
+    return result;
+}
+
+//
+// NOTE(michiel): Tag probing
+//
+
+internal b32
+read_tag_bytes(s32 fd, umm offset, umm size, u8 *dest)
+{
+    umm done = 0;
+    while (done < size)
+    {
+        ssize_t count = pread(fd, dest + done, size - done, offset + done);
+        if (count <= 0)
+        {
+            break;
+        }
+        done += count;
+    }
+    return done == size;
+}
+
+internal void
+probe_mpeg_file_tags(MemoryAllocator *allocator, s32 fd, umm fileSize, MpegTagProbe *probe)
+{
+    // NOTE(michiel): The ID3v2 tag from the start, then the last 160 bytes for an ID3v1 tag and an APE
+    // footer, then the APE tag itself. Each tag gets its own allocation, the audio is never read.
+    *probe = {};
+    probe->allocator = allocator;
+    probe->fileSize = fileSize;
+    probe->audioEnd = probe->fileSize;
+    
+    u8 header[ID3_HEADER_SIZE];
+    if ((probe->fileSize >= ID3_HEADER_SIZE) && read_tag_bytes(fd, 0, ID3_HEADER_SIZE, header))
+    {
+        probe->bytesRead += ID3_HEADER_SIZE;
+        if ((string(3, header) == string(3, "ID3")) && (header[3] >= 2) && (header[3] <= 4))
+        {
+            umm tagSize = ID3_HEADER_SIZE + get_id3_syncsafe(header + 6);
+            if ((header[3] == 4) && (header[5] & Id3Header_Footer))
+            {
+                tagSize += ID3_HEADER_SIZE;
+            }
+            tagSize = minimum(tagSize, probe->fileSize);
+            
+            probe->id3v2.data = allocate_array(allocator, u8, tagSize, default_memory_alloc());
+            probe->id3v2.size = tagSize;
+            memcpy(probe->id3v2.data, header, ID3_HEADER_SIZE);
+            if (read_tag_bytes(fd, ID3_HEADER_SIZE, tagSize - ID3_HEADER_SIZE, probe->id3v2.data + ID3_HEADER_SIZE))
+            {
+                probe->bytesRead += tagSize - ID3_HEADER_SIZE;
+                probe->audioStart = tagSize;
+            }
+            else
+            {
+                deallocate(allocator, probe->id3v2.data);
+                probe->id3v2 = {};
+            }
+        }
+    }
+    
+    // NOTE(michiel): An APE tag goes before an ID3v1 tag
+    u8 tail[APE_TAG_FOOTER_SIZE + ID3V1_TAG_SIZE];
+    umm tailSize = minimum(sizeof(tail), probe->audioEnd - probe->audioStart);
+    if (tailSize && read_tag_bytes(fd, probe->audioEnd - tailSize, tailSize, tail))
+    {
+        probe->bytesRead += tailSize;
+        u8 *tailEnd = tail + tailSize;
+        if ((tailSize >= ID3V1_TAG_SIZE) && (string(3, tailEnd - ID3V1_TAG_SIZE) == string(3, "TAG")))
+        {
+            probe->id3v1.data = allocate_array(allocator, u8, ID3V1_TAG_SIZE, default_memory_alloc());
+            probe->id3v1.size = ID3V1_TAG_SIZE;
+            memcpy(probe->id3v1.data, tailEnd - ID3V1_TAG_SIZE, ID3V1_TAG_SIZE);
+            tailEnd -= ID3V1_TAG_SIZE;
+            probe->audioEnd -= ID3V1_TAG_SIZE;
+        }
+        
+        if (((tailEnd - tail) >= APE_TAG_FOOTER_SIZE) &&
+            (string(8, tailEnd - APE_TAG_FOOTER_SIZE) == string(8, "APETAGEX")))
+        {
+            // NOTE(michiel): The size covers the items and the footer, not the header
+            u8 *footer = tailEnd - APE_TAG_FOOTER_SIZE;
+            u32 apeSize = *(u32 *)(footer + 12);
+            u32 apeFlags = *(u32 *)(footer + 20);
+            umm totalSize = (umm)apeSize + ((apeFlags & APE_TAG_HAS_HEADER) ? APE_TAG_FOOTER_SIZE : 0);
+            if ((totalSize >= APE_TAG_FOOTER_SIZE) && (totalSize <= (probe->audioEnd - probe->audioStart)))
+            {
+                probe->ape.data = allocate_array(allocator, u8, totalSize, default_memory_alloc());
+                probe->ape.size = totalSize;
+                if (read_tag_bytes(fd, probe->audioEnd - totalSize, totalSize, probe->ape.data))
+                {
+                    probe->bytesRead += totalSize;
+                    probe->audioEnd -= totalSize;
+                }
+                else
+                {
+                    deallocate(allocator, probe->ape.data);
+                    probe->ape = {};
+                }
+            }
+        }
+    }
+}
+    
+internal b32
+probe_mpeg_tags(MemoryAllocator *allocator, String fileName, MpegTagProbe *probe)
+{
+    *probe = {};
+    
+    char fileNameZ[4096];
+    snprintf(fileNameZ, sizeof(fileNameZ), "%.*s", STR_FMT(fileName));
+    s32 fd = open(fileNameZ, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    
+    b32 result = false;
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) == 0)
+    {
+        probe_mpeg_file_tags(allocator, fd, fileStat.st_size, probe);
+        result = true;
+    }
+    close(fd);
+    return result;
+}
+
+internal void
+free_mpeg_tag_probe(MpegTagProbe *probe)
+{
+    if (probe->id3v2.data)
+    {
+        deallocate(probe->allocator, probe->id3v2.data);
+    }
+    if (probe->id3v1.data)
+    {
+        deallocate(probe->allocator, probe->id3v1.data);
+    }
+    if (probe->ape.data)
+    {
+        deallocate(probe->allocator, probe->ape.data);
+    }
+    *probe = {};
+}
@@ -0,0 +1,136 @@
+// NOTE(michiel): ID3v2 tags, versions 2.2, 2.3 and 2.4. Parsing only indexes the frames, their data stays
+// a view into the file buffer (unless it was unsynchronised, then it points at a cleaned copy). Text is
+// kept in its own encoding until it is decoded to UTF-8 on request.
+
+#define ID3_HEADER_SIZE        10
+#define ID3_HASH_SLOTS         256
+#define ID3_HASH_MULTIPLIER    0xBDBA0FB5 // NOTE(michiel): Picked so all known frame ids get their own slot
+
+enum Id3HeaderFlags
+{
+    Id3Header_Unsynchronisation = 0x80,
+    Id3Header_ExtendedHeader    = 0x40,  // NOTE(michiel): Compression for v2.2, those tags are skipped
+    Id3Header_Experimental      = 0x20,
+    Id3Header_Footer            = 0x10,
+};
+
+enum Id3FrameFlags
+{
+    // NOTE(michiel): Format flags of v2.4, the v2.3 ones are translated to these
+    Id3Frame_Grouping           = 0x40,
+    Id3Frame_Compressed         = 0x08,
+    Id3Frame_Encrypted          = 0x04,
+    Id3Frame_Unsynchronised     = 0x02,
+    Id3Frame_DataLength         = 0x01,
+};
+
+enum Id3Encoding
+{
+    Id3Encoding_Latin1,
+    Id3Encoding_Utf16,          // NOTE(michiel): With a byte order mark
+    Id3Encoding_Utf16BE,
+    Id3Encoding_Utf8,
+};
+
+enum Id3FrameKind
+{
+    Id3Kind_Unknown,
+    Id3Kind_Title,
+    Id3Kind_Subtitle,
+    Id3Kind_Grouping,
+    Id3Kind_Artist,
+    Id3Kind_AlbumArtist,
+    Id3Kind_Conductor,
+    Id3Kind_Album,
+    Id3Kind_Track,
+    Id3Kind_Disc,
+    Id3Kind_Year,
+    Id3Kind_OriginalRelease,
+    Id3Kind_Genre,
+    Id3Kind_Composer,
+    Id3Kind_Lyricist,
+    Id3Kind_Bpm,
+    Id3Kind_Media,
+    Id3Kind_Publisher,
+    Id3Kind_ArtistSort,
+    Id3Kind_AlbumSort,
+    Id3Kind_TitleSort,
+    Id3Kind_Language,
+    Id3Kind_EncodedBy,
+    Id3Kind_EncoderSettings,
+    Id3Kind_Copyright,
+    Id3Kind_Length,
+    Id3Kind_InvolvedPeople,
+    Id3Kind_MusicianCredits,
+    Id3Kind_UserText,
+    Id3Kind_Comment,
+    Id3Kind_Lyrics,
+    Id3Kind_Picture,
+    Id3Kind_UniqueFileId,
+    Id3Kind_Private,
+    
+    Id3Kind_Count,
+};
+
+struct Id3FrameId
+{
+    char id[5];                 // NOTE(michiel): v2.2 ids have 3 characters
+    Id3FrameKind kind;
+};
+
+struct Id3Text
+{
+    Id3Encoding encoding;
+    Buffer raw;                 // NOTE(michiel): Without the terminator
+};
+
+struct Id3Frame
+{
+    u32 id;                     // NOTE(michiel): Big endian characters, v2.2 ids end in a zero byte
+    Id3FrameKind kind;
+    u32 flags;                  // NOTE(michiel): Id3FrameFlags
+    Buffer data;
+};
+
+struct Id3Tag
+{
+    MemoryAllocator *allocator;
+    u32 majorVersion;           // NOTE(michiel): 2, 3 or 4
+    u32 revision;
+    u32 flags;                  // NOTE(michiel): Id3HeaderFlags
+    u32 size;                   // NOTE(michiel): Excluding the header and footer
+    umm totalSize;              // NOTE(michiel): Everything, the audio starts after this
+    
+    u32 frameCount;
+    Id3Frame *frames;
+    u8 *clean;                  // NOTE(michiel): Unsynchronised data, only allocated if the tag has it
+};
+
+struct Id3Picture
+{
+    String mimeType;            // NOTE(michiel): Just the format for v2.2, like "JPG"
+    u32 pictureType;            // NOTE(michiel): 3 is the front cover
+    Id3Text description;
+    Buffer image;
+};
+
+//
+// NOTE(michiel): Tag probing, reads only the tags at the start and end of a file
+//
+
+#define ID3V1_TAG_SIZE         128
+#define APE_TAG_FOOTER_SIZE    32
+#define APE_TAG_HAS_HEADER     0x80000000
+
+struct MpegTagProbe
+{
+    MemoryAllocator *allocator;
+    umm fileSize;
+    umm audioStart;             // NOTE(michiel): The bytes between the tags
+    umm audioEnd;
+    umm bytesRead;
+    
+    Buffer id3v2;               // NOTE(michiel): Header included
+    Buffer id3v1;
+    Buffer ape;                 // NOTE(michiel): Header (when the tag has one) up to and including the footer
+};
@@ -0,0 +1,143 @@
+global u32 gMd5SineTable[64] =
+{
+    0xD76AA478, 0xE8C7B756, 0x242070DB, 0xC1BDCEEE, 0xF57C0FAF, 0x4787C62A, 0xA8304613, 0xFD469501,
+    0x698098D8, 0x8B44F7AF, 0xFFFF5BB1, 0x895CD7BE, 0x6B901122, 0xFD987193, 0xA679438E, 0x49B40821,
+    0xF61E2562, 0xC040B340, 0x265E5A51, 0xE9B6C7AA, 0xD62F105D, 0x02441453, 0xD8A1E681, 0xE7D3FBC8,
+    0x21E1CDE6, 0xC33707D6, 0xF4D50D87, 0x455A14ED, 0xA9E3E905, 0xFCEFA3F8, 0x676F02D9, 0x8D2A4C8A,
+    0xFFFA3942, 0x8771F681, 0x6D9D6122, 0xFDE5380C, 0xA4BEEA44, 0x4BDECFA9, 0xF6BB4B60, 0xBEBFBC70,
+    0x289B7EC6, 0xEAA127FA, 0xD4EF3085, 0x04881D05, 0xD9D4D039, 0xE6DB99E5, 0x1FA27CF8, 0xC4AC5665,
+    0xF4292244, 0x432AFF97, 0xAB9423A7, 0xFC93A039, 0x655B59C3, 0x8F0CCC92, 0xFFEFF47D, 0x85845DD1,
+    0x6FA87E4F, 0xFE2CE6E0, 0xA3014314, 0x4E0811A1, 0xF7537E82, 0xBD3AF235, 0x2AD7D2BB, 0xEB86D391,
+};
+
+global u8 gMd5Shifts[64] =
+{
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+internal Md5Context
+md5_init(void)
+{
+    Md5Context result = {};
+    result.state[0] = 0x67452301;
+    result.state[1] = 0xEFCDAB89;
+    result.state[2] = 0x98BADCFE;
+    result.state[3] = 0x10325476;
+    return result;
+}
+
+internal void
+md5_block(Md5Context *context, u8 *data)
+{
+    u32 words[16];
+    for (u32 wordIdx = 0; wordIdx < 16; ++wordIdx)
+    {
+        words[wordIdx] = ((u32)data[wordIdx * 4 + 0] <<  0) |
+            ((u32)data[wordIdx * 4 + 1] <<  8) |
+            ((u32)data[wordIdx * 4 + 2] << 16) |
+            ((u32)data[wordIdx * 4 + 3] << 24);
+    }
+    
+    u32 a = context->state[0];
+    u32 b = context->state[1];
+    u32 c = context->state[2];
+    u32 d = context->state[3];
+    
+    for (u32 step = 0; step < 64; ++step)
+    {
+        u32 f;
+        u32 wordIdx;
+        if (step < 16)
+        {
+            f = (b & c) | (~b & d);
+            wordIdx = step;
+        }
+        else if (step < 32)
+        {
+            f = (d & b) | (~d & c);
+            wordIdx = (5 * step + 1) & 0xF;
+        }
+        else if (step < 48)
+        {
+            f = b ^ c ^ d;
+            wordIdx = (3 * step + 5) & 0xF;
+        }
+        else
+        {
+            f = c ^ (b | ~d);
+            wordIdx = (7 * step) & 0xF;
+        }
+        
+        u32 rotate = a + f + gMd5SineTable[step] + words[wordIdx];
+        a = d;
+        d = c;
+        c = b;
+        b = b + ((rotate << gMd5Shifts[step]) | (rotate >> (32 - gMd5Shifts[step])));
+    }
+    
+    context->state[0] += a;
+    context->state[1] += b;
+    context->state[2] += c;
+    context->state[3] += d;
+}
+
+internal void
+md5_update(Md5Context *context, umm size, u8 *data)
+{
+    context->byteCount += size;
+    
+    if (context->bufferCount)
+    {
+        while (size && (context->bufferCount < 64))
+        {
+            context->buffer[context->bufferCount++] = *data++;
+            --size;
+        }
+        if (context->bufferCount == 64)
+        {
+            md5_block(context, context->buffer);
+            context->bufferCount = 0;
+        }
+    }
+    
+    while (size >= 64)
+    {
+        md5_block(context, data);
+        data += 64;
+        size -= 64;
+    }
+    
+    while (size)
+    {
+        context->buffer[context->bufferCount++] = *data++;
+        --size;
+    }
+}
+
+internal Md5Digest
+md5_final(Md5Context *context)
+{
+    u64 bitCount = context->byteCount * 8;
+    
+    u8 padding[72] = {0x80};
+    u32 padCount = ((context->bufferCount < 56) ? 56 : 120) - context->bufferCount;
+    for (u32 byteIdx = 0; byteIdx < 8; ++byteIdx)
+    {
+        padding[padCount + byteIdx] = (u8)(bitCount >> (byteIdx * 8));
+    }
+    md5_update(context, padCount + 8, padding);
+    i_expect(context->bufferCount == 0);
+    
+    Md5Digest result;
+    for (u32 wordIdx = 0; wordIdx < 4; ++wordIdx)
+    {
+        result.bytes[wordIdx * 4 + 0] = (u8)(context->state[wordIdx] >>  0);
+        result.bytes[wordIdx * 4 + 1] = (u8)(context->state[wordIdx] >>  8);
+        result.bytes[wordIdx * 4 + 2] = (u8)(context->state[wordIdx] >> 16);
+        result.bytes[wordIdx * 4 + 3] = (u8)(context->state[wordIdx] >> 24);
+    }
+    return result;
+}
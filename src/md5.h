@@ -0,0 +1,14 @@
+// NOTE(michiel): MD5 (RFC 1321), only used for the FLAC stream info signature
+
+struct Md5Context
+{
+    u32 state[4];
+    u64 byteCount;
+    u32 bufferCount;
+    u8 buffer[64];
+};
+
+struct Md5Digest
+{
+    u8 bytes[16];
+};
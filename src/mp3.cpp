@@ -0,0 +1,2050 @@
+//
+// NOTE(michiel): Frame header
+//
+
+internal b32
+parse_mpeg_frame_header(u8 *data, MpegFrameHeader *header)
+{
+    // NOTE(michiel): Expects MPEG_HEADER_SIZE bytes. Free format (bit rate index 0) is not supported.
+    *header = {};
+    if ((data[0] != 0xFF) || ((data[1] & 0xE0) != 0xE0))
+    {
+        return false;
+    }
+    
+    header->versionLayer = (MpegVersionLayer)((data[1] >> 1) & 0xF);
+    switch (header->versionLayer)
+    {
+        case Mpeg25_Layer3:
+        case Mpeg25_Layer2:
+        case Mpeg25_Layer1: { header->version = MpegVersion_25; } break;
+        case Mpeg2_Layer3:
+        case Mpeg2_Layer2:
+        case Mpeg2_Layer1: { header->version = MpegVersion_2; } break;
+        case Mpeg1_Layer3:
+        case Mpeg1_Layer2:
+        case Mpeg1_Layer1: { header->version = MpegVersion_1; } break;
+        default: { return false; } break;
+    }
+    header->layer = 4 - ((data[1] >> 1) & 0x3);
+    header->protection = !(data[1] & 0x1);
+    
+    u32 bitRateIdx = data[2] >> 4;
+    u32 sampleRateIdx = (data[2] >> 2) & 0x3;
+    if ((bitRateIdx == 0) || (bitRateIdx == 0xF) || (sampleRateIdx == 0x3))
+    {
+        return false;
+    }
+    
+    u32 bitRateRow = header->layer - 1;
+    if (header->version != MpegVersion_1)
+    {
+        bitRateRow = (header->layer == 1) ? 3 : 4;
+    }
+    header->bitRate = gMPEGBitRates[bitRateRow * 16 + bitRateIdx];
+    header->sampleRate = gMPEGSampleRates[header->version * 4 + sampleRateIdx];
+    header->sampleRateIndex = header->version * 3 + sampleRateIdx;
+    header->padded = (data[2] >> 1) & 0x1;
+    
+    header->channelMode = (MpegChannelModes)(data[3] >> 6);
+    if (header->channelMode == MpegChannel_JointStereo)
+    {
+        header->modeExtension = (data[3] >> 4) & 0x3;
+    }
+    header->emphasis = (MpegEmphasis)(data[3] & 0x3);
+    if (header->emphasis == MpegEmphasis_Reserved)
+    {
+        return false;
+    }
+    header->channelCount = (header->channelMode == MpegChannel_SingleChannel) ? 1 : 2;
+    
+    u32 bitRate = header->bitRate * 1000;
+    switch (header->layer)
+    {
+        case 1:
+        {
+            header->sampleCount = 384;
+            header->frameByteCount = (12 * bitRate / header->sampleRate + header->padded) * 4;
+        } break;
+        
+        case 2:
+        {
+            header->sampleCount = 1152;
+            header->frameByteCount = 144 * bitRate / header->sampleRate + header->padded;
+        } break;
+        
+        case 3:
+        {
+            // NOTE(michiel): MPEG-2 and 2.5 frames only have one granule
+            u32 granules = (header->version == MpegVersion_1) ? 2 : 1;
+            header->sampleCount = granules * MP3_GRANULE_SAMPLES;
+            header->frameByteCount = granules * 72 * bitRate / header->sampleRate + header->padded;
+        } break;
+        
+        INVALID_DEFAULT_CASE;
+    }
+    
+    return true;
+}
+
+internal u32
+get_mp3_side_info_size(MpegFrameHeader *header)
+{
+    u32 result = 0;
+    if (header->version == MpegVersion_1)
+    {
+        result = (header->channelCount == 1) ? 17 : 32;
+    }
+    else
+    {
+        result = (header->channelCount == 1) ? 9 : 17;
+    }
+    return result;
+}
+
+//
+// NOTE(michiel): Tables
+//
+
+#define MP3_HUFFMAN_ROOT_BITS  8
+#define MP3_HUFFMAN_MAX_ENTRIES 8192
+
+// NOTE(michiel): Lookup table entries. A leaf has the number of bits used at its level in bits 8-11 and
+// the decoded x and y in the low byte. A node (bit 15 set) points to a subtable with 1 to 7 index bits
+// (bits 12-14) at an offset from the table start (bits 0-11).
+#define MP3_HUFFMAN_NODE       0x8000
+
+struct Mp3HuffmanTable
+{
+    u16 *entries;
+    u32 rootBits;
+    u32 linbits;
+};
+
+struct Mp3BandLayout
+{
+    u32 bandCount;
+    u32 longCount;              // NOTE(michiel): Long bands come first, then short bands (one per window)
+    u32 shortBandOffset;        // NOTE(michiel): Short scalefactor band of the first short band
+    u8 widths[MP3_MAX_BANDS];
+};
+
+global b32 gMp3TablesReady;
+global u16 gMp3HuffmanEntries[MP3_HUFFMAN_MAX_ENTRIES];
+global u32 gMp3HuffmanEntryCount;
+global Mp3HuffmanTable gMp3HuffmanTables[34];
+
+global Mp3BandLayout gMp3BandLayouts[9][3];     // NOTE(michiel): Long, short and mixed blocks
+global u32 gMp3ShortBandStarts[9][14];          // NOTE(michiel): Start of a short band inside its window
+
+global f32 gMp3Pow43[8207];                     // NOTE(michiel): Huffman values go up to 15 + 2^13 - 1
+global f32 gMp3GainFractions[4] = {1.0f, 1.18920712f, 1.41421356f, 1.68179283f};
+global f32 gMp3IntensityRatios[7][2];
+global f32 gMp3LsfIntensityRatios[2][32][2];
+global f32 gMp3AliasCs[8];
+global f32 gMp3AliasCa[8];
+
+// NOTE(michiel): IMDCT coefficients are stored 4 times, once for each of the 4 subbands done together
+global f32 gMp3ImdctLong[18 * 18 * 4];
+global f32 gMp3ImdctShort[6 * 6 * 4];
+global f32 gMp3ImdctWindows[4][36];             // NOTE(michiel): Per block type, with the sign of the unfolding
+global f32 gMp3ImdctShortWindow[12];
+
+global f32 gMpegSynthesisCos[32 * 32];
+global f32 gMpegSynthesisD[512];
+
+global f32 gMp2ScaleFactors[64];                // NOTE(michiel): 2^(1 - i / 3), 63 is not used
+
+internal void
+fill_mp3_huffman_level(Mp3HuffmanSource *source, u32 symbolCount, u16 *table, u32 levelOffset,
+                       u32 levelBits, u32 prefix, u32 prefixLength)
+{
+    u16 *level = table + levelOffset;
+    for (u32 index = 0; index < (1u << levelBits); ++index)
+    {
+        level[index] = 0;
+    }
+    
+    for (u32 symbol = 0; symbol < symbolCount; ++symbol)
+    {
+        u32 length = source->lengths[symbol];
+        u32 code = source->codes[symbol];
+        if ((length > prefixLength) && ((code >> (length - prefixLength)) == prefix))
+        {
+            u32 remaining = length - prefixLength;
+            if (remaining <= levelBits)
+            {
+                u32 x = symbol / source->ySize;
+                u32 y = symbol % source->ySize;
+                u32 first = (code & ((1 << remaining) - 1)) << (levelBits - remaining);
+                for (u32 fill = 0; fill < (1u << (levelBits - remaining)); ++fill)
+                {
+                    level[first + fill] = (u16)((remaining << 8) | (x << 4) | y);
+                }
+            }
+        }
+    }
+    
+    for (u32 index = 0; index < (1u << levelBits); ++index)
+    {
+        u32 subPrefix = (prefix << levelBits) | index;
+        u32 subPrefixLength = prefixLength + levelBits;
+        u32 maxRemaining = 0;
+        for (u32 symbol = 0; symbol < symbolCount; ++symbol)
+        {
+            u32 length = source->lengths[symbol];
+            if ((length > subPrefixLength) && (((u32)source->codes[symbol] >> (length - subPrefixLength)) == subPrefix))
+            {
+                maxRemaining = maximum(maxRemaining, length - subPrefixLength);
+            }
+        }
+        
+        if (maxRemaining)
+        {
+            u32 subBits = minimum(maxRemaining, 7u);
+            u32 subOffset = (u32)(gMp3HuffmanEntries + gMp3HuffmanEntryCount - table);
+            i_expect(subOffset < 0x1000);
+            gMp3HuffmanEntryCount += 1 << subBits;
+            i_expect(gMp3HuffmanEntryCount <= MP3_HUFFMAN_MAX_ENTRIES);
+            level[index] = (u16)(MP3_HUFFMAN_NODE | (subBits << 12) | subOffset);
+            fill_mp3_huffman_level(source, symbolCount, table, subOffset, subBits, subPrefix, subPrefixLength);
+        }
+    }
+}
+
+internal void
+init_mp3_huffman_tables(void)
+{
+    for (u32 tableIdx = 0; tableIdx < array_count(gMp3HuffmanSources); ++tableIdx)
+    {
+        Mp3HuffmanSource *source = gMp3HuffmanSources + tableIdx;
+        Mp3HuffmanTable *table = gMp3HuffmanTables + tableIdx;
+        table->linbits = source->linbits;
+        if (!source->codes)
+        {
+            continue;
+        }
+        
+        // NOTE(michiel): Tables 16-23 and 24-31 only differ in linbits
+        if ((tableIdx > 0) && (source->codes == gMp3HuffmanSources[tableIdx - 1].codes))
+        {
+            table->entries = gMp3HuffmanTables[tableIdx - 1].entries;
+            table->rootBits = gMp3HuffmanTables[tableIdx - 1].rootBits;
+            continue;
+        }
+        
+        u32 symbolCount = (tableIdx >= 32) ? 16 : source->ySize * source->ySize;
+        u32 maxLength = 0;
+        for (u32 symbol = 0; symbol < symbolCount; ++symbol)
+        {
+            maxLength = maximum(maxLength, (u32)source->lengths[symbol]);
+        }
+        
+        table->rootBits = minimum(maxLength, (u32)MP3_HUFFMAN_ROOT_BITS);
+        table->entries = gMp3HuffmanEntries + gMp3HuffmanEntryCount;
+        gMp3HuffmanEntryCount += 1 << table->rootBits;
+        i_expect(gMp3HuffmanEntryCount <= MP3_HUFFMAN_MAX_ENTRIES);
+        fill_mp3_huffman_level(source, symbolCount, table->entries, 0, table->rootBits, 0, 0);
+    }
+}
+
+internal void
+init_mp3_band_layouts(void)
+{
+    for (u32 rateIdx = 0; rateIdx < 9; ++rateIdx)
+    {
+        u8 *longWidths = gMp3LongBandWidths[rateIdx];
+        u8 *shortWidths = gMp3ShortBandWidths[rateIdx];
+        
+        u32 *shortStarts = gMp3ShortBandStarts[rateIdx];
+        shortStarts[0] = 0;
+        for (u32 band = 0; band < 13; ++band)
+        {
+            shortStarts[band + 1] = shortStarts[band] + shortWidths[band];
+        }
+        
+        Mp3BandLayout *longLayout = &gMp3BandLayouts[rateIdx][0];
+        longLayout->bandCount = 22;
+        longLayout->longCount = 22;
+        for (u32 band = 0; band < 22; ++band)
+        {
+            longLayout->widths[band] = longWidths[band];
+        }
+        
+        Mp3BandLayout *shortLayout = &gMp3BandLayouts[rateIdx][1];
+        shortLayout->bandCount = 39;
+        for (u32 band = 0; band < 39; ++band)
+        {
+            shortLayout->widths[band] = shortWidths[band / 3];
+        }
+        
+        // NOTE(michiel): Mixed blocks use long bands for the first two subbands (36 lines) and short
+        // bands from short band 3 on. Only at 8 kHz this doesn't line up, the rest is a filler band there.
+        Mp3BandLayout *mixedLayout = &gMp3BandLayouts[rateIdx][2];
+        u32 lineCount = 0;
+        while (lineCount < 36)
+        {
+            mixedLayout->widths[mixedLayout->bandCount++] = longWidths[mixedLayout->longCount++];
+            lineCount += longWidths[mixedLayout->longCount - 1];
+        }
+        mixedLayout->shortBandOffset = 3;
+        for (u32 band = 3 * 3; band < 39; ++band)
+        {
+            mixedLayout->widths[mixedLayout->bandCount++] = shortWidths[band / 3];
+            lineCount += shortWidths[band / 3];
+        }
+        if (lineCount < MP3_GRANULE_SAMPLES)
+        {
+            mixedLayout->widths[mixedLayout->bandCount++] = (u8)(MP3_GRANULE_SAMPLES - lineCount);
+        }
+    }
+}
+
+internal void
+init_mp3_tables(void)
+{
+    if (gMp3TablesReady)
+    {
+        return;
+    }
+    
+    init_mp3_huffman_tables();
+    init_mp3_band_layouts();
+    
+    for (u32 index = 0; index < array_count(gMp3Pow43); ++index)
+    {
+        gMp3Pow43[index] = (f32)pow((f64)index, 4.0 / 3.0);
+    }
+    
+    for (u32 position = 0; position < 7; ++position)
+    {
+        if (position == 6)
+        {
+            gMp3IntensityRatios[position][0] = 1.0f;
+            gMp3IntensityRatios[position][1] = 0.0f;
+        }
+        else
+        {
+            f64 ratio = tan((f64)position * F64_PI / 12.0);
+            gMp3IntensityRatios[position][0] = (f32)(ratio / (1.0 + ratio));
+            gMp3IntensityRatios[position][1] = (f32)(1.0 / (1.0 + ratio));
+        }
+    }
+    
+    for (u32 scale = 0; scale < 2; ++scale)
+    {
+        f64 base = pow(2.0, -0.25 * (f64)(scale + 1));
+        for (u32 position = 0; position < 32; ++position)
+        {
+            f32 *ratios = gMp3LsfIntensityRatios[scale][position];
+            if (position & 1)
+            {
+                ratios[0] = (f32)pow(base, (f64)((position + 1) / 2));
+                ratios[1] = 1.0f;
+            }
+            else
+            {
+                ratios[0] = 1.0f;
+                ratios[1] = (f32)pow(base, (f64)(position / 2));
+            }
+        }
+    }
+    
+    f64 aliasCoefficients[8] = {-0.6, -0.535, -0.33, -0.185, -0.095, -0.041, -0.0142, -0.0037};
+    for (u32 index = 0; index < 8; ++index)
+    {
+        f64 scale = sqrt(1.0 + aliasCoefficients[index] * aliasCoefficients[index]);
+        gMp3AliasCs[index] = (f32)(1.0 / scale);
+        gMp3AliasCa[index] = (f32)(aliasCoefficients[index] / scale);
+    }
+    
+    // NOTE(michiel): The IMDCT is done as a DCT-IV of half the size, the 36 (or 12) outputs are the
+    // DCT-IV outputs unfolded: z[9..17], -z[17..0], -z[0..8] (or z[3..5], -z[5..0], -z[0..2]).
+    for (u32 m = 0; m < 18; ++m)
+    {
+        for (u32 k = 0; k < 18; ++k)
+        {
+            f32 value = (f32)cos(F64_PI / 72.0 * (f64)((2 * m + 1) * (2 * k + 1)));
+            for (u32 lane = 0; lane < 4; ++lane)
+            {
+                gMp3ImdctLong[(m * 18 + k) * 4 + lane] = value;
+            }
+        }
+    }
+    for (u32 m = 0; m < 6; ++m)
+    {
+        for (u32 k = 0; k < 6; ++k)
+        {
+            f32 value = (f32)cos(F64_PI / 24.0 * (f64)((2 * m + 1) * (2 * k + 1)));
+            for (u32 lane = 0; lane < 4; ++lane)
+            {
+                gMp3ImdctShort[(m * 6 + k) * 4 + lane] = value;
+            }
+        }
+    }
+    
+    for (u32 index = 0; index < 36; ++index)
+    {
+        f64 normal = sin(F64_PI / 36.0 * ((f64)index + 0.5));
+        f64 start = 0.0;
+        f64 stop = 0.0;
+        if (index < 18)
+        {
+            start = normal;
+        }
+        else if (index < 24)
+        {
+            start = 1.0;
+        }
+        else if (index < 30)
+        {
+            start = sin(F64_PI / 12.0 * ((f64)index - 18.0 + 0.5));
+        }
+        
+        if (index >= 18)
+        {
+            stop = normal;
+        }
+        else if (index >= 12)
+        {
+            stop = 1.0;
+        }
+        else if (index >= 6)
+        {
+            stop = sin(F64_PI / 12.0 * ((f64)index - 6.0 + 0.5));
+        }
+        
+        f64 sign = (index < 9) ? 1.0 : -1.0;
+        gMp3ImdctWindows[Mp3Block_Normal][index] = (f32)(sign * normal);
+        gMp3ImdctWindows[Mp3Block_Start][index] = (f32)(sign * start);
+        gMp3ImdctWindows[Mp3Block_Short][index] = 0.0f;
+        gMp3ImdctWindows[Mp3Block_Stop][index] = (f32)(sign * stop);
+    }
+    for (u32 index = 0; index < 12; ++index)
+    {
+        f64 sign = (index < 3) ? 1.0 : -1.0;
+        gMp3ImdctShortWindow[index] = (f32)(sign * sin(F64_PI / 12.0 * ((f64)index + 0.5)));
+    }
+    
+    for (u32 k = 0; k < 32; ++k)
+    {
+        for (u32 j = 0; j < 32; ++j)
+        {
+            gMpegSynthesisCos[k * 32 + j] = (f32)cos(F64_PI / 64.0 * (f64)((2 * k + 1) * j));
+        }
+    }
+    for (u32 index = 0; index < 512; ++index)
+    {
+        s32 value = gMpegSynthesisWindow[(index <= 256) ? index : (512 - index)];
+        if ((index / 64) & 1)
+        {
+            value = -value;
+        }
+        gMpegSynthesisD[index] = (f32)value / 65536.0f;
+    }
+    
+    for (u32 index = 0; index < array_count(gMp2ScaleFactors); ++index)
+    {
+        gMp2ScaleFactors[index] = (f32)pow(2.0, 1.0 - (f64)index / 3.0);
+    }
+    
+    gMp3TablesReady = true;
+}
+
+internal void
+init_mp3_decoder(Mp3Decoder *decoder)
+{
+    init_mp3_tables();
+    memset(decoder, 0, sizeof(Mp3Decoder));
+    decoder->fixedPoint = MPEG_FIXED_POINT;
+}
+
+//
+// NOTE(michiel): Bit reading
+//
+
+struct Mp3BitReader
+{
+    u8 *data;
+    u32 position;               // NOTE(michiel): In bits
+    u32 end;
+};
+
+internal u32
+peek_mp3_bits(Mp3BitReader *reader, u32 count)
+{
+    // NOTE(michiel): 1 to 32 bits, reads 8 bytes from the current byte on
+    u64 word;
+    memcpy(&word, reader->data + (reader->position >> 3), sizeof(u64));
+    word = __builtin_bswap64(word);
+    return (u32)((word << (reader->position & 7)) >> (64 - count));
+}
+
+internal u32
+get_mp3_bits(Mp3BitReader *reader, u32 count)
+{
+    u32 result = 0;
+    if (count)
+    {
+        result = peek_mp3_bits(reader, count);
+        reader->position += count;
+    }
+    return result;
+}
+
+internal u32
+decode_mp3_huffman(Mp3BitReader *reader, Mp3HuffmanTable *table)
+{
+    u32 entry = table->entries[peek_mp3_bits(reader, table->rootBits)];
+    if (entry & MP3_HUFFMAN_NODE)
+    {
+        reader->position += table->rootBits;
+        do
+        {
+            u32 subBits = (entry >> 12) & 0x7;
+            entry = table->entries[(entry & 0xFFF) + peek_mp3_bits(reader, subBits)];
+            if (entry & MP3_HUFFMAN_NODE)
+            {
+                reader->position += subBits;
+            }
+        } while (entry & MP3_HUFFMAN_NODE);
+    }
+    reader->position += (entry >> 8) & 0xF;
+    return entry & 0xFF;
+}
+
+//
+// NOTE(michiel): Side info and main data
+//
+
+internal void
+parse_mp3_side_info(MpegFrameHeader *header, u8 *data, Mp3SideInfo *sideInfo)
+{
+    // NOTE(michiel): The reader overshoots, so read from a padded copy
+    u8 padded[32 + 8] = {};
+    memcpy(padded, data, get_mp3_side_info_size(header));
+    Mp3BitReader reader = {};
+    reader.data = padded;
+    
+    *sideInfo = {};
+    u32 channelCount = header->channelCount;
+    u32 granuleCount = 1;
+    if (header->version == MpegVersion_1)
+    {
+        granuleCount = 2;
+        sideInfo->mainDataBegin = get_mp3_bits(&reader, 9);
+        get_mp3_bits(&reader, (channelCount == 1) ? 5 : 3);
+        for (u32 channel = 0; channel < channelCount; ++channel)
+        {
+            sideInfo->scfsi[channel] = get_mp3_bits(&reader, 4);
+        }
+    }
+    else
+    {
+        sideInfo->mainDataBegin = get_mp3_bits(&reader, 8);
+        get_mp3_bits(&reader, (channelCount == 1) ? 1 : 2);
+    }
+    
+    for (u32 granuleIdx = 0; granuleIdx < granuleCount; ++granuleIdx)
+    {
+        for (u32 channel = 0; channel < channelCount; ++channel)
+        {
+            Mp3GranuleInfo *granule = &sideInfo->granules[granuleIdx][channel];
+            granule->part23Length = get_mp3_bits(&reader, 12);
+            granule->bigValues = get_mp3_bits(&reader, 9);
+            granule->bigValues = minimum(granule->bigValues, (u32)(MP3_GRANULE_SAMPLES / 2));
+            granule->globalGain = get_mp3_bits(&reader, 8);
+            granule->scalefacCompress = get_mp3_bits(&reader, (header->version == MpegVersion_1) ? 4 : 9);
+            
+            if (get_mp3_bits(&reader, 1))
+            {
+                // NOTE(michiel): Window switching, the second region runs up to the big values end
+                granule->blockType = (Mp3BlockType)get_mp3_bits(&reader, 2);
+                granule->mixedBlock = get_mp3_bits(&reader, 1);
+                granule->tableSelect[0] = get_mp3_bits(&reader, 5);
+                granule->tableSelect[1] = get_mp3_bits(&reader, 5);
+                for (u32 window = 0; window < 3; ++window)
+                {
+                    granule->subblockGain[window] = get_mp3_bits(&reader, 3);
+                }
+                if (granule->blockType != Mp3Block_Short)
+                {
+                    granule->mixedBlock = false;
+                }
+                granule->region0Count = ((granule->blockType == Mp3Block_Short) && !granule->mixedBlock) ? 8 : 7;
+                granule->region1Count = 36;
+            }
+            else
+            {
+                granule->blockType = Mp3Block_Normal;
+                for (u32 region = 0; region < 3; ++region)
+                {
+                    granule->tableSelect[region] = get_mp3_bits(&reader, 5);
+                }
+                granule->region0Count = get_mp3_bits(&reader, 4);
+                granule->region1Count = get_mp3_bits(&reader, 3);
+            }
+            
+            if (header->version == MpegVersion_1)
+            {
+                granule->preflag = get_mp3_bits(&reader, 1);
+            }
+            granule->scalefacScale = get_mp3_bits(&reader, 1);
+            granule->count1Table = get_mp3_bits(&reader, 1);
+        }
+    }
+}
+
+internal u32
+get_mp3_main_data_begin(MpegFrameHeader *header, u8 *frame)
+{
+    // NOTE(michiel): Only the first side info field, for walking frames without parsing all of it
+    u8 *sideInfoData = frame + MPEG_HEADER_SIZE + (header->protection ? 2 : 0);
+    u32 result = sideInfoData[0];
+    if (header->version == MpegVersion_1)
+    {
+        result = (result << 1) | (sideInfoData[1] >> 7);
+    }
+    return result;
+}
+
+internal Mp3BandLayout *
+get_mp3_band_layout(MpegFrameHeader *header, Mp3GranuleInfo *granule)
+{
+    u32 kind = 0;
+    if (granule->blockType == Mp3Block_Short)
+    {
+        kind = granule->mixedBlock ? 2 : 1;
+    }
+    return &gMp3BandLayouts[header->sampleRateIndex][kind];
+}
+
+internal void
+read_mp3_scalefactors(Mp3Decoder *decoder, MpegFrameHeader *header, Mp3SideInfo *sideInfo,
+                      u32 granuleIdx, u32 channel, Mp3BandLayout *layout, Mp3BitReader *reader)
+{
+    Mp3GranuleInfo *granule = &sideInfo->granules[granuleIdx][channel];
+    u8 *scalefactors = decoder->scalefactors[channel];
+    u32 band = 0;
+    
+    if (header->version == MpegVersion_1)
+    {
+        u32 lowBits = gMp3ScalefacLengths[granule->scalefacCompress][0];
+        u32 highBits = gMp3ScalefacLengths[granule->scalefacCompress][1];
+        if (granule->blockType == Mp3Block_Short)
+        {
+            u32 lowCount = granule->mixedBlock ? 17 : 18;
+            for (; band < lowCount; ++band)
+            {
+                scalefactors[band] = (u8)get_mp3_bits(reader, lowBits);
+            }
+            for (; band < lowCount + 18; ++band)
+            {
+                scalefactors[band] = (u8)get_mp3_bits(reader, highBits);
+            }
+        }
+        else
+        {
+            // NOTE(michiel): The second granule can reuse groups of scalefactors of the first
+            u32 groupEnds[4] = {6, 11, 16, 21};
+            for (u32 group = 0; group < 4; ++group)
+            {
+                b32 reuse = (granuleIdx == 1) && (sideInfo->scfsi[channel] & (0x8 >> group));
+                u32 bits = (group < 2) ? lowBits : highBits;
+                for (; band < groupEnds[group]; ++band)
+                {
+                    if (!reuse)
+                    {
+                        scalefactors[band] = (u8)get_mp3_bits(reader, bits);
+                    }
+                }
+            }
+        }
+    }
+    else
+    {
+        u32 lengths[4] = {};
+        u32 tableIdx = 0;
+        u32 compress = granule->scalefacCompress;
+        b32 intensityChannel = (channel == 1) && (header->modeExtension & MpegChannelExt3_Intensity);
+        if (intensityChannel)
+        {
+            u32 halfCompress = compress >> 1;
+            decoder->intensityScale = compress & 0x1;
+            if (halfCompress < 180)
+            {
+                lengths[0] = halfCompress / 36;
+                lengths[1] = (halfCompress % 36) / 6;
+                lengths[2] = halfCompress % 6;
+                tableIdx = 3;
+            }
+            else if (halfCompress < 244)
+            {
+                halfCompress -= 180;
+                lengths[0] = (halfCompress & 0x3F) >> 4;
+                lengths[1] = (halfCompress & 0xF) >> 2;
+                lengths[2] = halfCompress & 0x3;
+                tableIdx = 4;
+            }
+            else
+            {
+                halfCompress -= 244;
+                lengths[0] = halfCompress / 3;
+                lengths[1] = halfCompress % 3;
+                tableIdx = 5;
+            }
+        }
+        else if (compress < 400)
+        {
+            lengths[0] = (compress >> 4) / 5;
+            lengths[1] = (compress >> 4) % 5;
+            lengths[2] = (compress & 0xF) >> 2;
+            lengths[3] = compress & 0x3;
+        }
+        else if (compress < 500)
+        {
+            compress -= 400;
+            lengths[0] = (compress >> 2) / 5;
+            lengths[1] = (compress >> 2) % 5;
+            lengths[2] = compress & 0x3;
+            tableIdx = 1;
+        }
+        else
+        {
+            compress -= 500;
+            lengths[0] = compress / 3;
+            lengths[1] = compress % 3;
+            granule->preflag = true;
+            tableIdx = 2;
+        }
+        
+        u32 kind = 0;
+        if (granule->blockType == Mp3Block_Short)
+        {
+            kind = granule->mixedBlock ? 2 : 1;
+        }
+        u8 *counts = gMp3LsfBandCounts[tableIdx][kind];
+        for (u32 group = 0; group < 4; ++group)
+        {
+            for (u32 index = 0; (index < counts[group]) && (band < layout->bandCount); ++index, ++band)
+            {
+                scalefactors[band] = (u8)get_mp3_bits(reader, lengths[group]);
+                decoder->intensityLimits[band] = (u8)((1 << lengths[group]) - 1);
+            }
+        }
+    }
+    
+    // NOTE(michiel): The last band (of each window) has no scalefactor
+    for (; band < MP3_MAX_BANDS; ++band)
+    {
+        scalefactors[band] = 0;
+        decoder->intensityLimits[band] = 0;
+    }
+}
+
+internal f32
+get_mp3_gain(s32 quarterPower)
+{
+    // NOTE(michiel): 2^(quarterPower / 4), built from the float bits
+    s32 exponent = quarterPower >> 2;
+    f32 result = 0.0f;
+    if (exponent > -127)
+    {
+        u32 bits = (u32)(exponent + 127) << 23;
+        memcpy(&result, &bits, sizeof(f32));
+        result *= gMp3GainFractions[quarterPower & 0x3];
+    }
+    return result;
+}
+
+internal void
+get_mp3_band_gains(Mp3GranuleInfo *granule, Mp3BandLayout *layout, u8 *scalefactors, f32 *gains)
+{
+    s32 globalPower = (s32)granule->globalGain - 210;
+    u32 scalefacShift = 1 + granule->scalefacScale;
+    for (u32 band = 0; band < layout->bandCount; ++band)
+    {
+        s32 power = globalPower;
+        if (band < layout->longCount)
+        {
+            u32 scalefactor = scalefactors[band] + (granule->preflag ? gMp3Pretab[band] : 0);
+            power -= (s32)(scalefactor << scalefacShift);
+        }
+        else
+        {
+            u32 window = (band - layout->longCount) % 3;
+            power -= 8 * (s32)granule->subblockGain[window];
+            power -= (s32)((u32)scalefactors[band] << scalefacShift);
+        }
+        gains[band] = get_mp3_gain(power);
+    }
+}
+
+internal u32
+read_mp3_huffman_data(Mp3BitReader *reader, u32 part3End, Mp3GranuleInfo *granule, Mp3BandLayout *layout,
+                      f32 *gains, f32 *spectrum)
+{
+    // NOTE(michiel): Returns the number of decoded lines, everything after that is zero
+    u32 regionEnds[3] = {};
+    u32 lineCount = 0;
+    u32 region0Bands = granule->region0Count + 1;
+    u32 region1Bands = region0Bands + granule->region1Count + 1;
+    for (u32 band = 0; band < layout->bandCount; ++band)
+    {
+        lineCount += layout->widths[band];
+        if (band < region0Bands)
+        {
+            regionEnds[0] = lineCount;
+        }
+        if (band < region1Bands)
+        {
+            regionEnds[1] = lineCount;
+        }
+    }
+    regionEnds[2] = MP3_GRANULE_SAMPLES;
+    
+    u32 bigValuesEnd = granule->bigValues * 2;
+    u32 line = 0;
+    u32 band = 0;
+    u32 bandEnd = layout->widths[0];
+    u32 region = 0;
+    while (line < bigValuesEnd)
+    {
+        while (line >= regionEnds[region])
+        {
+            ++region;
+        }
+        while (line >= bandEnd)
+        {
+            bandEnd += layout->widths[++band];
+        }
+        
+        u32 runEnd = minimum(minimum(bandEnd, regionEnds[region]), bigValuesEnd);
+        Mp3HuffmanTable *table = gMp3HuffmanTables + granule->tableSelect[region];
+        if (!table->entries)
+        {
+            // NOTE(michiel): Table 0 (and the unused 4 and 14) code nothing, the lines are zero
+            line = runEnd;
+            continue;
+        }
+        
+        f32 gain = gains[band];
+        u32 linbits = table->linbits;
+        while (line < runEnd)
+        {
+            if (reader->position > part3End)
+            {
+                return line;
+            }
+            
+            u32 value = decode_mp3_huffman(reader, table);
+            u32 x = value >> 4;
+            u32 y = value & 0xF;
+            if (x)
+            {
+                if (x == 15)
+                {
+                    x += get_mp3_bits(reader, linbits);
+                }
+                f32 sample = gMp3Pow43[x] * gain;
+                spectrum[line] = get_mp3_bits(reader, 1) ? -sample : sample;
+            }
+            if (y)
+            {
+                if (y == 15)
+                {
+                    y += get_mp3_bits(reader, linbits);
+                }
+                f32 sample = gMp3Pow43[y] * gain;
+                spectrum[line + 1] = get_mp3_bits(reader, 1) ? -sample : sample;
+            }
+            line += 2;
+        }
+    }
+    
+    // NOTE(michiel): Quadruples of -1, 0 and 1 up to the end of the data, a quadruple that runs over the
+    // end is not part of it.
+    Mp3HuffmanTable *table = gMp3HuffmanTables + 32 + granule->count1Table;
+    while ((line <= (MP3_GRANULE_SAMPLES - 4)) && (reader->position < part3End))
+    {
+        u32 value = decode_mp3_huffman(reader, table);
+        for (u32 index = 0; index < 4; ++index)
+        {
+            u32 at = line + index;
+            while (at >= bandEnd)
+            {
+                bandEnd += layout->widths[++band];
+            }
+            
+            if (value & (0x8 >> index))
+            {
+                spectrum[at] = get_mp3_bits(reader, 1) ? -gains[band] : gains[band];
+            }
+        }
+        
+        if (reader->position > part3End)
+        {
+            for (u32 index = 0; index < 4; ++index)
+            {
+                spectrum[line + index] = 0.0f;
+            }
+            break;
+        }
+        line += 4;
+    }
+    
+    return line;
+}
+
+internal void
+decode_mp3_channel(Mp3Decoder *decoder, MpegFrameHeader *header, Mp3SideInfo *sideInfo,
+                   u32 granuleIdx, u32 channel, Mp3BitReader *reader)
+{
+    Mp3GranuleInfo *granule = &sideInfo->granules[granuleIdx][channel];
+    f32 *spectrum = decoder->spectrum[channel];
+    memset(spectrum, 0, sizeof(decoder->spectrum[channel]));
+    decoder->nonZeroCount[channel] = 0;
+    
+    u32 part23End = reader->position + granule->part23Length;
+    if (part23End > reader->end)
+    {
+        ++decoder->badGranules;
+        reader->position = reader->end;
+        return;
+    }
+    
+    Mp3BandLayout *layout = get_mp3_band_layout(header, granule);
+    read_mp3_scalefactors(decoder, header, sideInfo, granuleIdx, channel, layout, reader);
+    if (reader->position > part23End)
+    {
+        ++decoder->badGranules;
+        reader->position = part23End;
+        return;
+    }
+    
+    f32 gains[MP3_MAX_BANDS];
+    get_mp3_band_gains(granule, layout, decoder->scalefactors[channel], gains);
+    decoder->nonZeroCount[channel] = read_mp3_huffman_data(reader, part23End, granule, layout, gains, spectrum);
+    
+    // NOTE(michiel): Stuffing bits after the Huffman data are skipped
+    reader->position = part23End;
+}
+
+//
+// NOTE(michiel): Stereo
+//
+
+internal void
+process_mp3_mid_side(f32 *left, f32 *right, u32 start, u32 end)
+{
+    __m128 scale = _mm_set1_ps(0.70710678f);
+    u32 line = start;
+    for (; (line + 4) <= end; line += 4)
+    {
+        __m128 mid = _mm_loadu_ps(left + line);
+        __m128 side = _mm_loadu_ps(right + line);
+        _mm_storeu_ps(left + line, _mm_mul_ps(_mm_add_ps(mid, side), scale));
+        _mm_storeu_ps(right + line, _mm_mul_ps(_mm_sub_ps(mid, side), scale));
+    }
+    for (; line < end; ++line)
+    {
+        f32 mid = left[line];
+        f32 side = right[line];
+        left[line] = (mid + side) * 0.70710678f;
+        right[line] = (mid - side) * 0.70710678f;
+    }
+}
+
+internal void
+process_mp3_stereo(Mp3Decoder *decoder, MpegFrameHeader *header, Mp3GranuleInfo *granule)
+{
+    // NOTE(michiel): Uses the band layout of the right channel, both channels should have the same block type
+    f32 *left = decoder->spectrum[0];
+    f32 *right = decoder->spectrum[1];
+    b32 midSide = header->modeExtension & MpegChannelExt3_MidSide;
+    u32 lineCount = maximum(decoder->nonZeroCount[0], decoder->nonZeroCount[1]);
+    
+    if (!(header->modeExtension & MpegChannelExt3_Intensity))
+    {
+        process_mp3_mid_side(left, right, 0, lineCount);
+    }
+    else
+    {
+        // NOTE(michiel): Intensity stereo starts above the last non-zero line of the right channel, for
+        // short blocks that is checked per window (the long part of mixed blocks goes with all windows).
+        Mp3BandLayout *layout = get_mp3_band_layout(header, granule);
+        u32 bandStarts[MP3_MAX_BANDS + 1];
+        bandStarts[0] = 0;
+        for (u32 band = 0; band < layout->bandCount; ++band)
+        {
+            bandStarts[band + 1] = bandStarts[band] + layout->widths[band];
+        }
+        
+        b32 intensityBands[MP3_MAX_BANDS];
+        b32 windowNonZero[3] = {};
+        b32 anyNonZero = false;
+        for (u32 band = layout->bandCount; band-- > 0;)
+        {
+            b32 nonZero = false;
+            for (u32 line = bandStarts[band]; (line < bandStarts[band + 1]) && !nonZero; ++line)
+            {
+                nonZero = (right[line] != 0.0f);
+            }
+            
+            if (band < layout->longCount)
+            {
+                intensityBands[band] = !anyNonZero && !nonZero;
+            }
+            else
+            {
+                u32 window = (band - layout->longCount) % 3;
+                intensityBands[band] = !windowNonZero[window] && !nonZero;
+                windowNonZero[window] |= nonZero;
+            }
+            anyNonZero |= nonZero;
+        }
+        
+        u8 *positions = decoder->scalefactors[1];
+        for (u32 band = 0; band < layout->bandCount; ++band)
+        {
+            u32 start = bandStarts[band];
+            u32 end = bandStarts[band + 1];
+            b32 intensity = intensityBands[band] && (start < MP3_GRANULE_SAMPLES);
+            if (intensity)
+            {
+                // NOTE(michiel): The last band (of a window) uses the position of the one below it
+                u32 positionBand = band;
+                if (band == (layout->bandCount - 1) && (layout->longCount == layout->bandCount))
+                {
+                    positionBand = band - 1;
+                }
+                else if ((band >= layout->longCount) && (band >= (layout->bandCount - 3)))
+                {
+                    positionBand = band - 3;
+                }
+                
+                u32 position = positions[positionBand];
+                f32 *ratios = 0;
+                if (header->version == MpegVersion_1)
+                {
+                    if (position < 7)
+                    {
+                        ratios = gMp3IntensityRatios[position];
+                    }
+                }
+                else if (position != decoder->intensityLimits[positionBand])
+                {
+                    ratios = gMp3LsfIntensityRatios[decoder->intensityScale][position];
+                }
+                
+                if (ratios)
+                {
+                    for (u32 line = start; line < end; ++line)
+                    {
+                        f32 sample = left[line];
+                        left[line] = sample * ratios[0];
+                        right[line] = sample * ratios[1];
+                    }
+                    continue;
+                }
+            }
+            
+            if (midSide)
+            {
+                process_mp3_mid_side(left, right, start, end);
+            }
+        }
+        lineCount = maximum(lineCount, decoder->nonZeroCount[0]);
+    }
+    
+    decoder->nonZeroCount[0] = lineCount;
+    decoder->nonZeroCount[1] = lineCount;
+}
+
+//
+// NOTE(michiel): Reorder, alias reduction, IMDCT
+//
+
+internal void
+reorder_mp3_short_bands(MpegFrameHeader *header, Mp3BandLayout *layout, f32 *spectrum)
+{
+    // NOTE(michiel): Short bands are stored band, window, line. The IMDCT wants them per subband as
+    // line * 3 + window, with lines counted inside one window.
+    u32 *shortStarts = gMp3ShortBandStarts[header->sampleRateIndex];
+    u32 line = 0;
+    for (u32 band = 0; band < layout->longCount; ++band)
+    {
+        line += layout->widths[band];
+    }
+    
+    f32 reordered[MP3_GRANULE_SAMPLES] = {};
+    u32 firstLine = line;
+    for (u32 band = layout->longCount; band < layout->bandCount; ++band)
+    {
+        u32 shortBand = layout->shortBandOffset + (band - layout->longCount) / 3;
+        u32 window = (band - layout->longCount) % 3;
+        u32 width = layout->widths[band];
+        if (shortBand < 13)
+        {
+            u32 windowLine = shortStarts[shortBand];
+            for (u32 index = 0; index < width; ++index)
+            {
+                reordered[(windowLine + index) * 3 + window] = spectrum[line + index];
+            }
+        }
+        line += width;
+    }
+    
+    for (u32 index = firstLine; index < MP3_GRANULE_SAMPLES; ++index)
+    {
+        spectrum[index] = reordered[index];
+    }
+}
+
+internal void
+reduce_mp3_aliasing(f32 *spectrum, u32 subbandCount, u32 lineCount)
+{
+    for (u32 subband = 1; (subband < subbandCount) && ((subband * 18 - 8) < lineCount); ++subband)
+    {
+        f32 *boundary = spectrum + subband * 18;
+        for (u32 index = 0; index < 8; ++index)
+        {
+            f32 low = boundary[-1 - (s32)index];
+            f32 high = boundary[index];
+            boundary[-1 - (s32)index] = low * gMp3AliasCs[index] - high * gMp3AliasCa[index];
+            boundary[index] = high * gMp3AliasCs[index] + low * gMp3AliasCa[index];
+        }
+    }
+}
+
+internal void
+imdct_mp3_long(__m128 *input, f32 *window, __m128 *output)
+{
+    // NOTE(michiel): 4 subbands at once, 18 lines in, 36 windowed samples out
+    __m128 dct[18];
+    f32 *coefficients = gMp3ImdctLong;
+    for (u32 m = 0; m < 18; ++m)
+    {
+        __m128 sum = _mm_mul_ps(input[0], _mm_loadu_ps(coefficients));
+        coefficients += 4;
+        for (u32 k = 1; k < 18; ++k)
+        {
+            sum = _mm_add_ps(sum, _mm_mul_ps(input[k], _mm_loadu_ps(coefficients)));
+            coefficients += 4;
+        }
+        dct[m] = sum;
+    }
+    
+    for (u32 index = 0; index < 9; ++index)
+    {
+        output[index] = _mm_mul_ps(dct[index + 9], _mm_set1_ps(window[index]));
+        output[index + 27] = _mm_mul_ps(dct[index], _mm_set1_ps(window[index + 27]));
+    }
+    for (u32 index = 9; index < 27; ++index)
+    {
+        output[index] = _mm_mul_ps(dct[26 - index], _mm_set1_ps(window[index]));
+    }
+}
+
+internal void
+imdct_mp3_short(__m128 *input, __m128 *output)
+{
+    // NOTE(michiel): Three overlapping 12 point transforms, at 6, 12 and 18 of the 36 samples
+    for (u32 index = 0; index < 36; ++index)
+    {
+        output[index] = _mm_setzero_ps();
+    }
+    
+    for (u32 window = 0; window < 3; ++window)
+    {
+        __m128 dct[6];
+        f32 *coefficients = gMp3ImdctShort;
+        for (u32 m = 0; m < 6; ++m)
+        {
+            __m128 sum = _mm_mul_ps(input[window], _mm_loadu_ps(coefficients));
+            coefficients += 4;
+            for (u32 k = 1; k < 6; ++k)
+            {
+                sum = _mm_add_ps(sum, _mm_mul_ps(input[k * 3 + window], _mm_loadu_ps(coefficients)));
+                coefficients += 4;
+            }
+            dct[m] = sum;
+        }
+        
+        __m128 *at = output + 6 + window * 6;
+        for (u32 index = 0; index < 3; ++index)
+        {
+            at[index] = _mm_add_ps(at[index], _mm_mul_ps(dct[index + 3], _mm_set1_ps(gMp3ImdctShortWindow[index])));
+            at[index + 9] = _mm_add_ps(at[index + 9], _mm_mul_ps(dct[index], _mm_set1_ps(gMp3ImdctShortWindow[index + 9])));
+        }
+        for (u32 index = 3; index < 9; ++index)
+        {
+            at[index] = _mm_add_ps(at[index], _mm_mul_ps(dct[8 - index], _mm_set1_ps(gMp3ImdctShortWindow[index])));
+        }
+    }
+}
+
+internal void
+imdct_mp3_channel(Mp3Decoder *decoder, Mp3GranuleInfo *granule, u32 channel)
+{
+    // NOTE(michiel): Subbands are done 4 at a time, that also gives the time slot order the synthesis wants
+    f32 *spectrum = decoder->spectrum[channel];
+    f32 *overlap = decoder->overlap[channel];
+    __m128 oddSlotSigns = _mm_setr_ps(1.0f, -1.0f, 1.0f, -1.0f);
+    __m128 longLanes = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, 0, 0));
+    
+    for (u32 group = 0; group < 8; ++group)
+    {
+        f32 *lines = spectrum + group * 4 * 18;
+        __m128 input[18];
+        for (u32 index = 0; index < 18; ++index)
+        {
+            input[index] = _mm_setr_ps(lines[index], lines[18 + index], lines[36 + index], lines[54 + index]);
+        }
+        
+        __m128 output[36];
+        if (granule->blockType != Mp3Block_Short)
+        {
+            imdct_mp3_long(input, gMp3ImdctWindows[granule->blockType], output);
+        }
+        else if (!granule->mixedBlock || (group > 0))
+        {
+            imdct_mp3_short(input, output);
+        }
+        else
+        {
+            // NOTE(michiel): Mixed blocks have long (normal window) subbands 0 and 1
+            __m128 shortOutput[36];
+            imdct_mp3_long(input, gMp3ImdctWindows[Mp3Block_Normal], output);
+            imdct_mp3_short(input, shortOutput);
+            for (u32 index = 0; index < 36; ++index)
+            {
+                output[index] = _mm_or_ps(_mm_and_ps(longLanes, output[index]), _mm_andnot_ps(longLanes, shortOutput[index]));
+            }
+        }
+        
+        // NOTE(michiel): Overlap-add, and invert the odd samples of the odd subbands
+        f32 *previous = overlap + group * 18 * 4;
+        for (u32 slot = 0; slot < 18; ++slot)
+        {
+            __m128 sample = _mm_add_ps(output[slot], _mm_loadu_ps(previous + slot * 4));
+            _mm_storeu_ps(previous + slot * 4, output[slot + 18]);
+            if (slot & 1)
+            {
+                sample = _mm_mul_ps(sample, oddSlotSigns);
+            }
+            _mm_storeu_ps(decoder->subbandSamples[slot] + group * 4, sample);
+        }
+    }
+}
+
+//
+// NOTE(michiel): Polyphase synthesis, shared with the other layers
+//
+
+internal void
+synthesize_mpeg_slot(f32 *history, u32 slot, f32 *subbands, f32 *output, u32 outputStride)
+{
+    // NOTE(michiel): history holds the last 16 matrixed vectors of 64 samples, slot (mod 16) is the new one.
+    // The matrixing only needs the 32 point DCT X[j] = sum(S[k] cos((2k + 1) j pi / 64)), because
+    // V[i] = X[16 + i] is X[16..31], 0, -X[31..1] and -X[0..15].
+    __m128 sums[8];
+    for (u32 group = 0; group < 8; ++group)
+    {
+        sums[group] = _mm_setzero_ps();
+    }
+    f32 *coefficients = gMpegSynthesisCos;
+    for (u32 k = 0; k < 32; ++k)
+    {
+        if (subbands[k] != 0.0f)
+        {
+            __m128 sample = _mm_set1_ps(subbands[k]);
+            for (u32 group = 0; group < 8; ++group)
+            {
+                sums[group] = _mm_add_ps(sums[group], _mm_mul_ps(sample, _mm_loadu_ps(coefficients + group * 4)));
+            }
+        }
+        coefficients += 32;
+    }
+    
+    f32 dct[32];
+    for (u32 group = 0; group < 8; ++group)
+    {
+        _mm_storeu_ps(dct + group * 4, sums[group]);
+    }
+    
+    f32 *vector = history + (slot & 15) * 64;
+    for (u32 index = 0; index < 16; ++index)
+    {
+        vector[index] = dct[16 + index];
+        vector[48 + index] = -dct[index];
+    }
+    vector[16] = 0.0f;
+    for (u32 index = 17; index < 48; ++index)
+    {
+        vector[index] = -dct[48 - index];
+    }
+    
+    // NOTE(michiel): out[j] = sum over i of V(2i)[j] D[64i + j] + V(2i + 1)[32 + j] D[64i + 32 + j], where
+    // V(n) is the vector of n slots ago
+    for (u32 group = 0; group < 8; ++group)
+    {
+        u32 offset = group * 4;
+        __m128 sum = _mm_setzero_ps();
+        for (u32 index = 0; index < 8; ++index)
+        {
+            f32 *even = history + ((slot - 2 * index) & 15) * 64;
+            f32 *odd = history + ((slot - 2 * index - 1) & 15) * 64;
+            f32 *window = gMpegSynthesisD + index * 64;
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(even + offset), _mm_loadu_ps(window + offset)));
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(odd + 32 + offset), _mm_loadu_ps(window + 32 + offset)));
+        }
+        
+        if (outputStride == 1)
+        {
+            _mm_storeu_ps(output + offset, sum);
+        }
+        else
+        {
+            f32 samples[4];
+            _mm_storeu_ps(samples, sum);
+            for (u32 index = 0; index < 4; ++index)
+            {
+                output[(offset + index) * outputStride] = samples[index];
+            }
+        }
+    }
+}
+
+//
+// NOTE(michiel): Fixed point IMDCT and synthesis
+//
+
+// NOTE(michiel): The same transforms as above on Q28 samples and the Q30 tables of mp3_fixed.h. SSE4.1 only
+// has a 32 x 32 -> 64 bit multiply for lanes 0 and 2 (_mm_mul_epi32), so the odd lanes are shifted down
+// and summed apart, then both halves are joined again by get_mpeg_fixed_sum.
+
+internal __m128i
+get_mpeg_fixed_samples(__m128 samples)
+{
+    // NOTE(michiel): _mm_cvtps_epi32 gives 0x80000000 for values out of range, so clamp just inside +-8 first
+    __m128 limit = _mm_set1_ps(7.999f);
+    samples = _mm_min_ps(_mm_max_ps(samples, _mm_sub_ps(_mm_setzero_ps(), limit)), limit);
+    return _mm_cvtps_epi32(_mm_mul_ps(samples, _mm_set1_ps((f32)(1 << MPEG_FIXED_SAMPLE_BITS))));
+}
+
+internal __m128
+get_mpeg_float_samples(__m128i samples)
+{
+    return _mm_mul_ps(_mm_cvtepi32_ps(samples), _mm_set1_ps(1.0f / (f32)(1 << MPEG_FIXED_SAMPLE_BITS)));
+}
+
+internal __m128i
+get_mpeg_fixed_sum(__m128i evenSum, __m128i oddSum)
+{
+    // NOTE(michiel): Rounds the 64 bit sums of lanes 0, 2 and lanes 1, 3 back to Q28. Only the low 32 bits
+    // are kept, those are the same for a logical and an arithmetic shift, so negative sums work as well.
+    __m128i round = _mm_set1_epi64x((s64)1 << (MPEG_FIXED_COEFF_BITS - 1));
+    evenSum = _mm_srli_epi64(_mm_add_epi64(evenSum, round), MPEG_FIXED_COEFF_BITS);
+    oddSum = _mm_srli_epi64(_mm_add_epi64(oddSum, round), MPEG_FIXED_COEFF_BITS);
+    return _mm_blend_epi16(evenSum, _mm_slli_epi64(oddSum, 32), 0xCC);
+}
+
+internal __m128i
+mul_mpeg_fixed(__m128i samples, __m128i coefficient)
+{
+    // NOTE(michiel): coefficient is the same in all lanes
+    return get_mpeg_fixed_sum(_mm_mul_epi32(samples, coefficient),
+                              _mm_mul_epi32(_mm_srli_epi64(samples, 32), coefficient));
+}
+
+internal void
+imdct_mp3_long_fixed(__m128i *input, const s32 *window, __m128i *output)
+{
+    __m128i inputOdd[18];
+    for (u32 k = 0; k < 18; ++k)
+    {
+        inputOdd[k] = _mm_srli_epi64(input[k], 32);
+    }
+    
+    __m128i dct[18];
+    const s32 *coefficients = gMp3FixedImdctLong.values;
+    for (u32 m = 0; m < 18; ++m)
+    {
+        __m128i evenSum = _mm_setzero_si128();
+        __m128i oddSum = _mm_setzero_si128();
+        for (u32 k = 0; k < 18; ++k)
+        {
+            __m128i coefficient = _mm_loadu_si128((__m128i *)coefficients);
+            evenSum = _mm_add_epi64(evenSum, _mm_mul_epi32(input[k], coefficient));
+            oddSum = _mm_add_epi64(oddSum, _mm_mul_epi32(inputOdd[k], coefficient));
+            coefficients += 4;
+        }
+        dct[m] = get_mpeg_fixed_sum(evenSum, oddSum);
+    }
+    
+    for (u32 index = 0; index < 9; ++index)
+    {
+        output[index] = mul_mpeg_fixed(dct[index + 9], _mm_set1_epi32(window[index]));
+        output[index + 27] = mul_mpeg_fixed(dct[index], _mm_set1_epi32(window[index + 27]));
+    }
+    for (u32 index = 9; index < 27; ++index)
+    {
+        output[index] = mul_mpeg_fixed(dct[26 - index], _mm_set1_epi32(window[index]));
+    }
+}
+
+internal void
+imdct_mp3_short_fixed(__m128i *input, __m128i *output)
+{
+    for (u32 index = 0; index < 36; ++index)
+    {
+        output[index] = _mm_setzero_si128();
+    }
+    
+    const s32 *shortWindow = gMp3FixedImdctShortWindow.values;
+    for (u32 window = 0; window < 3; ++window)
+    {
+        __m128i dct[6];
+        const s32 *coefficients = gMp3FixedImdctShort.values;
+        for (u32 m = 0; m < 6; ++m)
+        {
+            __m128i evenSum = _mm_setzero_si128();
+            __m128i oddSum = _mm_setzero_si128();
+            for (u32 k = 0; k < 6; ++k)
+            {
+                __m128i coefficient = _mm_loadu_si128((__m128i *)coefficients);
+                __m128i sample = input[k * 3 + window];
+                evenSum = _mm_add_epi64(evenSum, _mm_mul_epi32(sample, coefficient));
+                oddSum = _mm_add_epi64(oddSum, _mm_mul_epi32(_mm_srli_epi64(sample, 32), coefficient));
+                coefficients += 4;
+            }
+            dct[m] = get_mpeg_fixed_sum(evenSum, oddSum);
+        }
+        
+        __m128i *at = output + 6 + window * 6;
+        for (u32 index = 0; index < 3; ++index)
+        {
+            at[index] = _mm_add_epi32(at[index], mul_mpeg_fixed(dct[index + 3], _mm_set1_epi32(shortWindow[index])));
+            at[index + 9] = _mm_add_epi32(at[index + 9], mul_mpeg_fixed(dct[index], _mm_set1_epi32(shortWindow[index + 9])));
+        }
+        for (u32 index = 3; index < 9; ++index)
+        {
+            at[index] = _mm_add_epi32(at[index], mul_mpeg_fixed(dct[8 - index], _mm_set1_epi32(shortWindow[index])));
+        }
+    }
+}
+
+internal void
+imdct_mp3_channel_fixed(Mp3Decoder *decoder, Mp3GranuleInfo *granule, u32 channel)
+{
+    // NOTE(michiel): The spectrum is still float, it goes to Q28 here
+    f32 *spectrum = decoder->spectrum[channel];
+    s32 *overlap = decoder->fixedOverlap[channel];
+    __m128i oddSlotSigns = _mm_setr_epi32(1, -1, 1, -1);
+    __m128i longLanes = _mm_setr_epi32(-1, -1, 0, 0);
+    
+    for (u32 group = 0; group < 8; ++group)
+    {
+        f32 *lines = spectrum + group * 4 * 18;
+        __m128i input[18];
+        for (u32 index = 0; index < 18; ++index)
+        {
+            input[index] = get_mpeg_fixed_samples(_mm_setr_ps(lines[index], lines[18 + index],
+                                                              lines[36 + index], lines[54 + index]));
+        }
+        
+        __m128i output[36];
+        if (granule->blockType != Mp3Block_Short)
+        {
+            imdct_mp3_long_fixed(input, gMp3FixedImdctWindows.values + granule->blockType * 36, output);
+        }
+        else if (!granule->mixedBlock || (group > 0))
+        {
+            imdct_mp3_short_fixed(input, output);
+        }
+        else
+        {
+            __m128i shortOutput[36];
+            imdct_mp3_long_fixed(input, gMp3FixedImdctWindows.values + Mp3Block_Normal * 36, output);
+            imdct_mp3_short_fixed(input, shortOutput);
+            for (u32 index = 0; index < 36; ++index)
+            {
+                output[index] = _mm_blendv_epi8(shortOutput[index], output[index], longLanes);
+            }
+        }
+        
+        s32 *previous = overlap + group * 18 * 4;
+        for (u32 slot = 0; slot < 18; ++slot)
+        {
+            __m128i sample = _mm_add_epi32(output[slot], _mm_loadu_si128((__m128i *)(previous + slot * 4)));
+            _mm_storeu_si128((__m128i *)(previous + slot * 4), output[slot + 18]);
+            if (slot & 1)
+            {
+                sample = _mm_sign_epi32(sample, oddSlotSigns);
+            }
+            _mm_storeu_si128((__m128i *)(decoder->fixedSubbandSamples[slot] + group * 4), sample);
+        }
+    }
+}
+
+internal void
+synthesize_mpeg_slot_fixed(s32 *history, u32 slot, s32 *subbands, f32 *output, u32 outputStride)
+{
+    // NOTE(michiel): synthesize_mpeg_slot on Q28 history and subband samples, the output is still float
+    __m128i evenSums[8];
+    __m128i oddSums[8];
+    for (u32 group = 0; group < 8; ++group)
+    {
+        evenSums[group] = _mm_setzero_si128();
+        oddSums[group] = _mm_setzero_si128();
+    }
+    const s32 *coefficients = gMpegFixedSynthesisCos.values;
+    for (u32 k = 0; k < 32; ++k)
+    {
+        if (subbands[k] != 0)
+        {
+            __m128i sample = _mm_set1_epi32(subbands[k]);
+            for (u32 group = 0; group < 8; ++group)
+            {
+                __m128i even = _mm_loadu_si128((__m128i *)(coefficients + group * 8));
+                __m128i odd = _mm_loadu_si128((__m128i *)(coefficients + group * 8 + 4));
+                evenSums[group] = _mm_add_epi64(evenSums[group], _mm_mul_epi32(sample, even));
+                oddSums[group] = _mm_add_epi64(oddSums[group], _mm_mul_epi32(sample, odd));
+            }
+        }
+        coefficients += 64;
+    }
+    
+    s32 dct[32];
+    for (u32 group = 0; group < 8; ++group)
+    {
+        _mm_storeu_si128((__m128i *)(dct + group * 4), get_mpeg_fixed_sum(evenSums[group], oddSums[group]));
+    }
+    
+    s32 *vector = history + (slot & 15) * 64;
+    for (u32 index = 0; index < 16; ++index)
+    {
+        vector[index] = dct[16 + index];
+        vector[48 + index] = -dct[index];
+    }
+    vector[16] = 0;
+    for (u32 index = 17; index < 48; ++index)
+    {
+        vector[index] = -dct[48 - index];
+    }
+    
+    for (u32 group = 0; group < 8; ++group)
+    {
+        u32 offset = group * 4;
+        __m128i evenSum = _mm_setzero_si128();
+        __m128i oddSum = _mm_setzero_si128();
+        for (u32 index = 0; index < 8; ++index)
+        {
+            __m128i even = _mm_loadu_si128((__m128i *)(history + ((slot - 2 * index) & 15) * 64 + offset));
+            __m128i odd = _mm_loadu_si128((__m128i *)(history + ((slot - 2 * index - 1) & 15) * 64 + 32 + offset));
+            const s32 *window = gMpegFixedSynthesisD.values + (index * 64 + offset) * 2;
+            __m128i evenWindow = _mm_loadu_si128((__m128i *)window);
+            __m128i oddWindow = _mm_loadu_si128((__m128i *)(window + 4));
+            evenSum = _mm_add_epi64(evenSum, _mm_mul_epi32(even, evenWindow));
+            oddSum = _mm_add_epi64(oddSum, _mm_mul_epi32(_mm_srli_epi64(even, 32), oddWindow));
+            
+            window += 64;
+            evenWindow = _mm_loadu_si128((__m128i *)window);
+            oddWindow = _mm_loadu_si128((__m128i *)(window + 4));
+            evenSum = _mm_add_epi64(evenSum, _mm_mul_epi32(odd, evenWindow));
+            oddSum = _mm_add_epi64(oddSum, _mm_mul_epi32(_mm_srli_epi64(odd, 32), oddWindow));
+        }
+        __m128 sum = get_mpeg_float_samples(get_mpeg_fixed_sum(evenSum, oddSum));
+        
+        if (outputStride == 1)
+        {
+            _mm_storeu_ps(output + offset, sum);
+        }
+        else
+        {
+            f32 samples[4];
+            _mm_storeu_ps(samples, sum);
+            for (u32 index = 0; index < 4; ++index)
+            {
+                output[(offset + index) * outputStride] = samples[index];
+            }
+        }
+    }
+}
+
+//
+// NOTE(michiel): Frame
+//
+
+internal b32
+decode_mp3_frame(Mp3Decoder *decoder, MpegFrameHeader *header, u8 *frame, f32 *output)
+{
+    // NOTE(michiel): Writes header->sampleCount samples of each channel, interleaved. Frames that can't
+    // be decoded (their main data starts before the data we have) give silence and return false.
+    i_expect(header->layer == 3);
+    u32 channelCount = header->channelCount;
+    u8 *sideInfoData = frame + MPEG_HEADER_SIZE + (header->protection ? 2 : 0);
+    u32 sideInfoSize = get_mp3_side_info_size(header);
+    u32 headerBytes = (u32)(sideInfoData - frame) + sideInfoSize;
+    if (headerBytes > header->frameByteCount)
+    {
+        ++decoder->badGranules;
+        memset(output, 0, header->sampleCount * channelCount * sizeof(f32));
+        return false;
+    }
+    
+    Mp3SideInfo sideInfo;
+    parse_mp3_side_info(header, sideInfoData, &sideInfo);
+    
+    u32 mainDataSize = header->frameByteCount - headerBytes;
+    memcpy(decoder->mainData + decoder->reservoirSize, sideInfoData + sideInfoSize, mainDataSize);
+    u32 availableSize = decoder->reservoirSize + mainDataSize;
+    memset(decoder->mainData + availableSize, 0, MP3_MAIN_DATA_PADDING);
+    
+    b32 result = sideInfo.mainDataBegin <= decoder->reservoirSize;
+    if (result)
+    {
+        Mp3BitReader reader = {};
+        reader.data = decoder->mainData + decoder->reservoirSize - sideInfo.mainDataBegin;
+        reader.end = (sideInfo.mainDataBegin + mainDataSize) * 8;
+        
+        u32 granuleCount = (header->version == MpegVersion_1) ? 2 : 1;
+        for (u32 granuleIdx = 0; granuleIdx < granuleCount; ++granuleIdx)
+        {
+            for (u32 channel = 0; channel < channelCount; ++channel)
+            {
+                decode_mp3_channel(decoder, header, &sideInfo, granuleIdx, channel, &reader);
+            }
+            
+            if (header->modeExtension && (header->channelMode == MpegChannel_JointStereo))
+            {
+                process_mp3_stereo(decoder, header, &sideInfo.granules[granuleIdx][1]);
+            }
+            
+            for (u32 channel = 0; channel < channelCount; ++channel)
+            {
+                Mp3GranuleInfo *granule = &sideInfo.granules[granuleIdx][channel];
+                f32 *spectrum = decoder->spectrum[channel];
+                if (granule->blockType == Mp3Block_Short)
+                {
+                    reorder_mp3_short_bands(header, get_mp3_band_layout(header, granule), spectrum);
+                    if (granule->mixedBlock)
+                    {
+                        reduce_mp3_aliasing(spectrum, 2, decoder->nonZeroCount[channel]);
+                    }
+                }
+                else
+                {
+                    reduce_mp3_aliasing(spectrum, 32, decoder->nonZeroCount[channel]);
+                }
+                
+                f32 *channelOutput = output + granuleIdx * MP3_GRANULE_SAMPLES * channelCount + channel;
+                if (decoder->fixedPoint)
+                {
+                    imdct_mp3_channel_fixed(decoder, granule, channel);
+                    for (u32 slot = 0; slot < 18; ++slot)
+                    {
+                        synthesize_mpeg_slot_fixed(decoder->fixedSynthesis[channel], decoder->synthesisSlot + slot,
+                                                   decoder->fixedSubbandSamples[slot],
+                                                   channelOutput + slot * 32 * channelCount, channelCount);
+                    }
+                }
+                else
+                {
+                    imdct_mp3_channel(decoder, granule, channel);
+                    for (u32 slot = 0; slot < 18; ++slot)
+                    {
+                        synthesize_mpeg_slot(decoder->synthesis[channel], decoder->synthesisSlot + slot,
+                                             decoder->subbandSamples[slot], channelOutput + slot * 32 * channelCount,
+                                             channelCount);
+                    }
+                }
+            }
+            decoder->synthesisSlot += 18;
+        }
+    }
+    else
+    {
+        ++decoder->missingFrames;
+        memset(output, 0, header->sampleCount * channelCount * sizeof(f32));
+    }
+    
+    // NOTE(michiel): Keep what the next frames can point back to
+    u32 keepSize = minimum(availableSize, (u32)MP3_MAX_MAIN_DATA_BACK);
+    memmove(decoder->mainData, decoder->mainData + availableSize - keepSize, keepSize);
+    decoder->reservoirSize = keepSize;
+    ++decoder->frameCount;
+    
+    return result;
+}
+
+//
+// NOTE(michiel): Layer II
+//
+
+internal void
+init_mp2_decoder(Mp2Decoder *decoder)
+{
+    init_mp3_tables();
+    memset(decoder, 0, sizeof(Mp2Decoder));
+    decoder->fixedPoint = MPEG_FIXED_POINT;
+}
+
+internal Mp2AllocationTable *
+get_mp2_allocation_table(MpegFrameHeader *header)
+{
+    // NOTE(michiel): MPEG-1 picks the table by the bit rate of one channel
+    u32 tableIdx = 4;
+    if (header->version == MpegVersion_1)
+    {
+        u32 channelBitRate = header->bitRate / header->channelCount;
+        if ((channelBitRate >= 56) && ((channelBitRate <= 80) || (header->sampleRate == 48000)))
+        {
+            tableIdx = 0;
+        }
+        else if (channelBitRate >= 96)
+        {
+            tableIdx = 1;
+        }
+        else if (header->sampleRate != 32000)
+        {
+            tableIdx = 2;
+        }
+        else
+        {
+            tableIdx = 3;
+        }
+    }
+    return gMp2AllocationTables + tableIdx;
+}
+
+internal void
+dequantize_mp2_samples(Mp2QuantClass *quant, u32 *values, f32 scale, f32 *output)
+{
+    // NOTE(michiel): Levels are spread evenly over (-1, 1): (2v - (levels - 1)) / levels
+    __m128 codes = _mm_cvtepi32_ps(_mm_setr_epi32((s32)values[0], (s32)values[1], (s32)values[2], 0));
+    __m128 offset = _mm_set1_ps((f32)(quant->levels - 1));
+    __m128 step = _mm_set1_ps(scale / (f32)quant->levels);
+    __m128 samples = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(codes, codes), offset), step);
+    f32 result[4];
+    _mm_storeu_ps(result, samples);
+    output[0] = result[0];
+    output[32] = result[1];
+    output[64] = result[2];
+}
+
+internal b32
+decode_mp2_frame(Mp2Decoder *decoder, MpegFrameHeader *header, u8 *frame, f32 *output)
+{
+    // NOTE(michiel): Writes header->sampleCount samples of each channel, interleaved. Frames that don't
+    // hold the samples their allocation asks for give silence and return false.
+    i_expect(header->layer == 2);
+    u32 channelCount = header->channelCount;
+    if (header->frameByteCount > MP2_MAX_FRAME_BYTES)
+    {
+        // NOTE(michiel): Only MPEG-2.5, which has no layer II
+        ++decoder->badFrames;
+        ++decoder->frameCount;
+        memset(output, 0, header->sampleCount * channelCount * sizeof(f32));
+        return false;
+    }
+    
+    memcpy(decoder->frameData, frame, header->frameByteCount);
+    memset(decoder->frameData + header->frameByteCount, 0, MP2_FRAME_PADDING);
+    Mp3BitReader reader = {};
+    reader.data = decoder->frameData;
+    reader.position = (MPEG_HEADER_SIZE + (header->protection ? 2 : 0)) * 8;
+    reader.end = header->frameByteCount * 8;
+    
+    // NOTE(michiel): Joint stereo sends one allocation (and one set of samples) for both channels from
+    // the bound up, only the scalefactors differ.
+    Mp2AllocationTable *table = get_mp2_allocation_table(header);
+    u32 subbandLimit = table->subbandLimit;
+    u32 bound = subbandLimit;
+    if (header->channelMode == MpegChannel_JointStereo)
+    {
+        bound = minimum(4 * (header->modeExtension + 1), subbandLimit);
+    }
+    
+    Mp2QuantClass *quants[MPEG_MAX_CHANNELS][MP2_MAX_SUBBANDS] = {};
+    u32 sampleBits = 0;
+    for (u32 subband = 0; subband < subbandLimit; ++subband)
+    {
+        u8 *row = gMp2AllocationRows[table->rows[subband]];
+        u32 sharedCount = (subband < bound) ? channelCount : 1;
+        for (u32 channel = 0; channel < sharedCount; ++channel)
+        {
+            u32 allocation = get_mp3_bits(&reader, row[0]);
+            if (allocation)
+            {
+                Mp2QuantClass *quant = gMp2QuantClasses + row[allocation];
+                quants[channel][subband] = quant;
+                sampleBits += quant->grouped ? quant->bits : 3 * quant->bits;
+            }
+        }
+        if (sharedCount < channelCount)
+        {
+            quants[1][subband] = quants[0][subband];
+        }
+    }
+    
+    u32 scfsi[MPEG_MAX_CHANNELS][MP2_MAX_SUBBANDS];
+    for (u32 subband = 0; subband < subbandLimit; ++subband)
+    {
+        for (u32 channel = 0; channel < channelCount; ++channel)
+        {
+            if (quants[channel][subband])
+            {
+                scfsi[channel][subband] = get_mp3_bits(&reader, 2);
+            }
+        }
+    }
+    
+    // NOTE(michiel): Three scalefactors per subband, one for each third of the frame. The scfsi says
+    // which ones are sent: 0 all, 1 the first two are the same, 2 one for all, 3 the last two are the same.
+    f32 scales[MPEG_MAX_CHANNELS][MP2_MAX_SUBBANDS][3];
+    for (u32 subband = 0; subband < subbandLimit; ++subband)
+    {
+        for (u32 channel = 0; channel < channelCount; ++channel)
+        {
+            if (quants[channel][subband])
+            {
+                u32 indices[3];
+                indices[0] = get_mp3_bits(&reader, 6);
+                switch (scfsi[channel][subband])
+                {
+                    case 0:
+                    {
+                        indices[1] = get_mp3_bits(&reader, 6);
+                        indices[2] = get_mp3_bits(&reader, 6);
+                    } break;
+                    
+                    case 1:
+                    {
+                        indices[1] = indices[0];
+                        indices[2] = get_mp3_bits(&reader, 6);
+                    } break;
+                    
+                    case 2:
+                    {
+                        indices[1] = indices[0];
+                        indices[2] = indices[0];
+                    } break;
+                    
+                    case 3:
+                    {
+                        indices[1] = get_mp3_bits(&reader, 6);
+                        indices[2] = indices[1];
+                    } break;
+                    
+                    INVALID_DEFAULT_CASE;
+                }
+                
+                for (u32 part = 0; part < 3; ++part)
+                {
+                    scales[channel][subband][part] = gMp2ScaleFactors[indices[part]];
+                }
+            }
+        }
+    }
+    
+    u32 granuleCount = MPEG_MAX_FRAME_SAMPLES / (3 * 32);
+    if ((reader.position + granuleCount * sampleBits) > reader.end)
+    {
+        ++decoder->badFrames;
+        ++decoder->frameCount;
+        memset(output, 0, header->sampleCount * channelCount * sizeof(f32));
+        return false;
+    }
+    
+    // NOTE(michiel): 12 granules of 3 samples per subband, a scalefactor covers 4 granules
+    for (u32 granuleIdx = 0; granuleIdx < granuleCount; ++granuleIdx)
+    {
+        u32 part = granuleIdx / 4;
+        memset(decoder->subbandSamples, 0, sizeof(decoder->subbandSamples));
+        for (u32 subband = 0; subband < subbandLimit; ++subband)
+        {
+            u32 sharedCount = (subband < bound) ? channelCount : 1;
+            for (u32 channel = 0; channel < sharedCount; ++channel)
+            {
+                Mp2QuantClass *quant = quants[channel][subband];
+                if (quant)
+                {
+                    u32 values[3];
+                    if (quant->grouped)
+                    {
+                        u32 code = get_mp3_bits(&reader, quant->bits);
+                        for (u32 index = 0; index < 3; ++index)
+                        {
+                            values[index] = code % quant->levels;
+                            code /= quant->levels;
+                        }
+                    }
+                    else
+                    {
+                        for (u32 index = 0; index < 3; ++index)
+                        {
+                            values[index] = get_mp3_bits(&reader, quant->bits);
+                        }
+                    }
+                    
+                    dequantize_mp2_samples(quant, values, scales[channel][subband][part],
+                                           &decoder->subbandSamples[channel][0][subband]);
+                    if (sharedCount < channelCount)
+                    {
+                        dequantize_mp2_samples(quant, values, scales[1][subband][part],
+                                               &decoder->subbandSamples[1][0][subband]);
+                    }
+                }
+            }
+        }
+        
+        for (u32 channel = 0; channel < channelCount; ++channel)
+        {
+            f32 *channelOutput = output + granuleIdx * 3 * 32 * channelCount + channel;
+            for (u32 slot = 0; slot < 3; ++slot)
+            {
+                f32 *subbands = decoder->subbandSamples[channel][slot];
+                if (decoder->fixedPoint)
+                {
+                    s32 fixedSubbands[32];
+                    for (u32 subband = 0; subband < 32; subband += 4)
+                    {
+                        _mm_storeu_si128((__m128i *)(fixedSubbands + subband), get_mpeg_fixed_samples(_mm_loadu_ps(subbands + subband)));
+                    }
+                    synthesize_mpeg_slot_fixed(decoder->fixedSynthesis[channel], decoder->synthesisSlot + slot,
+                                               fixedSubbands, channelOutput + slot * 32 * channelCount, channelCount);
+                }
+                else
+                {
+                    synthesize_mpeg_slot(decoder->synthesis[channel], decoder->synthesisSlot + slot,
+                                         subbands, channelOutput + slot * 32 * channelCount, channelCount);
+                }
+            }
+        }
+        decoder->synthesisSlot += 3;
+    }
+    
+    ++decoder->frameCount;
+    return true;
+}
+
+//
+// NOTE(michiel): Frame CRC
+//
+
+global b32 gMpegCrcReady;
+global u16 gMpegCrcTable[256];
+
+internal void
+init_mpeg_crc_table(void)
+{
+    if (!gMpegCrcReady)
+    {
+        crc16_init_table(MPEG_CRC_POLYNOMIAL, gMpegCrcTable);
+        gMpegCrcReady = true;
+    }
+}
+
+internal u32
+get_mpeg_crc_bit_count(MpegFrameHeader *header, u8 *frame)
+{
+    // NOTE(michiel): Bits after the CRC that it covers. Layer III protects the side info, layers I and II
+    // the bit allocation, layer II also the scfsi of every allocated subband.
+    u32 result = 0;
+    if (header->layer == 3)
+    {
+        result = get_mp3_side_info_size(header) * 8;
+    }
+    else
+    {
+        u32 channelCount = header->channelCount;
+        Mp2AllocationTable *table = (header->layer == 2) ? get_mp2_allocation_table(header) : 0;
+        u32 subbandLimit = table ? table->subbandLimit : 32;
+        u32 bound = subbandLimit;
+        if (header->channelMode == MpegChannel_JointStereo)
+        {
+            bound = minimum(4 * (header->modeExtension + 1), subbandLimit);
+        }
+        
+        if (header->layer == 1)
+        {
+            result = 4 * (bound * channelCount + (subbandLimit - bound));
+        }
+        else
+        {
+            // NOTE(michiel): The scfsi count needs the allocation, read from a zero padded copy as the bit
+            // reader looks 8 bytes ahead.
+            u8 data[MPEG_CRC_MAX_BYTES + 8] = {};
+            u32 dataOffset = MPEG_HEADER_SIZE + MPEG_CRC_SIZE;
+            if (header->frameByteCount > dataOffset)
+            {
+                memcpy(data, frame + dataOffset, minimum(header->frameByteCount - dataOffset, (u32)MPEG_CRC_MAX_BYTES));
+            }
+            
+            Mp3BitReader reader = {};
+            reader.data = data;
+            reader.end = MPEG_CRC_MAX_BYTES * 8;
+            // NOTE(michiel): Counted without a branch on the allocation, that one is unpredictable
+            u32 scfsiCount = 0;
+            for (u32 subband = 0; subband < subbandLimit; ++subband)
+            {
+                u8 *row = gMp2AllocationRows[table->rows[subband]];
+                u32 sharedCount = (subband < bound) ? channelCount : 1;
+                u32 scfsiPerAllocation = (sharedCount < channelCount) ? channelCount : 1;
+                for (u32 channel = 0; channel < sharedCount; ++channel)
+                {
+                    scfsiCount += (u32)(get_mp3_bits(&reader, row[0]) != 0) * scfsiPerAllocation;
+                }
+            }
+            result = reader.position + 2 * scfsiCount;
+        }
+    }
+    return result;
+}
+
+internal b32
+check_mpeg_frame_crc(MpegFrameHeader *header, u8 *frame)
+{
+    // NOTE(michiel): True for frames without a CRC. The CRC runs over the last two header bytes and the
+    // protected bits after it, frame has to hold the whole frame.
+    b32 result = true;
+    if (header->protection)
+    {
+        init_mpeg_crc_table();
+        u32 bitCount = get_mpeg_crc_bit_count(header, frame);
+        u32 dataOffset = MPEG_HEADER_SIZE + MPEG_CRC_SIZE;
+        if ((dataOffset + (bitCount + 7) / 8) > header->frameByteCount)
+        {
+            result = false;
+        }
+        else
+        {
+            u16 crc = 0xFFFF;
+            crc = (u16)((crc << 8) ^ gMpegCrcTable[(crc >> 8) ^ frame[2]]);
+            crc = (u16)((crc << 8) ^ gMpegCrcTable[(crc >> 8) ^ frame[3]]);
+            u8 *at = frame + dataOffset;
+            u8 *end = at + bitCount / 8;
+            while (at < end)
+            {
+                crc = (u16)((crc << 8) ^ gMpegCrcTable[(crc >> 8) ^ *at++]);
+            }
+            
+            // NOTE(michiel): Layers I and II can stop in the middle of a byte
+            for (u32 bitIdx = 0; bitIdx < (bitCount & 7); ++bitIdx)
+            {
+                u32 bit = (*at >> (7 - bitIdx)) & 1;
+                u32 top = ((u32)crc >> 15) ^ bit;
+                crc = (u16)(crc << 1);
+                if (top)
+                {
+                    crc ^= MPEG_CRC_POLYNOMIAL;
+                }
+            }
+            
+            result = (crc == (((u32)frame[MPEG_HEADER_SIZE] << 8) | (u32)frame[MPEG_HEADER_SIZE + 1]));
+        }
+    }
+    return result;
+}
@@ -59,6 +59,147 @@ global u32 gMPEGSampleRates[] =
     11025, 12000,  8000, U32_MAX,
 };
 
+#define MPEG_MAX_CHANNELS      2
+#define MPEG_HEADER_SIZE       4
+#define MPEG_MAX_FRAME_SAMPLES 1152
+
+// NOTE(michiel): The IMDCT and synthesis can run in fixed point, for targets without a fast FPU. Samples are
+// Q28 (so +-8, the float path stays well inside +-2) and coefficients Q30, their products are summed in 64
+// bits. MPEG_FIXED_POINT picks the default for new decoders, the fixedPoint member can change it per decoder.
+#ifndef MPEG_FIXED_POINT
+#define MPEG_FIXED_POINT       0
+#endif
+#define MPEG_FIXED_SAMPLE_BITS 28
+#define MPEG_FIXED_COEFF_BITS  30
+
+enum MpegVersion
+{
+    MpegVersion_1,
+    MpegVersion_2,
+    MpegVersion_25,
+};
+
+struct MpegFrameHeader
+{
+    MpegVersionLayer versionLayer;
+    MpegVersion version;
+    u32 layer;                  // NOTE(michiel): 1, 2 or 3
+    b32 protection;             // NOTE(michiel): A CRC-16 follows the header
+    b32 padded;
+    u32 bitRate;                // NOTE(michiel): In kbit/s
+    u32 sampleRate;
+    u32 sampleRateIndex;        // NOTE(michiel): 0-8, MPEG-1 44.1/48/32 kHz, then MPEG-2, then MPEG-2.5
+    MpegChannelModes channelMode;
+    u32 modeExtension;          // NOTE(michiel): MpegChannelExtension12 or MpegChannelExtension3, joint stereo only
+    MpegEmphasis emphasis;
+    
+    u32 channelCount;
+    u32 sampleCount;            // NOTE(michiel): Per channel
+    u32 frameByteCount;         // NOTE(michiel): Including the header
+};
+
+//
+// NOTE(michiel): Layer III
+//
+
+#define MP3_GRANULE_SAMPLES    576
+#define MP3_MAX_BANDS          40       // NOTE(michiel): Short blocks have 13 bands of 3 windows
+#define MP3_MAX_MAIN_DATA_BACK 511      // NOTE(michiel): Largest main_data_begin
+#define MP3_MAX_FRAME_BYTES    1441     // NOTE(michiel): 320 kbit/s at 32 kHz, or 160 kbit/s at 8 kHz, padded
+#define MP3_MAIN_DATA_PADDING  32       // NOTE(michiel): Zeroes after the main data, the readers overshoot on bad data
+
+enum Mp3BlockType
+{
+    Mp3Block_Normal,
+    Mp3Block_Start,
+    Mp3Block_Short,
+    Mp3Block_Stop,
+};
+
+struct Mp3GranuleInfo
+{
+    u32 part23Length;           // NOTE(michiel): Bits of scalefactors and Huffman data
+    u32 bigValues;
+    u32 globalGain;
+    u32 scalefacCompress;
+    Mp3BlockType blockType;
+    b32 mixedBlock;
+    u32 tableSelect[3];
+    u32 subblockGain[3];
+    u32 region0Count;
+    u32 region1Count;
+    b32 preflag;
+    u32 scalefacScale;
+    u32 count1Table;
+};
+
+struct Mp3SideInfo
+{
+    u32 mainDataBegin;          // NOTE(michiel): Bytes back into the main data of the previous frames
+    u32 scfsi[MPEG_MAX_CHANNELS];
+    Mp3GranuleInfo granules[2][MPEG_MAX_CHANNELS];
+};
+
+struct Mp3Decoder
+{
+    // NOTE(michiel): Main data of the last frames followed by the current frame
+    u32 reservoirSize;
+    u8 mainData[MP3_MAX_MAIN_DATA_BACK + MP3_MAX_FRAME_BYTES + MP3_MAIN_DATA_PADDING];
+    
+    u8 scalefactors[MPEG_MAX_CHANNELS][MP3_MAX_BANDS]; // NOTE(michiel): Granule 0 is kept for scfsi
+    u8 intensityLimits[MP3_MAX_BANDS];  // NOTE(michiel): MPEG-2 right channel, the illegal (no intensity) position
+    u32 intensityScale;
+    
+    f32 spectrum[MPEG_MAX_CHANNELS][MP3_GRANULE_SAMPLES];
+    u32 nonZeroCount[MPEG_MAX_CHANNELS];
+    f32 overlap[MPEG_MAX_CHANNELS][MP3_GRANULE_SAMPLES];  // NOTE(michiel): Second IMDCT half, 4 subbands interleaved
+    f32 subbandSamples[18][32];
+    
+    f32 synthesis[MPEG_MAX_CHANNELS][16 * 64];            // NOTE(michiel): Last 16 matrixed vectors
+    u32 synthesisSlot;
+    
+    // NOTE(michiel): Fixed point IMDCT and synthesis state, only set it before the first frame
+    b32 fixedPoint;
+    s32 fixedOverlap[MPEG_MAX_CHANNELS][MP3_GRANULE_SAMPLES];
+    s32 fixedSubbandSamples[18][32];
+    s32 fixedSynthesis[MPEG_MAX_CHANNELS][16 * 64];
+    
+    u64 frameCount;
+    u64 missingFrames;          // NOTE(michiel): Frames that point before the start of the reservoir
+    u64 badGranules;            // NOTE(michiel): Granules with side info that doesn't fit their data
+};
+
+//
+// NOTE(michiel): Layer II
+//
+
+#define MP2_MAX_SUBBANDS       30
+#define MP2_MAX_FRAME_BYTES    1729     // NOTE(michiel): 384 kbit/s at 32 kHz, padded
+#define MP2_FRAME_PADDING      256      // NOTE(michiel): Zeroes after the frame, bad allocations read past the end
+
+struct Mp2Decoder
+{
+    u8 frameData[MP2_MAX_FRAME_BYTES + MP2_FRAME_PADDING];
+    
+    f32 subbandSamples[MPEG_MAX_CHANNELS][3][32];
+    f32 synthesis[MPEG_MAX_CHANNELS][16 * 64];
+    u32 synthesisSlot;
+    
+    b32 fixedPoint;             // NOTE(michiel): Fixed point synthesis, only set it before the first frame
+    s32 fixedSynthesis[MPEG_MAX_CHANNELS][16 * 64];
+    
+    u64 frameCount;
+    u64 badFrames;              // NOTE(michiel): Frames with more sample bits than fit in them
+};
+
+//
+// NOTE(michiel): Frame CRC
+//
+
+#define MPEG_CRC_POLYNOMIAL    0x8005
+#define MPEG_CRC_SIZE          2        // NOTE(michiel): Right after the header when the protection bit is 0
+#define MPEG_CRC_MAX_BYTES     32       // NOTE(michiel): Layer II allocation, 30 subbands of 4 bits for 2 channels
+
 // NOTE(michiel): ID3v1/ID3v1.1
 global String gID3v1Genres[256] =
 {
@@ -0,0 +1,933 @@
+#include "../libberdip/platform.h"
+#include "../libberdip/std_memory.h"
+
+#include <x86intrin.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+global MemoryAllocator gMemoryAllocator_;
+global MemoryAllocator *gMemoryAllocator = &gMemoryAllocator_;
+
+global FileAPI gFileApi_;
+global FileAPI *gFileApi = &gFileApi_;
+
+#include "../libberdip/std_memory.cpp"
+#include "../libberdip/std_file.c"
+#include "../libberdip/crc.cpp"
+
+#include "./mp3.h"
+#include "./mp3_tables.h"
+#include "./mp3_fixed.h"
+#include "./mp3_stream.h"
+#include "./id3.h"
+#include "./mp3.cpp"
+#include "./mp3_stream.cpp"
+#include "./id3.cpp"
+
+// NOTE(michiel): Cuts and joins layer III streams without decoding them. The frames are copied as they are
+// with copy_file_range, so the audio never leaves the kernel, and a new Xing/LAME header frame is written
+// in front. The first frame of a piece can point back into the main data of frames that are not copied
+// (the bit reservoir). Those bytes are written over the unused main data at the end of the frames before
+// it, the last of those frames gets a higher bit rate when that is too small. At the start of the output
+// a carrier frame goes in front instead: a frame without audio that holds them at the end of its main
+// data. The frames before the first cut are copied as well, for the overlap, and the LAME delay skips them
+// and the carrier. The first and last cut are sample exact for decoders that play gapless, the joins are on
+// the nearest frame boundary.
+
+#define MP3_DECODER_DELAY      529      // NOTE(michiel): Samples a decoder outputs before the encoder delay, not in the LAME tag
+#define MP3_CUT_PRIMING_GRANULES 2      // NOTE(michiel): Decoded before the first cut, for the overlap and the synthesis
+#define MP3_CUT_MAX_INPUTS     256
+#define MP3_CUT_INLINE         U32_MAX  // NOTE(michiel): Frame source for the bytes written from memory
+#define MP3_CUT_XING_SIZE      120      // NOTE(michiel): Tag, flags, frames, bytes, seek table and quality
+#define MP3_CUT_ENCODER        "Mpegcut  " // NOTE(michiel): LAME tag encoder for inputs that don't have one
+
+struct Mp3CutInput
+{
+    String fileName;
+    f64 startSeconds;
+    f64 endSeconds;             // NOTE(michiel): Negative for the end of the stream
+    
+    s32 fd;
+    Buffer file;                // NOTE(michiel): The mapping
+    umm id3v2Size;
+    MpegStream stream;          // NOTE(michiel): Always has the frame index
+    u64 decodedOffset;          // NOTE(michiel): Decoder output before the first sample, the delays from the LAME tag
+    u64 sampleCount;            // NOTE(michiel): Per channel, without the delay and padding
+};
+
+struct Mp3CutFrame
+{
+    u64 offset;                 // NOTE(michiel): In the input file, or in the inline bytes
+    u32 input;                  // NOTE(michiel): MP3_CUT_INLINE for the inline bytes
+    u16 byteCount;
+    u16 headerBytes;            // NOTE(michiel): Header, CRC and side info, the main data follows
+};
+
+struct Mp3Cutter
+{
+    MemoryAllocator *allocator;
+    u32 inputCount;
+    Mp3CutInput *inputs;
+    
+    // NOTE(michiel): The output, the first frame is the Xing/LAME header frame
+    u32 frameCount;
+    u32 frameCapacity;
+    Mp3CutFrame *frames;
+    
+    umm inlineSize;
+    umm inlineCapacity;
+    u8 *inlineBytes;            // NOTE(michiel): Header and carrier frames, and copies of the frames that were patched
+    
+    u64 mainDataSize;           // NOTE(michiel): Of all audio frames in the output
+    u32 unusedMainData;         // NOTE(michiel): At the end of the output, free for the reservoir of the next piece
+    
+    u16 lameCrcTable[8][256];
+    
+    u32 carrierFrames;
+    u32 grownFrames;
+    u32 patchedFrames;
+    u64 patchedBytes;
+    u64 copiedBytes;            // NOTE(michiel): By the kernel
+    u64 writtenBytes;
+};
+
+//
+// NOTE(michiel): LAME tag CRC
+//
+
+internal void
+init_lame_crc_table(u16 table[8][256])
+{
+    // NOTE(michiel): LAME uses the reflected mpeg polynomial, starting at zero (CRC-16/ARC). The music CRC
+    // runs over everything that is copied, so it takes 8 bytes per step: table[n] is the CRC of a byte
+    // followed by n zero bytes.
+    for (u32 index = 0; index < 256; ++index)
+    {
+        u16 crc = (u16)index;
+        for (u32 bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc & 1) ? (u16)((crc >> 1) ^ 0xA001) : (u16)(crc >> 1);
+        }
+        table[0][index] = crc;
+    }
+    for (u32 slice = 1; slice < 8; ++slice)
+    {
+        for (u32 index = 0; index < 256; ++index)
+        {
+            u16 crc = table[slice - 1][index];
+            table[slice][index] = (crc >> 8) ^ table[0][crc & 0xFF];
+        }
+    }
+}
+
+internal u16
+update_lame_crc(u16 table[8][256], u16 crc, umm size, u8 *data)
+{
+    while (size >= 8)
+    {
+        u64 word;
+        memcpy(&word, data, sizeof(u64));
+        word ^= crc;
+        crc = (table[7][word & 0xFF] ^ table[6][(word >> 8) & 0xFF] ^
+               table[5][(word >> 16) & 0xFF] ^ table[4][(word >> 24) & 0xFF] ^
+               table[3][(word >> 32) & 0xFF] ^ table[2][(word >> 40) & 0xFF] ^
+               table[1][(word >> 48) & 0xFF] ^ table[0][word >> 56]);
+        data += 8;
+        size -= 8;
+    }
+    for (umm index = 0; index < size; ++index)
+    {
+        crc = (crc >> 8) ^ table[0][(crc ^ data[index]) & 0xFF];
+    }
+    return crc;
+}
+
+internal void
+put_mpeg_be_bytes(u8 *data, u32 count, u32 value)
+{
+    for (u32 index = 0; index < count; ++index)
+    {
+        data[index] = (u8)(value >> (8 * (count - index - 1)));
+    }
+}
+
+//
+// NOTE(michiel): Input frames
+//
+
+internal u32
+get_mp3_header_bytes(MpegFrameHeader *header)
+{
+    return MPEG_HEADER_SIZE + (header->protection ? MPEG_CRC_SIZE : 0) + get_mp3_side_info_size(header);
+}
+
+internal u32
+get_mp3_main_data_size(MpegFrameHeader *header)
+{
+    u32 headerBytes = get_mp3_header_bytes(header);
+    return (header->frameByteCount > headerBytes) ? header->frameByteCount - headerBytes : 0;
+}
+
+internal u8 *
+get_mp3_cut_input_frame(Mp3CutInput *input, u32 frameIndex, MpegFrameHeader *header)
+{
+    u8 *result = input->stream.data.data + input->stream.frames[frameIndex].offset;
+    parse_mpeg_frame_header(result, header);
+    return result;
+}
+
+internal u32
+get_mp3_cut_reservoir(Mp3CutInput *input, u32 firstFrame, u32 endFrame)
+{
+    // NOTE(michiel): Main data bytes before firstFrame that it or one of the frames after it points back
+    // to. Only the frames in the first MP3_MAX_MAIN_DATA_BACK bytes of main data can reach that far.
+    u32 result = 0;
+    u32 ahead = 0;
+    for (u32 frameIndex = firstFrame; (frameIndex < endFrame) && (ahead < MP3_MAX_MAIN_DATA_BACK); ++frameIndex)
+    {
+        MpegFrameHeader header;
+        u8 *frame = get_mp3_cut_input_frame(input, frameIndex, &header);
+        u32 mainDataBegin = get_mp3_main_data_begin(&header, frame);
+        if (mainDataBegin > ahead)
+        {
+            result = maximum(result, mainDataBegin - ahead);
+        }
+        ahead += get_mp3_main_data_size(&header);
+    }
+    return result;
+}
+
+internal void
+get_mp3_cut_reservoir_bytes(Mp3CutInput *input, u32 firstFrame, u32 size, u8 *dest)
+{
+    // NOTE(michiel): The last size bytes of main data before firstFrame, zeroes where the stream starts sooner
+    memset(dest, 0, size);
+    u32 remaining = size;
+    u32 frameIndex = firstFrame;
+    while (remaining && frameIndex)
+    {
+        --frameIndex;
+        MpegFrameHeader header;
+        u8 *frame = get_mp3_cut_input_frame(input, frameIndex, &header);
+        u32 copySize = minimum(get_mp3_main_data_size(&header), remaining);
+        memcpy(dest + remaining - copySize, frame + header.frameByteCount - copySize, copySize);
+        remaining -= copySize;
+    }
+}
+
+internal u32
+get_mp3_unused_main_data(Mp3CutInput *input, u32 frameIndex)
+{
+    // NOTE(michiel): Main data after the part this frame uses, in the source it is the reservoir of the
+    // next frames. Could reach back into the frames before this one.
+    MpegFrameHeader header;
+    u8 *frame = get_mp3_cut_input_frame(input, frameIndex, &header);
+    u32 mainDataSize = get_mp3_main_data_size(&header);
+    if (!mainDataSize)
+    {
+        return 0;
+    }
+    
+    Mp3SideInfo sideInfo;
+    parse_mp3_side_info(&header, frame + MPEG_HEADER_SIZE + (header.protection ? MPEG_CRC_SIZE : 0), &sideInfo);
+    u32 usedBits = 0;
+    u32 granuleCount = (header.version == MpegVersion_1) ? 2 : 1;
+    for (u32 granuleIdx = 0; granuleIdx < granuleCount; ++granuleIdx)
+    {
+        for (u32 channel = 0; channel < header.channelCount; ++channel)
+        {
+            usedBits += sideInfo.granules[granuleIdx][channel].part23Length;
+        }
+    }
+    u32 usedBytes = (usedBits + 7) / 8;
+    u32 available = sideInfo.mainDataBegin + mainDataSize;
+    return (usedBytes < available) ? available - usedBytes : 0;
+}
+
+internal b32
+open_mp3_cut_input(MemoryAllocator *allocator, Mp3CutInput *input)
+{
+    char fileNameZ[4096];
+    snprintf(fileNameZ, sizeof(fileNameZ), "%.*s", STR_FMT(input->fileName));
+    input->fd = open(fileNameZ, O_RDONLY);
+    if (input->fd < 0)
+    {
+        fprintf(stderr, "Could not open '%.*s'\n", STR_FMT(input->fileName));
+        return false;
+    }
+    
+    struct stat fileStat;
+    void *mapping = MAP_FAILED;
+    if ((fstat(input->fd, &fileStat) == 0) && fileStat.st_size)
+    {
+        mapping = mmap(0, fileStat.st_size, PROT_READ, MAP_SHARED, input->fd, 0);
+    }
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map '%.*s'\n", STR_FMT(input->fileName));
+        return false;
+    }
+    input->file.size = fileStat.st_size;
+    input->file.data = (u8 *)mapping;
+    
+    MpegTagProbe probe;
+    probe_mpeg_file_tags(allocator, input->fd, input->file.size, &probe);
+    input->id3v2Size = probe.id3v2.size;
+    Buffer audio = {probe.audioEnd - probe.audioStart, input->file.data + probe.audioStart};
+    free_mpeg_tag_probe(&probe);
+    
+    if (!open_mpeg_stream(allocator, audio, &input->stream))
+    {
+        fprintf(stderr, "No mpeg audio frames found in '%.*s'\n", STR_FMT(input->fileName));
+        return false;
+    }
+    
+    MpegStream *stream = &input->stream;
+    if (stream->firstHeader.layer != 3)
+    {
+        fprintf(stderr, "'%.*s' is layer %u, only layer III can be cut\n", STR_FMT(input->fileName),
+                stream->firstHeader.layer);
+        return false;
+    }
+    
+    // NOTE(michiel): The header frame only gives the frame count, the cuts need every frame
+    if (!stream->frames)
+    {
+        index_mpeg_frames(stream);
+    }
+    if (!stream->indexCount)
+    {
+        fprintf(stderr, "No audio frames in '%.*s'\n", STR_FMT(input->fileName));
+        return false;
+    }
+    
+    u64 totalSamples = (u64)stream->indexCount * stream->samplesPerFrame;
+    u64 trimmed = 0;
+    if (stream->vbr.hasLame)
+    {
+        input->decodedOffset = stream->vbr.lame.encoderDelay + MP3_DECODER_DELAY;
+        trimmed = stream->vbr.lame.encoderDelay + stream->vbr.lame.encoderPadding;
+    }
+    input->sampleCount = (totalSamples > trimmed) ? totalSamples - trimmed : 0;
+    
+    return true;
+}
+
+internal void
+close_mp3_cut_input(Mp3CutInput *input)
+{
+    close_mpeg_stream(&input->stream);
+    if (input->file.data)
+    {
+        munmap(input->file.data, input->file.size);
+    }
+    if (input->fd >= 0)
+    {
+        close(input->fd);
+    }
+    input->file = {};
+    input->fd = -1;
+}
+
+//
+// NOTE(michiel): Output frames
+//
+
+internal Mp3CutFrame *
+push_mp3_cut_frame(Mp3Cutter *cutter)
+{
+    if (cutter->frameCount == cutter->frameCapacity)
+    {
+        u32 newCapacity = maximum(cutter->frameCapacity * 2, 1024u);
+        Mp3CutFrame *newFrames = allocate_array(cutter->allocator, Mp3CutFrame, newCapacity, default_memory_alloc());
+        if (cutter->frames)
+        {
+            memcpy(newFrames, cutter->frames, cutter->frameCount * sizeof(Mp3CutFrame));
+            deallocate(cutter->allocator, cutter->frames);
+        }
+        cutter->frames = newFrames;
+        cutter->frameCapacity = newCapacity;
+    }
+    
+    Mp3CutFrame *result = cutter->frames + cutter->frameCount++;
+    *result = {};
+    return result;
+}
+
+internal umm
+push_mp3_cut_bytes(Mp3Cutter *cutter, umm size)
+{
+    // NOTE(michiel): Returns the offset of the zeroed bytes, the buffer moves when it grows
+    if ((cutter->inlineSize + size) > cutter->inlineCapacity)
+    {
+        umm newCapacity = maximum(cutter->inlineCapacity * 2, cutter->inlineSize + size + kilobytes(16));
+        u8 *newBytes = allocate_array(cutter->allocator, u8, newCapacity, default_memory_alloc());
+        if (cutter->inlineBytes)
+        {
+            memcpy(newBytes, cutter->inlineBytes, cutter->inlineSize);
+            deallocate(cutter->allocator, cutter->inlineBytes);
+        }
+        cutter->inlineBytes = newBytes;
+        cutter->inlineCapacity = newCapacity;
+    }
+    
+    umm result = cutter->inlineSize;
+    memset(cutter->inlineBytes + result, 0, size);
+    cutter->inlineSize += size;
+    return result;
+}
+
+internal u8 *
+get_mp3_cut_frame_data(Mp3Cutter *cutter, Mp3CutFrame *frame)
+{
+    u8 *result = 0;
+    if (frame->input == MP3_CUT_INLINE)
+    {
+        result = cutter->inlineBytes + frame->offset;
+    }
+    else
+    {
+        result = cutter->inputs[frame->input].file.data + frame->offset;
+    }
+    return result;
+}
+
+internal void
+patch_mp3_cut_main_data(Mp3Cutter *cutter, u32 size, u8 *bytes)
+{
+    // NOTE(michiel): Writes over the last size bytes of main data in the output. The frames that get a part
+    // of it are written from memory instead of copied.
+    u32 remaining = size;
+    u32 frameIndex = cutter->frameCount;
+    while (remaining && (frameIndex > 1))
+    {
+        Mp3CutFrame *frame = cutter->frames + --frameIndex;
+        u32 patchSize = minimum((u32)(frame->byteCount - frame->headerBytes), remaining);
+        if (patchSize)
+        {
+            if (frame->input != MP3_CUT_INLINE)
+            {
+                u8 *source = cutter->inputs[frame->input].file.data + frame->offset;
+                umm offset = push_mp3_cut_bytes(cutter, frame->byteCount);
+                memcpy(cutter->inlineBytes + offset, source, frame->byteCount);
+                frame->input = MP3_CUT_INLINE;
+                frame->offset = offset;
+                ++cutter->patchedFrames;
+            }
+            memcpy(cutter->inlineBytes + frame->offset + frame->byteCount - patchSize,
+                   bytes + remaining - patchSize, patchSize);
+            remaining -= patchSize;
+        }
+    }
+    cutter->patchedBytes += size;
+}
+
+internal b32
+grow_mp3_cut_frame(Mp3Cutter *cutter, u32 extraSize)
+{
+    // NOTE(michiel): Gives the last output frame a bit rate with at least extraSize more main data, the new
+    // bytes at its end are free. The CRC is dropped, it covers the bit rate.
+    Mp3CutFrame *frame = cutter->frames + cutter->frameCount - 1;
+    u8 *data = get_mp3_cut_frame_data(cutter, frame);
+    MpegFrameHeader header;
+    parse_mpeg_frame_header(data, &header);
+    u32 crcSize = header.protection ? MPEG_CRC_SIZE : 0;
+    u32 mainDataSize = frame->byteCount - frame->headerBytes;
+    
+    u8 headerBits[MPEG_HEADER_SIZE];
+    memcpy(headerBits, data, MPEG_HEADER_SIZE);
+    headerBits[1] |= 0x01;
+    MpegFrameHeader newHeader = {};
+    b32 result = false;
+    for (u32 bitRateIndex = header.bitRate ? (data[2] >> 4) : 15; !result && (bitRateIndex < 15); ++bitRateIndex)
+    {
+        headerBits[2] = (u8)((bitRateIndex << 4) | (data[2] & 0x0D));
+        parse_mpeg_frame_header(headerBits, &newHeader);
+        result = get_mp3_main_data_size(&newHeader) >= (mainDataSize + extraSize);
+    }
+    
+    if (result)
+    {
+        umm offset = push_mp3_cut_bytes(cutter, newHeader.frameByteCount);
+        data = get_mp3_cut_frame_data(cutter, frame);
+        u8 *newData = cutter->inlineBytes + offset;
+        memcpy(newData, headerBits, MPEG_HEADER_SIZE);
+        memcpy(newData + MPEG_HEADER_SIZE, data + MPEG_HEADER_SIZE + crcSize, frame->byteCount - MPEG_HEADER_SIZE - crcSize);
+        
+        u32 grownSize = get_mp3_main_data_size(&newHeader) - mainDataSize;
+        frame->offset = offset;
+        frame->input = MP3_CUT_INLINE;
+        frame->byteCount = (u16)newHeader.frameByteCount;
+        frame->headerBytes = (u16)get_mp3_header_bytes(&newHeader);
+        cutter->mainDataSize += grownSize;
+        cutter->unusedMainData = minimum(cutter->unusedMainData + grownSize, (u32)MP3_MAX_MAIN_DATA_BACK);
+        ++cutter->grownFrames;
+    }
+    return result;
+}
+
+internal void
+push_mp3_carrier_frame(Mp3Cutter *cutter, u8 *nextFrame, u32 size, u8 *bytes)
+{
+    // NOTE(michiel): All zero side info, so no main data is used and it decodes to silence. The bit rate is
+    // the lowest that fits the bytes, the rest is the same as the next frame.
+    u8 headerBits[MPEG_HEADER_SIZE];
+    memcpy(headerBits, nextFrame, MPEG_HEADER_SIZE);
+    headerBits[1] |= 0x01;      // NOTE(michiel): Not protected
+    MpegFrameHeader header = {};
+    for (u32 bitRateIndex = 1; bitRateIndex < 15; ++bitRateIndex)
+    {
+        headerBits[2] = (u8)((bitRateIndex << 4) | (nextFrame[2] & 0x0D));
+        parse_mpeg_frame_header(headerBits, &header);
+        if (get_mp3_main_data_size(&header) >= size)
+        {
+            break;
+        }
+    }
+    i_expect(get_mp3_main_data_size(&header) >= size);
+    
+    umm offset = push_mp3_cut_bytes(cutter, header.frameByteCount);
+    u8 *data = cutter->inlineBytes + offset;
+    memcpy(data, headerBits, MPEG_HEADER_SIZE);
+    memcpy(data + header.frameByteCount - size, bytes, size);
+    
+    Mp3CutFrame *frame = push_mp3_cut_frame(cutter);
+    frame->offset = offset;
+    frame->input = MP3_CUT_INLINE;
+    frame->byteCount = (u16)header.frameByteCount;
+    frame->headerBytes = (u16)get_mp3_header_bytes(&header);
+    cutter->mainDataSize += get_mp3_main_data_size(&header);
+    ++cutter->carrierFrames;
+}
+
+internal u32
+push_mp3_cut_piece(Mp3Cutter *cutter, u32 inputIndex, u32 firstFrame, u32 endFrame)
+{
+    // NOTE(michiel): Returns the output index of firstFrame
+    Mp3CutInput *input = cutter->inputs + inputIndex;
+    u32 reservoirSize = get_mp3_cut_reservoir(input, firstFrame, endFrame);
+    if (reservoirSize)
+    {
+        u8 reservoir[MP3_MAX_MAIN_DATA_BACK];
+        get_mp3_cut_reservoir_bytes(input, firstFrame, reservoirSize, reservoir);
+        if ((reservoirSize <= cutter->unusedMainData) ||
+            ((cutter->frameCount > 1) && grow_mp3_cut_frame(cutter, reservoirSize - cutter->unusedMainData)))
+        {
+            patch_mp3_cut_main_data(cutter, reservoirSize, reservoir);
+        }
+        else
+        {
+            MpegFrameHeader header;
+            push_mp3_carrier_frame(cutter, get_mp3_cut_input_frame(input, firstFrame, &header), reservoirSize, reservoir);
+        }
+    }
+    
+    u32 result = cutter->frameCount;
+    u64 streamOffset = input->stream.data.data - input->file.data;
+    for (u32 frameIndex = firstFrame; frameIndex < endFrame; ++frameIndex)
+    {
+        MpegFrameHeader header;
+        get_mp3_cut_input_frame(input, frameIndex, &header);
+        Mp3CutFrame *frame = push_mp3_cut_frame(cutter);
+        frame->offset = streamOffset + input->stream.frames[frameIndex].offset;
+        frame->input = inputIndex;
+        frame->byteCount = (u16)header.frameByteCount;
+        frame->headerBytes = (u16)minimum(get_mp3_header_bytes(&header), header.frameByteCount);
+        cutter->mainDataSize += get_mp3_main_data_size(&header);
+    }
+    
+    u64 unused = minimum((u64)get_mp3_unused_main_data(input, endFrame - 1), cutter->mainDataSize);
+    cutter->unusedMainData = (u32)minimum(unused, (u64)MP3_MAX_MAIN_DATA_BACK);
+    
+    return result;
+}
+
+internal void
+write_mp3_cut_header(Mp3Cutter *cutter, MpegVbrInfo *sourceVbr, u32 delay, u32 padding)
+{
+    // NOTE(michiel): Info for a constant bit rate, Xing otherwise. All fields are written, so the LAME tag
+    // is always at the same offset. The LAME tag of the first input is kept with new delays, length and
+    // CRCs.
+    u32 audioFrameCount = cutter->frameCount - 1;
+    u8 *firstFrame = get_mp3_cut_frame_data(cutter, cutter->frames + 1);
+    u8 headerBits[MPEG_HEADER_SIZE];
+    memcpy(headerBits, firstFrame, MPEG_HEADER_SIZE);
+    headerBits[1] |= 0x01;
+    
+    b32 constantBitRate = true;
+    u64 totalSize = 0;
+    for (u32 frameIndex = 1; frameIndex < cutter->frameCount; ++frameIndex)
+    {
+        Mp3CutFrame *frame = cutter->frames + frameIndex;
+        constantBitRate = constantBitRate && ((get_mp3_cut_frame_data(cutter, frame)[2] >> 4) == (headerBits[2] >> 4));
+        totalSize += frame->byteCount;
+    }
+    
+    MpegFrameHeader header = {};
+    parse_mpeg_frame_header(headerBits, &header);
+    u32 sideInfoSize = get_mp3_side_info_size(&header);
+    u32 neededSize = MPEG_HEADER_SIZE + sideInfoSize + MP3_CUT_XING_SIZE + MPEG_LAME_TAG_SIZE;
+    for (u32 bitRateIndex = constantBitRate ? (headerBits[2] >> 4) : 1; bitRateIndex < 15; ++bitRateIndex)
+    {
+        headerBits[2] = (u8)((bitRateIndex << 4) | (headerBits[2] & 0x0D));
+        parse_mpeg_frame_header(headerBits, &header);
+        if (header.frameByteCount >= neededSize)
+        {
+            break;
+        }
+    }
+    i_expect(header.frameByteCount >= neededSize);
+    totalSize += header.frameByteCount;
+    
+    umm offset = push_mp3_cut_bytes(cutter, header.frameByteCount);
+    Mp3CutFrame *headerFrame = cutter->frames;
+    headerFrame->offset = offset;
+    headerFrame->input = MP3_CUT_INLINE;
+    headerFrame->byteCount = (u16)header.frameByteCount;
+    headerFrame->headerBytes = (u16)get_mp3_header_bytes(&header);
+    
+    u8 *data = cutter->inlineBytes + offset;
+    memcpy(data, headerBits, MPEG_HEADER_SIZE);
+    u8 *xing = data + MPEG_HEADER_SIZE + sideInfoSize;
+    memcpy(xing, constantBitRate ? "Info" : "Xing", 4);
+    put_mpeg_be_bytes(xing + 4, 4, MpegXing_Frames | MpegXing_Bytes | MpegXing_Toc | MpegXing_Quality);
+    put_mpeg_be_bytes(xing + 8, 4, audioFrameCount);
+    put_mpeg_be_bytes(xing + 12, 4, (u32)totalSize);
+    
+    u8 *toc = xing + 16;
+    u64 position = header.frameByteCount;
+    u32 audioIdx = 0;
+    for (u32 percent = 0; percent < MPEG_XING_TOC_SIZE; ++percent)
+    {
+        u32 targetIdx = (u32)((u64)percent * audioFrameCount / MPEG_XING_TOC_SIZE);
+        while (audioIdx < targetIdx)
+        {
+            position += cutter->frames[1 + audioIdx++].byteCount;
+        }
+        toc[percent] = (u8)minimum(position * 256 / totalSize, (u64)255);
+    }
+    put_mpeg_be_bytes(xing + 116, 4, (sourceVbr->flags & MpegXing_Quality) ? sourceVbr->quality : 0);
+    
+    u8 *lame = xing + MP3_CUT_XING_SIZE;
+    if (sourceVbr->hasLame)
+    {
+        memcpy(lame, sourceVbr->lame.encoder.data, MPEG_LAME_TAG_SIZE);
+    }
+    else
+    {
+        memcpy(lame, MP3_CUT_ENCODER, 9);
+    }
+    put_mpeg_be_bytes(lame + 21, 3, (delay << 12) | padding);
+    put_mpeg_be_bytes(lame + 28, 4, (u32)totalSize);
+    
+    u16 musicCrc = 0;
+    for (u32 frameIndex = 1; frameIndex < cutter->frameCount; ++frameIndex)
+    {
+        Mp3CutFrame *frame = cutter->frames + frameIndex;
+        musicCrc = update_lame_crc(cutter->lameCrcTable, musicCrc, frame->byteCount, get_mp3_cut_frame_data(cutter, frame));
+    }
+    put_mpeg_be_bytes(lame + 32, 2, musicCrc);
+    put_mpeg_be_bytes(lame + 34, 2, update_lame_crc(cutter->lameCrcTable, 0, (lame + 34) - data, data));
+}
+
+//
+// NOTE(michiel): Writing
+//
+
+internal b32
+write_mp3_cut_bytes(Mp3Cutter *cutter, s32 outputFd, umm size, u8 *data)
+{
+    umm done = 0;
+    while (done < size)
+    {
+        ssize_t count = write(outputFd, data + done, size - done);
+        if (count <= 0)
+        {
+            break;
+        }
+        done += count;
+    }
+    cutter->writtenBytes += done;
+    return done == size;
+}
+
+internal b32
+copy_mp3_cut_range(Mp3Cutter *cutter, s32 outputFd, Mp3CutInput *input, u64 offset, umm size)
+{
+    // NOTE(michiel): The kernel copies the range (or shares the blocks on filesystems with reflinks). When it
+    // can't, like across filesystems on older kernels, the rest is written from the mapping.
+    loff_t inputOffset = offset;
+    umm remaining = size;
+    while (remaining)
+    {
+        ssize_t count = copy_file_range(input->fd, &inputOffset, outputFd, 0, remaining, 0);
+        if (count <= 0)
+        {
+            break;
+        }
+        remaining -= count;
+    }
+    cutter->copiedBytes += size - remaining;
+    
+    b32 result = true;
+    if (remaining)
+    {
+        result = write_mp3_cut_bytes(cutter, outputFd, remaining, input->file.data + inputOffset);
+    }
+    return result;
+}
+
+internal b32
+write_mp3_cut_output(Mp3Cutter *cutter, String fileName, b32 copyTags)
+{
+    // NOTE(michiel): Written next to the output and renamed over it, the output can be one of the inputs
+    char fileNameZ[4096];
+    char tempNameZ[4096];
+    snprintf(fileNameZ, sizeof(fileNameZ), "%.*s", STR_FMT(fileName));
+    snprintf(tempNameZ, sizeof(tempNameZ), "%.*s.tmp", STR_FMT(fileName));
+    s32 outputFd = open(tempNameZ, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (outputFd < 0)
+    {
+        return false;
+    }
+    
+    b32 result = true;
+    Mp3CutInput *firstInput = cutter->inputs;
+    if (copyTags && firstInput->id3v2Size)
+    {
+        result = copy_mp3_cut_range(cutter, outputFd, firstInput, 0, firstInput->id3v2Size);
+    }
+    
+    // NOTE(michiel): Frames that follow each other in the same source go in one call
+    u32 frameIndex = 0;
+    while (result && (frameIndex < cutter->frameCount))
+    {
+        Mp3CutFrame *run = cutter->frames + frameIndex++;
+        umm runSize = run->byteCount;
+        while ((frameIndex < cutter->frameCount) && (cutter->frames[frameIndex].input == run->input) &&
+               (cutter->frames[frameIndex].offset == (run->offset + runSize)))
+        {
+            runSize += cutter->frames[frameIndex++].byteCount;
+        }
+        
+        if (run->input == MP3_CUT_INLINE)
+        {
+            result = write_mp3_cut_bytes(cutter, outputFd, runSize, cutter->inlineBytes + run->offset);
+        }
+        else
+        {
+            result = copy_mp3_cut_range(cutter, outputFd, cutter->inputs + run->input, run->offset, runSize);
+        }
+    }
+    
+    result = (close(outputFd) == 0) && result;
+    if (result)
+    {
+        result = (rename(tempNameZ, fileNameZ) == 0);
+    }
+    else
+    {
+        unlink(tempNameZ);
+    }
+    return result;
+}
+
+internal void
+print_usage(char *program)
+{
+    fprintf(stderr, "Usage: %s [options] -o <output.mp3> <input.mp3> [-s <seconds>] [-e <seconds>] [<input.mp3> ...]\n"
+            "  -o | --output <file>     The cut, every input (or the part of it) in order\n"
+            "  -s | --start <seconds>   Start of the part of the input before it, defaults to the start\n"
+            "  -e | --end <seconds>     End of the part of the input before it, defaults to the end\n"
+            "  -t | --tags              Copy the ID3v2 tag of the first input\n",
+            program);
+}
+
+int main(int argc, char **argv)
+{
+    std_file_api(gFileApi);
+    initialize_std_allocator(0, gMemoryAllocator);
+    
+    Mp3Cutter cutter_ = {};
+    Mp3Cutter *cutter = &cutter_;
+    cutter->allocator = gMemoryAllocator;
+    cutter->inputs = allocate_array(gMemoryAllocator, Mp3CutInput, MP3_CUT_MAX_INPUTS, default_memory_alloc());
+    init_lame_crc_table(cutter->lameCrcTable);
+    
+    String outputFile = {};
+    b32 copyTags = false;
+    b32 badArguments = false;
+    
+    s32 index = 1;
+    while (index < argc)
+    {
+        String arg = string(argv[index++]);
+        Mp3CutInput *lastInput = cutter->inputCount ? cutter->inputs + cutter->inputCount - 1 : 0;
+        if (((arg == string("--output")) || (arg == string("-o"))) && (index < argc))
+        {
+            outputFile = string(argv[index++]);
+        }
+        else if (((arg == string("--start")) || (arg == string("-s"))) && lastInput && (index < argc))
+        {
+            lastInput->startSeconds = float_from_string(string(argv[index++]));
+        }
+        else if (((arg == string("--end")) || (arg == string("-e"))) && lastInput && (index < argc))
+        {
+            lastInput->endSeconds = float_from_string(string(argv[index++]));
+        }
+        else if ((arg == string("--tags")) || (arg == string("-t")))
+        {
+            copyTags = true;
+        }
+        else if ((arg.size > 1) && (arg.data[0] == '-'))
+        {
+            badArguments = true;
+        }
+        else if (cutter->inputCount < MP3_CUT_MAX_INPUTS)
+        {
+            Mp3CutInput *input = cutter->inputs + cutter->inputCount++;
+            input->fileName = arg;
+            input->endSeconds = -1.0;
+            input->fd = -1;
+        }
+        else
+        {
+            badArguments = true;
+        }
+    }
+    
+    if (badArguments || !outputFile.size || !cutter->inputCount)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    struct timespec startTime;
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    
+    for (u32 inputIdx = 0; inputIdx < cutter->inputCount; ++inputIdx)
+    {
+        Mp3CutInput *input = cutter->inputs + inputIdx;
+        if (!open_mp3_cut_input(gMemoryAllocator, input))
+        {
+            return 1;
+        }
+        
+        // NOTE(michiel): The channel mode can change between frames, the sample rate can't
+        u32 streamBits = get_mpeg_header_bits(input->stream.data.data) & MPEG_SYNC_HEADER_MASK;
+        if (streamBits != (get_mpeg_header_bits(cutter->inputs[0].stream.data.data) & MPEG_SYNC_HEADER_MASK))
+        {
+            fprintf(stderr, "'%.*s' has a different mpeg version or sample rate than '%.*s'\n",
+                    STR_FMT(input->fileName), STR_FMT(cutter->inputs[0].fileName));
+            return 1;
+        }
+    }
+    
+    // NOTE(michiel): Positions are in the decoder output, so including the decoder and encoder delay
+    u32 samplesPerFrame = cutter->inputs[0].stream.samplesPerFrame;
+    u32 primingFrames = MP3_CUT_PRIMING_GRANULES * MP3_GRANULE_SAMPLES / samplesPerFrame;
+    u32 sampleRate = cutter->inputs[0].stream.firstHeader.sampleRate;
+    u64 startPosition = 0;
+    u64 endPosition = 0;
+    push_mp3_cut_frame(cutter);
+    for (u32 inputIdx = 0; inputIdx < cutter->inputCount; ++inputIdx)
+    {
+        Mp3CutInput *input = cutter->inputs + inputIdx;
+        b32 isFirst = (inputIdx == 0);
+        b32 isLast = (inputIdx == (cutter->inputCount - 1));
+        
+        u64 startSample = (u64)(maximum(input->startSeconds, 0.0) * (f64)sampleRate + 0.5);
+        u64 endSample = input->sampleCount;
+        if (input->endSeconds >= 0.0)
+        {
+            endSample = minimum((u64)(input->endSeconds * (f64)sampleRate + 0.5), endSample);
+        }
+        u64 rawStart = startSample + input->decodedOffset;
+        u64 rawEnd = endSample + input->decodedOffset;
+        
+        // NOTE(michiel): The outer cuts are made exact by the LAME delay and padding, the joins go to the
+        // nearest frame boundary.
+        u32 startFrame = (u32)(isFirst ? rawStart / samplesPerFrame : (rawStart + samplesPerFrame / 2) / samplesPerFrame);
+        u32 endFrame = (u32)(isLast ? (rawEnd + samplesPerFrame - 1) / samplesPerFrame : (rawEnd + samplesPerFrame / 2) / samplesPerFrame);
+        endFrame = minimum(endFrame, input->stream.indexCount);
+        if ((startSample >= endSample) || (startFrame >= endFrame))
+        {
+            fprintf(stderr, "Nothing left of '%.*s' from %.3f to %.3f seconds\n", STR_FMT(input->fileName),
+                    (f64)startSample / (f64)sampleRate, (f64)endSample / (f64)sampleRate);
+            return 1;
+        }
+        
+        // NOTE(michiel): The first granule needs the overlap of the granule before it to decode right, and
+        // the synthesis the output of that one. At the start of the output those frames are copied as well
+        // and skipped with the delay.
+        u32 firstFrame = isFirst ? startFrame - minimum(startFrame, primingFrames) : startFrame;
+        u32 carrierFrames = cutter->carrierFrames;
+        u32 grownFrames = cutter->grownFrames;
+        u64 patchedBytes = cutter->patchedBytes;
+        u32 outputFrame = push_mp3_cut_piece(cutter, inputIdx, firstFrame, endFrame) + (startFrame - firstFrame);
+        u64 outputPosition = (u64)(outputFrame - 1) * samplesPerFrame;
+        if (isFirst)
+        {
+            startPosition = outputPosition + (rawStart - (u64)startFrame * samplesPerFrame);
+        }
+        if (isLast)
+        {
+            endPosition = outputPosition + (rawEnd - (u64)startFrame * samplesPerFrame);
+        }
+        
+        fprintf(stdout, "%.*s: frames %u to %u", STR_FMT(input->fileName), firstFrame, endFrame);
+        if (cutter->carrierFrames != carrierFrames)
+        {
+            fprintf(stdout, ", reservoir in a carrier frame");
+        }
+        else if (cutter->patchedBytes != patchedBytes)
+        {
+            fprintf(stdout, ", reservoir of %lu bytes in the frames before%s", cutter->patchedBytes - patchedBytes,
+                    (cutter->grownFrames != grownFrames) ? " (with a higher bit rate)" : "");
+        }
+        fprintf(stdout, "\n");
+    }
+    
+    u64 audioSamples = (u64)(cutter->frameCount - 1) * samplesPerFrame;
+    u32 delay = (u32)((startPosition > MP3_DECODER_DELAY) ? startPosition - MP3_DECODER_DELAY : 0);
+    u32 padding = (u32)(audioSamples + MP3_DECODER_DELAY - endPosition);
+    if ((delay > 0xFFF) || (padding > 0xFFF))
+    {
+        fprintf(stderr, "Delay %u or padding %u does not fit the LAME tag\n", delay, padding);
+        delay = minimum(delay, 0xFFFu);
+        padding = minimum(padding, 0xFFFu);
+    }
+    write_mp3_cut_header(cutter, &cutter->inputs[0].stream.vbr, delay, padding);
+    
+    b32 written = write_mp3_cut_output(cutter, outputFile, copyTags);
+    
+    struct timespec endTime;
+    clock_gettime(CLOCK_MONOTONIC, &endTime);
+    f64 seconds = (f64)(endTime.tv_sec - startTime.tv_sec) + (f64)(endTime.tv_nsec - startTime.tv_nsec) * 1.0e-9;
+    
+    for (u32 inputIdx = 0; inputIdx < cutter->inputCount; ++inputIdx)
+    {
+        close_mp3_cut_input(cutter->inputs + inputIdx);
+    }
+    
+    if (!written)
+    {
+        fprintf(stderr, "Could not write '%.*s'\n", STR_FMT(outputFile));
+        return 1;
+    }
+    
+    u64 totalBytes = cutter->copiedBytes + cutter->writtenBytes;
+    u64 sampleCount = endPosition - startPosition;
+    fprintf(stdout, "Wrote %u frames, %lu bytes in %.3f seconds (%.1f MB/s)\n", cutter->frameCount, totalBytes,
+            seconds, (seconds > 0.0) ? (f64)totalBytes / (seconds * 1024.0 * 1024.0) : 0.0);
+    fprintf(stdout, "  %lu bytes copied by the kernel, %lu written: the header frame, %u carrier frames and %u frames with %lu reservoir bytes (%u with a higher bit rate)\n",
+            cutter->copiedBytes, cutter->writtenBytes, cutter->carrierFrames, cutter->patchedFrames + cutter->grownFrames,
+            cutter->patchedBytes, cutter->grownFrames);
+    fprintf(stdout, "  Delay %u, padding %u, %lu samples (%.3f seconds)\n", delay, padding, sampleCount,
+            (f64)sampleCount / (f64)sampleRate);
+    
+    return 0;
+}
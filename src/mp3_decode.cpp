@@ -1,6 +1,21 @@
 #include "../libberdip/platform.h"
 #include "../libberdip/std_memory.h"
 
+#include <alsa/asoundlib.h>
+#include <x86intrin.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "./platform_sound.h"
+
+#define SOUND_PERIOND_COUNT    4
+#define SOUND_HW_NAME          "default"
+
+#include "./linux_sound.h"
+#include "./linux_sound.cpp"
+
 global MemoryAllocator gMemoryAllocator_;
 global MemoryAllocator *gMemoryAllocator = &gMemoryAllocator_;
 
@@ -9,8 +24,68 @@ global FileAPI *gFileApi = &gFileApi_;
 
 #include "../libberdip/std_memory.cpp"
 #include "../libberdip/std_file.c"
+#include "../libberdip/crc.cpp"
 
 #include "./mp3.h"
+#include "./mp3_tables.h"
+#include "./mp3_fixed.h"
+#include "./mp3_stream.h"
+#include "./id3.h"
+#include "./mp3.cpp"
+#include "./mp3_stream.cpp"
+#include "./id3.cpp"
+
+PlatformSoundErrorString *platform_sound_error_string = linux_sound_error_string;
+PlatformSoundInit *platform_sound_init = linux_sound_init;
+PlatformSoundReformat *platform_sound_reformat = linux_sound_reformat;
+PlatformSoundWrite *platform_sound_write = linux_sound_write;
+
+struct SoundOutput
+{
+    SoundDevice *device;
+    u32 periodCount;   // NOTE(michiel): Samples per channel of one device write
+    u32 periodFill;
+    f32 *period;       // NOTE(michiel): Collects partial periods, frames don't line up with the device writes
+    b32 ok;
+};
+
+global String gId3KindNames[Id3Kind_Count] =
+{
+    static_string("Unknown"),
+    static_string("Title"),
+    static_string("Subtitle"),
+    static_string("Grouping"),
+    static_string("Artist"),
+    static_string("Album artist"),
+    static_string("Conductor"),
+    static_string("Album"),
+    static_string("Track"),
+    static_string("Disc"),
+    static_string("Year"),
+    static_string("Original release"),
+    static_string("Genre"),
+    static_string("Composer"),
+    static_string("Lyricist"),
+    static_string("BPM"),
+    static_string("Media"),
+    static_string("Publisher"),
+    static_string("Artist sort order"),
+    static_string("Album sort order"),
+    static_string("Title sort order"),
+    static_string("Language"),
+    static_string("Encoded by"),
+    static_string("Encoder settings"),
+    static_string("Copyright"),
+    static_string("Length"),
+    static_string("Involved people"),
+    static_string("Musician credits"),
+    static_string("User text"),
+    static_string("Comment"),
+    static_string("Lyrics"),
+    static_string("Picture"),
+    static_string("Unique file id"),
+    static_string("Private"),
+};
 
 internal void
 print_id3v1(Buffer tag)
@@ -115,554 +190,656 @@ print_ape(Buffer tag)
     }
 }
 
-int main(int argc, char **argv)
+internal void
+print_id3_value(char *label, Id3Text text)
 {
-    std_file_api(gFileApi);
-    initialize_std_allocator(0, gMemoryAllocator);
+    u8 decoded[1024];
+    String value = decode_id3_text(text, sizeof(decoded), decoded);
+    fprintf(stdout, "    %s: %.*s\n", label, STR_FMT(value));
+}
+
+internal u8 *
+print_id3v2(Buffer data)
+{
+    // NOTE(michiel): Returns the first byte after the tag, or the start of the data without a tag
+    Id3Tag tag;
+    if (!parse_id3v2_tag(gMemoryAllocator, data, &tag))
+    {
+        return data.data;
+    }
     
-    if (argc > 1)
+    fprintf(stdout, "ID3 v2.%u.%u:\n", tag.majorVersion, tag.revision);
+    fprintf(stdout, "    unsynched   : %s\n", (tag.flags & Id3Header_Unsynchronisation) ? "true" : "false");
+    fprintf(stdout, "    extended hdr: %s\n", (tag.flags & Id3Header_ExtendedHeader) ? "true" : "false");
+    fprintf(stdout, "    experimental: %s\n", (tag.flags & Id3Header_Experimental) ? "true" : "false");
+    fprintf(stdout, "    footer      : %s\n", (tag.flags & Id3Header_Footer) ? "true" : "false");
+    fprintf(stdout, "    size        : %u\n", tag.size);
+    
+    // NOTE(michiel): http://id3.org/id3v2.4.0-frames
+    for (u32 frameIdx = 0; frameIdx < tag.frameCount; ++frameIdx)
     {
-        String inputFile = string(argv[1]);
-        fprintf(stdout, "Opening: %.*s.\n", STR_FMT(inputFile));
-        
-        Buffer inputData = gFileApi->read_entire_file(gMemoryAllocator, inputFile);
-        if (inputData.size)
+        Id3Frame *frame = tag.frames + frameIdx;
+        String name = gId3KindNames[frame->kind];
+        u8 idChars[4] = {(u8)(frame->id >> 24), (u8)(frame->id >> 16), (u8)(frame->id >> 8), (u8)frame->id};
+        String frameId = string((tag.majorVersion == 2) ? 3 : 4, idChars);
+        switch (frame->kind)
         {
-            u8 *src = inputData.data;
-            String tag = {3, src};
-            src += 3;
-            
-            u8 version = *src++;
-            u8 revision = *src++;
-            
-            u8 flags = *src++;
-            b32 unsynchronisation = flags & 0x80;
-            b32 extendedHeader = flags & 0x40;
-            b32 experimental = flags & 0x20;
-            b32 hasFooter = flags & 0x10;
-            i_expect((flags & 0x0F) == 0x00);
-            
-            u32 size = *(u32 *)src;
-            src += 4;
-            size = (((size << 21) & 0x0FE00000) |
-                    ((size <<  6) & 0x001FC000) |
-                    ((size >>  9) & 0x00003F80) |
-                    ((size >> 24) & 0x0000007F));
-            
-            fprintf(stdout, "%.*s v%u.%u:\n", STR_FMT(tag), version, revision);
-            fprintf(stdout, "    unsynched   : %s\n", unsynchronisation ? "true" : "false");
-            fprintf(stdout, "    extended hdr: %s\n", extendedHeader ? "true" : "false");
-            fprintf(stdout, "    experimental: %s\n", experimental ? "true" : "false");
-            fprintf(stdout, "    footer      : %s\n", hasFooter ? "true" : "false");
-            fprintf(stdout, "    size        : %u\n", size);
-            
-            u32 frameNr = 0;
-            u8 *end = src + size;
-            while (src < end)
+            case Id3Kind_Unknown:
             {
-                String frameId = {4, src};
-                src += 4;
-                u32 frameSize = *(u32 *)src;
-                src += 4;
-                frameSize = (((frameSize << 21) & 0x0FE00000) |
-                             ((frameSize <<  6) & 0x001FC000) |
-                             ((frameSize >>  9) & 0x00003F80) |
-                             ((frameSize >> 24) & 0x0000007F));
-                u16 frameFlags = *src++;
-                frameFlags = (frameFlags << 8) | *src++;
-                
-                // NOTE(michiel): http://id3.org/id3v2.4.0-frames
-                if (frameId == string(4, "TIT2"))
-                {
-                    fprintf(stdout, "Title : %.*s\n", frameSize, src);
-                }
-                else if (frameId == string(4, "TPE1"))
-                {
-                    fprintf(stdout, "Artist: %.*s\n", frameSize, src);
-                }
-                else if (frameId == string(4, "TALB"))
-                {
-                    fprintf(stdout, "Album : %.*s\n", frameSize, src);
-                }
-                else if (frameId == string(4, "TRCK"))
-                {
-                    fprintf(stdout, "Track : %.*s\n", frameSize, src);
-                }
-                else if (frameId == string(4, "TPOS"))
-                {
-                    fprintf(stdout, "Disk  : %.*s\n", frameSize, src);
-                }
-                else if (frameId == string(4, "TDRC"))
-                {
-                    fprintf(stdout, "Recorded at %.*s\n", frameSize, src);
-                }
-                else if (frameId == string(4, "TCON"))
-                {
-                    fprintf(stdout, "Content type: %.*s\n", frameSize, src);
-                }
-                else if (frameId == string(4, "TBPM"))
-                {
-                    fprintf(stdout, "BPM   : %.*s beats per minute\n", frameSize, src);
-                }
-                else if (frameId == string(4, "TCOM"))
-                {
-                    fprintf(stdout, "Composer: %.*s\n", frameSize, src);
-                }
-                else if (frameId == string(4, "TDOR"))
-                {
-                    fprintf(stdout, "Original release: %.*s\n", frameSize, src);
-                }
-                else if (frameId == string(4, "TEXT"))
-                {
-                    fprintf(stdout, "Text written by: %.*s\n", frameSize, src);
-                }
-                else if (frameId == string(4, "TMED"))
-                {
-                    fprintf(stdout, "Original medium: %.*s\n", frameSize, src);
-                }
-                else if (frameId == string(4, "TPE2"))
-                {
-                    fprintf(stdout, "Band: %.*s\n", frameSize, src);
-                }
-                else if (frameId == string(4, "TPUB"))
-                {
-                    fprintf(stdout, "Publisher: %.*s\n", frameSize, src);
-                }
-                else if (frameId == string(4, "TSOP"))
-                {
-                    fprintf(stdout, "Performer sort order: %.*s\n", frameSize, src);
-                }
-                else if (frameId == string(4, "TLAN"))
-                {
-                    fprintf(stdout, "Language: %.*s\n", frameSize, src);
-                }
-                else if (frameId == string(4, "TIPL"))
-                {
-                    fprintf(stdout, "Involved people:\n");
-                    u8 *startP = src;
-                    u8 *endP = startP + frameSize;
-                    while (startP < endP)
-                    {
-                        if (((startP[0] == 0xFF) &&
-                             (startP[1] == 0xFE)) ||
-                            ((startP[0] == 0xFE) &&
-                             (startP[1] == 0xFF)))
-                        {
-                            startP += 2;
-                        }
-                        
-                        String what = string((char *)startP);
-                        startP += what.size + 1;
-                        String who = string((char *)startP);
-                        startP += who.size + 1;
-                        fprintf(stdout, "    %.*s: %.*s\n", STR_FMT(what), STR_FMT(who));
-                    }
-                }
-                else if (frameId == string(4, "TMCL"))
-                {
-                    fprintf(stdout, "Musician credits\n");
-                    u8 *startP = src;
-                    u8 *endP = startP + frameSize;
-                    while (startP < endP)
-                    {
-                        String what = string((char *)startP);
-                        startP += what.size + 1;
-                        String who = string((char *)startP);
-                        startP += who.size + 1;
-                        fprintf(stdout, "    %.*s: %.*s\n", STR_FMT(what), STR_FMT(who));
-                    }
-                }
-                else if (frameId == string(4, "COMM"))
-                {
-                    u8 encoding = src[0];
-                    String language = {3, src + 1};
-                    String descript = string((char *)src + 4);
-                    String comment  = string(frameSize - descript.size - 5, (char *)src + 4 + descript.size + 1);
-                    fprintf(stdout, "Comments (%02X) in %.*s: %.*s ||| %.*s\n", encoding, STR_FMT(language),
-                            STR_FMT(descript), STR_FMT(comment));
-                }
-                else if (frameId == string(4, "PRIV"))
-                {
-                    // NOTE(michiel): ...
-                }
-                else if (frameId == string(4, "TXXX"))
-                {
-                    u8 encoding = src[0];
-                    String descript = string((char *)src + 1);
-                    String value    = string((char *)src + descript.size + 2);
-                    fprintf(stdout, "Text (%02X): %.*s ||| %.*s\n", encoding, STR_FMT(descript), STR_FMT(value));
-                }
-                else if (frameId == string(4, "UFID"))
-                {
-                    String owner = string((char *)src);
-                    
-#if 1
-                    String dataBlock = string(frameSize - owner.size - 1, (char *)src + owner.size + 1);
-                    fprintf(stdout, "Unique File ID owner: %.*s <== %.*s\n", STR_FMT(owner), STR_FMT(dataBlock));
-#else
-                    u32 binSize = frameSize - owner.size - 1;
-                    u8 *binData = src + owner.size + 1;
-                    fprintf(stdout, "Unique File ID owner: %.*s <== 0x", STR_FMT(owner));
-                    for (u32 binIdx = 0; binIdx < binSize; ++binIdx)
-                    {
-                        fprintf(stdout, "%02X", binData[binIdx]);
-                    }
-                    fprintf(stdout, "\n");
-#endif
-                    
-                }
-                else if (frameId == string(4, "USLT"))
-                {
-                    u8 encoding = src[0];
-                    String language = {3, src + 1};
-                    String descript = string((char *)src + 4);
-                    if (descript.size)
+                fprintf(stdout, "Frame %u:\n", frameIdx + 1);
+                fprintf(stdout, "    ID   : %.*s\n", STR_FMT(frameId));
+                fprintf(stdout, "    size : %lu\n", frame->data.size);
+                fprintf(stdout, "    flags: 0x%04X\n", frame->flags);
+            } break;
+    
+            case Id3Kind_InvolvedPeople:
+            case Id3Kind_MusicianCredits:
+            {
+                // NOTE(michiel): Pairs of what and who
+                fprintf(stdout, "%.*s:\n", STR_FMT(name));
+                Id3Text text = get_id3_text(frame);
+                Id3Text what;
+                Id3Text who;
+                while (next_id3_text_value(&text, &what))
+                {
+                    u8 whatDecoded[256];
+                    String whatString = decode_id3_text(what, sizeof(whatDecoded) - 1, whatDecoded);
+                    if (!next_id3_text_value(&text, &who))
                     {
-                        String lyrics  = string(frameSize - descript.size - 5, (char *)src + 4 + descript.size + 1);
-                        fprintf(stdout, "Lyrics (%02X) in %.*s: %.*s ||| %.*s\n", encoding, STR_FMT(language),
-                                STR_FMT(descript), STR_FMT(lyrics));
+                        who = {};
                     }
+                    whatString.data[whatString.size] = 0;
+                    print_id3_value((char *)whatString.data, who);
                 }
-                else
-                {
-                    fprintf(stdout, "Frame %u:\n", frameNr + 1);
-                    fprintf(stdout, "    ID   : %.*s\n", STR_FMT(frameId));
-                    fprintf(stdout, "    size : %u\n", frameSize);
-                    fprintf(stdout, "    flags: 0x%04X\n", frameFlags);
-                    
-                    String test = {frameSize, src};
-                    fprintf(stdout, "    test : %.*s\n", STR_FMT(test));
-                }
-                
-                src += frameSize;
-                if (*src == 0)
+            } break;
+    
+            case Id3Kind_UserText:
+            {
+                Id3Text description;
+                Id3Text value;
+                get_id3_user_text(frame, &description, &value);
+                u8 decoded[256];
+                String descString = decode_id3_text(description, sizeof(decoded) - 1, decoded);
+                descString.data[descString.size] = 0;
+                fprintf(stdout, "%.*s:\n", STR_FMT(name));
+                print_id3_value((char *)descString.data, value);
+            } break;
+    
+            case Id3Kind_Comment:
+            case Id3Kind_Lyrics:
+            {
+                String language;
+                Id3Text description;
+                Id3Text text;
+                get_id3_comment(frame, &language, &description, &text);
+                fprintf(stdout, "%.*s in %.*s:\n", STR_FMT(name), STR_FMT(language));
+                print_id3_value("description", description);
+                print_id3_value("text       ", text);
+            } break;
+    
+            case Id3Kind_Picture:
+            {
+                Id3Picture picture;
+                if (get_id3_picture(frame, tag.majorVersion == 2, &picture))
                 {
-                    src = end;
+                    fprintf(stdout, "%.*s: %.*s, type %u, %lu bytes\n", STR_FMT(name), STR_FMT(picture.mimeType),
+                            picture.pictureType, picture.image.size);
+                    print_id3_value("description", picture.description);
                 }
-                
-                ++frameNr;
-            }
+            } break;
+        
+            case Id3Kind_UniqueFileId:
+            case Id3Kind_Private:
+            {
+                String owner;
+                Buffer ownerData;
+                get_id3_owner_data(frame, &owner, &ownerData);
+                fprintf(stdout, "%.*s: %.*s, %lu bytes\n", STR_FMT(name), STR_FMT(owner), ownerData.size);
+            } break;
             
-            Buffer id3v1tag = {128, inputData.data + inputData.size - 128};
-            if (string(3, id3v1tag.data) == string(3, "TAG"))
+            default:
             {
-                print_id3v1(id3v1tag);
-                inputData.size -= id3v1tag.size;
+                u8 decoded[1024];
+                String value = decode_id3_text(get_id3_text(frame), sizeof(decoded), decoded);
+                fprintf(stdout, "%.*s: %.*s\n", STR_FMT(name), STR_FMT(value));
+            } break;
+        }
+    }
+    
+    u8 *result = data.data + minimum(tag.totalSize, data.size);
+    free_id3v2_tag(&tag);
+    return result;
+}
+
+internal void
+queue_sound_samples(SoundOutput *output, u32 sampleCount, f32 *samples)
+{
+    // NOTE(michiel): Only whole periods go to the device, what is left waits for the next frame
+    SoundDevice *device = output->device;
+    u32 channelCount = device->channelCount;
+    f32 *source = samples;
+    while (output->ok && sampleCount)
+    {
+        if ((output->periodFill == 0) && (sampleCount >= output->periodCount))
+        {
+            output->ok = platform_sound_write(device, source);
+            source += output->periodCount * channelCount;
+            sampleCount -= output->periodCount;
+        }
+        else
+        {
+            u32 fillCount = minimum(sampleCount, output->periodCount - output->periodFill);
+            memcpy(output->period + output->periodFill * channelCount, source, fillCount * channelCount * sizeof(f32));
+            output->periodFill += fillCount;
+            source += fillCount * channelCount;
+            sampleCount -= fillCount;
+            
+            if (output->periodFill == output->periodCount)
+            {
+                output->ok = platform_sound_write(device, output->period);
+                output->periodFill = 0;
+            }
+        }
+    }
+    
+    if (!output->ok)
+    {
+        fprintf(stderr, "Sound write failed:\n    ");
+        fprintf(stderr, "%.*s\n\n", STR_FMT(platform_sound_error_string(device)));
+    }
+}
+
+internal void
+flush_sound_output(SoundOutput *output)
+{
+    // NOTE(michiel): Write the last partial period as a shorter write
+    if (output->ok && output->periodFill)
+    {
+        SoundDevice *device = output->device;
+        device->sampleCount = output->periodFill;
+        output->ok = platform_sound_write(device, output->period);
+        device->sampleCount = output->periodCount;
+        output->periodFill = 0;
+    }
+}
+
+internal void
+play_mpeg_stream(u8 *src, u8 *end, String outputFile, b32 checkCrc, b32 fixedPoint, b32 checkAccuracy)
+{
+    // NOTE(michiel): With an output file the samples are written there as raw interleaved f32 instead of
+    // played, as fast as they decode. Frames that fail their CRC are reported, but still decoded.
+    Mp3Decoder *decoder = allocate_struct(gMemoryAllocator, Mp3Decoder, default_memory_alloc());
+    init_mp3_decoder(decoder);
+    Mp2Decoder *decoderII = allocate_struct(gMemoryAllocator, Mp2Decoder, default_memory_alloc());
+    init_mp2_decoder(decoderII);
+    f32 *samples = allocate_array(gMemoryAllocator, f32, MPEG_MAX_FRAME_SAMPLES * MPEG_MAX_CHANNELS, default_memory_alloc());
+    decoder->fixedPoint = fixedPoint && !checkAccuracy;
+    decoderII->fixedPoint = decoder->fixedPoint;
+    
+    // NOTE(michiel): The accuracy check runs a second, fixed point, decoder next to the float one. The float
+    // samples are the ones played or written.
+    Mp3Decoder *fixedDecoder = 0;
+    Mp2Decoder *fixedDecoderII = 0;
+    f32 *fixedSamples = 0;
+    if (checkAccuracy)
+    {
+        fixedDecoder = allocate_struct(gMemoryAllocator, Mp3Decoder, default_memory_alloc());
+        init_mp3_decoder(fixedDecoder);
+        fixedDecoder->fixedPoint = true;
+        fixedDecoderII = allocate_struct(gMemoryAllocator, Mp2Decoder, default_memory_alloc());
+        init_mp2_decoder(fixedDecoderII);
+        fixedDecoderII->fixedPoint = true;
+        fixedSamples = allocate_array(gMemoryAllocator, f32, MPEG_MAX_FRAME_SAMPLES * MPEG_MAX_CHANNELS, default_memory_alloc());
+    }
+    f64 errorSum = 0.0;
+    f64 maxError = 0.0;
+    u64 errorSampleCount = 0;
+    
+    SoundDevice soundDev_ = {};
+    SoundDevice *soundDev = &soundDev_;
+    soundDev->sampleCount = 512;
+    soundDev->format = SoundFormat_f32;
+    
+    SoundOutput output = {};
+    output.device = soundDev;
+    output.periodCount = soundDev->sampleCount;
+    output.period = allocate_array(gMemoryAllocator, f32, output.periodCount * MPEG_MAX_CHANNELS, default_memory_alloc());
+    output.ok = true;
+    
+    ApiFile rawFile = {};
+    if (outputFile.size)
+    {
+        rawFile = gFileApi->open_file(outputFile, FileOpen_Write);
+        output.ok = no_file_errors(&rawFile);
+        if (!output.ok)
+        {
+            fprintf(stderr, "Could not open '%.*s' for writing\n", STR_FMT(outputFile));
+        }
+    }
+    
+    struct timespec startTime;
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    
+    b32 soundReady = false;
+    u64 layerIFrames = 0;
+    f64 audioSeconds = 0.0;
+    u64 skippedBytes = 0;
+    u32 syncLosses = 0;
+    u8 *start = src;
+    u64 frameIndex = 0;
+    u64 protectedFrames = 0;
+    u64 crcFailures = 0;
+    while (output.ok && ((end - src) >= MPEG_HEADER_SIZE))
+    {
+        MpegFrameHeader header;
+        if (!parse_mpeg_frame_header(src, &header))
+        {
+            // NOTE(michiel): Lost sync, go on at the next chain of frames
+            u8 *next = find_mpeg_frame(src + 1, end);
+            if (!next)
+            {
+                next = end;
+            }
+            skippedBytes += next - src;
+            ++syncLosses;
+            src = next;
+            continue;
+        }
+        
+        if (header.frameByteCount > (umm)(end - src))
+        {
+            fprintf(stderr, "Too few bytes remaining in the frame (%lu from the %u), stopping.\n",
+                    end - src, header.frameByteCount);
+            break;
+        }
+        
+        if (checkCrc && header.protection)
+        {
+            ++protectedFrames;
+            if (!check_mpeg_frame_crc(&header, src))
+            {
+                ++crcFailures;
+                fprintf(stderr, "CRC mismatch in frame %lu at byte %lu\n", frameIndex, (u64)(src - start));
             }
+        }
+        ++frameIndex;
+        
+        if (header.layer == 1)
+        {
+            ++layerIFrames;
+        }
+        else
+        {
+            if (header.layer == 2)
+            {
+                decode_mp2_frame(decoderII, &header, src, samples);
+            }
+            else
+            {
+                decode_mp3_frame(decoder, &header, src, samples);
+            }
+            audioSeconds += (f64)header.sampleCount / (f64)header.sampleRate;
             
-            Buffer testApe = {32, id3v1tag.data - 32};
-            if (string(8, testApe.data) == string(8, "APETAGEX"))
+            if (checkAccuracy)
             {
-                Buffer apeTag = testApe;
-                //u32 version = *(u32 *)(testApe.data + 8);
-                u32 tagSize = *(u32 *)(testApe.data + 12);
-                //u32 itemCount = *(u32 *)(testApe.data + 16);
-                //u32 tagFlags = *(u32 *)(testApe.data + 20);
-                u64 reserved = *(u64 *)(testApe.data + 24);
-                if (reserved == 0)
+                if (header.layer == 2)
                 {
-                    apeTag.data -= tagSize;
-                    apeTag.size += tagSize;
-                    
-                    if (string(8, apeTag.data) == string(8, "APETAGEX"))
-                    {
-                        print_ape(apeTag);
-                        inputData.size -= apeTag.size;
-                    }
+                    decode_mp2_frame(fixedDecoderII, &header, src, fixedSamples);
                 }
                 else
                 {
-                    fprintf(stderr, "APE Tag reserved not zero!\n");
+                    decode_mp3_frame(fixedDecoder, &header, src, fixedSamples);
+                }
+                
+                u32 sampleCount = header.sampleCount * header.channelCount;
+                for (u32 sampleIdx = 0; sampleIdx < sampleCount; ++sampleIdx)
+                {
+                    f64 error = (f64)fixedSamples[sampleIdx] - (f64)samples[sampleIdx];
+                    errorSum += error * error;
+                    maxError = maximum(maxError, fabs(error));
                 }
+                errorSampleCount += sampleCount;
             }
             
-            end = inputData.data + inputData.size;
-            fprintf(stdout, "Remainig: %lu bytes\n", end - src);
-            frameNr = 0;
-            u8 *lastSearch = src;
-            while (src < end)
+            if (outputFile.size)
+            {
+                gFileApi->write_to_file(&rawFile, header.sampleCount * header.channelCount * sizeof(f32), samples);
+                output.ok = no_file_errors(&rawFile);
+            }
+            else
             {
-                b32 endOfFile = false;
-                u8 *startSearch = src;
-                // NOTE(michiel): Look for sync frame
-                while ((src[0] != 0xFF) || ((src[1] & 0xE0) != 0xE0))
+                if (!soundReady)
                 {
-                    ++src;
-                    if (src >= (end - 1))
+                    soundDev->sampleFrequency = header.sampleRate;
+                    soundDev->channelCount = header.channelCount;
+                    if (!platform_sound_init(gMemoryAllocator, soundDev))
                     {
-                        endOfFile = true;
+                        fprintf(stderr, "Sound initialization failed:\n    ");
+                        fprintf(stderr, "%.*s\n\n", STR_FMT(platform_sound_error_string(soundDev)));
                         break;
                     }
+                    soundReady = true;
                 }
-                
-                if (endOfFile)
-                {
-                    break;
-                }
-                
-                if (src - startSearch)
-                {
-                    fprintf(stderr, "Skipped%s %lu bytes searching for sync.\n", frameNr == 0 ? " first" : "", src - startSearch);
-                    
-                    fprintf(stderr, "Bytes:\n");
-                    for (u32 skipIdx = 0; skipIdx < (src - startSearch); ++skipIdx)
-                    {
-                        fprintf(stderr, "%02X", startSearch[skipIdx]);
-                    }
-                    fprintf(stderr, "\nString:\n%.*s\n", (s32)(src - startSearch), (char *)startSearch);
-                }
-                
-                u32 frameHeader = *(u32 *)src;
-                frameHeader = ((frameHeader >> 24) |
-                               ((frameHeader >> 8) & 0x0000FF00) |
-                               ((frameHeader << 8) & 0x00FF0000) |
-                               (frameHeader << 24));
-                
-                u16 frameSync = (frameHeader >> 21);
-                i_expect(frameSync == 0x07FF); // NOTE(michiel): Guaranteed by the search loop above
-#if 0            
-                u8 mpegAudioID = (frameHeader >> 19) & 0x3;
-                u8 layerDesc = (frameHeader >> 17) & 0x3;
-#endif
-                MpegVersionLayer versionLayer = (MpegVersionLayer)((frameHeader >> 17) & 0xF);
-                switch (versionLayer)
-                {
-                    case Mpeg25_Layer3:
-                    case Mpeg25_Layer2:
-                    case Mpeg25_Layer1:
-                    case Mpeg2_Layer3:
-                    case Mpeg2_Layer2:
-                    case Mpeg2_Layer1:
-                    case Mpeg1_Layer3:
-                    case Mpeg1_Layer2:
-                    case Mpeg1_Layer1: {} break;
-                    default:
-                    {
-                        // NOTE(michiel): Invalid frame;
-                        fprintf(stderr, "MPEG Version invalid, resyncing!\n");
-                        ++src;
-                        continue;
-                    } break;
-                }
-                
-                
-                b32 protection = !(frameHeader & (1 << 16));
-                
-                u8 bitRateIdx = (frameHeader >> 12) & 0xF;
-                if (bitRateIdx == 0xF)
-                {
-                    // NOTE(michiel): Invalid frame
-                    fprintf(stderr, "Bit rate index invalid, resyncing!\n");
-                    ++src;
-                    continue;
-                }
-                
-                u16 bitRate = 0;
-                switch (versionLayer)
+                else if ((header.sampleRate != soundDev->sampleFrequency) ||
+                         (header.channelCount != soundDev->channelCount))
                 {
-                    case Mpeg1_Layer1:
+                    flush_sound_output(&output);
+                    soundDev->sampleFrequency = header.sampleRate;
+                    soundDev->channelCount = header.channelCount;
+                    output.ok = platform_sound_reformat(soundDev);
+                    if (!output.ok)
                     {
-                        bitRate = gMPEGBitRates[bitRateIdx];
-                    } break;
-                    
-                    case Mpeg1_Layer2:
-                    {
-                        bitRate = gMPEGBitRates[16 + bitRateIdx];
-                    } break;
-                    
-                    case Mpeg1_Layer3:
-                    {
-                        bitRate = gMPEGBitRates[32 + bitRateIdx];
-                    } break;
-                    
-                    case Mpeg2_Layer1:
-                    case Mpeg25_Layer1:
-                    {
-                        bitRate = gMPEGBitRates[48 + bitRateIdx];
-                    } break;
-                    
-                    case Mpeg2_Layer2:
-                    case Mpeg25_Layer2:
-                    case Mpeg2_Layer3:
-                    case Mpeg25_Layer3:
-                    {
-                        bitRate = gMPEGBitRates[64 + bitRateIdx];
-                    } break;
-                    
-                    INVALID_DEFAULT_CASE;
-                }
-                if (bitRate == 0)
-                {
-                    fprintf(stderr, "Unsupported variable bitrate!\n");
-                }
-                
-                u8 sampleRateIdx = (frameHeader >> 10) & 0x3;
-                if (sampleRateIdx == 0x3)
-                {
-                    // NOTE(michiel): Invalid frame
-                    fprintf(stderr, "Sample rate index invalid, resyncing!\n");
-                    ++src;
-                    continue;
-                }
-                
-                u32 sampleRate = 0;
-                switch (versionLayer)
-                {
-                    case Mpeg1_Layer1:
-                    case Mpeg1_Layer2:
-                    case Mpeg1_Layer3:
-                    {
-                        sampleRate = gMPEGSampleRates[sampleRateIdx];
-                    } break;
-                    
-                    case Mpeg2_Layer1:
-                    case Mpeg2_Layer2:
-                    case Mpeg2_Layer3:
-                    {
-                        sampleRate = gMPEGSampleRates[4 + sampleRateIdx];
-                    } break;
-                    
-                    case Mpeg25_Layer1:
-                    case Mpeg25_Layer2:
-                    case Mpeg25_Layer3:
-                    {
-                        sampleRate = gMPEGSampleRates[8 + sampleRateIdx];
-                    } break;
-                    
-                    INVALID_DEFAULT_CASE;
-                }
-                
-                b32 framePadded = frameHeader & (1 << 9);
-                
-                u32 slotSize = 0;
-                u32 frameByteCount = 0;
-                switch (versionLayer)
-                {
-                    case Mpeg1_Layer1:
-                    case Mpeg2_Layer1:
-                    case Mpeg25_Layer1:
-                    {
-                        slotSize = 4;
-                        frameByteCount = (12 * bitRate * 1000 / sampleRate + (framePadded ? 1 : 0)) * 4;
-                    } break;
-                    
-                    case Mpeg1_Layer2:
-                    case Mpeg2_Layer2:
-                    case Mpeg25_Layer2:
-                    case Mpeg1_Layer3:
-                    case Mpeg2_Layer3:
-                    case Mpeg25_Layer3:
-                    {
-                        slotSize = 1;
-                        frameByteCount = (144 * bitRate * 1000 / sampleRate + (framePadded ? 1 : 0));
-                    } break;
-                    
-                    INVALID_DEFAULT_CASE;
-                }
-                if (frameByteCount > (end - src))
-                {
-                    // NOTE(michiel): Invalid frame
-                    fprintf(stderr, "Too few bytes remaining in the frame (%lu from the %u), resyncing!\n",
-                            end - src, frameByteCount);
-                    
-                    fprintf(stderr, "Bytes:\n");
-                    for (u32 skipIdx = 0; skipIdx < (end - src); ++skipIdx)
-                    {
-                        fprintf(stderr, "%02X", src[skipIdx]);
+                        fprintf(stderr, "Sound reformat failed:\n    ");
+                        fprintf(stderr, "%.*s\n\n", STR_FMT(platform_sound_error_string(soundDev)));
+                        break;
                     }
-                    fprintf(stderr, "\nString:\n%.*s\n", (s32)(end - src), (char *)src);
-                    
-                    src = end;
-                    continue;
-                }
-                
-                //u8 privateBit = (frameHeader >> 8) & 0x1; // NOTE(michiel): Application-dependent
-                MpegChannelModes channelMode = (MpegChannelModes)((frameHeader >> 6) & 0x3);
-                u8 modeExtension = 0;
-                if (channelMode == MpegChannel_JointStereo)
-                {
-                    modeExtension = (frameHeader >> 4) & 0x3; // NOTE(michiel): For joint-stereo only
-                }
-                
-                
-                MpegEmphasis emphasis = (MpegEmphasis)(frameHeader & 0x3);
-                if (emphasis == MpegEmphasis_Reserved)
-                {
-                    // NOTE(michiel): Invalid frame
-                    fprintf(stderr, "Emphasis reserved, resyncing!\n");
-                    ++src;
-                    continue;
-                }
-                
-#if 0
-                b32 copyrighted = frameHeader & (1 << 3);
-                b32 original = frameHeader & (1 << 2);
-                
-                fprintf(stdout, "Data frame %u: 0x%04X\n", frameNr + 1, frameSync);
-                switch (versionLayer)
-                {
-                    case Mpeg25_Layer3: { fprintf(stdout, "MPEG2.5LIII\n"); } break;
-                    case Mpeg25_Layer2: { fprintf(stdout, "MPEG2.5LII\n"); } break;
-                    case Mpeg25_Layer1: { fprintf(stdout, "MPEG2.5LI\n"); } break;
-                    case Mpeg2_Layer3:   { fprintf(stdout, "MPEG2LIII\n"); } break;
-                    case Mpeg2_Layer2:   { fprintf(stdout, "MPEG2LII\n"); } break;
-                    case Mpeg2_Layer1:   { fprintf(stdout, "MPEG2LI\n"); } break;
-                    case Mpeg1_Layer3:   { fprintf(stdout, "MPEG1LIII\n"); } break;
-                    case Mpeg1_Layer2:   { fprintf(stdout, "MPEG1LII\n"); } break;
-                    case Mpeg1_Layer1:   { fprintf(stdout, "MPEG1LI\n"); } break;
-                    
-                    INVALID_DEFAULT_CASE;
-                }
-                
-                fprintf(stdout, "%s, %u kbps, %u Hz\n", protection ? "protected" : "unprotected", bitRate, sampleRate);
-                
-                char *channelModeStr = "";
-                switch (channelMode)
-                {
-                    case MpegChannel_Stereo:        { channelModeStr = "stereo"; } break;
-                    case MpegChannel_JointStereo:   { channelModeStr = "joint-stereo"; } break;
-                    case MpegChannel_DualChannel:   { channelModeStr = "dual-channel"; } break;
-                    case MpegChannel_SingleChannel: { channelModeStr = "single-channel"; } break;
-                    INVALID_DEFAULT_CASE;
-                }
-                fprintf(stdout, "%s, %u bytes, %s, %u\n", framePadded ? "padded" : "unpadded", frameByteCount, channelModeStr, modeExtension);
-                
-                char *emphasisName = "";
-                switch (emphasis)
-                {
-                    case MpegEmphasis_None:     { emphasisName = "none"; } break;
-                    case MpegEmphasis_50_15ms:  { emphasisName = "50/15msec"; } break;
-                    case MpegEmphasis_Reserved: { emphasisName = "reserved"; } break;
-                    case MpegEmphasis_CCIT_J17: { emphasisName = "CCIT J.17"; } break;
-                    INVALID_DEFAULT_CASE;
-                }
-                fprintf(stdout, "%s, %s, emphasis: %s\n", copyrighted ? "copyright" : "copyleft", original ? "original" : "fake", emphasisName);
-#endif
-                
-                u8 *startOfSideInfo = src + 4;
-                if (protection)
-                {
-                    u16 crc = (src[4] << 8) | src[5];
-                    unused(crc);
-                    startOfSideInfo += 2;
                 }
                 
-                Buffer sideInfo = {32, startOfSideInfo};
-                if (channelMode == MpegChannel_SingleChannel)
+                queue_sound_samples(&output, header.sampleCount, samples);
+            }
+        }
+        
+        src += header.frameByteCount;
+    }
+    
+    if (outputFile.size)
+    {
+        gFileApi->close_file(&rawFile);
+    }
+    else
+    {
+        flush_sound_output(&output);
+    }
+    
+    struct timespec endTime;
+    clock_gettime(CLOCK_MONOTONIC, &endTime);
+    f64 seconds = (f64)(endTime.tv_sec - startTime.tv_sec) + 1.0e-9 * (f64)(endTime.tv_nsec - startTime.tv_nsec);
+    
+    if (syncLosses)
+    {
+        fprintf(stderr, "Skipped %lu bytes in %u places searching for sync.\n", skippedBytes, syncLosses);
+    }
+    fprintf(stdout, "Decoded %lu frames", decoder->frameCount + decoderII->frameCount);
+    if (decoderII->frameCount)
+    {
+        fprintf(stdout, " (%lu layer II)", decoderII->frameCount);
+    }
+    if (decoder->missingFrames)
+    {
+        fprintf(stdout, ", %lu without their main data", decoder->missingFrames);
+    }
+    if (decoder->badGranules)
+    {
+        fprintf(stdout, ", %lu bad granules", decoder->badGranules);
+    }
+    if (decoderII->badFrames)
+    {
+        fprintf(stdout, ", %lu bad layer II frames", decoderII->badFrames);
+    }
+    if (layerIFrames)
+    {
+        fprintf(stdout, ", skipped %lu layer I frames", layerIFrames);
+    }
+    fprintf(stdout, "\n");
+    if (checkCrc)
+    {
+        if (protectedFrames)
+        {
+            fprintf(stdout, "  CRC: %lu of %lu protected frames failed (%.2f%%), %lu frames without a CRC\n",
+                    crcFailures, protectedFrames, 100.0 * (f64)crcFailures / (f64)protectedFrames,
+                    frameIndex - protectedFrames);
+        }
+        else
+        {
+            fprintf(stdout, "  CRC: none of the %lu frames has a CRC\n", frameIndex);
+        }
+    }
+    if (checkAccuracy && errorSampleCount)
+    {
+        // NOTE(michiel): The ISO 11172-4 compliance limits, relative to a full scale of +-1. Full accuracy is
+        // an RMS error below 2^-15 / sqrt(12) with no sample off by more than 2^-14, limited accuracy only
+        // needs an RMS error below 2^-11 / sqrt(12).
+        f64 rmsError = sqrt(errorSum / (f64)errorSampleCount);
+        char *compliance = "not compliant";
+        if ((rmsError < (1.0 / 32768.0) / sqrt(12.0)) && (maxError <= 1.0 / 16384.0))
+        {
+            compliance = "full accuracy";
+        }
+        else if (rmsError < (1.0 / 2048.0) / sqrt(12.0))
+        {
+            compliance = "limited accuracy";
+        }
+        fprintf(stdout, "  Fixed point against float: RMS error %.3g (2^%.1f), max error %.3g (2^%.1f), %s\n",
+                rmsError, log2(rmsError), maxError, log2(maxError), compliance);
+    }
+    if (outputFile.size)
+    {
+        fprintf(stdout, "  %.3f seconds of audio in %.3f seconds, %.1fx realtime\n", audioSeconds, seconds,
+                (seconds > 0.0) ? audioSeconds / seconds : 0.0);
+    }
+    
+    deallocate(gMemoryAllocator, output.period);
+    deallocate(gMemoryAllocator, samples);
+    if (checkAccuracy)
+    {
+        deallocate(gMemoryAllocator, fixedSamples);
+        deallocate(gMemoryAllocator, fixedDecoderII);
+        deallocate(gMemoryAllocator, fixedDecoder);
+    }
+    deallocate(gMemoryAllocator, decoderII);
+    deallocate(gMemoryAllocator, decoder);
+}
+
+internal void
+print_mpeg_stream(MpegStream *stream)
+{
+    MpegVbrInfo *vbr = &stream->vbr;
+    if (vbr->kind == MpegVbr_None)
+    {
+        fprintf(stdout, "No Xing or VBRI header, indexed %lu frames\n", stream->frameCount);
+    }
+    else
+    {
+        fprintf(stdout, "%s header:", (vbr->kind == MpegVbr_Xing) ? "Xing" : ((vbr->kind == MpegVbr_Info) ? "Info" : "VBRI"));
+        if (vbr->flags & MpegXing_Frames)
+        {
+            fprintf(stdout, " %u frames", vbr->frameCount);
+        }
+        else
+        {
+            fprintf(stdout, " no frame count (indexed %lu frames)", stream->frameCount);
+        }
+        if (vbr->flags & MpegXing_Bytes)
+        {
+            fprintf(stdout, ", %u bytes", vbr->byteCount);
+        }
+        if (vbr->flags & MpegXing_Quality)
+        {
+            fprintf(stdout, ", quality %u", vbr->quality);
+        }
+        fprintf(stdout, (vbr->flags & MpegXing_Toc) ? ", seek table\n" : "\n");
+        if (vbr->hasLame)
+        {
+            MpegLameTag *lame = &vbr->lame;
+            fprintf(stdout, "  %.*s rev %u, vbr method %u, lowpass %u Hz, %u kbit/s, delay %u, padding %u\n",
+                    STR_FMT(lame->encoder), lame->revision, lame->vbrMethod, lame->lowpass, lame->bitRate,
+                    lame->encoderDelay, lame->encoderPadding);
+        }
+    }
+    
+    f64 duration = get_mpeg_duration(stream);
+    u32 minutes = (u32)(duration / 60.0);
+    fprintf(stdout, "Duration: %u:%06.3f (%lu samples)\n", minutes, duration - 60.0 * (f64)minutes, stream->sampleCount);
+}
+
+internal void
+print_usage(char *program)
+{
+    fprintf(stderr, "Usage: %s [options] <file.mp3>\n"
+            "  -o | --output <file>     Write the samples as raw interleaved 32 bit floats instead of playing them\n"
+            "  -s | --start <seconds>   Start at this time, found with the seek table of the file if it has one\n"
+            "  -t | --tags              Only print the tags, reading nothing but the start and end of the file\n"
+            "  -c | --crc               Check the CRC of protected frames and report the ones that fail\n"
+            "  -x | --fixed             Run the IMDCT and synthesis in fixed point\n"
+            "  -a | --accuracy          Also decode in fixed point and check it against the float decode (ISO 11172-4)\n",
+            program);
+}
+
+int main(int argc, char **argv)
+{
+    std_file_api(gFileApi);
+    initialize_std_allocator(0, gMemoryAllocator);
+    
+    String inputFile = {};
+    String outputFile = {};
+    f64 startSeconds = 0.0;
+    b32 tagsOnly = false;
+    b32 checkCrc = false;
+    b32 fixedPoint = MPEG_FIXED_POINT;
+    b32 checkAccuracy = false;
+    b32 badArguments = false;
+    
+    s32 index = 1;
+    while (index < argc)
+    {
+        String arg = string(argv[index++]);
+        if (((arg == string("--output")) || (arg == string("-o"))) && (index < argc))
+        {
+            outputFile = string(argv[index++]);
+        }
+        else if (((arg == string("--start")) || (arg == string("-s"))) && (index < argc))
+        {
+            startSeconds = float_from_string(string(argv[index++]));
+        }
+        else if ((arg == string("--tags")) || (arg == string("-t")))
+        {
+            tagsOnly = true;
+        }
+        else if ((arg == string("--crc")) || (arg == string("-c")))
+        {
+            checkCrc = true;
+        }
+        else if ((arg == string("--fixed")) || (arg == string("-x")))
+        {
+            fixedPoint = true;
+        }
+        else if ((arg == string("--accuracy")) || (arg == string("-a")))
+        {
+            checkAccuracy = true;
+        }
+        else if (!inputFile.size)
+        {
+            inputFile = arg;
+        }
+        else
+        {
+            badArguments = true;
+        }
+    }
+        
+    if (badArguments || !inputFile.size)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+    
+    fprintf(stdout, "Opening: %.*s.\n", STR_FMT(inputFile));
+    
+    if (tagsOnly)
+    {
+        MpegTagProbe probe;
+        if (!probe_mpeg_tags(gMemoryAllocator, inputFile, &probe))
+        {
+            fprintf(stderr, "Could not open '%.*s'\n", STR_FMT(inputFile));
+            return 1;
+        }
+        
+        if (probe.id3v2.size)
+        {
+            print_id3v2(probe.id3v2);
+        }
+        if (probe.id3v1.size)
+        {
+            print_id3v1(probe.id3v1);
+        }
+        if (probe.ape.size)
+        {
+            // NOTE(michiel): The footer flags tell whether the tag starts with a header, print_ape reads that
+            u8 *apeFooter = probe.ape.data + probe.ape.size - APE_TAG_FOOTER_SIZE;
+            u32 apeFlags = *(u32 *)(apeFooter + 20);
+            if ((apeFlags & APE_TAG_HAS_HEADER) && (probe.ape.size >= 2 * APE_TAG_FOOTER_SIZE))
+            {
+                print_ape(probe.ape);
+            }
+            else
+            {
+                fprintf(stdout, "APE Tag without a header, %lu bytes\n", probe.ape.size);
+            }
+        }
+        fprintf(stdout, "Audio: bytes %lu to %lu, read %lu of %lu bytes\n", probe.audioStart, probe.audioEnd,
+                probe.bytesRead, probe.fileSize);
+        free_mpeg_tag_probe(&probe);
+        return 0;
+    }
+    
+    Buffer inputData = gFileApi->read_entire_file(gMemoryAllocator, inputFile);
+    if (inputData.size)
+    {
+        u8 *src = print_id3v2(inputData);
+        
+        Buffer id3v1tag = {128, inputData.data + inputData.size - 128};
+        if ((inputData.size >= 128) && (string(3, id3v1tag.data) == string(3, "TAG")))
+        {
+            print_id3v1(id3v1tag);
+            inputData.size -= id3v1tag.size;
+        }
+            
+        Buffer testApe = {32, inputData.data + inputData.size - 32};
+        if (((umm)(testApe.data - src) >= 32) && (string(8, testApe.data) == string(8, "APETAGEX")))
+        {
+            Buffer apeTag = testApe;
+            //u32 version = *(u32 *)(testApe.data + 8);
+            u32 tagSize = *(u32 *)(testApe.data + 12);
+            //u32 itemCount = *(u32 *)(testApe.data + 16);
+            //u32 tagFlags = *(u32 *)(testApe.data + 20);
+            u64 reserved = *(u64 *)(testApe.data + 24);
+            if ((reserved == 0) && (tagSize <= (umm)(testApe.data - src)))
+            {
+                apeTag.data -= tagSize;
+                apeTag.size += tagSize;
+            
+                if (string(8, apeTag.data) == string(8, "APETAGEX"))
                 {
-                    sideInfo.size = 17;
+                    print_ape(apeTag);
+                    inputData.size -= apeTag.size;
                 }
-                s32 offset = *sideInfo.data;
-                offset = (offset << 1) | ((sideInfo.data[1] & 0x80) >> 7);
-                offset = -offset;
-                fprintf(stdout, "Offset: %d\n", offset);
-                
-                src += frameByteCount;
-                lastSearch = src;
-                ++frameNr;
+            }
+            else
+            {
+                fprintf(stderr, "APE Tag reserved not zero!\n");
             }
         }
+            
+        u8 *end = inputData.data + inputData.size;
+        fprintf(stdout, "Remainig: %lu bytes\n", end - src);
+        
+        MpegStream stream;
+        if (open_mpeg_stream(gMemoryAllocator, {(umm)(end - src), src}, &stream))
+        {
+            print_mpeg_stream(&stream);
+            umm startOffset = get_mpeg_seek_offset(&stream, startSeconds);
+            if (startSeconds > 0.0)
+            {
+                fprintf(stdout, "Starting at %.3f seconds, byte %lu\n", startSeconds, startOffset);
+            }
+            play_mpeg_stream(stream.data.data + startOffset, end, outputFile, checkCrc, fixedPoint, checkAccuracy);
+            close_mpeg_stream(&stream);
+        }
+        else
+        {
+            fprintf(stderr, "No mpeg audio frames found\n");
+        }
     }
     
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,206 @@
+// NOTE(michiel): Q format coefficient tables of the fixed point IMDCT and synthesis. They are built by the
+// compiler from the same formulas init_mp3_tables uses for the float path, so nothing runs at startup.
+
+//
+// NOTE(michiel): Compile time table building
+//
+
+template <u32... Indices>
+struct MpegIndexList
+{
+};
+
+template <typename First, typename Second>
+struct JoinMpegIndexList;
+
+template <u32... First, u32... Second>
+struct JoinMpegIndexList<MpegIndexList<First...>, MpegIndexList<Second...>>
+{
+    typedef MpegIndexList<First..., (sizeof...(First) + Second)...> Type;
+};
+
+// NOTE(michiel): 0 to Count - 1, built from two halves to stay far from the template depth limit
+template <u32 Count>
+struct MakeMpegIndexList
+{
+    typedef typename JoinMpegIndexList<typename MakeMpegIndexList<Count / 2>::Type,
+                                       typename MakeMpegIndexList<Count - Count / 2>::Type>::Type Type;
+};
+
+template <>
+struct MakeMpegIndexList<0>
+{
+    typedef MpegIndexList<> Type;
+};
+
+template <>
+struct MakeMpegIndexList<1>
+{
+    typedef MpegIndexList<0> Type;
+};
+
+template <u32 Count>
+struct MpegFixedTable
+{
+    s32 values[Count];
+};
+
+// NOTE(michiel): Generator is a struct with a constexpr value(index) for each entry
+template <typename Generator, u32... Indices>
+constexpr MpegFixedTable<sizeof...(Indices)>
+make_mpeg_fixed_table(MpegIndexList<Indices...>)
+{
+    return {{Generator::value(Indices)...}};
+}
+
+constexpr f64
+mpeg_cos_series(f64 square, f64 term, u32 n)
+{
+    // NOTE(michiel): Taylor terms (-1)^n x^2n / (2n)!, 16 of them are exact to f64 for x up to pi / 2
+    return (n == 16) ? 0.0 : term + mpeg_cos_series(square, -term * square / (f64)((2 * n + 1) * (2 * n + 2)), n + 1);
+}
+
+constexpr f64
+mpeg_cos_quadrant(s64 numerator, s64 denominator)
+{
+    // NOTE(michiel): numerator is in [0, denominator], fold it to [0, pi / 2] with cos(pi - a) = -cos(a)
+    return (2 * numerator > denominator) ? -mpeg_cos_quadrant(denominator - numerator, denominator) :
+        mpeg_cos_series((F64_PI * (f64)numerator / (f64)denominator) * (F64_PI * (f64)numerator / (f64)denominator), 1.0, 0);
+}
+
+constexpr s64
+fold_mpeg_angle(s64 numerator, s64 denominator)
+{
+    // NOTE(michiel): numerator is in [0, 2 * denominator), cos(2 pi - a) = cos(a)
+    return (numerator > denominator) ? (2 * denominator - numerator) : numerator;
+}
+
+constexpr f64
+mpeg_cos_pi(s64 numerator, s64 denominator)
+{
+    // NOTE(michiel): cos(pi * numerator / denominator)
+    return mpeg_cos_quadrant(fold_mpeg_angle(((numerator < 0) ? -numerator : numerator) % (2 * denominator),
+                                             denominator), denominator);
+}
+
+constexpr s32
+mpeg_fixed_coefficient(f64 value)
+{
+    return (s32)((value < 0.0) ? (value * (f64)(1 << MPEG_FIXED_COEFF_BITS) - 0.5) :
+                 (value * (f64)(1 << MPEG_FIXED_COEFF_BITS) + 0.5));
+}
+
+constexpr u32
+split_mpeg_fixed_index(u32 index)
+{
+    // NOTE(michiel): Tables that are multiplied lane by lane store each group of 4 twice, as is and as lanes
+    // 1, 1, 3, 3. _mm_mul_epi32 only uses lanes 0 and 2, so the second copy does the odd lanes.
+    return (index / 8) * 4 + (((index / 4) & 1) ? ((index & 3) | 1) : (index & 3));
+}
+
+//
+// NOTE(michiel): IMDCT
+//
+
+constexpr f64
+mp3_long_window_sin(u32 index)
+{
+    // NOTE(michiel): sin(pi / 36 * (index + 0.5))
+    return mpeg_cos_pi(35 - 2 * (s64)index, 72);
+}
+
+constexpr f64
+mp3_short_window_sin(u32 index)
+{
+    // NOTE(michiel): sin(pi / 12 * (index + 0.5))
+    return mpeg_cos_pi(11 - 2 * (s64)index, 24);
+}
+
+constexpr f64
+mp3_start_window(u32 index)
+{
+    return (index < 18) ? mp3_long_window_sin(index) : ((index < 24) ? 1.0 : ((index < 30) ? mp3_short_window_sin(index - 18) : 0.0));
+}
+
+constexpr f64
+mp3_stop_window(u32 index)
+{
+    return (index >= 18) ? mp3_long_window_sin(index) : ((index >= 12) ? 1.0 : ((index >= 6) ? mp3_short_window_sin(index - 6) : 0.0));
+}
+
+// NOTE(michiel): Each coefficient 4 times, like gMp3ImdctLong and gMp3ImdctShort
+struct Mp3FixedImdctLong
+{
+    static constexpr s32 value(u32 index)
+    {
+        return mpeg_fixed_coefficient(mpeg_cos_pi((2 * (index / 72) + 1) * (2 * ((index / 4) % 18) + 1), 72));
+    }
+};
+
+struct Mp3FixedImdctShort
+{
+    static constexpr s32 value(u32 index)
+    {
+        return mpeg_fixed_coefficient(mpeg_cos_pi((2 * (index / 24) + 1) * (2 * ((index / 4) % 6) + 1), 24));
+    }
+};
+
+// NOTE(michiel): Per block type, with the sign of the unfolding, like gMp3ImdctWindows
+struct Mp3FixedImdctWindows
+{
+    static constexpr s32 value(u32 index)
+    {
+        return mpeg_fixed_coefficient(((index % 36) < 9 ? 1.0 : -1.0) *
+                                      ((index / 36) == Mp3Block_Normal ? mp3_long_window_sin(index % 36) :
+                                       ((index / 36) == Mp3Block_Start ? mp3_start_window(index % 36) :
+                                        ((index / 36) == Mp3Block_Stop ? mp3_stop_window(index % 36) : 0.0))));
+    }
+};
+
+struct Mp3FixedImdctShortWindow
+{
+    static constexpr s32 value(u32 index)
+    {
+        return mpeg_fixed_coefficient((index < 3 ? 1.0 : -1.0) * mp3_short_window_sin(index));
+    }
+};
+
+global constexpr MpegFixedTable<18 * 18 * 4> gMp3FixedImdctLong =
+    make_mpeg_fixed_table<Mp3FixedImdctLong>(MakeMpegIndexList<18 * 18 * 4>::Type());
+global constexpr MpegFixedTable<6 * 6 * 4> gMp3FixedImdctShort =
+    make_mpeg_fixed_table<Mp3FixedImdctShort>(MakeMpegIndexList<6 * 6 * 4>::Type());
+global constexpr MpegFixedTable<4 * 36> gMp3FixedImdctWindows =
+    make_mpeg_fixed_table<Mp3FixedImdctWindows>(MakeMpegIndexList<4 * 36>::Type());
+global constexpr MpegFixedTable<12> gMp3FixedImdctShortWindow =
+    make_mpeg_fixed_table<Mp3FixedImdctShortWindow>(MakeMpegIndexList<12>::Type());
+
+//
+// NOTE(michiel): Polyphase synthesis
+//
+
+// NOTE(michiel): cos((2k + 1) j pi / 64) for k = index / 64, split per group of 4 j's
+struct MpegFixedSynthesisCos
+{
+    static constexpr s32 value(u32 index)
+    {
+        return mpeg_fixed_coefficient(mpeg_cos_pi((2 * (split_mpeg_fixed_index(index) / 32) + 1) *
+                                                  (split_mpeg_fixed_index(index) % 32), 64));
+    }
+};
+
+// NOTE(michiel): D[i] of gMpegSynthesisD, split per group of 4. The window is in units of 2^-16, so it is
+// exact in Q30.
+struct MpegFixedSynthesisD
+{
+    static constexpr s32 value(u32 index)
+    {
+        return (((split_mpeg_fixed_index(index) / 64) & 1) ? -1 : 1) *
+            gMpegSynthesisWindow[(split_mpeg_fixed_index(index) <= 256) ? split_mpeg_fixed_index(index) :
+                                 (512 - split_mpeg_fixed_index(index))] * (1 << (MPEG_FIXED_COEFF_BITS - 16));
+    }
+};
+
+global constexpr MpegFixedTable<32 * 32 * 2> gMpegFixedSynthesisCos =
+    make_mpeg_fixed_table<MpegFixedSynthesisCos>(MakeMpegIndexList<32 * 32 * 2>::Type());
+global constexpr MpegFixedTable<512 * 2> gMpegFixedSynthesisD =
+    make_mpeg_fixed_table<MpegFixedSynthesisD>(MakeMpegIndexList<512 * 2>::Type());
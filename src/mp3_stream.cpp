@@ -0,0 +1,398 @@
+//
+// NOTE(michiel): Xing, Info and VBRI headers
+//
+
+internal u32
+get_mpeg_be_bytes(u8 *data, u32 count)
+{
+    u32 result = 0;
+    for (u32 index = 0; index < count; ++index)
+    {
+        result = (result << 8) | data[index];
+    }
+    return result;
+}
+
+internal void
+parse_mpeg_lame_tag(u8 *data, MpegLameTag *lame)
+{
+    *lame = {};
+    lame->encoder = string(9, data);
+    lame->revision = data[9] >> 4;
+    lame->vbrMethod = data[9] & 0xF;
+    lame->lowpass = data[10] * 100;
+    // NOTE(michiel): Peak amplitude is fixed point with 23 fraction bits
+    lame->peak = (f32)get_mpeg_be_bytes(data + 11, 4) / (f32)(1 << 23);
+    lame->radioGain = (u16)get_mpeg_be_bytes(data + 15, 2);
+    lame->audiophileGain = (u16)get_mpeg_be_bytes(data + 17, 2);
+    lame->bitRate = data[20];
+    u32 delays = get_mpeg_be_bytes(data + 21, 3);
+    lame->encoderDelay = delays >> 12;
+    lame->encoderPadding = delays & 0xFFF;
+    lame->musicLength = get_mpeg_be_bytes(data + 28, 4);
+    lame->musicCrc = (u16)get_mpeg_be_bytes(data + 32, 2);
+}
+
+internal b32
+parse_mpeg_vbr_header(u8 *frame, MpegFrameHeader *header, MpegVbrInfo *vbr)
+{
+    // NOTE(michiel): The header frame is a layer III frame without audio, the tag sits where the main
+    // data would start.
+    *vbr = {};
+    if (header->layer != 3)
+    {
+        return false;
+    }
+    
+    u8 *frameEnd = frame + header->frameByteCount;
+    u8 *xing = frame + MPEG_HEADER_SIZE + (header->protection ? 2 : 0) + get_mp3_side_info_size(header);
+    u8 *vbri = frame + MPEG_VBRI_OFFSET;
+    if (((xing + 8) <= frameEnd) &&
+        ((string(4, xing) == string(4, "Xing")) || (string(4, xing) == string(4, "Info"))))
+    {
+        vbr->kind = (xing[0] == 'X') ? MpegVbr_Xing : MpegVbr_Info;
+        vbr->flags = get_mpeg_be_bytes(xing + 4, 4) & 0xF;
+        u8 *at = xing + 8;
+        u32 fieldsSize = ((vbr->flags & MpegXing_Frames) ? 4 : 0) + ((vbr->flags & MpegXing_Bytes) ? 4 : 0) +
+            ((vbr->flags & MpegXing_Toc) ? MPEG_XING_TOC_SIZE : 0) + ((vbr->flags & MpegXing_Quality) ? 4 : 0);
+        if ((at + fieldsSize) > frameEnd)
+        {
+            *vbr = {};
+            return false;
+        }
+        
+        if (vbr->flags & MpegXing_Frames)
+        {
+            vbr->frameCount = get_mpeg_be_bytes(at, 4);
+            at += 4;
+        }
+        if (vbr->flags & MpegXing_Bytes)
+        {
+            vbr->byteCount = get_mpeg_be_bytes(at, 4);
+            at += 4;
+        }
+        if (vbr->flags & MpegXing_Toc)
+        {
+            memcpy(vbr->toc, at, MPEG_XING_TOC_SIZE);
+            at += MPEG_XING_TOC_SIZE;
+        }
+        if (vbr->flags & MpegXing_Quality)
+        {
+            vbr->quality = get_mpeg_be_bytes(at, 4);
+            at += 4;
+        }
+        
+        // NOTE(michiel): LAME (and encoders copying it, like Lavc) extend the Xing header with the
+        // encoder delay and padding, the version string starts with 4 letters.
+        if ((at + MPEG_LAME_TAG_SIZE) <= frameEnd)
+        {
+            b32 isLame = true;
+            for (u32 index = 0; index < 4; ++index)
+            {
+                u8 c = at[index];
+                isLame = isLame && (((c >= 'A') && (c <= 'Z')) || ((c >= 'a') && (c <= 'z')));
+            }
+            if (isLame)
+            {
+                vbr->hasLame = true;
+                parse_mpeg_lame_tag(at, &vbr->lame);
+            }
+        }
+    }
+    else if (((vbri + 26) <= frameEnd) && (string(4, vbri) == string(4, "VBRI")))
+    {
+        vbr->kind = MpegVbr_Vbri;
+        vbr->flags = MpegXing_Frames | MpegXing_Bytes | MpegXing_Quality;
+        //u32 version = get_mpeg_be_bytes(vbri + 4, 2);
+        vbr->vbriDelay = get_mpeg_be_bytes(vbri + 6, 2);
+        vbr->quality = get_mpeg_be_bytes(vbri + 8, 2);
+        vbr->byteCount = get_mpeg_be_bytes(vbri + 10, 4);
+        vbr->frameCount = get_mpeg_be_bytes(vbri + 14, 4);
+        vbr->vbriEntryCount = get_mpeg_be_bytes(vbri + 18, 2);
+        vbr->vbriScale = get_mpeg_be_bytes(vbri + 20, 2);
+        vbr->vbriEntryBytes = get_mpeg_be_bytes(vbri + 22, 2);
+        vbr->vbriFramesPerEntry = get_mpeg_be_bytes(vbri + 24, 2);
+        vbr->vbriEntries = vbri + 26;
+        
+        // NOTE(michiel): The table often runs past the frame (it is sized for the file, not the frame
+        // bit rate), it is only used when it fits.
+        if ((vbr->vbriEntryBytes >= 1) && (vbr->vbriEntryBytes <= 4) && vbr->vbriFramesPerEntry &&
+            ((vbr->vbriEntries + vbr->vbriEntryCount * vbr->vbriEntryBytes) <= frameEnd))
+        {
+            vbr->flags |= MpegXing_Toc;
+        }
+    }
+    
+    return vbr->kind != MpegVbr_None;
+}
+
+//
+// NOTE(michiel): Stream
+//
+
+internal u8 *
+find_mpeg_sync(u8 *at, u8 *end)
+{
+    // NOTE(michiel): First 0xFF 0xEx byte pair from at, 32 positions per step. The second bytes are
+    // loaded one further, so a pair across two steps is still found.
+    __m128i syncByte = _mm_set1_epi8((s8)0xFF);
+    __m128i syncBits = _mm_set1_epi8((s8)0xE0);
+    while ((end - at) >= 33)
+    {
+        __m128i low = _mm_loadu_si128((__m128i *)at);
+        __m128i high = _mm_loadu_si128((__m128i *)(at + 16));
+        __m128i lowNext = _mm_and_si128(_mm_loadu_si128((__m128i *)(at + 1)), syncBits);
+        __m128i highNext = _mm_and_si128(_mm_loadu_si128((__m128i *)(at + 17)), syncBits);
+        __m128i lowHits = _mm_and_si128(_mm_cmpeq_epi8(low, syncByte), _mm_cmpeq_epi8(lowNext, syncBits));
+        __m128i highHits = _mm_and_si128(_mm_cmpeq_epi8(high, syncByte), _mm_cmpeq_epi8(highNext, syncBits));
+        u32 hits = (u32)_mm_movemask_epi8(lowHits) | ((u32)_mm_movemask_epi8(highHits) << 16);
+        if (hits)
+        {
+            return at + find_least_significant_set_bit(hits).index;
+        }
+        at += 32;
+    }
+    
+    while ((end - at) >= 2)
+    {
+        if ((at[0] == 0xFF) && ((at[1] & 0xE0) == 0xE0))
+        {
+            return at;
+        }
+        ++at;
+    }
+    return 0;
+}
+
+internal u32
+get_mpeg_header_bits(u8 *data)
+{
+    return ((u32)data[0] << 24) | ((u32)data[1] << 16) | ((u32)data[2] << 8) | (u32)data[3];
+}
+
+internal b32
+is_mpeg_frame_chain(u8 *at, u8 *end)
+{
+    // NOTE(michiel): Sync patterns are common in tags and album art, a candidate only counts when the
+    // next MPEG_SYNC_CHAIN - 1 frames start right after it with the same version, layer and sample rate.
+    // Near the end of the data the frames that are there have to agree.
+    b32 result = true;
+    u32 streamBits = get_mpeg_header_bits(at) & MPEG_SYNC_HEADER_MASK;
+    for (u32 chainIdx = 0; result && (chainIdx < MPEG_SYNC_CHAIN); ++chainIdx)
+    {
+        if ((end - at) < MPEG_HEADER_SIZE)
+        {
+            result = (chainIdx > 0);
+            break;
+        }
+        
+        MpegFrameHeader header;
+        result = (parse_mpeg_frame_header(at, &header) &&
+                  ((get_mpeg_header_bits(at) & MPEG_SYNC_HEADER_MASK) == streamBits) &&
+                  (header.frameByteCount <= (umm)(end - at)));
+        at += header.frameByteCount;
+    }
+    return result;
+}
+
+internal u8 *
+find_mpeg_frame(u8 *at, u8 *end)
+{
+    u8 *result = 0;
+    while (!result && at)
+    {
+        at = find_mpeg_sync(at, end);
+        if (at)
+        {
+            if (is_mpeg_frame_chain(at, end))
+            {
+                result = at;
+            }
+            ++at;
+        }
+    }
+    return result;
+}
+
+internal void
+index_mpeg_frames(MpegStream *stream)
+{
+    // NOTE(michiel): Fallback for streams without a frame count. Frames mostly follow each other, the
+    // sync scan is only needed after damage or junk between frames.
+    u8 *start = stream->data.data;
+    u8 *end = start + stream->data.size;
+    u32 streamBits = get_mpeg_header_bits(start) & MPEG_SYNC_HEADER_MASK;
+    
+    // NOTE(michiel): Start with room for the frames of the first frame size, that is enough for constant
+    // bit rates
+    u32 capacity = (u32)minimum(stream->data.size / maximum(stream->firstHeader.frameByteCount, 1u) + 16, (umm)U32_MAX);
+    stream->frames = allocate_array(stream->allocator, MpegFrameEntry, capacity, default_memory_alloc());
+    
+    u8 *at = start + stream->audioOffset;
+    while (at)
+    {
+        MpegFrameHeader header;
+        if (((end - at) < MPEG_HEADER_SIZE) || !parse_mpeg_frame_header(at, &header) ||
+            ((get_mpeg_header_bits(at) & MPEG_SYNC_HEADER_MASK) != streamBits) ||
+            (header.frameByteCount > (umm)(end - at)))
+        {
+            at = find_mpeg_frame(at + 1, end);
+            continue;
+        }
+        
+        if (stream->indexCount == capacity)
+        {
+            u32 newCapacity = capacity * 2;
+            MpegFrameEntry *newFrames = allocate_array(stream->allocator, MpegFrameEntry, newCapacity, default_memory_alloc());
+            memcpy(newFrames, stream->frames, capacity * sizeof(MpegFrameEntry));
+            deallocate(stream->allocator, stream->frames);
+            stream->frames = newFrames;
+            capacity = newCapacity;
+        }
+        MpegFrameEntry *entry = stream->frames + stream->indexCount++;
+        entry->offset = (u32)(at - start);
+        entry->byteCount = (u16)header.frameByteCount;
+        entry->headerBits[0] = at[2];
+        entry->headerBits[1] = at[3];
+        at += header.frameByteCount;
+    }
+}
+
+internal b32
+open_mpeg_stream(MemoryAllocator *allocator, Buffer data, MpegStream *stream)
+{
+    // NOTE(michiel): data should have the tags removed. Only the first frame is looked at when it has a
+    // Xing/Info or VBRI header.
+    b32 result = false;
+    *stream = {};
+    stream->allocator = allocator;
+    
+    u8 *end = data.data + data.size;
+    u8 *first = find_mpeg_frame(data.data, end);
+    if (first)
+    {
+        stream->data.data = first;
+        stream->data.size = end - first;
+        parse_mpeg_frame_header(first, &stream->firstHeader);
+        stream->samplesPerFrame = stream->firstHeader.sampleCount;
+        
+        if (parse_mpeg_vbr_header(first, &stream->firstHeader, &stream->vbr))
+        {
+            stream->audioOffset = stream->firstHeader.frameByteCount;
+        }
+        
+        if (stream->vbr.flags & MpegXing_Frames)
+        {
+            stream->frameCount = stream->vbr.frameCount;
+        }
+        else
+        {
+            index_mpeg_frames(stream);
+            stream->frameCount = stream->indexCount;
+        }
+        if (!(stream->vbr.flags & MpegXing_Bytes) || (stream->vbr.byteCount > stream->data.size))
+        {
+            stream->vbr.byteCount = (u32)minimum(stream->data.size, (umm)U32_MAX);
+        }
+        stream->sampleCount = stream->frameCount * stream->samplesPerFrame;
+        result = true;
+    }
+    
+    return result;
+}
+
+internal void
+close_mpeg_stream(MpegStream *stream)
+{
+    if (stream->frames)
+    {
+        deallocate(stream->allocator, stream->frames);
+    }
+    *stream = {};
+}
+
+internal f64
+get_mpeg_duration(MpegStream *stream)
+{
+    // NOTE(michiel): Without the encoder delay and padding when they are known
+    u64 sampleCount = stream->sampleCount;
+    if (stream->vbr.hasLame)
+    {
+        u32 trimmed = stream->vbr.lame.encoderDelay + stream->vbr.lame.encoderPadding;
+        sampleCount = (sampleCount > trimmed) ? sampleCount - trimmed : 0;
+    }
+    return (f64)sampleCount / (f64)stream->firstHeader.sampleRate;
+}
+
+internal umm
+get_mpeg_seek_offset(MpegStream *stream, f64 seconds)
+{
+    // NOTE(michiel): Byte offset in stream->data of the frame to start decoding at for the given time.
+    // Only the frame index is exact, the seek tables give a position near the frame and the next frame
+    // from there is used.
+    umm result = stream->audioOffset;
+    f64 duration = (f64)stream->sampleCount / (f64)stream->firstHeader.sampleRate;
+    if ((seconds > 0.0) && (duration > 0.0))
+    {
+        f64 fraction = minimum(seconds / duration, 1.0);
+        MpegVbrInfo *vbr = &stream->vbr;
+        if (stream->frames)
+        {
+            u64 frame = (u64)(fraction * (f64)stream->indexCount);
+            if (frame < stream->indexCount)
+            {
+                result = stream->frames[frame].offset;
+            }
+            else
+            {
+                result = stream->data.size;
+            }
+        }
+        else if ((vbr->kind == MpegVbr_Xing) && (vbr->flags & MpegXing_Toc))
+        {
+            f64 percent = minimum(fraction * 100.0, 99.999);
+            u32 index = (u32)percent;
+            f64 from = (f64)vbr->toc[index];
+            f64 to = (index < (MPEG_XING_TOC_SIZE - 1)) ? (f64)vbr->toc[index + 1] : 256.0;
+            f64 position = from + (to - from) * (percent - (f64)index);
+            result = (umm)(position * (1.0 / 256.0) * (f64)vbr->byteCount);
+        }
+        else if ((vbr->kind == MpegVbr_Vbri) && (vbr->flags & MpegXing_Toc))
+        {
+            // NOTE(michiel): Add up the stretches before the target frame, interpolate inside the last one
+            f64 frame = fraction * (f64)vbr->frameCount;
+            f64 position = 0.0;
+            f64 stretchStart = 0.0;
+            u8 *entry = vbr->vbriEntries;
+            for (u32 index = 0; index < vbr->vbriEntryCount; ++index)
+            {
+                f64 stretchBytes = (f64)(get_mpeg_be_bytes(entry, vbr->vbriEntryBytes) * vbr->vbriScale);
+                entry += vbr->vbriEntryBytes;
+                f64 stretchEnd = stretchStart + (f64)vbr->vbriFramesPerEntry;
+                if (frame < stretchEnd)
+                {
+                    position += stretchBytes * (frame - stretchStart) / (f64)vbr->vbriFramesPerEntry;
+                    break;
+                }
+                position += stretchBytes;
+                stretchStart = stretchEnd;
+            }
+            result = (umm)position;
+        }
+        else
+        {
+            // NOTE(michiel): Info headers are written for constant bit rates, the bytes go linear with time
+            result = stream->audioOffset + (umm)(fraction * (f64)(vbr->byteCount - stream->audioOffset));
+        }
+        
+        result = maximum(result, (umm)stream->audioOffset);
+        result = minimum(result, stream->data.size);
+        if (!stream->frames)
+        {
+            u8 *end = stream->data.data + stream->data.size;
+            u8 *frame = find_mpeg_frame(stream->data.data + result, end);
+            result = frame ? (umm)(frame - stream->data.data) : stream->data.size;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,88 @@
+// NOTE(michiel): Stream level information of an in memory mpeg audio file. Most encoders put a Xing
+// (called Info when the bit rate is constant) or VBRI header in place of the first frame, with the frame
+// and byte counts and a seek table. Only streams without one are walked to build a frame index.
+
+enum MpegVbrKind
+{
+    MpegVbr_None,
+    MpegVbr_Xing,
+    MpegVbr_Info,
+    MpegVbr_Vbri,
+};
+
+enum MpegXingFlags
+{
+    MpegXing_Frames  = 0x1,
+    MpegXing_Bytes   = 0x2,
+    MpegXing_Toc     = 0x4,
+    MpegXing_Quality = 0x8,
+};
+
+#define MPEG_XING_TOC_SIZE     100
+#define MPEG_VBRI_OFFSET       36       // NOTE(michiel): Always right after 32 bytes of side info
+#define MPEG_LAME_TAG_SIZE     36
+
+struct MpegLameTag
+{
+    String encoder;             // NOTE(michiel): Points into the frame, like "LAME3.100"
+    u32 revision;
+    u32 vbrMethod;
+    u32 lowpass;                // NOTE(michiel): In Hz
+    f32 peak;
+    u16 radioGain;
+    u16 audiophileGain;
+    u32 bitRate;                // NOTE(michiel): Average bit rate for vbr, the target or minimum otherwise
+    u32 encoderDelay;           // NOTE(michiel): Samples the encoder added at the start
+    u32 encoderPadding;         // NOTE(michiel): And at the end
+    u32 musicLength;            // NOTE(michiel): Bytes from the header frame to the end of the audio
+    u16 musicCrc;
+};
+
+struct MpegVbrInfo
+{
+    MpegVbrKind kind;
+    u32 flags;                  // NOTE(michiel): MpegXingFlags of the fields that were present (all for VBRI)
+    u32 frameCount;             // NOTE(michiel): Audio frames, the header frame not included
+    u32 byteCount;              // NOTE(michiel): Header frame included
+    u32 quality;
+    u8 toc[MPEG_XING_TOC_SIZE]; // NOTE(michiel): Position in 256ths of byteCount at every percent of the duration
+    
+    // NOTE(michiel): The VBRI table has the byte size (divided by scale) of every stretch of framesPerEntry
+    // frames, big endian in entryBytes bytes.
+    u32 vbriDelay;
+    u32 vbriEntryCount;
+    u32 vbriEntryBytes;
+    u32 vbriScale;
+    u32 vbriFramesPerEntry;
+    u8 *vbriEntries;
+    
+    b32 hasLame;
+    MpegLameTag lame;
+};
+
+#define MPEG_SYNC_CHAIN        3        // NOTE(michiel): Headers that have to follow each other for a sync to count
+#define MPEG_SYNC_HEADER_MASK  0xFFFE0C00 // NOTE(michiel): Version, layer and sample rate, fixed within a stream
+
+struct MpegFrameEntry
+{
+    u32 offset;
+    u16 byteCount;
+    u8 headerBits[2];           // NOTE(michiel): Last two header bytes, the rest is the same for the stream
+};
+
+struct MpegStream
+{
+    MemoryAllocator *allocator;
+    Buffer data;                // NOTE(michiel): Starts at the first frame
+    MpegFrameHeader firstHeader;
+    MpegVbrInfo vbr;
+    
+    u32 audioOffset;            // NOTE(michiel): Of the first audio frame, past the header frame if there is one
+    u32 samplesPerFrame;
+    u64 frameCount;
+    u64 sampleCount;            // NOTE(michiel): Per channel, frameCount * samplesPerFrame
+    
+    // NOTE(michiel): Only built when the stream has no header to give the frame count
+    u32 indexCount;
+    MpegFrameEntry *frames;
+};
@@ -0,0 +1,1437 @@
+#include "../libberdip/platform.h"
+#include "../libberdip/std_memory.h"
+#include "../libberdip/random.h"
+
+#include <x86intrin.h>
+#include <math.h>
+
+global MemoryAllocator gMemoryAllocator_;
+global MemoryAllocator *gMemoryAllocator = &gMemoryAllocator_;
+
+#include "../libberdip/std_memory.cpp"
+#include "../libberdip/crc.cpp"
+
+#include "./mp3.h"
+#include "./mp3_tables.h"
+#include "./mp3_fixed.h"
+#include "./mp3.cpp"
+
+// NOTE(michiel): Checks the layer III decoder against streams written here from a known signal. The writer
+// runs the analysis filterbank and MDCT, then quantizes with random scalefactors, scfsi, region splits and
+// the cheapest Huffman tables, and spreads the main data over the bit reservoir. Joint stereo streams use
+// mid/side and intensity stereo, for MPEG-1 and MPEG-2. There are two references:
+//   - the quantized spectrum, which decode_mp3_channel has to give back up to float rounding. This covers the
+//     Huffman decoding, the scalefactors and the reservoir.
+//   - the input signal, which the decoded samples have to follow as close as the quantization allows, for
+//     both the float and the fixed point synthesis. This covers the stereo processing, IMDCT and synthesis.
+
+#define MP3_TEST_FRAMES        24
+#define MP3_TEST_SIGNAL_SAMPLES ((MP3_TEST_FRAMES + 2) * MPEG_MAX_FRAME_SAMPLES)
+#define MP3_TEST_DELAY         1057     // NOTE(michiel): 528 samples in the analysis and MDCT, 529 in the decoder
+#define MP3_TEST_SKIP          2000     // NOTE(michiel): Samples at both ends that are left out of the SNR
+#define MP3_TEST_MAX_SNR_LOSS  6.0      // NOTE(michiel): In dB, how much worse the output may be than the spectrum
+
+struct Mp3TestConfig
+{
+    char *name;
+    u32 version;                // NOTE(michiel): 0 MPEG-1, 1 MPEG-2, 2 MPEG-2.5
+    u32 sampleRateIdx;
+    MpegChannelModes channelMode;
+    u32 modeExtension;          // NOTE(michiel): MpegChannelExtension3
+    u32 bitRateIdx;
+    b32 crc;
+    u32 blockPattern;           // NOTE(michiel): 0 only long blocks, 1 switching to short and back, 2 mostly short
+    b32 mixedBlocks;
+    f64 lowCut;                 // NOTE(michiel): In Hz, the mixed block tests keep the lowest subbands empty
+    u32 intensityScale;         // NOTE(michiel): MPEG-2 intensity_scale
+};
+
+global Mp3TestConfig gMp3TestConfigs[] =
+{
+    {"mpeg1 44.1k stereo 320k",            0, 0, MpegChannel_Stereo,        0, 14, false, 0, false,    0.0, 0},
+    {"mpeg1 44.1k mid/side 160k",          0, 0, MpegChannel_JointStereo,   2, 11, false, 1, false,    0.0, 0},
+    {"mpeg1 48k intensity mid/side 256k",  0, 1, MpegChannel_JointStereo,   3, 13, false, 1, false,    0.0, 0},
+    {"mpeg1 32k intensity 224k",           0, 2, MpegChannel_JointStereo,   1, 12, false, 0, false,    0.0, 0},
+    {"mpeg1 32k intensity short",          0, 2, MpegChannel_JointStereo,   1, 12, false, 2, false,    0.0, 0},
+    {"mpeg1 44.1k mono crc",               0, 0, MpegChannel_SingleChannel, 0,  9, true,  1, false,    0.0, 0},
+    {"mpeg1 44.1k stereo mixed",           0, 0, MpegChannel_Stereo,        0, 14, false, 2, true,  1600.0, 0},
+    {"mpeg1 48k dual channel",             0, 1, MpegChannel_DualChannel,   0, 14, false, 1, false,    0.0, 0},
+    {"mpeg2 22.05k mid/side 80k",          1, 0, MpegChannel_JointStereo,   2, 10, false, 1, false,    0.0, 0},
+    {"mpeg2 24k intensity",                1, 1, MpegChannel_JointStereo,   1, 12, false, 1, false,    0.0, 0},
+    {"mpeg2 24k intensity mid/side short", 1, 1, MpegChannel_JointStereo,   3, 12, false, 2, false,    0.0, 1},
+    {"mpeg2 16k mono short",               1, 2, MpegChannel_SingleChannel, 0,  8, false, 2, false,    0.0, 0},
+    {"mpeg2 22.05k stereo mixed crc",      1, 0, MpegChannel_Stereo,        0, 14, true,  2, true,  1200.0, 0},
+    {"mpeg2.5 8k mono",                    2, 2, MpegChannel_SingleChannel, 0,  8, false, 1, false,    0.0, 0},
+    {"mpeg2.5 11.025k stereo",             2, 0, MpegChannel_Stereo,        0, 12, false, 1, false,    0.0, 0},
+    {"mpeg2.5 12k intensity mid/side",     2, 1, MpegChannel_JointStereo,   3, 12, false, 2, false,    0.0, 0},
+    {"mpeg2.5 11.025k mono mixed",         2, 0, MpegChannel_SingleChannel, 0, 10, false, 2, true,   900.0, 0},
+};
+
+struct Mp3TestBitWriter
+{
+    u8 *data;
+    u32 bitCount;
+};
+
+struct Mp3TestGranule
+{
+    Mp3GranuleInfo info;        // NOTE(michiel): What goes in the side info
+    b32 intensityChannel;       // NOTE(michiel): Right channel of an intensity stereo frame
+    u32 lsfTable;               // NOTE(michiel): MPEG-2 scalefactor band count table
+    u32 slen[4];
+    u32 scfsi;                  // NOTE(michiel): MPEG-1 granule 1, groups taken over from granule 0
+    u32 count1End;
+    u32 scalefactors[MP3_MAX_BANDS];
+    s32 values[MP3_GRANULE_SAMPLES];    // NOTE(michiel): Quantized, in bitstream order
+    f32 expected[MP3_GRANULE_SAMPLES];  // NOTE(michiel): What decode_mp3_channel has to give
+};
+
+struct Mp3TestEncoder
+{
+    Mp3TestConfig *config;
+    u32 sampleRateIndex;        // NOTE(michiel): 0-8, like MpegFrameHeader
+    u32 sampleRate;
+    u32 channelCount;
+    u32 granuleCount;
+    u32 maxMainDataBegin;
+    RandomSeriesPCG random;
+    
+    f64 analysisHistory[MPEG_MAX_CHANNELS][512];
+    f64 previousSubbands[MPEG_MAX_CHANNELS][32][18];
+    u32 granuleCounter;
+    u32 paddingRest;
+    
+    // NOTE(michiel): The main data is written as one stream, the frame slots are cut from it at the end
+    u32 frameCount;
+    u32 frameHeadSizes[MP3_TEST_FRAMES];
+    u8 frameHeads[MP3_TEST_FRAMES][MPEG_HEADER_SIZE + MPEG_CRC_SIZE + 32];
+    u32 frameSlotStarts[MP3_TEST_FRAMES];
+    u32 frameSlotSizes[MP3_TEST_FRAMES];
+    u32 mainDataEnd;
+    u32 slotStart;
+    u8 mainData[MP3_TEST_FRAMES * MP3_MAX_FRAME_BYTES];
+    
+    Mp3TestGranule granules[MP3_TEST_FRAMES][2][MPEG_MAX_CHANNELS];
+    f64 spectrumSignal;
+    f64 spectrumError;
+    
+    u32 shortGranules;
+    u32 mixedGranules;
+    u32 scfsiGranules;
+    u32 largestMainDataBegin;
+};
+
+global f64 gMp3TestAnalysisWindow[512];
+global f64 gMp3TestAnalysisCos[32][64];
+global f64 gMp3TestLongWindows[4][36];
+global f64 gMp3TestLongCos[18][36];
+global f64 gMp3TestShortWindow[12];
+global f64 gMp3TestShortCos[6][12];
+global f64 gMp3TestAliasCs[8];
+global f64 gMp3TestAliasCa[8];
+
+global Mp3TestEncoder gMp3TestEncoder;
+global Mp3Decoder gMp3TestDecoder;
+global f64 gMp3TestSignal[MPEG_MAX_CHANNELS][MP3_TEST_SIGNAL_SAMPLES];
+global u8 gMp3TestStream[MP3_TEST_FRAMES * MP3_MAX_FRAME_BYTES];
+global f32 gMp3TestOutput[MP3_TEST_FRAMES * MPEG_MAX_FRAME_SAMPLES * MPEG_MAX_CHANNELS];
+global u16 gMp3TestCrcTable[256];
+
+internal void
+init_mp3_test_tables(void)
+{
+    init_mp3_tables();
+    crc16_init_table(MPEG_CRC_POLYNOMIAL, gMp3TestCrcTable);
+    
+    // NOTE(michiel): The analysis window C[i] is the synthesis window D[i] / 32
+    for (u32 index = 0; index < 512; ++index)
+    {
+        gMp3TestAnalysisWindow[index] = gMpegSynthesisD[index] / 32.0;
+    }
+    for (u32 subband = 0; subband < 32; ++subband)
+    {
+        for (u32 index = 0; index < 64; ++index)
+        {
+            gMp3TestAnalysisCos[subband][index] = cos((f64)((2 * subband + 1) * ((s32)index - 16)) * M_PI / 64.0);
+        }
+    }
+    
+    for (u32 index = 0; index < 36; ++index)
+    {
+        f64 normal = sin(M_PI / 36.0 * (index + 0.5));
+        f64 start = (index < 18) ? normal : (index < 24) ? 1.0 : (index < 30) ? sin(M_PI / 12.0 * (index - 18 + 0.5)) : 0.0;
+        f64 stop = (index >= 18) ? normal : (index >= 12) ? 1.0 : (index >= 6) ? sin(M_PI / 12.0 * (index - 6 + 0.5)) : 0.0;
+        gMp3TestLongWindows[Mp3Block_Normal][index] = normal;
+        gMp3TestLongWindows[Mp3Block_Start][index] = start;
+        gMp3TestLongWindows[Mp3Block_Short][index] = 0.0;
+        gMp3TestLongWindows[Mp3Block_Stop][index] = stop;
+    }
+    for (u32 line = 0; line < 18; ++line)
+    {
+        for (u32 index = 0; index < 36; ++index)
+        {
+            gMp3TestLongCos[line][index] = cos(M_PI / 72.0 * (f64)(2 * index + 19) * (f64)(2 * line + 1));
+        }
+    }
+    for (u32 index = 0; index < 12; ++index)
+    {
+        gMp3TestShortWindow[index] = sin(M_PI / 12.0 * (index + 0.5));
+    }
+    for (u32 line = 0; line < 6; ++line)
+    {
+        for (u32 index = 0; index < 12; ++index)
+        {
+            gMp3TestShortCos[line][index] = cos(M_PI / 24.0 * (f64)(2 * index + 7) * (f64)(2 * line + 1));
+        }
+    }
+    
+    f64 aliasCoefficients[8] = {-0.6, -0.535, -0.33, -0.185, -0.095, -0.041, -0.0142, -0.0037};
+    for (u32 index = 0; index < 8; ++index)
+    {
+        f64 norm = sqrt(1.0 + aliasCoefficients[index] * aliasCoefficients[index]);
+        gMp3TestAliasCs[index] = 1.0 / norm;
+        gMp3TestAliasCa[index] = aliasCoefficients[index] / norm;
+    }
+}
+
+internal void
+generate_mp3_test_signal(RandomSeriesPCG *random, u32 sampleRate, f64 lowCut, f64 amplitude, f64 *samples)
+{
+    // NOTE(michiel): Six slowly modulated tones with short bursts on top, the bursts make the encoder pick short
+    // blocks where the pattern asks for them.
+    u32 count = MP3_TEST_SIGNAL_SAMPLES;
+    memset(samples, 0, count * sizeof(f64));
+    f64 top = 0.45 * (f64)sampleRate;
+    for (u32 toneIdx = 0; toneIdx < 6; ++toneIdx)
+    {
+        f64 frequency = lowCut + 100.0 + random_unilateral(random) * (top - lowCut - 100.0);
+        f64 level = amplitude * (0.2 + 0.8 * random_unilateral(random)) / 6.0;
+        f64 phase = random_unilateral(random) * 6.28;
+        f64 modulation = 0.5 + random_unilateral(random) * 3.0;
+        for (u32 index = 0; index < count; ++index)
+        {
+            f64 envelope = 0.6 + 0.4 * sin(2.0 * M_PI * modulation * index / sampleRate);
+            samples[index] += level * envelope * sin(2.0 * M_PI * frequency * index / sampleRate + phase);
+        }
+    }
+    
+    u32 burstCount = count / (sampleRate / 6);
+    for (u32 burstIdx = 0; burstIdx < burstCount; ++burstIdx)
+    {
+        u32 at = (u32)(random_unilateral(random) * (f64)(count - 200));
+        f64 frequency = lowCut + 200.0 + random_unilateral(random) * (top - lowCut - 200.0);
+        for (u32 index = 0; index < 128; ++index)
+        {
+            f64 window = sin(M_PI * index / 128.0);
+            samples[at + index] += amplitude * 0.5 * window * window * sin(2.0 * M_PI * frequency * index / sampleRate);
+        }
+    }
+}
+
+internal u32
+get_mp3_test_random(Mp3TestEncoder *encoder, u32 range)
+{
+    return random_next_u32(&encoder->random) % range;
+}
+
+internal void
+put_mp3_test_bits(Mp3TestBitWriter *writer, u32 value, u32 count)
+{
+    for (u32 bitIdx = count; bitIdx > 0; --bitIdx)
+    {
+        if ((writer->bitCount & 7) == 0)
+        {
+            writer->data[writer->bitCount >> 3] = 0;
+        }
+        if ((value >> (bitIdx - 1)) & 1)
+        {
+            writer->data[writer->bitCount >> 3] |= 0x80 >> (writer->bitCount & 7);
+        }
+        ++writer->bitCount;
+    }
+}
+
+//
+// NOTE(michiel): Filterbank
+//
+
+internal void
+analyse_mp3_test_slot(f64 *history, f64 *input, f64 *subbands)
+{
+    // NOTE(michiel): 32 new samples in, 32 subband samples out
+    memmove(history + 32, history, (512 - 32) * sizeof(f64));
+    for (u32 index = 0; index < 32; ++index)
+    {
+        history[31 - index] = input[index];
+    }
+    
+    f64 partials[64];
+    for (u32 index = 0; index < 64; ++index)
+    {
+        f64 sum = 0.0;
+        for (u32 tap = 0; tap < 8; ++tap)
+        {
+            sum += gMp3TestAnalysisWindow[index + 64 * tap] * history[index + 64 * tap];
+        }
+        partials[index] = sum;
+    }
+    for (u32 subband = 0; subband < 32; ++subband)
+    {
+        f64 sum = 0.0;
+        for (u32 index = 0; index < 64; ++index)
+        {
+            sum += gMp3TestAnalysisCos[subband][index] * partials[index];
+        }
+        subbands[subband] = sum;
+    }
+}
+
+internal void
+transform_mp3_test_granule(Mp3TestEncoder *encoder, u32 channel, f64 *input, Mp3BlockType blockType,
+                           b32 mixedBlock, f64 *spectrum)
+{
+    // NOTE(michiel): spectrum is in decoder order, short blocks have their windows interleaved per line
+    f64 subbandSamples[18][32];
+    for (u32 slot = 0; slot < 18; ++slot)
+    {
+        analyse_mp3_test_slot(encoder->analysisHistory[channel], input + slot * 32, subbandSamples[slot]);
+        if (slot & 1)
+        {
+            for (u32 subband = 1; subband < 32; subband += 2)
+            {
+                subbandSamples[slot][subband] = -subbandSamples[slot][subband];
+            }
+        }
+    }
+    
+    for (u32 subband = 0; subband < 32; ++subband)
+    {
+        f64 block[36];
+        for (u32 index = 0; index < 18; ++index)
+        {
+            block[index] = encoder->previousSubbands[channel][subband][index];
+            block[18 + index] = subbandSamples[index][subband];
+            encoder->previousSubbands[channel][subband][index] = subbandSamples[index][subband];
+        }
+        
+        f64 *lines = spectrum + subband * 18;
+        if ((blockType != Mp3Block_Short) || (mixedBlock && (subband < 2)))
+        {
+            f64 *window = gMp3TestLongWindows[(blockType == Mp3Block_Short) ? Mp3Block_Normal : blockType];
+            for (u32 line = 0; line < 18; ++line)
+            {
+                f64 sum = 0.0;
+                for (u32 index = 0; index < 36; ++index)
+                {
+                    sum += window[index] * block[index] * gMp3TestLongCos[line][index];
+                }
+                lines[line] = sum / 9.0;
+            }
+        }
+        else
+        {
+            for (u32 windowIdx = 0; windowIdx < 3; ++windowIdx)
+            {
+                for (u32 line = 0; line < 6; ++line)
+                {
+                    f64 sum = 0.0;
+                    for (u32 index = 0; index < 12; ++index)
+                    {
+                        sum += gMp3TestShortWindow[index] * block[6 + 6 * windowIdx + index] * gMp3TestShortCos[line][index];
+                    }
+                    lines[3 * line + windowIdx] = sum / 3.0;
+                }
+            }
+        }
+    }
+    
+    // NOTE(michiel): The inverse of the decoder alias reduction
+    u32 aliasLimit = (blockType == Mp3Block_Short) ? (mixedBlock ? 2 : 0) : 32;
+    for (u32 subband = 1; subband < aliasLimit; ++subband)
+    {
+        for (u32 index = 0; index < 8; ++index)
+        {
+            f64 low = spectrum[subband * 18 - 1 - index];
+            f64 high = spectrum[subband * 18 + index];
+            spectrum[subband * 18 - 1 - index] = low * gMp3TestAliasCs[index] + high * gMp3TestAliasCa[index];
+            spectrum[subband * 18 + index] = high * gMp3TestAliasCs[index] - low * gMp3TestAliasCa[index];
+        }
+    }
+}
+
+//
+// NOTE(michiel): Quantization
+//
+
+internal Mp3BandLayout *
+get_mp3_test_layout(Mp3TestEncoder *encoder, Mp3GranuleInfo *info)
+{
+    u32 kind = (info->blockType == Mp3Block_Short) ? (info->mixedBlock ? 2 : 1) : 0;
+    return &gMp3BandLayouts[encoder->sampleRateIndex][kind];
+}
+
+internal void
+order_mp3_test_spectrum(Mp3TestEncoder *encoder, Mp3BandLayout *layout, f64 *spectrum, f64 *ordered, u32 *bands)
+{
+    // NOTE(michiel): Decoder order to bitstream order, with the band of each line
+    u32 *shortStarts = gMp3ShortBandStarts[encoder->sampleRateIndex];
+    u32 line = 0;
+    for (u32 band = 0; band < layout->bandCount; ++band)
+    {
+        for (u32 index = 0; index < layout->widths[band]; ++index)
+        {
+            s32 source = line + index;
+            if (band >= layout->longCount)
+            {
+                u32 shortBand = layout->shortBandOffset + (band - layout->longCount) / 3;
+                u32 window = (band - layout->longCount) % 3;
+                source = (shortBand < 13) ? (s32)((shortStarts[shortBand] + index) * 3 + window) : -1;
+            }
+            ordered[line + index] = (source >= 0) ? spectrum[source] : 0.0;
+            bands[line + index] = band;
+        }
+        line += layout->widths[band];
+    }
+}
+
+internal f64
+get_mp3_test_gain(Mp3TestGranule *granule, Mp3BandLayout *layout, u32 band, u32 globalGain)
+{
+    Mp3GranuleInfo *info = &granule->info;
+    f64 power = (f64)globalGain - 210.0;
+    f64 multiplier = info->scalefacScale ? 1.0 : 0.5;
+    if (band < layout->longCount)
+    {
+        power = 0.25 * power - multiplier * (granule->scalefactors[band] + (info->preflag ? gMp3Pretab[band] : 0));
+    }
+    else
+    {
+        power = 0.25 * (power - 8.0 * info->subblockGain[(band - layout->longCount) % 3]) -
+            multiplier * granule->scalefactors[band];
+    }
+    return pow(2.0, power);
+}
+
+internal s32
+quantize_mp3_test_granule(Mp3TestGranule *granule, Mp3BandLayout *layout, f64 *ordered, u32 *bands, u32 globalGain)
+{
+    // NOTE(michiel): Returns the largest value, or -1 when it doesn't fit the Huffman tables
+    f64 gains[MP3_MAX_BANDS];
+    for (u32 band = 0; band < layout->bandCount; ++band)
+    {
+        gains[band] = get_mp3_test_gain(granule, layout, band, globalGain);
+    }
+    
+    s32 result = 0;
+    for (u32 index = 0; index < MP3_GRANULE_SAMPLES; ++index)
+    {
+        f64 level = floor(pow(fabs(ordered[index]) / gains[bands[index]], 0.75) + 0.4054);
+        if (level > 8206.0)
+        {
+            result = -1;
+            break;
+        }
+        s32 value = (s32)level;
+        granule->values[index] = (ordered[index] < 0.0) ? -value : value;
+        result = maximum(result, value);
+    }
+    return result;
+}
+
+//
+// NOTE(michiel): Huffman coding
+//
+
+internal u32
+get_mp3_test_pair_bits(u32 table, u32 x, u32 y)
+{
+    Mp3HuffmanSource *source = gMp3HuffmanSources + table;
+    u32 result = 0;
+    u32 extra = 0;
+    u32 codeX = x;
+    u32 codeY = y;
+    if (source->linbits)
+    {
+        if (codeX >= 15)
+        {
+            extra += source->linbits;
+            codeX = 15;
+        }
+        if (codeY >= 15)
+        {
+            extra += source->linbits;
+            codeY = 15;
+        }
+    }
+    
+    if ((codeX >= source->ySize) || (codeY >= source->ySize) ||
+        (source->linbits && ((x >= 15 + (1u << source->linbits)) || (y >= 15 + (1u << source->linbits)))))
+    {
+        result = U16_MAX;
+    }
+    else
+    {
+        result = source->lengths[codeX * source->ySize + codeY] + extra + (x ? 1 : 0) + (y ? 1 : 0);
+    }
+    return result;
+}
+
+internal void
+put_mp3_test_pair(Mp3TestBitWriter *writer, u32 table, s32 x, s32 y)
+{
+    Mp3HuffmanSource *source = gMp3HuffmanSources + table;
+    u32 absX = (x < 0) ? -x : x;
+    u32 absY = (y < 0) ? -y : y;
+    u32 codeX = (source->linbits && (absX >= 15)) ? 15 : absX;
+    u32 codeY = (source->linbits && (absY >= 15)) ? 15 : absY;
+    u32 index = codeX * source->ySize + codeY;
+    put_mp3_test_bits(writer, source->codes[index], source->lengths[index]);
+    if (source->linbits && (codeX == 15))
+    {
+        put_mp3_test_bits(writer, absX - 15, source->linbits);
+    }
+    if (absX)
+    {
+        put_mp3_test_bits(writer, (x < 0) ? 1 : 0, 1);
+    }
+    if (source->linbits && (codeY == 15))
+    {
+        put_mp3_test_bits(writer, absY - 15, source->linbits);
+    }
+    if (absY)
+    {
+        put_mp3_test_bits(writer, (y < 0) ? 1 : 0, 1);
+    }
+}
+
+internal u32
+get_mp3_test_region_bits(s32 *values, u32 start, u32 end, u32 table)
+{
+    u32 result = 0;
+    for (u32 index = start; index < end; index += 2)
+    {
+        if (table == 0)
+        {
+            result += (values[index] || values[index + 1]) ? U16_MAX : 0;
+        }
+        else
+        {
+            result += get_mp3_test_pair_bits(table, absolute(values[index]), absolute(values[index + 1]));
+        }
+    }
+    return result;
+}
+
+internal u32
+pick_mp3_test_table(s32 *values, u32 start, u32 end, u32 *bitCount)
+{
+    u32 result = 0;
+    *bitCount = get_mp3_test_region_bits(values, start, end, 0);
+    for (u32 table = 1; table < 32; ++table)
+    {
+        if (gMp3HuffmanSources[table].ySize)
+        {
+            u32 bits = get_mp3_test_region_bits(values, start, end, table);
+            if (bits < *bitCount)
+            {
+                result = table;
+                *bitCount = bits;
+            }
+        }
+    }
+    return result;
+}
+
+internal void
+get_mp3_test_region_ends(Mp3TestGranule *granule, Mp3BandLayout *layout, u32 *ends)
+{
+    Mp3GranuleInfo *info = &granule->info;
+    u32 region0Bands = info->region0Count + 1;
+    u32 region1Bands = region0Bands + info->region1Count + 1;
+    u32 line = 0;
+    ends[0] = 0;
+    ends[1] = 0;
+    for (u32 band = 0; band < layout->bandCount; ++band)
+    {
+        line += layout->widths[band];
+        if (band < region0Bands)
+        {
+            ends[0] = line;
+        }
+        if (band < region1Bands)
+        {
+            ends[1] = line;
+        }
+    }
+    if (info->blockType != Mp3Block_Normal)
+    {
+        ends[1] = MP3_GRANULE_SAMPLES;
+    }
+    ends[2] = MP3_GRANULE_SAMPLES;
+}
+
+internal u32
+layout_mp3_test_huffman(Mp3TestGranule *granule, Mp3BandLayout *layout)
+{
+    // NOTE(michiel): Splits the values in big values and count1 quadruples and picks the tables, returns the
+    // number of Huffman bits.
+    Mp3GranuleInfo *info = &granule->info;
+    s32 lastNonZero = -1;
+    s32 lastBig = -1;
+    for (u32 index = 0; index < MP3_GRANULE_SAMPLES; ++index)
+    {
+        if (granule->values[index])
+        {
+            lastNonZero = index;
+        }
+        if (absolute(granule->values[index]) > 1)
+        {
+            lastBig = index;
+        }
+    }
+    
+    u32 bigEnd = (lastBig + 2) & ~1;
+    u32 quadCount = ((u32)(lastNonZero + 1) > bigEnd) ? ((lastNonZero + 1) - bigEnd + 3) / 4 : 0;
+    if ((bigEnd + 4 * quadCount) > MP3_GRANULE_SAMPLES)
+    {
+        bigEnd = minimum(MP3_GRANULE_SAMPLES, (u32)(lastNonZero + 2) & ~1);
+        quadCount = 0;
+    }
+    info->bigValues = bigEnd / 2;
+    granule->count1End = bigEnd + 4 * quadCount;
+    
+    u32 ends[3];
+    get_mp3_test_region_ends(granule, layout, ends);
+    u32 regionCount = (info->blockType == Mp3Block_Normal) ? 3 : 2;
+    u32 result = 0;
+    u32 start = 0;
+    for (u32 region = 0; region < 3; ++region)
+    {
+        u32 end = maximum(start, minimum(ends[region], bigEnd));
+        u32 bits = 0;
+        info->tableSelect[region] = pick_mp3_test_table(granule->values, start, end, &bits);
+        if (region >= regionCount)
+        {
+            info->tableSelect[region] = 0;
+        }
+        result += bits;
+        start = end;
+    }
+    
+    u32 bitsA = 0;
+    u32 bitsB = 0;
+    for (u32 index = bigEnd; index < granule->count1End; index += 4)
+    {
+        u32 quad = 0;
+        u32 signCount = 0;
+        for (u32 valueIdx = 0; valueIdx < 4; ++valueIdx)
+        {
+            if (granule->values[index + valueIdx])
+            {
+                quad |= 8 >> valueIdx;
+                ++signCount;
+            }
+        }
+        bitsA += gMp3HuffmanSources[32].lengths[quad] + signCount;
+        bitsB += gMp3HuffmanSources[33].lengths[quad] + signCount;
+    }
+    info->count1Table = (bitsB < bitsA) ? 1 : 0;
+    result += minimum(bitsA, bitsB);
+    
+    return result;
+}
+
+internal void
+put_mp3_test_huffman(Mp3TestBitWriter *writer, Mp3TestGranule *granule, Mp3BandLayout *layout)
+{
+    Mp3GranuleInfo *info = &granule->info;
+    u32 ends[3];
+    get_mp3_test_region_ends(granule, layout, ends);
+    
+    u32 bigEnd = info->bigValues * 2;
+    for (u32 index = 0; index < bigEnd; index += 2)
+    {
+        u32 region = (index < ends[0]) ? 0 : (index < ends[1]) ? 1 : 2;
+        if (info->tableSelect[region])
+        {
+            put_mp3_test_pair(writer, info->tableSelect[region], granule->values[index], granule->values[index + 1]);
+        }
+    }
+    
+    Mp3HuffmanSource *quadSource = gMp3HuffmanSources + 32 + info->count1Table;
+    for (u32 index = bigEnd; index < granule->count1End; index += 4)
+    {
+        u32 quad = 0;
+        for (u32 valueIdx = 0; valueIdx < 4; ++valueIdx)
+        {
+            if (granule->values[index + valueIdx])
+            {
+                quad |= 8 >> valueIdx;
+            }
+        }
+        put_mp3_test_bits(writer, quadSource->codes[quad], quadSource->lengths[quad]);
+        for (u32 valueIdx = 0; valueIdx < 4; ++valueIdx)
+        {
+            if (granule->values[index + valueIdx])
+            {
+                put_mp3_test_bits(writer, (granule->values[index + valueIdx] < 0) ? 1 : 0, 1);
+            }
+        }
+    }
+}
+
+//
+// NOTE(michiel): Scalefactors
+//
+
+global u32 gMp3TestScfsiBands[5] = {0, 6, 11, 16, 21};
+global u32 gMp3TestIntensityCompress[6] = {9, 10, 12, 13, 14, 15};  // NOTE(michiel): At least 2 bits everywhere, for position 2
+
+internal u32
+choose_mp3_test_scalefactors(Mp3TestEncoder *encoder, Mp3TestGranule *granule, Mp3BandLayout *layout,
+                             Mp3TestGranule *granule0, u32 intensityPosition)
+{
+    // NOTE(michiel): Random scalefactors, the intensity channel gets the intensity position in all of them.
+    // granule0 is set for MPEG-1 granule 1, some groups are taken from it with scfsi. Returns the part 2 bits.
+    Mp3GranuleInfo *info = &granule->info;
+    memset(granule->scalefactors, 0, sizeof(granule->scalefactors));
+    info->scalefacScale = get_mp3_test_random(encoder, 2);
+    info->preflag = false;
+    granule->scfsi = 0;
+    b32 intensity = granule->intensityChannel;
+    
+    u32 result = 0;
+    if (encoder->config->version == 0)
+    {
+        info->scalefacCompress = intensity ? gMp3TestIntensityCompress[get_mp3_test_random(encoder, 6)] : get_mp3_test_random(encoder, 16);
+        u32 lowLength = gMp3ScalefacLengths[info->scalefacCompress][0];
+        u32 highLength = gMp3ScalefacLengths[info->scalefacCompress][1];
+        if (info->blockType == Mp3Block_Short)
+        {
+            u32 lowCount = info->mixedBlock ? 17 : 18;
+            for (u32 band = 0; band < lowCount + 18; ++band)
+            {
+                u32 length = (band < lowCount) ? lowLength : highLength;
+                granule->scalefactors[band] = intensity ? intensityPosition : get_mp3_test_random(encoder, 1 << length);
+                result += length;
+            }
+        }
+        else
+        {
+            info->preflag = intensity ? false : get_mp3_test_random(encoder, 2);
+            for (u32 group = 0; group < 4; ++group)
+            {
+                u32 length = (group < 2) ? lowLength : highLength;
+                b32 reuse = false;
+                if (granule0 && (granule0->info.blockType != Mp3Block_Short) && !intensity &&
+                    get_mp3_test_random(encoder, 2) &&
+                    (gMp3ScalefacLengths[granule0->info.scalefacCompress][(group < 2) ? 0 : 1] <= length))
+                {
+                    reuse = true;
+                    granule->scfsi |= 8 >> group;
+                }
+                for (u32 band = gMp3TestScfsiBands[group]; band < gMp3TestScfsiBands[group + 1]; ++band)
+                {
+                    if (reuse)
+                    {
+                        granule->scalefactors[band] = granule0->scalefactors[band];
+                    }
+                    else
+                    {
+                        granule->scalefactors[band] = intensity ? intensityPosition : get_mp3_test_random(encoder, 1 << length);
+                        result += length;
+                    }
+                }
+            }
+            encoder->scfsiGranules += granule->scfsi ? 1 : 0;
+        }
+    }
+    else
+    {
+        u32 *slen = granule->slen;
+        memset(slen, 0, sizeof(granule->slen));
+        if (intensity)
+        {
+            granule->lsfTable = 3;
+            slen[0] = 2 + get_mp3_test_random(encoder, 3);
+            slen[1] = 2 + get_mp3_test_random(encoder, 4);
+            slen[2] = 2 + get_mp3_test_random(encoder, 4);
+            info->scalefacCompress = (slen[0] * 36 + slen[1] * 6 + slen[2]) * 2 + encoder->config->intensityScale;
+        }
+        else
+        {
+            granule->lsfTable = get_mp3_test_random(encoder, 3);
+            if (granule->lsfTable == 0)
+            {
+                slen[0] = get_mp3_test_random(encoder, 5);
+                slen[1] = get_mp3_test_random(encoder, 5);
+                slen[2] = get_mp3_test_random(encoder, 4);
+                slen[3] = get_mp3_test_random(encoder, 4);
+                info->scalefacCompress = ((slen[0] * 5 + slen[1]) << 4) + (slen[2] << 2) + slen[3];
+            }
+            else if (granule->lsfTable == 1)
+            {
+                slen[0] = get_mp3_test_random(encoder, 5);
+                slen[1] = get_mp3_test_random(encoder, 5);
+                slen[2] = get_mp3_test_random(encoder, 4);
+                info->scalefacCompress = 400 + ((slen[0] * 5 + slen[1]) << 2) + slen[2];
+            }
+            else
+            {
+                slen[0] = get_mp3_test_random(encoder, 4);
+                slen[1] = get_mp3_test_random(encoder, 3);
+                info->scalefacCompress = 500 + slen[0] * 3 + slen[1];
+                info->preflag = true;
+            }
+        }
+        
+        u32 kind = (info->blockType == Mp3Block_Short) ? (info->mixedBlock ? 2 : 1) : 0;
+        u8 *counts = gMp3LsfBandCounts[granule->lsfTable][kind];
+        u32 band = 0;
+        for (u32 group = 0; group < 4; ++group)
+        {
+            for (u32 index = 0; (index < counts[group]) && (band < layout->bandCount); ++index, ++band)
+            {
+                granule->scalefactors[band] = intensity ? intensityPosition : get_mp3_test_random(encoder, 1 << slen[group]);
+                result += slen[group];
+            }
+        }
+    }
+    return result;
+}
+
+internal void
+put_mp3_test_scalefactors(Mp3TestBitWriter *writer, Mp3TestEncoder *encoder, Mp3TestGranule *granule,
+                          Mp3BandLayout *layout)
+{
+    Mp3GranuleInfo *info = &granule->info;
+    if (encoder->config->version == 0)
+    {
+        u32 lowLength = gMp3ScalefacLengths[info->scalefacCompress][0];
+        u32 highLength = gMp3ScalefacLengths[info->scalefacCompress][1];
+        if (info->blockType == Mp3Block_Short)
+        {
+            u32 lowCount = info->mixedBlock ? 17 : 18;
+            for (u32 band = 0; band < lowCount + 18; ++band)
+            {
+                put_mp3_test_bits(writer, granule->scalefactors[band], (band < lowCount) ? lowLength : highLength);
+            }
+        }
+        else
+        {
+            for (u32 group = 0; group < 4; ++group)
+            {
+                if (!(granule->scfsi & (8 >> group)))
+                {
+                    for (u32 band = gMp3TestScfsiBands[group]; band < gMp3TestScfsiBands[group + 1]; ++band)
+                    {
+                        put_mp3_test_bits(writer, granule->scalefactors[band], (group < 2) ? lowLength : highLength);
+                    }
+                }
+            }
+        }
+    }
+    else
+    {
+        u32 kind = (info->blockType == Mp3Block_Short) ? (info->mixedBlock ? 2 : 1) : 0;
+        u8 *counts = gMp3LsfBandCounts[granule->lsfTable][kind];
+        u32 band = 0;
+        for (u32 group = 0; group < 4; ++group)
+        {
+            for (u32 index = 0; (index < counts[group]) && (band < layout->bandCount); ++index, ++band)
+            {
+                put_mp3_test_bits(writer, granule->scalefactors[band], granule->slen[group]);
+            }
+        }
+    }
+}
+
+//
+// NOTE(michiel): Stream writing
+//
+
+internal f64
+get_mp3_test_intensity_ratio(Mp3TestEncoder *encoder)
+{
+    // NOTE(michiel): Right over left for the intensity position the intensity channel uses, 2 for MPEG-1 and
+    // 1 for MPEG-2. The test signal has the same ratio between its channels.
+    f64 result = 0.0;
+    if (encoder->config->version == 0)
+    {
+        result = 1.0 / tan(2.0 * M_PI / 12.0);
+    }
+    else
+    {
+        result = pow(2.0, 0.25 * (encoder->config->intensityScale + 1));
+    }
+    return result;
+}
+
+internal f64
+get_mp3_test_intensity_left(Mp3TestEncoder *encoder)
+{
+    // NOTE(michiel): The part of the coded value the decoder puts in the left channel
+    f64 result = 0.0;
+    if (encoder->config->version == 0)
+    {
+        f64 ratio = tan(2.0 * M_PI / 12.0);
+        result = ratio / (1.0 + ratio);
+    }
+    else
+    {
+        result = pow(2.0, -0.25 * (encoder->config->intensityScale + 1));
+    }
+    return result;
+}
+
+global Mp3BlockType gMp3TestSwitchingBlocks[8] =
+{
+    Mp3Block_Normal, Mp3Block_Normal, Mp3Block_Start, Mp3Block_Short,
+    Mp3Block_Short, Mp3Block_Stop, Mp3Block_Normal, Mp3Block_Normal,
+};
+
+global Mp3BlockType gMp3TestShortBlocks[5] =
+{
+    Mp3Block_Start, Mp3Block_Short, Mp3Block_Short, Mp3Block_Short, Mp3Block_Stop,
+};
+
+internal Mp3BlockType
+get_mp3_test_block_type(Mp3TestEncoder *encoder)
+{
+    u32 granuleIdx = encoder->granuleCounter++;
+    Mp3BlockType result = Mp3Block_Normal;
+    if (encoder->config->blockPattern == 1)
+    {
+        result = gMp3TestSwitchingBlocks[granuleIdx % array_count(gMp3TestSwitchingBlocks)];
+    }
+    else if (encoder->config->blockPattern == 2)
+    {
+        result = gMp3TestShortBlocks[granuleIdx % array_count(gMp3TestShortBlocks)];
+    }
+    return result;
+}
+
+internal void
+get_mp3_test_intensity_bands(Mp3BandLayout *layout, s32 *rightValues, b32 *intensityBands)
+{
+    // NOTE(michiel): The bands the decoder takes as intensity stereo, those above the last non zero band of the
+    // right channel, per window for short bands
+    b32 nonZeroAbove = false;
+    b32 windowNonZeroAbove[3] = {};
+    u32 bandEnd = MP3_GRANULE_SAMPLES;
+    for (s32 band = layout->bandCount - 1; band >= 0; --band)
+    {
+        u32 bandStart = bandEnd - layout->widths[band];
+        b32 nonZero = false;
+        for (u32 index = bandStart; index < bandEnd; ++index)
+        {
+            nonZero |= (rightValues[index] != 0);
+        }
+        
+        if ((u32)band < layout->longCount)
+        {
+            intensityBands[band] = !nonZeroAbove && !nonZero;
+        }
+        else
+        {
+            u32 window = (band - layout->longCount) % 3;
+            intensityBands[band] = !windowNonZeroAbove[window] && !nonZero;
+            windowNonZeroAbove[window] |= nonZero;
+        }
+        nonZeroAbove |= nonZero;
+        bandEnd = bandStart;
+    }
+}
+
+internal u32
+quantize_mp3_test_rate(Mp3TestEncoder *encoder, Mp3TestGranule *granule, Mp3BandLayout *layout, f64 *ordered,
+                       u32 *bands, u32 part2Bits, u32 budget)
+{
+    // NOTE(michiel): Lowest global gain that fits the budget, returns part2_3_length
+    budget = minimum(budget, 4095u);
+    u32 low = 0;
+    while (quantize_mp3_test_granule(granule, layout, ordered, bands, low) < 0)
+    {
+        ++low;
+    }
+    u32 high = 255;
+    quantize_mp3_test_granule(granule, layout, ordered, bands, high);
+    i_expect((part2Bits + layout_mp3_test_huffman(granule, layout)) <= budget);
+    while (low < high)
+    {
+        u32 middle = (low + high) / 2;
+        quantize_mp3_test_granule(granule, layout, ordered, bands, middle);
+        if ((part2Bits + layout_mp3_test_huffman(granule, layout)) <= budget)
+        {
+            high = middle;
+        }
+        else
+        {
+            low = middle + 1;
+        }
+    }
+    
+    Mp3GranuleInfo *info = &granule->info;
+    info->globalGain = low;
+    quantize_mp3_test_granule(granule, layout, ordered, bands, low);
+    info->part23Length = part2Bits + layout_mp3_test_huffman(granule, layout);
+    
+    for (u32 index = 0; index < MP3_GRANULE_SAMPLES; ++index)
+    {
+        s32 value = granule->values[index];
+        f64 dequantized = pow((f64)absolute(value), 4.0 / 3.0) * get_mp3_test_gain(granule, layout, bands[index], low);
+        dequantized = (value < 0) ? -dequantized : dequantized;
+        granule->expected[index] = (f32)dequantized;
+        encoder->spectrumSignal += ordered[index] * ordered[index];
+        encoder->spectrumError += (dequantized - ordered[index]) * (dequantized - ordered[index]);
+    }
+    return info->part23Length;
+}
+
+internal void
+init_mp3_test_encoder(Mp3TestEncoder *encoder, Mp3TestConfig *config, u64 seed)
+{
+    memset(encoder, 0, sizeof(Mp3TestEncoder));
+    encoder->config = config;
+    encoder->random = random_seed_pcg(seed, 0x14057B7EF767814FULL);
+    encoder->sampleRateIndex = config->version * 3 + config->sampleRateIdx;
+    encoder->sampleRate = gMPEGSampleRates[config->version * 4 + config->sampleRateIdx];
+    encoder->channelCount = (config->channelMode == MpegChannel_SingleChannel) ? 1 : 2;
+    encoder->granuleCount = (config->version == 0) ? 2 : 1;
+    encoder->maxMainDataBegin = (config->version == 0) ? 511 : 255;
+}
+
+internal void
+encode_mp3_test_frame(Mp3TestEncoder *encoder, f64 **input)
+{
+    Mp3TestConfig *config = encoder->config;
+    u32 frameIdx = encoder->frameCount++;
+    i_expect(frameIdx < MP3_TEST_FRAMES);
+    
+    u32 bitRate = gMPEGBitRates[(config->version ? 4 : 2) * 16 + config->bitRateIdx];
+    u32 frameSize = encoder->granuleCount * 72 * bitRate * 1000;
+    u32 frameBytes = frameSize / encoder->sampleRate;
+    encoder->paddingRest += frameSize % encoder->sampleRate;
+    b32 padded = encoder->paddingRest >= encoder->sampleRate;
+    if (padded)
+    {
+        encoder->paddingRest -= encoder->sampleRate;
+        ++frameBytes;
+    }
+    
+    u32 sideInfoSize = (config->version == 0) ? ((encoder->channelCount == 1) ? 17 : 32) : ((encoder->channelCount == 1) ? 9 : 17);
+    u32 slotSize = frameBytes - MPEG_HEADER_SIZE - (config->crc ? MPEG_CRC_SIZE : 0) - sideInfoSize;
+    u32 slotStart = encoder->slotStart;
+    u32 mainDataStart = maximum(encoder->mainDataEnd, slotStart - minimum(slotStart, encoder->maxMainDataBegin));
+    u32 mainDataBegin = slotStart - mainDataStart;
+    encoder->largestMainDataBegin = maximum(encoder->largestMainDataBegin, mainDataBegin);
+    u32 availableBits = (slotStart + slotSize - mainDataStart) * 8;
+    
+    b32 midSide = (config->channelMode == MpegChannel_JointStereo) && (config->modeExtension & MpegChannelExt3_MidSide);
+    b32 intensity = (config->channelMode == MpegChannel_JointStereo) && (config->modeExtension & MpegChannelExt3_Intensity);
+    u32 intensityPosition = (config->version == 0) ? 2 : 1;
+    u32 unitCount = encoder->granuleCount * encoder->channelCount;
+    u32 unitIdx = 0;
+    u32 usedBits = 0;
+    for (u32 granuleIdx = 0; granuleIdx < encoder->granuleCount; ++granuleIdx)
+    {
+        Mp3BlockType blockType = get_mp3_test_block_type(encoder);
+        b32 mixedBlock = (blockType == Mp3Block_Short) && config->mixedBlocks;
+        encoder->shortGranules += (blockType == Mp3Block_Short) ? 1 : 0;
+        encoder->mixedGranules += mixedBlock ? 1 : 0;
+        
+        Mp3GranuleInfo blockInfo = {};
+        blockInfo.blockType = blockType;
+        blockInfo.mixedBlock = mixedBlock;
+        Mp3BandLayout *layout = get_mp3_test_layout(encoder, &blockInfo);
+        
+        f64 spectrum[MP3_GRANULE_SAMPLES];
+        f64 ordered[MPEG_MAX_CHANNELS][MP3_GRANULE_SAMPLES];
+        f64 coded[MPEG_MAX_CHANNELS][MP3_GRANULE_SAMPLES];
+        u32 bands[MP3_GRANULE_SAMPLES];
+        for (u32 channel = 0; channel < encoder->channelCount; ++channel)
+        {
+            transform_mp3_test_granule(encoder, channel, input[channel] + granuleIdx * MP3_GRANULE_SAMPLES,
+                                       blockType, mixedBlock, spectrum);
+            order_mp3_test_spectrum(encoder, layout, spectrum, ordered[channel], bands);
+            memcpy(coded[channel], ordered[channel], sizeof(coded[channel]));
+        }
+        
+        // NOTE(michiel): Intensity stereo from long band 12 or short band 7 on, where the right channel is
+        // left empty. Mid/side for the rest.
+        b32 plannedIntensity[MP3_MAX_BANDS] = {};
+        if (intensity)
+        {
+            for (u32 band = layout->longCount; band < layout->bandCount; ++band)
+            {
+                plannedIntensity[band] = (layout->shortBandOffset + (band - layout->longCount) / 3) >= 7;
+            }
+            if (layout->longCount == layout->bandCount)
+            {
+                for (u32 band = 12; band < layout->bandCount; ++band)
+                {
+                    plannedIntensity[band] = true;
+                }
+            }
+        }
+        for (u32 index = 0; index < MP3_GRANULE_SAMPLES; ++index)
+        {
+            if (midSide)
+            {
+                coded[0][index] = (ordered[0][index] + ordered[1][index]) * M_SQRT1_2;
+                coded[1][index] = (ordered[0][index] - ordered[1][index]) * M_SQRT1_2;
+            }
+            if (plannedIntensity[bands[index]])
+            {
+                coded[1][index] = 0.0;
+            }
+        }
+        
+        // NOTE(michiel): The right channel goes first, its quantized values decide the intensity bands
+        for (u32 order = 0; order < encoder->channelCount; ++order)
+        {
+            u32 channel = encoder->channelCount - 1 - order;
+            Mp3TestGranule *granule = &encoder->granules[frameIdx][granuleIdx][channel];
+            Mp3GranuleInfo *info = &granule->info;
+            info->blockType = blockType;
+            info->mixedBlock = mixedBlock;
+            granule->intensityChannel = intensity && (channel == 1);
+            for (u32 window = 0; window < 3; ++window)
+            {
+                info->subblockGain[window] = (blockType == Mp3Block_Short) ? get_mp3_test_random(encoder, 3) : 0;
+            }
+            if (blockType == Mp3Block_Normal)
+            {
+                info->region0Count = get_mp3_test_random(encoder, 16);
+                info->region1Count = get_mp3_test_random(encoder, 8);
+            }
+            else
+            {
+                info->region0Count = ((blockType == Mp3Block_Short) && !mixedBlock) ? 8 : 7;
+                info->region1Count = 36;
+            }
+            
+            if (intensity && (channel == 0))
+            {
+                b32 intensityBands[MP3_MAX_BANDS];
+                get_mp3_test_intensity_bands(layout, encoder->granules[frameIdx][granuleIdx][1].values, intensityBands);
+                f64 leftPart = get_mp3_test_intensity_left(encoder);
+                for (u32 index = 0; index < MP3_GRANULE_SAMPLES; ++index)
+                {
+                    if (intensityBands[bands[index]])
+                    {
+                        coded[0][index] = ordered[0][index] / leftPart;
+                    }
+                }
+            }
+            
+            Mp3TestGranule *granule0 = granuleIdx ? &encoder->granules[frameIdx][0][channel] : 0;
+            u32 part2Bits = choose_mp3_test_scalefactors(encoder, granule, layout, granule0, intensityPosition);
+            u32 budget = (availableBits - usedBits) / (unitCount - unitIdx);
+            usedBits += quantize_mp3_test_rate(encoder, granule, layout, coded[channel], bands, part2Bits, budget);
+            ++unitIdx;
+        }
+    }
+    
+    // NOTE(michiel): Main data
+    Mp3TestBitWriter mainWriter = {};
+    u8 mainData[4 * 4096 / 8];
+    mainWriter.data = mainData;
+    for (u32 granuleIdx = 0; granuleIdx < encoder->granuleCount; ++granuleIdx)
+    {
+        for (u32 channel = 0; channel < encoder->channelCount; ++channel)
+        {
+            Mp3TestGranule *granule = &encoder->granules[frameIdx][granuleIdx][channel];
+            Mp3BandLayout *layout = get_mp3_test_layout(encoder, &granule->info);
+            u32 bitsBefore = mainWriter.bitCount;
+            put_mp3_test_scalefactors(&mainWriter, encoder, granule, layout);
+            put_mp3_test_huffman(&mainWriter, granule, layout);
+            i_expect((mainWriter.bitCount - bitsBefore) == granule->info.part23Length);
+        }
+    }
+    u32 mainDataSize = (mainWriter.bitCount + 7) / 8;
+    i_expect((mainDataStart + mainDataSize) <= (slotStart + slotSize));
+    memset(encoder->mainData + encoder->mainDataEnd, 0, mainDataStart - encoder->mainDataEnd);
+    memcpy(encoder->mainData + mainDataStart, mainData, mainDataSize);
+    encoder->mainDataEnd = mainDataStart + mainDataSize;
+    
+    // NOTE(michiel): Side info
+    Mp3TestBitWriter sideWriter = {};
+    u8 sideInfo[32];
+    sideWriter.data = sideInfo;
+    if (config->version == 0)
+    {
+        put_mp3_test_bits(&sideWriter, mainDataBegin, 9);
+        put_mp3_test_bits(&sideWriter, 0, (encoder->channelCount == 1) ? 5 : 3);
+        for (u32 channel = 0; channel < encoder->channelCount; ++channel)
+        {
+            put_mp3_test_bits(&sideWriter, encoder->granules[frameIdx][1][channel].scfsi, 4);
+        }
+    }
+    else
+    {
+        put_mp3_test_bits(&sideWriter, mainDataBegin, 8);
+        put_mp3_test_bits(&sideWriter, 0, encoder->channelCount);
+    }
+    for (u32 granuleIdx = 0; granuleIdx < encoder->granuleCount; ++granuleIdx)
+    {
+        for (u32 channel = 0; channel < encoder->channelCount; ++channel)
+        {
+            Mp3GranuleInfo *info = &encoder->granules[frameIdx][granuleIdx][channel].info;
+            put_mp3_test_bits(&sideWriter, info->part23Length, 12);
+            put_mp3_test_bits(&sideWriter, info->bigValues, 9);
+            put_mp3_test_bits(&sideWriter, info->globalGain, 8);
+            put_mp3_test_bits(&sideWriter, info->scalefacCompress, (config->version == 0) ? 4 : 9);
+            if (info->blockType != Mp3Block_Normal)
+            {
+                put_mp3_test_bits(&sideWriter, 1, 1);
+                put_mp3_test_bits(&sideWriter, info->blockType, 2);
+                put_mp3_test_bits(&sideWriter, info->mixedBlock ? 1 : 0, 1);
+                put_mp3_test_bits(&sideWriter, info->tableSelect[0], 5);
+                put_mp3_test_bits(&sideWriter, info->tableSelect[1], 5);
+                for (u32 window = 0; window < 3; ++window)
+                {
+                    put_mp3_test_bits(&sideWriter, info->subblockGain[window], 3);
+                }
+            }
+            else
+            {
+                put_mp3_test_bits(&sideWriter, 0, 1);
+                for (u32 region = 0; region < 3; ++region)
+                {
+                    put_mp3_test_bits(&sideWriter, info->tableSelect[region], 5);
+                }
+                put_mp3_test_bits(&sideWriter, info->region0Count, 4);
+                put_mp3_test_bits(&sideWriter, info->region1Count, 3);
+            }
+            if (config->version == 0)
+            {
+                put_mp3_test_bits(&sideWriter, info->preflag ? 1 : 0, 1);
+            }
+            put_mp3_test_bits(&sideWriter, info->scalefacScale, 1);
+            put_mp3_test_bits(&sideWriter, info->count1Table, 1);
+        }
+    }
+    i_expect(sideWriter.bitCount == sideInfoSize * 8);
+    
+    // NOTE(michiel): Header, the CRC covers the last two header bytes and the side info
+    u8 *head = encoder->frameHeads[frameIdx];
+    u32 versionBits = (config->version == 0) ? 3 : (config->version == 1) ? 2 : 0;
+    head[0] = 0xFF;
+    head[1] = (u8)(0xE0 | (versionBits << 3) | (1 << 1) | (config->crc ? 0 : 1));
+    head[2] = (u8)((config->bitRateIdx << 4) | (config->sampleRateIdx << 2) | (padded ? 2 : 0));
+    head[3] = (u8)((config->channelMode << 6) | ((config->channelMode == MpegChannel_JointStereo) ? (config->modeExtension << 4) : 0) | 0x4);
+    u32 headSize = MPEG_HEADER_SIZE;
+    if (config->crc)
+    {
+        u16 crc = 0xFFFF;
+        crc = (u16)((crc << 8) ^ gMp3TestCrcTable[(crc >> 8) ^ head[2]]);
+        crc = (u16)((crc << 8) ^ gMp3TestCrcTable[(crc >> 8) ^ head[3]]);
+        for (u32 index = 0; index < sideInfoSize; ++index)
+        {
+            crc = (u16)((crc << 8) ^ gMp3TestCrcTable[(crc >> 8) ^ sideInfo[index]]);
+        }
+        head[headSize++] = (u8)(crc >> 8);
+        head[headSize++] = (u8)crc;
+    }
+    memcpy(head + headSize, sideInfo, sideInfoSize);
+    encoder->frameHeadSizes[frameIdx] = headSize + sideInfoSize;
+    encoder->frameSlotStarts[frameIdx] = slotStart;
+    encoder->frameSlotSizes[frameIdx] = slotSize;
+    encoder->slotStart += slotSize;
+}
+
+internal u32
+finish_mp3_test_stream(Mp3TestEncoder *encoder, u8 *stream)
+{
+    // NOTE(michiel): Puts the headers and side info in front of their slots, returns the stream size
+    memset(encoder->mainData + encoder->mainDataEnd, 0, encoder->slotStart - encoder->mainDataEnd);
+    u8 *at = stream;
+    for (u32 frameIdx = 0; frameIdx < encoder->frameCount; ++frameIdx)
+    {
+        memcpy(at, encoder->frameHeads[frameIdx], encoder->frameHeadSizes[frameIdx]);
+        at += encoder->frameHeadSizes[frameIdx];
+        memcpy(at, encoder->mainData + encoder->frameSlotStarts[frameIdx], encoder->frameSlotSizes[frameIdx]);
+        at += encoder->frameSlotSizes[frameIdx];
+    }
+    return (u32)(at - stream);
+}
+
+//
+// NOTE(michiel): Checks
+//
+
+internal u32
+check_mp3_test_spectra(Mp3TestEncoder *encoder, Mp3Decoder *decoder, u8 *stream, u32 streamSize)
+{
+    // NOTE(michiel): Follows the start of decode_mp3_frame and compares the spectrum of each channel before any
+    // stereo processing. Returns the number of lines that differ, and counts bad CRCs too.
+    init_mp3_decoder(decoder);
+    u32 result = 0;
+    u32 frameIdx = 0;
+    u8 *at = stream;
+    u8 *end = stream + streamSize;
+    while ((at + MPEG_HEADER_SIZE) <= end)
+    {
+        MpegFrameHeader header;
+        if (!parse_mpeg_frame_header(at, &header) || (frameIdx >= encoder->frameCount))
+        {
+            ++result;
+            break;
+        }
+        result += check_mpeg_frame_crc(&header, at) ? 0 : 1;
+        
+        u8 *sideInfoData = at + MPEG_HEADER_SIZE + (header.protection ? MPEG_CRC_SIZE : 0);
+        u32 sideInfoSize = get_mp3_side_info_size(&header);
+        Mp3SideInfo sideInfo;
+        parse_mp3_side_info(&header, sideInfoData, &sideInfo);
+        u32 mainDataSize = header.frameByteCount - (u32)(sideInfoData - at) - sideInfoSize;
+        memcpy(decoder->mainData + decoder->reservoirSize, sideInfoData + sideInfoSize, mainDataSize);
+        u32 availableSize = decoder->reservoirSize + mainDataSize;
+        memset(decoder->mainData + availableSize, 0, MP3_MAIN_DATA_PADDING);
+        
+        Mp3BitReader reader = {};
+        reader.data = decoder->mainData + decoder->reservoirSize - sideInfo.mainDataBegin;
+        reader.end = (sideInfo.mainDataBegin + mainDataSize) * 8;
+        for (u32 granuleIdx = 0; granuleIdx < encoder->granuleCount; ++granuleIdx)
+        {
+            for (u32 channel = 0; channel < encoder->channelCount; ++channel)
+            {
+                decode_mp3_channel(decoder, &header, &sideInfo, granuleIdx, channel, &reader);
+                f32 *expected = encoder->granules[frameIdx][granuleIdx][channel].expected;
+                for (u32 index = 0; index < MP3_GRANULE_SAMPLES; ++index)
+                {
+                    f32 difference = expected[index] - decoder->spectrum[channel][index];
+                    if (absolute(difference) > (1e-4f * absolute(expected[index]) + 1e-9f))
+                    {
+                        ++result;
+                    }
+                }
+            }
+        }
+        
+        u32 keepSize = minimum(availableSize, (u32)MP3_MAX_MAIN_DATA_BACK);
+        memmove(decoder->mainData, decoder->mainData + availableSize - keepSize, keepSize);
+        decoder->reservoirSize = keepSize;
+        at += header.frameByteCount;
+        ++frameIdx;
+    }
+    result += (frameIdx == encoder->frameCount) ? 0 : 1;
+    return result;
+}
+
+internal b32
+check_mp3_test_output(Mp3TestEncoder *encoder, Mp3Decoder *decoder, u8 *stream, u32 streamSize, b32 fixedPoint,
+                      f64 *snr)
+{
+    // NOTE(michiel): Decodes the whole stream and measures the SNR of each channel against the input signal
+    init_mp3_decoder(decoder);
+    decoder->fixedPoint = fixedPoint;
+    b32 result = true;
+    u32 sampleCount = 0;
+    u8 *at = stream;
+    u8 *end = stream + streamSize;
+    while ((at + MPEG_HEADER_SIZE) <= end)
+    {
+        MpegFrameHeader header;
+        if (!parse_mpeg_frame_header(at, &header))
+        {
+            result = false;
+            break;
+        }
+        result &= decode_mp3_frame(decoder, &header, at, gMp3TestOutput + sampleCount * encoder->channelCount);
+        sampleCount += header.sampleCount;
+        at += header.frameByteCount;
+    }
+    result &= (decoder->missingFrames == 0) && (decoder->badGranules == 0);
+    
+    for (u32 channel = 0; channel < encoder->channelCount; ++channel)
+    {
+        f64 signal = 0.0;
+        f64 error = 0.0;
+        for (u32 index = MP3_TEST_SKIP; (index + MP3_TEST_DELAY + MP3_TEST_SKIP) < sampleCount; ++index)
+        {
+            f64 reference = gMp3TestSignal[channel][index];
+            f64 output = gMp3TestOutput[(index + MP3_TEST_DELAY) * encoder->channelCount + channel];
+            signal += reference * reference;
+            error += (output - reference) * (output - reference);
+        }
+        snr[channel] = 10.0 * log10(signal / error);
+    }
+    return result;
+}
+
+int main(int argc, char **argv)
+{
+    initialize_std_allocator(0, gMemoryAllocator);
+    init_mp3_test_tables();
+    
+    Mp3TestEncoder *encoder = &gMp3TestEncoder;
+    Mp3Decoder *decoder = &gMp3TestDecoder;
+    u32 failures = 0;
+    u32 shortGranules = 0;
+    u32 mixedGranules = 0;
+    u32 scfsiGranules = 0;
+    u32 largestMainDataBegin = 0;
+    for (u32 configIdx = 0; configIdx < array_count(gMp3TestConfigs); ++configIdx)
+    {
+        Mp3TestConfig *config = gMp3TestConfigs + configIdx;
+        init_mp3_test_encoder(encoder, config, configIdx + 1);
+        
+        // NOTE(michiel): For intensity stereo the right channel is the left one at the intensity ratio
+        RandomSeriesPCG signalRandom = random_seed_pcg(configIdx + 1, 0xDA3E39CB94B95BDBULL);
+        generate_mp3_test_signal(&signalRandom, encoder->sampleRate, config->lowCut, 0.8, gMp3TestSignal[0]);
+        if ((config->channelMode == MpegChannel_JointStereo) && (config->modeExtension & MpegChannelExt3_Intensity))
+        {
+            f64 ratio = get_mp3_test_intensity_ratio(encoder);
+            for (u32 index = 0; index < MP3_TEST_SIGNAL_SAMPLES; ++index)
+            {
+                gMp3TestSignal[1][index] = gMp3TestSignal[0][index] * ratio;
+            }
+        }
+        else
+        {
+            generate_mp3_test_signal(&signalRandom, encoder->sampleRate, config->lowCut, 0.6, gMp3TestSignal[1]);
+        }
+        
+        u32 frameSamples = encoder->granuleCount * MP3_GRANULE_SAMPLES;
+        for (u32 frameIdx = 0; frameIdx < MP3_TEST_FRAMES; ++frameIdx)
+        {
+            f64 *input[MPEG_MAX_CHANNELS] = {gMp3TestSignal[0] + frameIdx * frameSamples,
+                                             gMp3TestSignal[1] + frameIdx * frameSamples};
+            encode_mp3_test_frame(encoder, input);
+        }
+        u32 streamSize = finish_mp3_test_stream(encoder, gMp3TestStream);
+        
+        u32 mismatches = check_mp3_test_spectra(encoder, decoder, gMp3TestStream, streamSize);
+        f64 spectrumSnr = 10.0 * log10(encoder->spectrumSignal / encoder->spectrumError);
+        f64 floatSnr[MPEG_MAX_CHANNELS] = {};
+        f64 fixedSnr[MPEG_MAX_CHANNELS] = {};
+        b32 decoded = check_mp3_test_output(encoder, decoder, gMp3TestStream, streamSize, false, floatSnr);
+        decoded &= check_mp3_test_output(encoder, decoder, gMp3TestStream, streamSize, true, fixedSnr);
+        
+        b32 ok = decoded && (mismatches == 0);
+        for (u32 channel = 0; channel < encoder->channelCount; ++channel)
+        {
+            ok &= (floatSnr[channel] > (spectrumSnr - MP3_TEST_MAX_SNR_LOSS));
+            ok &= (fixedSnr[channel] > (spectrumSnr - MP3_TEST_MAX_SNR_LOSS));
+        }
+        fprintf(stdout, "%-36s: %s (%u mismatches, spectrum %.1f dB, float %.1f/%.1f dB, fixed %.1f/%.1f dB)\n",
+                config->name, ok ? "ok" : "FAIL", mismatches, spectrumSnr, floatSnr[0], floatSnr[1],
+                fixedSnr[0], fixedSnr[1]);
+        failures += ok ? 0 : 1;
+        
+        shortGranules += encoder->shortGranules;
+        mixedGranules += encoder->mixedGranules;
+        scfsiGranules += encoder->scfsiGranules;
+        largestMainDataBegin = maximum(largestMainDataBegin, encoder->largestMainDataBegin);
+    }
+    
+    // NOTE(michiel): Make sure the streams used what they were meant to
+    b32 covered = shortGranules && mixedGranules && scfsiGranules && (largestMainDataBegin > 255);
+    fprintf(stdout, "%-36s: %s (%u short, %u mixed, %u scfsi granules, main_data_begin up to %u)\n", "coverage",
+            covered ? "ok" : "FAIL", shortGranules, mixedGranules, scfsiGranules, largestMainDataBegin);
+    failures += covered ? 0 : 1;
+    
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,304 @@
+//
+// NOTE(michiel): CRC32
+//
+
+internal void
+init_ogg_crc_table(u32 table[8][256])
+{
+    // NOTE(michiel): Polynomial 0x04C11DB7, not reflected, no initial value and no final xor.
+    // Table k gives the CRC of a byte followed by k zero bytes, for slicing by 8.
+    for (u32 index = 0; index < 256; ++index)
+    {
+        u32 crc = index << 24;
+        for (u32 bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc & 0x80000000) ? ((crc << 1) ^ 0x04C11DB7) : (crc << 1);
+        }
+        table[0][index] = crc;
+    }
+    for (u32 slice = 1; slice < 8; ++slice)
+    {
+        for (u32 index = 0; index < 256; ++index)
+        {
+            u32 crc = table[slice - 1][index];
+            table[slice][index] = (crc << 8) ^ table[0][crc >> 24];
+        }
+    }
+}
+
+internal u32
+ogg_crc32(u32 table[8][256], u32 crc, umm size, u8 *data)
+{
+    while (size >= 8)
+    {
+        u32 high = crc ^ (((u32)data[0] << 24) | ((u32)data[1] << 16) | ((u32)data[2] << 8) | (u32)data[3]);
+        crc = (table[7][high >> 24] ^ table[6][(high >> 16) & 0xFF] ^
+               table[5][(high >> 8) & 0xFF] ^ table[4][high & 0xFF] ^
+               table[3][data[4]] ^ table[2][data[5]] ^
+               table[1][data[6]] ^ table[0][data[7]]);
+        data += 8;
+        size -= 8;
+    }
+    while (size--)
+    {
+        crc = (crc << 8) ^ table[0][(crc >> 24) ^ *data++];
+    }
+    return crc;
+}
+
+//
+// NOTE(michiel): Pages
+//
+
+internal u32
+get_ogg_le_u32(u8 *data)
+{
+    return ((u32)data[0] << 0) | ((u32)data[1] << 8) | ((u32)data[2] << 16) | ((u32)data[3] << 24);
+}
+
+internal b32
+parse_ogg_page(OggPacketReader *reader, u8 *at, OggPage *page)
+{
+    // NOTE(michiel): Only a complete page with a valid CRC32 counts
+    u8 *end = reader->data.data + reader->data.size;
+    if (((end - at) < OGG_HEADER_SIZE) ||
+        (at[0] != 'O') || (at[1] != 'g') || (at[2] != 'g') || (at[3] != 'S') || (at[4] != 0))
+    {
+        return false;
+    }
+    
+    u32 segmentCount = at[26];
+    if ((umm)(end - at) < (OGG_HEADER_SIZE + segmentCount))
+    {
+        return false;
+    }
+    
+    umm dataSize = 0;
+    for (u32 segmentIdx = 0; segmentIdx < segmentCount; ++segmentIdx)
+    {
+        dataSize += at[OGG_HEADER_SIZE + segmentIdx];
+    }
+    umm pageSize = OGG_HEADER_SIZE + segmentCount + dataSize;
+    if ((umm)(end - at) < pageSize)
+    {
+        return false;
+    }
+    
+    // NOTE(michiel): The CRC is calculated with the CRC field set to zero
+    u8 zeros[4] = {};
+    u32 crc = ogg_crc32(reader->crcTable, 0, 22, at);
+    crc = ogg_crc32(reader->crcTable, crc, 4, zeros);
+    crc = ogg_crc32(reader->crcTable, crc, pageSize - 26, at + 26);
+    if (crc != get_ogg_le_u32(at + 22))
+    {
+        return false;
+    }
+    
+    page->start = at;
+    page->size = pageSize;
+    page->flags = at[5];
+    page->granulePosition = ((u64)get_ogg_le_u32(at + 10) << 32) | get_ogg_le_u32(at + 6);
+    page->serial = get_ogg_le_u32(at + 14);
+    page->sequence = get_ogg_le_u32(at + 18);
+    page->segmentCount = segmentCount;
+    page->lacing = at + OGG_HEADER_SIZE;
+    page->data = page->lacing + segmentCount;
+    return true;
+}
+
+internal u8 *
+find_ogg_page(OggPacketReader *reader, u8 *searchStart, OggPage *page)
+{
+    // NOTE(michiel): Next valid page of our logical stream, starting the search at searchStart
+    u8 *end = reader->data.data + reader->data.size;
+    u8 *at = searchStart;
+    while ((end - at) >= OGG_HEADER_SIZE)
+    {
+        at = (u8 *)memchr(at, 'O', end - at - OGG_HEADER_SIZE + 1);
+        if (!at)
+        {
+            break;
+        }
+        
+        if (parse_ogg_page(reader, at, page))
+        {
+            if (!reader->hasSerial || (page->serial == reader->serial))
+            {
+                return at;
+            }
+            at += page->size;
+        }
+        else
+        {
+            ++at;
+        }
+    }
+    return 0;
+}
+
+internal void
+init_ogg_packet_reader(MemoryAllocator *allocator, Buffer data, OggPacketReader *reader)
+{
+    *reader = {};
+    reader->allocator = allocator;
+    reader->data = data;
+    reader->at = data.data;
+    init_ogg_crc_table(reader->crcTable);
+}
+
+internal void
+free_ogg_packet_reader(OggPacketReader *reader)
+{
+    if (reader->packetBuffer)
+    {
+        deallocate(reader->allocator, reader->packetBuffer);
+    }
+    reader->packetBuffer = 0;
+    reader->packetCapacity = 0;
+}
+
+internal void
+collect_ogg_packet_data(OggPacketReader *reader, umm size, u8 *data)
+{
+    if ((reader->packetSize + size) > reader->packetCapacity)
+    {
+        umm newCapacity = maximum(reader->packetCapacity * 2, reader->packetSize + size);
+        newCapacity = maximum(newCapacity, (umm)kilobytes(64));
+        u8 *newBuffer = (u8 *)allocate_size(reader->allocator, newCapacity, default_memory_alloc());
+        if (reader->packetBuffer)
+        {
+            memcpy(newBuffer, reader->packetBuffer, reader->packetSize);
+            deallocate(reader->allocator, reader->packetBuffer);
+        }
+        reader->packetBuffer = newBuffer;
+        reader->packetCapacity = newCapacity;
+    }
+    memcpy(reader->packetBuffer + reader->packetSize, data, size);
+    reader->packetSize += size;
+}
+
+internal b32
+load_next_ogg_page(OggPacketReader *reader)
+{
+    OggPage page = {};
+    u8 *pageStart = find_ogg_page(reader, reader->at, &page);
+    if (!pageStart)
+    {
+        reader->skippedBytes += (reader->data.data + reader->data.size) - reader->at;
+        reader->at = reader->data.data + reader->data.size;
+        reader->hasPage = false;
+        return false;
+    }
+    
+    b32 inSequence = reader->hasPage && (page.sequence == (reader->page.sequence + 1));
+    if (pageStart != reader->at)
+    {
+        reader->skippedBytes += pageStart - reader->at;
+        ++reader->badPages;
+        inSequence = false;
+    }
+    
+    if (!reader->hasSerial)
+    {
+        reader->serial = page.serial;
+        reader->hasSerial = true;
+    }
+    
+    reader->at = pageStart + page.size;
+    reader->page = page;
+    reader->hasPage = true;
+    reader->segmentIndex = 0;
+    reader->segmentAt = page.data;
+    
+    if (page.flags & OggPage_Continued)
+    {
+        if (!reader->collecting || !inSequence)
+        {
+            // NOTE(michiel): The start of this packet is gone, skip what is left of it
+            if (reader->collecting)
+            {
+                ++reader->lostPackets;
+            }
+            reader->collecting = false;
+            reader->packetSize = 0;
+            while (reader->segmentIndex < page.segmentCount)
+            {
+                u8 lacing = page.lacing[reader->segmentIndex++];
+                reader->segmentAt += lacing;
+                if (lacing < 255)
+                {
+                    break;
+                }
+            }
+        }
+    }
+    else if (reader->collecting)
+    {
+        ++reader->lostPackets;
+        reader->collecting = false;
+        reader->packetSize = 0;
+    }
+    
+    return true;
+}
+
+internal b32
+next_ogg_packet(OggPacketReader *reader, Buffer *packet)
+{
+    // NOTE(michiel): The returned data stays valid until the next call
+    for (;;)
+    {
+        if (!reader->hasPage || (reader->segmentIndex == reader->page.segmentCount))
+        {
+            if (!load_next_ogg_page(reader))
+            {
+                return false;
+            }
+            continue;
+        }
+        
+        OggPage *page = &reader->page;
+        u8 *packetStart = reader->segmentAt;
+        umm size = 0;
+        b32 complete = false;
+        while (reader->segmentIndex < page->segmentCount)
+        {
+            u8 lacing = page->lacing[reader->segmentIndex++];
+            size += lacing;
+            if (lacing < 255)
+            {
+                complete = true;
+                break;
+            }
+        }
+        reader->segmentAt += size;
+        
+        if (complete && !reader->collecting)
+        {
+            packet->data = packetStart;
+            packet->size = size;
+            return true;
+        }
+        
+        collect_ogg_packet_data(reader, size, packetStart);
+        if (complete)
+        {
+            reader->collecting = false;
+            packet->data = reader->packetBuffer;
+            packet->size = reader->packetSize;
+            reader->packetSize = 0;
+            return true;
+        }
+        reader->collecting = true;
+    }
+}
+
+internal void
+seek_ogg_packet_reader(OggPacketReader *reader, u8 *pageStart)
+{
+    // NOTE(michiel): Continue reading at the given page, a packet continued from the page before it is skipped
+    reader->at = pageStart;
+    reader->hasPage = false;
+    reader->collecting = false;
+    reader->packetSize = 0;
+}
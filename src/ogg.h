@@ -0,0 +1,54 @@
+// NOTE(michiel): Ogg container (RFC 3533) on top of an in memory file. Pages are checked with their
+// CRC32, packets that stay inside one page are handed out as a pointer into the file, only packets
+// that span pages are collected in a buffer.
+
+#define OGG_HEADER_SIZE        27
+#define OGG_MAX_PAGE_SIZE      (OGG_HEADER_SIZE + 255 + 255 * 255)
+#define OGG_NO_GRANULE         0xFFFFFFFFFFFFFFFFULL
+
+enum OggPageFlags
+{
+    OggPage_Continued = 0x01,   // NOTE(michiel): The first packet continues from the previous page
+    OggPage_FirstPage = 0x02,
+    OggPage_LastPage  = 0x04,
+};
+
+struct OggPage
+{
+    u8 *start;
+    umm size;                   // NOTE(michiel): Header, lacing values and data
+    
+    u32 flags;
+    u64 granulePosition;        // NOTE(michiel): Codec defined, OGG_NO_GRANULE if no packet ends on this page
+    u32 serial;
+    u32 sequence;
+    
+    u32 segmentCount;
+    u8 *lacing;
+    u8 *data;
+};
+
+struct OggPacketReader
+{
+    Buffer data;
+    u32 serial;
+    b32 hasSerial;              // NOTE(michiel): Pages of other logical streams are skipped once this is set
+    
+    u8 *at;                     // NOTE(michiel): Start of the next page to read
+    b32 hasPage;
+    OggPage page;
+    u32 segmentIndex;
+    u8 *segmentAt;
+    
+    u8 *packetBuffer;           // NOTE(michiel): Packets spanning pages are collected here
+    umm packetCapacity;
+    umm packetSize;
+    b32 collecting;
+    MemoryAllocator *allocator;
+    
+    u64 skippedBytes;           // NOTE(michiel): Bytes between pages (damage or other streams)
+    u32 badPages;
+    u32 lostPackets;            // NOTE(michiel): Partial packets that were dropped because of a bad or missing page
+    
+    u32 crcTable[8][256];
+};
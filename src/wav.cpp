@@ -1,120 +1,260 @@
 // NOTE(michiel): See: http://www-mmsp.ece.mcgill.ca/Documents/AudioFormats/WAVE/WAVE.html
 
-internal WavStreamer
-wav_open_stream(String filename)
+//
+// NOTE(michiel): Containers
+//
+
+// NOTE(michiel): Wave64 GUIDs, chunks that RIFF also has are their RIFF id followed by the same 12 bytes
+global u8 gW64RiffGuid[16] = {'r', 'i', 'f', 'f', 0x2E, 0x91, 0xCF, 0x11, 0xA5, 0xD6, 0x28, 0xDB, 0x04, 0xC1, 0x00, 0x00};
+global u8 gW64GuidTail[12] = {0xF3, 0xAC, 0xD3, 0x11, 0x8C, 0xD1, 0x00, 0xC0, 0x4F, 0x8E, 0xDB, 0x8A};
+
+// NOTE(michiel): The subFormat of WAVE_FORMAT_EXTENSIBLE is the old format code followed by these 14 bytes
+global u8 gWavSubFormatGuidTail[14] = {0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71};
+
+// NOTE(michiel): Speaker masks for 1 to 8 channels: mono, stereo, 3.0, quad, 5.0, 5.1, 6.1 and 7.1
+global u32 gWavDefaultSpeakerMasks[9] = {0, 0x004, 0x003, 0x007, 0x033, 0x037, 0x03F, 0x70F, 0x63F};
+
+#define WAV_PROBE_SIZE (sizeof(RiffHeader) + sizeof(WavDs64))
+
+internal b32
+wav_parse_layout(u8 *data, umm size, WavLayout *layout)
+{
+    // NOTE(michiel): data is the start of the file, WAV_PROBE_SIZE bytes of it unless the file is smaller
+    b32 result = false;
+    *layout = {};
+    
+    RiffHeader *header = (RiffHeader *)data;
+    if ((size >= sizeof(RiffHeader)) && (header->magic == MAKE_MAGIC('R', 'I', 'F', 'F')))
+    {
+        layout->container = WavContainer_Riff;
+        layout->headerSize = sizeof(RiffHeader);
+        layout->chunkHeaderSize = sizeof(RiffChunk);
+        layout->fileSize = (u64)header->size + sizeof(RiffChunk);
+        result = header->fileType == MAKE_MAGIC('W', 'A', 'V', 'E');
+    }
+    else if ((size >= WAV_PROBE_SIZE) &&
+             ((header->magic == MAKE_MAGIC('R', 'F', '6', '4')) || (header->magic == MAKE_MAGIC('B', 'W', '6', '4'))))
+    {
+        WavDs64 *ds64 = (WavDs64 *)(data + sizeof(RiffHeader));
+        layout->container = (header->magic == MAKE_MAGIC('B', 'W', '6', '4')) ? WavContainer_BW64 : WavContainer_RF64;
+        layout->headerSize = sizeof(RiffHeader) + sizeof(RiffChunk) + (((u64)ds64->chunkSize + 1) & ~1);
+        layout->chunkHeaderSize = sizeof(RiffChunk);
+        layout->fileSize = ds64->riffSize + sizeof(RiffChunk);
+        layout->dataSize = ds64->dataSize;
+        result = ((header->fileType == MAKE_MAGIC('W', 'A', 'V', 'E')) &&
+                  (ds64->magic == MAKE_MAGIC('d', 's', '6', '4')) &&
+                  (ds64->chunkSize >= (sizeof(WavDs64) - sizeof(RiffChunk))));
+    }
+    else if ((size >= (sizeof(W64Chunk) + 16)) && (memcmp(data, gW64RiffGuid, 16) == 0))
+    {
+        W64Chunk *riff = (W64Chunk *)data;
+        u8 *waveGuid = data + sizeof(W64Chunk);
+        layout->container = WavContainer_W64;
+        layout->headerSize = sizeof(W64Chunk) + 16;
+        layout->chunkHeaderSize = sizeof(W64Chunk);
+        layout->fileSize = riff->size;
+        result = ((*(u32 *)waveGuid == MAKE_MAGIC('w', 'a', 'v', 'e')) &&
+                  (memcmp(waveGuid + 4, gW64GuidTail, sizeof(gW64GuidTail)) == 0));
+    }
+    
+    return result;
+}
+
+internal b32
+wav_parse_chunk(WavLayout *layout, u8 *data, WavChunk *chunk)
+{
+    // NOTE(michiel): data is a chunk header of layout->chunkHeaderSize bytes
+    b32 result = true;
+    *chunk = {};
+    
+    if (layout->container == WavContainer_W64)
+    {
+        W64Chunk *header = (W64Chunk *)data;
+        if (memcmp(header->guid + 4, gW64GuidTail, sizeof(gW64GuidTail)) == 0)
+        {
+            chunk->magic = *(u32 *)header->guid;
+        }
+        chunk->size = header->size - sizeof(W64Chunk);
+        chunk->nextOffset = (header->size + 7) & ~7ULL;
+        result = header->size >= sizeof(W64Chunk);
+    }
+    else
+    {
+        RiffChunk *header = (RiffChunk *)data;
+        chunk->magic = header->magic;
+        chunk->size = header->size;
+        if ((layout->container != WavContainer_Riff) &&
+            (header->magic == MAKE_MAGIC('d', 'a', 't', 'a')) && (header->size == U32_MAX))
+        {
+            chunk->size = layout->dataSize;
+        }
+        chunk->nextOffset = sizeof(RiffChunk) + ((chunk->size + 1) & ~1ULL);
+    }
+    
+    return result;
+}
+
+internal void
+wav_parse_format(u8 *data, u64 size, WavSettings *settings)
 {
-    WavStreamer result = {};
+    // NOTE(michiel): data is the content of the fmt chunk, size bytes or the size of WavFormat if that is less
+    if (size >= 16)
+    {
+        WavFormat format = {};
+        format.chunkSize = (u32)minimum(size, (u64)U32_MAX);
+        memcpy((u8 *)&format + sizeof(RiffChunk), data, minimum(size, (u64)(sizeof(WavFormat) - sizeof(RiffChunk))));
+        
+        settings->channelCount = format.channelCount;
+        settings->sampleFrequency = format.sampleRate;
+        settings->sampleResolution = format.sampleSize;
+        settings->sampleFrameSize = format.blockAlign;
+        settings->format = (WavFormatType)format.formatCode;
+        if ((format.formatCode == WavFormat_Extensible) &&
+            (format.chunkSize >= (sizeof(WavFormat) - sizeof(RiffChunk))) &&
+            format.extensionCount)
+        {
+            i_expect(format.channelCount == ((format.blockAlign * 8) / format.sampleSize));
+            settings->format = (WavFormatType)*(u16 *)format.subFormat;
+            settings->speakerMask = format.speakerPosMask;
+            if (format.validSampleSize && (format.validSampleSize <= format.sampleSize))
+            {
+                // NOTE(michiel): The resolution is the valid bits, sampleFrameSize still gives the container
+                settings->sampleResolution = format.validSampleSize;
+            }
+        }
+    }
+}
+
+internal void *
+wav_prefetch_stream(void *data)
+{
+    // NOTE(michiel): The I/O thread, it reads the data chunk in whole blocks, in ring order, as long as
+    // there are free blocks. Only the first read seeks, the rest follows on.
+    WavStreamer *streamer = (WavStreamer *)data;
+    umm fileOffset = streamer->prefetchOffset;
+    umm fileEnd = (umm)streamer->dataFileOffset + streamer->dataCount;
+    api.file.set_file_position(&streamer->file, fileOffset, FileCursor_StartOfFile);
     
-    result.file = api.file.open_file(filename, FileOpen_Read);
+    u32 writeIndex = 0;
+    b32 done = false;
+    while (!done)
+    {
+        pthread_mutex_lock(&streamer->lock);
+        while ((streamer->filledCount == streamer->blockCount) && !streamer->stopping)
+        {
+            pthread_cond_wait(&streamer->blockFreed, &streamer->lock);
+        }
+        done = streamer->stopping;
+        pthread_mutex_unlock(&streamer->lock);
     
-    if (result.file.fileSize)
+        if (!done)
+        {
+            WavStreamBlock *block = streamer->blocks + writeIndex;
+            u32 readSize = (u32)minimum((umm)WAV_STREAM_BLOCK_SIZE, fileEnd - fileOffset);
+            u32 bytesRead = api.file.read_from_file(&streamer->file, readSize, block->data + WAV_STREAM_BLOCK_SLACK);
+            fileOffset += bytesRead;
+            done = (bytesRead < readSize) || (fileOffset == fileEnd);
+            
+            pthread_mutex_lock(&streamer->lock);
+            block->size = bytesRead;
+            ++streamer->filledCount;
+            streamer->readDone = done;
+            pthread_cond_signal(&streamer->blockFilled);
+            pthread_mutex_unlock(&streamer->lock);
+            
+            writeIndex = (writeIndex + 1) % streamer->blockCount;
+        }
+    }
+    
+    return 0;
+}
+
+internal b32
+wav_open_stream(WavStreamer *streamer, String filename, u32 blockCount)
+{
+    *streamer = {};
+    
+    streamer->file = api.file.open_file(filename, FileOpen_Read);
+    
+    if (streamer->file.fileSize)
     {
-        RiffHeader header = {};
-        umm fileOffset = 0;
-        umm bytesRead = api.file.read_from_file(&result.file,
-                                                sizeof(RiffHeader), &header);
+        u8 probe[WAV_PROBE_SIZE];
+        umm bytesRead = api.file.read_from_file(&streamer->file, minimum(streamer->file.fileSize, sizeof(probe)), probe);
         
-        if (bytesRead == sizeof(RiffHeader))
+        WavLayout layout;
+        if (wav_parse_layout(probe, bytesRead, &layout))
         {
-            if (header.magic == MAKE_MAGIC('R', 'I', 'F', 'F'))
+            // NOTE(michiel): Files that are still being written can have a smaller size in the header
+            if (layout.fileSize <= streamer->file.fileSize)
             {
-                fileOffset += sizeof(RiffHeader);
-                if ((header.size + sizeof(RiffChunk)) == result.file.fileSize)
+                streamer->settings.container = layout.container;
+                
+                u64 fileSize = streamer->file.fileSize;
+                u64 fileOffset = layout.headerSize;
+                b32 searching = true;
+                while (searching && ((fileOffset + layout.chunkHeaderSize) <= fileSize))
                 {
-                    if (header.fileType == MAKE_MAGIC('W', 'A', 'V', 'E'))
+                    u8 chunkHeader[sizeof(W64Chunk)];
+                    WavChunk chunk;
+                    api.file.set_file_position(&streamer->file, fileOffset, FileCursor_StartOfFile);
+                    bytesRead = api.file.read_from_file(&streamer->file, layout.chunkHeaderSize, chunkHeader);
+                    if ((bytesRead == layout.chunkHeaderSize) && wav_parse_chunk(&layout, chunkHeader, &chunk))
                     {
-                        while (fileOffset < result.file.fileSize)
+                        u64 payloadOffset = fileOffset + layout.chunkHeaderSize;
+                        switch (chunk.magic)
                         {
-                            RiffChunk chunk;
-                            bytesRead = api.file.read_from_file(&result.file,
-                                                                sizeof(RiffChunk), &chunk);
-                            if (bytesRead == sizeof(RiffChunk))
+                            case MAKE_MAGIC('f', 'm', 't', ' '):
                             {
-                                fileOffset += sizeof(RiffChunk);
-                                
-                                switch (chunk.magic)
+                                u8 formatData[sizeof(WavFormat) - sizeof(RiffChunk)];
+                                u32 bytesToRead = (u32)minimum(chunk.size, (u64)sizeof(formatData));
+                                bytesRead = api.file.read_from_file(&streamer->file, bytesToRead, formatData);
+                                if (bytesRead == bytesToRead)
                                 {
-                                    case MAKE_MAGIC('f', 'm', 't', ' '):
-                                    {
-                                        u32 bytesToRead = minimum(chunk.size, sizeof(WavFormat) - sizeof(RiffChunk));
-                                        WavFormat format = {};
-                                        format.magic = chunk.magic;
-                                        format.chunkSize = chunk.size;
-                                        bytesRead = api.file.read_from_file(&result.file,
-                                                                            bytesToRead,
-                                                                            ((u8 *)&format) + sizeof(RiffChunk));
-                                        if (bytesRead == bytesToRead)
-                                        {
-                                            result.settings.channelCount = format.channelCount;
-                                            result.settings.sampleFrequency = format.sampleRate;
-                                            result.settings.sampleResolution = format.sampleSize;
-                                            result.settings.sampleFrameSize = format.blockAlign;
-                                            result.settings.format = (WavFormatType)format.formatCode;
-                                            if ((format.chunkSize > 16) && format.extensionCount)
-                                            {
-                                                i_expect(format.channelCount == ((format.blockAlign * 8) / format.sampleSize));
-                                                result.settings.format = (WavFormatType)*(u16 *)format.subFormat;
-                                            }
-                                        }
-                                        else
-                                        {
-                                            // TODO(michiel): Failed to read all of the fmt
-                                        }
-                                        
-                                        fileOffset += bytesRead;
-                                    } break;
-                                    
-                                    case MAKE_MAGIC('d', 'a', 't', 'a'):
-                                    {
-                                        result.dataFileOffset = fileOffset;
-                                        result.dataCount = chunk.size;
-                                        result.dataOffset = fileOffset;
+                                    wav_parse_format(formatData, chunk.size, &streamer->settings);
+                                }
+                                else
+                                {
+                                    // TODO(michiel): Failed to read all of the fmt
+                                }
+                            } break;
+                                
+                            case MAKE_MAGIC('d', 'a', 't', 'a'):
+                            {
+                                streamer->dataFileOffset = payloadOffset;
+                                streamer->dataCount = minimum(chunk.size, fileSize - payloadOffset);
+                                streamer->dataOffset = payloadOffset;
                                         
-                                        if (result.settings.sampleFrequency)
-                                        {
-                                            // NOTE(michiel): Break the search loop, we have all the info
-                                            fileOffset = result.file.fileSize;
-                                        }
-                                        else
-                                        {
-                                            fileOffset += ((chunk.size + 1) & ~1);
-                                            api.file.set_file_position(&result.file, fileOffset, FileCursor_StartOfFile);
-                                        }
-                                    } break;
+                                // NOTE(michiel): Stop the search if we have all the info
+                                searching = !streamer->settings.sampleFrequency;
+                            } break;
                                     
-                                    default:
-                                    {
-                                        // TODO(michiel): Unsupported
-                                        fileOffset += chunk.size;
-                                        api.file.set_file_position(&result.file, fileOffset, FileCursor_StartOfFile);
-                                    } break;
-                                }
-                            }
-                            else
+                            default:
                             {
-                                // TODO(michiel): Can't read chunk header
-                                break;
-                            }
+                                // TODO(michiel): Unsupported
+                            } break;
                         }
+                                        
+                        if (chunk.nextOffset > (fileSize - fileOffset))
+                        {
+                            break;
+                        }
+                        fileOffset += chunk.nextOffset;
                     }
                     else
                     {
-                        // TODO(michiel): Invalid wave header
+                        // TODO(michiel): Can't read chunk header
+                        break;
                     }
                 }
-                else
-                {
-                    // TODO(michiel): Invalid file size in header
-                }
             }
             else
             {
-                // TODO(michiel): Invalid file header
+                // TODO(michiel): Invalid file size in header
             }
         }
         else
         {
-            // TODO(michiel): Can't read file header
+            // TODO(michiel): Invalid file header
         }
     }
     else
@@ -122,106 +262,221 @@ wav_open_stream(String filename)
         // TODO(michiel): Can't open file
     }
     
+    b32 result = false;
+    u32 frameSize = streamer->settings.sampleFrameSize;
+    if (streamer->settings.sampleFrequency && streamer->dataFileOffset &&
+        frameSize && (frameSize <= WAV_STREAM_BLOCK_SLACK))
+    {
+        if (blockCount == 0)
+        {
+            blockCount = WAV_STREAM_DEFAULT_BLOCKS;
+        }
+        streamer->blockCount = clamp(2u, blockCount, (u32)WAV_STREAM_MAX_BLOCKS);
+        streamer->memory = gMemoryApi->allocate_memory(streamer->blockCount * (WAV_STREAM_BLOCK_SLACK + WAV_STREAM_BLOCK_SIZE),
+                                                       default_memory_alloc());
+        for (u32 blockIdx = 0; blockIdx < streamer->blockCount; ++blockIdx)
+        {
+            streamer->blocks[blockIdx].data = streamer->memory->base + blockIdx * (WAV_STREAM_BLOCK_SLACK + WAV_STREAM_BLOCK_SIZE);
+        }
+        
+        streamer->prefetchOffset = streamer->dataFileOffset & ~(WAV_STREAM_BLOCK_SLACK - 1);
+        streamer->viewOffset = WAV_STREAM_BLOCK_SLACK + streamer->dataFileOffset - streamer->prefetchOffset;
+        pthread_mutex_init(&streamer->lock, 0);
+        pthread_cond_init(&streamer->blockFilled, 0);
+        pthread_cond_init(&streamer->blockFreed, 0);
+        result = pthread_create(&streamer->thread, 0, wav_prefetch_stream, streamer) == 0;
+        if (!result)
+        {
+            pthread_cond_destroy(&streamer->blockFreed);
+            pthread_cond_destroy(&streamer->blockFilled);
+            pthread_mutex_destroy(&streamer->lock);
+            gMemoryApi->deallocate_memory(streamer->memory);
+            streamer->memory = 0;
+            streamer->blockCount = 0;
+        }
+    }
+    
+    if (!result && streamer->file.fileSize)
+    {
+        api.file.close_file(&streamer->file);
+    }
+    
     return result;
 }
 
-internal b32
-wav_read_stream(WavStreamer *streamer, Buffer *output)
+internal Buffer
+wav_read_stream(WavStreamer *streamer, u32 maxSize)
 {
-    i_expect(output->size);
-    i_expect(output->data);
+    Buffer result = {};
     
-    b32 result = false;
+    u32 frameSize = streamer->settings.sampleFrameSize;
+    i_expect(maxSize >= frameSize);
     
-    u32 readSize = output->size;
-    if ((streamer->dataOffset + readSize) > (streamer->dataFileOffset + streamer->dataCount))
+    if (streamer->blockCount)
     {
-        readSize = streamer->dataFileOffset + streamer->dataCount - streamer->dataOffset;
+        pthread_mutex_lock(&streamer->lock);
+        while (true)
+        {
+            while (!streamer->filledCount && !streamer->readDone)
+            {
+                pthread_cond_wait(&streamer->blockFilled, &streamer->lock);
+            }
+            if (!streamer->filledCount)
+            {
+                break;
+            }
+            
+            WavStreamBlock *block = streamer->blocks + streamer->readIndex;
+            u32 blockEnd = WAV_STREAM_BLOCK_SLACK + block->size;
+            u32 remaining = (blockEnd > streamer->viewOffset) ? blockEnd - streamer->viewOffset : 0;
+            u32 viewSize = (minimum(remaining, maxSize) / frameSize) * frameSize;
+            if (viewSize)
+            {
+                result.size = viewSize;
+                result.data = block->data + streamer->viewOffset;
+                streamer->viewOffset += viewSize;
+                streamer->dataOffset += viewSize;
+                break;
+            }
+            
+            // NOTE(michiel): The block is used up, hand it back. A frame split over two blocks is put back
+            // together in the slack in front of the next one, that is the only copy.
+            while ((streamer->filledCount < 2) && !streamer->readDone)
+            {
+                pthread_cond_wait(&streamer->blockFilled, &streamer->lock);
+            }
+            u32 nextIndex = (streamer->readIndex + 1) % streamer->blockCount;
+            u32 nextOffset = WAV_STREAM_BLOCK_SLACK;
+            if (streamer->filledCount >= 2)
+            {
+                nextOffset -= remaining;
+                memcpy(streamer->blocks[nextIndex].data + nextOffset, block->data + streamer->viewOffset, remaining);
+            }
+            streamer->readIndex = nextIndex;
+            streamer->viewOffset = nextOffset;
+            --streamer->filledCount;
+            pthread_cond_signal(&streamer->blockFreed);
+        }
+        pthread_mutex_unlock(&streamer->lock);
     }
     
-    if (readSize)
+    return result;
+}
+
+internal void
+wav_close_stream(WavStreamer *streamer)
+{
+    if (streamer->blockCount)
     {
-        api.file.set_file_position(&streamer->file, streamer->dataOffset, FileCursor_StartOfFile);
-        u32 bytesRead = api.file.read_from_file(&streamer->file, readSize, output->data);
-        if (bytesRead == readSize)
-        {
-            streamer->dataOffset += bytesRead;
-            result = true;
-        }
-        else
-        {
-            // TODO(michiel): Should we close the file here?
-            //api.file.close_file(&streamer->file);
-            readSize = 0;
-        }
+        pthread_mutex_lock(&streamer->lock);
+        streamer->stopping = true;
+        pthread_cond_signal(&streamer->blockFreed);
+        pthread_mutex_unlock(&streamer->lock);
+        pthread_join(streamer->thread, 0);
+        
+        pthread_cond_destroy(&streamer->blockFreed);
+        pthread_cond_destroy(&streamer->blockFilled);
+        pthread_mutex_destroy(&streamer->lock);
+        gMemoryApi->deallocate_memory(streamer->memory);
+        api.file.close_file(&streamer->file);
     }
-    else
+    *streamer = {};
+}
+
+internal void
+wav_advise_read_ahead(WavReader *reader)
+{
+    // NOTE(michiel): Asks the kernel for the next window of the mapping once reading gets halfway into the
+    // last one, so the pages are in by the time they are read. The start is rounded down to the largest
+    // page size around, madvise wants it page aligned.
+    umm readAt = reader->dataOffset + reader->readOffset;
+    umm end = minimum((umm)reader->dataOffset + reader->dataCount, reader->rawData.size);
+    if (((readAt + WAV_READ_AHEAD_SIZE / 2) > reader->readAheadOffset) && (reader->readAheadOffset < end))
     {
-        // TODO(michiel): Or should we maybe close the file here?
-        //api.file.close_file(&streamer->file);
+        umm adviseStart = reader->readAheadOffset & ~(umm)(WAV_MAP_PAGE_SIZE - 1);
+        umm adviseEnd = minimum(readAt + WAV_READ_AHEAD_SIZE, end);
+        madvise(reader->rawData.data + adviseStart, adviseEnd - adviseStart, MADV_WILLNEED);
+        reader->readAheadOffset = adviseEnd;
     }
-    
-    output->size = readSize;
-    
-    return result;
 }
 
 internal WavReader
-wav_load_file(MemoryAllocator *allocator, String filename)
+wav_load_file(String filename)
 {
+    // NOTE(michiel): The file is mapped instead of read, so this takes the same time for any file size and
+    // only the pages that get touched use memory. The views of wav_read_chunk point into the mapping.
     WavReader result = {};
     
-    result.rawData = api.file.read_entire_file(allocator, filename);
+    char fileNameZ[4096];
+    snprintf(fileNameZ, sizeof(fileNameZ), "%.*s", STR_FMT(filename));
+    s32 fd = open(fileNameZ, O_RDONLY);
+    if (fd >= 0)
+    {
+        struct stat fileStat;
+        if ((fstat(fd, &fileStat) == 0) && ((umm)fileStat.st_size >= sizeof(RiffHeader)))
+        {
+            void *mapping = mmap(0, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (mapping != MAP_FAILED)
+            {
+                madvise(mapping, fileStat.st_size, MADV_SEQUENTIAL);
+                result.rawData.size = fileStat.st_size;
+                result.rawData.data = (u8 *)mapping;
+            }
+        }
+        // NOTE(michiel): The mapping keeps its own reference to the file
+        close(fd);
+    }
+    
     if (result.rawData.size)
     {
-        u8 *src = result.rawData.data;
-        RiffHeader *header = (RiffHeader *)src;
-        src += sizeof(RiffHeader);
+        u8 *data = result.rawData.data;
+        u64 size = result.rawData.size;
         
-        if ((header->magic == MAKE_MAGIC('R', 'I', 'F', 'F')) &&
-            (header->fileType == MAKE_MAGIC('W', 'A', 'V', 'E')))
+        WavLayout layout;
+        if (wav_parse_layout(data, size, &layout))
         {
-            while (src < (result.rawData.data + result.rawData.size))
+            result.settings.container = layout.container;
+            
+            // NOTE(michiel): Reading past the end of the mapping faults, so every chunk is checked against it
+            u64 offset = layout.headerSize;
+            while ((offset + layout.chunkHeaderSize) <= size)
             {
-                RiffChunk *chunk = (RiffChunk *)src;
-                src += sizeof(RiffChunk);
+                WavChunk chunk;
+                if (!wav_parse_chunk(&layout, data + offset, &chunk))
+                {
+                    break;
+                }
                 
-                switch (chunk->magic)
+                u64 payloadOffset = offset + layout.chunkHeaderSize;
+                u64 available = minimum(chunk.size, size - payloadOffset);
+                switch (chunk.magic)
                 {
                     case MAKE_MAGIC('f', 'm', 't', ' '):
                     {
-                        WavFormat *format = (WavFormat *)chunk;
-                        src += format->chunkSize;
-                        
-                        result.settings.channelCount = format->channelCount;
-                        result.settings.sampleFrequency = format->sampleRate;
-                        result.settings.sampleResolution = format->sampleSize;
-                        result.settings.sampleFrameSize = format->blockAlign;
-                        result.settings.format = (WavFormatType)format->formatCode;
-                        if ((format->formatCode == WavFormat_Extensible) &&
-                            (format->chunkSize > 16) &&
-                            format->extensionCount)
-                        {
-                            i_expect(format->channelCount == ((format->blockAlign * 8) / format->sampleSize));
-                            result.settings.format = (WavFormatType)*(u16 *)format->subFormat;
-                        }
+                        wav_parse_format(data + payloadOffset, available, &result.settings);
                     } break;
                     
                     case MAKE_MAGIC('d', 'a', 't', 'a'):
                     {
-                        result.dataOffset = (src - result.rawData.data);
-                        result.dataCount = chunk->size;
+                        // NOTE(michiel): Truncated recordings keep what is there
+                        result.dataOffset = payloadOffset;
+                        result.dataCount = available;
                         result.readOffset = 0;
-                        src += (chunk->size + 1) & ~1;
                     } break;
                     
-                    default:
-                    {
-                        src += chunk->size;
-                    } break;
+                    default: {} break;
                 }
+                
+                if (chunk.nextOffset > (size - offset))
+                {
+                    break;
+                }
+                offset += chunk.nextOffset;
             }
         }
+        
+        result.readAheadOffset = result.dataOffset;
+        wav_advise_read_ahead(&result);
     }
     
     return result;
@@ -234,7 +489,7 @@ wav_read_chunk(WavReader *reader, u32 byteCount)
     
     if ((reader->readOffset + byteCount) > reader->dataCount)
     {
-        byteCount = reader->dataCount - reader->readOffset;
+        byteCount = (u32)(reader->dataCount - reader->readOffset);
     }
     
     if (byteCount)
@@ -242,53 +497,299 @@ wav_read_chunk(WavReader *reader, u32 byteCount)
         result.size = byteCount;
         result.data = reader->rawData.data + reader->dataOffset + reader->readOffset;
         reader->readOffset += byteCount;
+        wav_advise_read_ahead(reader);
     }
     
     return result;
 }
 
-internal b32
-wav_write_file(String filename, WavSettings *settings, Buffer wavData)
+internal void
+wav_close_file(WavReader *reader)
+{
+    if (reader->rawData.data)
+    {
+        munmap(reader->rawData.data, reader->rawData.size);
+    }
+    *reader = {};
+}
+
+internal u32
+wav_put_header(WavSettings *settings, u64 dataSize, b32 reserveDs64, u8 *header)
 {
-    /* TODO(michiel): The WAVE_FORMAT_EXTENSIBLE format should be used whenever:
+    WavFormat format = {};
+    format.formatCode = safe_truncate_to_u16(settings->format);
+    format.channelCount = safe_truncate_to_u16(settings->channelCount);
+    format.sampleRate = settings->sampleFrequency;
+    format.dataRate = settings->sampleFrequency * settings->sampleFrameSize; // TODO(michiel): Needed?
+    format.blockAlign = safe_truncate_to_u16(settings->sampleFrameSize);
+    format.sampleSize = safe_truncate_to_u16(settings->sampleResolution);
+    u32 formatSize = offset_of(WavFormat, extensionCount) - sizeof(RiffChunk);
+    
+    /* NOTE(michiel): The WAVE_FORMAT_EXTENSIBLE format is used whenever:
     
     PCM data has more than 16 bits/sample.
         The number of channels is more than 2.
         The actual number of bits/sample is not equal to the container size.
         The mapping from channels to speakers needs to be specified.
 */
+    u32 containerSize = settings->channelCount ? (8 * settings->sampleFrameSize) / settings->channelCount : 0;
+    if (((settings->format == WavFormat_PCM) && (settings->sampleResolution > 16)) ||
+        (settings->channelCount > 2) ||
+        (settings->sampleResolution != containerSize) ||
+        settings->speakerMask)
+    {
+        format.formatCode = WavFormat_Extensible;
+        format.sampleSize = safe_truncate_to_u16(containerSize);
+        format.extensionCount = 22;
+        format.validSampleSize = safe_truncate_to_u16(settings->sampleResolution);
+        format.speakerPosMask = settings->speakerMask;
+        if (!format.speakerPosMask && (settings->channelCount < array_count(gWavDefaultSpeakerMasks)))
+        {
+            format.speakerPosMask = gWavDefaultSpeakerMasks[settings->channelCount];
+        }
+        *(u16 *)format.subFormat = safe_truncate_to_u16(settings->format);
+        memcpy(format.subFormat + 2, gWavSubFormatGuidTail, sizeof(gWavSubFormatGuidTail));
+        formatSize = sizeof(WavFormat) - sizeof(RiffChunk);
+    }
+    
+    u8 *at = header;
+    if (settings->container == WavContainer_W64)
+    {
+        u64 formatChunkSize = sizeof(W64Chunk) + formatSize;
+        
+        W64Chunk *riff = (W64Chunk *)at;
+        memcpy(riff->guid, gW64RiffGuid, sizeof(gW64RiffGuid));
+        riff->size = sizeof(W64Chunk) + 16 + ((formatChunkSize + 7) & ~7ULL) + sizeof(W64Chunk) + dataSize;
+        at += sizeof(W64Chunk);
+        *(u32 *)at = MAKE_MAGIC('w', 'a', 'v', 'e');
+        memcpy(at + 4, gW64GuidTail, sizeof(gW64GuidTail));
+        at += 16;
+        
+        W64Chunk *formatChunk = (W64Chunk *)at;
+        *(u32 *)formatChunk->guid = MAKE_MAGIC('f', 'm', 't', ' ');
+        memcpy(formatChunk->guid + 4, gW64GuidTail, sizeof(gW64GuidTail));
+        formatChunk->size = formatChunkSize;
+        at += sizeof(W64Chunk);
+        memcpy(at, (u8 *)&format + sizeof(RiffChunk), formatSize);
+        at += formatSize;
+        while ((at - header) & 7)
+        {
+            *at++ = 0;
+        }
+        
+        W64Chunk *dataChunk = (W64Chunk *)at;
+        *(u32 *)dataChunk->guid = MAKE_MAGIC('d', 'a', 't', 'a');
+        memcpy(dataChunk->guid + 4, gW64GuidTail, sizeof(gW64GuidTail));
+        dataChunk->size = sizeof(W64Chunk) + dataSize;
+        at += sizeof(W64Chunk);
+    }
+    else
+    {
+        // NOTE(michiel): RF64 and BW64 have the ds64 chunk first. A RIFF file that may need it later has a JUNK
+        // chunk of the same size there instead.
+        b32 hasDs64 = reserveDs64 || (settings->container != WavContainer_Riff);
+        u64 riffSize = 4 + sizeof(RiffChunk) + formatSize + sizeof(RiffChunk) + dataSize;
+        if (hasDs64)
+        {
+            riffSize += sizeof(WavDs64);
+        }
+        
+        WavContainer container = settings->container;
+        if ((container == WavContainer_Riff) && (riffSize > U32_MAX))
+        {
+            container = WavContainer_RF64;
+            if (!hasDs64)
+            {
+                hasDs64 = true;
+                riffSize += sizeof(WavDs64);
+            }
+        }
+        b32 large = (container != WavContainer_Riff);
+        
+        RiffHeader *riff = (RiffHeader *)at;
+        riff->magic = MAKE_MAGIC('R', 'I', 'F', 'F');
+        if (large)
+        {
+            riff->magic = (container == WavContainer_BW64) ? MAKE_MAGIC('B', 'W', '6', '4') : MAKE_MAGIC('R', 'F', '6', '4');
+        }
+        riff->size = large ? U32_MAX : (u32)riffSize;
+        riff->fileType = MAKE_MAGIC('W', 'A', 'V', 'E');
+        at += sizeof(RiffHeader);
+        
+        if (hasDs64)
+        {
+            WavDs64 *ds64 = (WavDs64 *)at;
+            *ds64 = {};
+            ds64->magic = large ? MAKE_MAGIC('d', 's', '6', '4') : MAKE_MAGIC('J', 'U', 'N', 'K');
+            ds64->chunkSize = sizeof(WavDs64) - sizeof(RiffChunk);
+            if (large)
+            {
+                ds64->riffSize = riffSize;
+                ds64->dataSize = dataSize;
+                ds64->sampleCount = settings->sampleFrameSize ? dataSize / settings->sampleFrameSize : 0;
+            }
+            at += sizeof(WavDs64);
+        }
+        
+        format.magic = MAKE_MAGIC('f', 'm', 't', ' ');
+        format.chunkSize = formatSize;
+        memcpy(at, &format, sizeof(RiffChunk) + formatSize);
+        at += sizeof(RiffChunk) + formatSize;
+        
+        RiffChunk *dataChunk = (RiffChunk *)at;
+        dataChunk->magic = MAKE_MAGIC('d', 'a', 't', 'a');
+        dataChunk->size = large ? U32_MAX : (u32)dataSize;
+        at += sizeof(RiffChunk);
+    }
+    
+    i_expect((at - header) <= WAV_MAX_HEADER_SIZE);
+    return (u32)(at - header);
+}
+
+internal b32
+wav_write_all(s32 fd, u64 fileOffset, umm size, u8 *data)
+{
+    b32 result = true;
+    while (result && size)
+    {
+        ssize_t written = pwrite(fd, data, size, fileOffset);
+        result = written > 0;
+        if (result)
+        {
+            fileOffset += written;
+            data += written;
+            size -= written;
+        }
+    }
+    return result;
+}
+
+internal b32
+wav_open_writer(WavWriter *writer, String filename, WavSettings *settings, u64 frameCount)
+{
+    *writer = {};
+    writer->settings = *settings;
     
-    umm totalSize = (sizeof(RiffHeader) +
-                     offset_of(WavFormat, extensionCount) +
-                     sizeof(RiffChunk) +
-                     wavData.size);
+    char fileNameZ[4096];
+    snprintf(fileNameZ, sizeof(fileNameZ), "%.*s", STR_FMT(filename));
+    writer->fd = open(fileNameZ, O_WRONLY | O_CREAT | O_TRUNC, 0644);
     
-    RiffHeader header;
-    header.magic = MAKE_MAGIC('R', 'I', 'F', 'F');
-    header.size = totalSize;
-    header.fileType = MAKE_MAGIC('W', 'A', 'V', 'E');
+    b32 result = false;
+    if (writer->fd >= 0)
+    {
+        writer->memory = gMemoryApi->allocate_memory(WAV_WRITE_BLOCK_SIZE, default_memory_alloc());
+        
+        // NOTE(michiel): The header starts out in the buffer, so the block writes stay aligned in the file
+        u64 dataSize = frameCount * settings->sampleFrameSize;
+        writer->reserveDs64 = (frameCount == 0);
+        writer->headerSize = wav_put_header(&writer->settings, dataSize, writer->reserveDs64, writer->memory->base);
+        writer->bufferCount = writer->headerSize;
+        
+        if (frameCount)
+        {
+            // NOTE(michiel): Only a hint, file systems without fallocate just grow the file as it is written
+            fallocate(writer->fd, 0, 0, writer->headerSize + dataSize);
+        }
+        result = true;
+    }
     
-    WavFormat format;
-    format.magic = MAKE_MAGIC('f', 'm', 't', ' ');
-    format.chunkSize = offset_of(WavFormat, extensionCount) - sizeof(RiffChunk); //offset_of(WavFormat, extensionCount);
-    format.formatCode = settings->format;
-    format.channelCount = safe_truncate_to_u16(settings->channelCount);
-    format.sampleRate = settings->sampleFrequency;
-    format.dataRate = settings->sampleFrequency * settings->sampleFrameSize; // TODO(michiel): Needed?
-    format.blockAlign = safe_truncate_to_u16(settings->sampleFrameSize);
-    format.sampleSize = safe_truncate_to_u16(settings->sampleResolution);
+    return result;
+}
+
+internal void
+wav_flush_writer(WavWriter *writer)
+{
+    if (!wav_write_all(writer->fd, writer->fileOffset, writer->bufferCount, writer->memory->base))
+    {
+        writer->failed = true;
+    }
+    writer->fileOffset += writer->bufferCount;
+    writer->bufferCount = 0;
+}
+
+internal void
+wav_write_frames(WavWriter *writer, u64 frameCount, void *frames)
+{
+    u8 *source = (u8 *)frames;
+    u64 byteCount = frameCount * writer->settings.sampleFrameSize;
+    writer->dataCount += byteCount;
     
-    RiffChunk dataChunk;
-    dataChunk.magic = MAKE_MAGIC('d', 'a', 't', 'a');
-    dataChunk.size = wavData.size;
-    ApiFile writeFile = api.file.open_file(filename, FileOpen_Write);
-    api.file.write_to_file(&writeFile, sizeof(RiffHeader), &header);
-    api.file.write_to_file(&writeFile, offset_of(WavFormat, extensionCount), &format);
-    api.file.write_to_file(&writeFile, sizeof(RiffChunk), &dataChunk);
-    api.file.write_to_file(&writeFile, wavData.size, wavData.data);
-    api.file.close_file(&writeFile);
-    
-    return no_file_errors(&writeFile);
+    while (byteCount && !writer->failed)
+    {
+        if ((writer->bufferCount == 0) && (byteCount >= WAV_WRITE_BLOCK_SIZE))
+        {
+            // NOTE(michiel): Whole blocks skip the buffer
+            u64 direct = byteCount & ~((u64)WAV_WRITE_BLOCK_SIZE - 1);
+            if (!wav_write_all(writer->fd, writer->fileOffset, direct, source))
+            {
+                writer->failed = true;
+            }
+            writer->fileOffset += direct;
+            source += direct;
+            byteCount -= direct;
+        }
+        else
+        {
+            u32 copyCount = (u32)minimum(byteCount, (u64)(WAV_WRITE_BLOCK_SIZE - writer->bufferCount));
+            memcpy(writer->memory->base + writer->bufferCount, source, copyCount);
+            writer->bufferCount += copyCount;
+            source += copyCount;
+            byteCount -= copyCount;
+            
+            if (writer->bufferCount == WAV_WRITE_BLOCK_SIZE)
+            {
+                wav_flush_writer(writer);
+            }
+        }
+    }
+}
+
+internal b32
+wav_close_writer(WavWriter *writer)
+{
+    b32 result = false;
+    if (writer->fd >= 0)
+    {
+        if (!writer->failed)
+        {
+            wav_flush_writer(writer);
+        }
+        
+        // NOTE(michiel): A count given at open that was off by enough to change the header can't be patched
+        u8 header[WAV_MAX_HEADER_SIZE];
+        u32 headerSize = wav_put_header(&writer->settings, writer->dataCount, writer->reserveDs64, header);
+        if (headerSize != writer->headerSize)
+        {
+            writer->failed = true;
+        }
+        
+        if (!writer->failed)
+        {
+            // NOTE(michiel): Drops what fallocate reserved beyond the data that was written
+            writer->failed = ((ftruncate(writer->fd, writer->headerSize + writer->dataCount) != 0) ||
+                              !wav_write_all(writer->fd, 0, headerSize, header));
+        }
+        
+        result = (close(writer->fd) == 0) && !writer->failed;
+        gMemoryApi->deallocate_memory(writer->memory);
+    }
+    *writer = {};
+    writer->fd = -1;
+    
+    return result;
+}
+
+internal b32
+wav_write_file(String filename, WavSettings *settings, Buffer wavData)
+{
+    WavWriter writer;
+    b32 result = false;
+    if (settings->sampleFrameSize && wav_open_writer(&writer, filename, settings, wavData.size / settings->sampleFrameSize))
+    {
+        wav_write_frames(&writer, wavData.size / settings->sampleFrameSize, wavData.data);
+        result = wav_close_writer(&writer);
+    }
+    return result;
 }
 
 internal void
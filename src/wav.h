@@ -8,6 +8,14 @@ enum WavFormatType
     WavFormat_Extensible = 0xFFFE, // NOTE(michiel): Defined in subFormat
 };
 
+enum WavContainer
+{
+    WavContainer_Riff,  // NOTE(michiel): Plain RIFF, written as RF64 when the sizes don't fit in 32 bits
+    WavContainer_RF64,  // NOTE(michiel): EBU Tech 3306, the 64 bit sizes are in a ds64 chunk
+    WavContainer_BW64,  // NOTE(michiel): ITU-R BS.2088, the same layout as RF64
+    WavContainer_W64,   // NOTE(michiel): Sony Wave64, GUID chunk ids and 64 bit sizes everywhere
+};
+
 #pragma pack(push, 1)
 struct RiffChunk
 {
@@ -40,6 +48,24 @@ struct WavFormat
     u8 subFormat[16];
 };
 
+// NOTE(michiel): First chunk of RF64 and BW64 files, the RIFF and data sizes are then 0xFFFFFFFF
+struct WavDs64
+{
+    u32 magic;
+    u32 chunkSize;    // NOTE(michiel): 28 + 12 * tableLength
+    u64 riffSize;
+    u64 dataSize;
+    u64 sampleCount;  // NOTE(michiel): Of the fact chunk
+    u32 tableLength;  // NOTE(michiel): Sizes of other chunks over 4 GB, not used here
+};
+
+// NOTE(michiel): Wave64 chunk header, the known chunks have the RIFF id in the first 4 bytes of the GUID
+struct W64Chunk
+{
+    u8 guid[16];
+    u64 size;         // NOTE(michiel): Including this header, the next chunk starts 8 byte aligned
+};
+
 struct WavFact
 {
     u32 magic;
@@ -64,39 +90,124 @@ struct WavSettings
     u32 sampleResolution;
     u32 sampleFrameSize;  // NOTE(michiel): Size of a single sample frame (so 1 sample for all channels)
     WavFormatType format;
+    WavContainer container;
+    u32 speakerMask;      // NOTE(michiel): Channel to speaker mapping, 0 writes the default one for the channel count
+};
+
+// NOTE(michiel): Where the chunks are in a file, after its container header
+struct WavLayout
+{
+    WavContainer container;
+    u64 headerSize;       // NOTE(michiel): RIFF header, and the ds64 chunk for RF64 and BW64
+    u32 chunkHeaderSize;  // NOTE(michiel): 8, or 24 for Wave64
+    u64 fileSize;         // NOTE(michiel): As the header has it
+    u64 dataSize;         // NOTE(michiel): From the ds64 chunk
+};
+
+struct WavChunk
+{
+    u32 magic;            // NOTE(michiel): 0 for Wave64 chunks that aren't RIFF chunks
+    u64 size;             // NOTE(michiel): Without the chunk header
+    u64 nextOffset;       // NOTE(michiel): From the start of the chunk header
+};
+
+#define WAV_MAX_HEADER_SIZE 128  // NOTE(michiel): Wave64 with a 40 byte fmt chunk
+
+#define WAV_STREAM_BLOCK_SIZE     megabytes(1)
+#define WAV_STREAM_BLOCK_SLACK    kilobytes(4)  // NOTE(michiel): Room in front of a block for the partial frame at the end of the one before
+#define WAV_STREAM_MAX_BLOCKS     16
+#define WAV_STREAM_DEFAULT_BLOCKS 4
+
+struct WavStreamBlock
+{
+    u8 *data;           // NOTE(michiel): WAV_STREAM_BLOCK_SLACK bytes, then the WAV_STREAM_BLOCK_SIZE read in
+    u32 size;           // NOTE(michiel): Bytes read in after the slack
 };
 
 struct WavStreamer
 {
-    ApiFile file;
+    ApiFile file;       // NOTE(michiel): Only used by the I/O thread once the stream is open
     
     WavSettings settings;
     
-    u32 dataFileOffset; // NOTE(michiel): Start of data chunk in file
-    u32 dataCount;      // NOTE(michiel): Number of data bytes total
-    u32 dataOffset;     // NOTE(michiel): Current offset in file, updated while reading
+    u64 dataFileOffset; // NOTE(michiel): Start of data chunk in file
+    u64 dataCount;      // NOTE(michiel): Number of data bytes total
+    u64 dataOffset;     // NOTE(michiel): Current offset in file, updated while reading
+    
+    // NOTE(michiel): Ring of blocks the I/O thread reads ahead into. Reads start at a page boundary, so the
+    // first block begins with the end of the header.
+    PlatformMemoryBlock *memory;
+    WavStreamBlock blocks[WAV_STREAM_MAX_BLOCKS];
+    u32 blockCount;
+    u64 prefetchOffset; // NOTE(michiel): File offset of the first block
+    u32 readIndex;      // NOTE(michiel): Block the views come from
+    u32 viewOffset;     // NOTE(michiel): Next byte of the read block to hand out
+    
+    pthread_mutex_t lock;
+    pthread_cond_t blockFilled;
+    pthread_cond_t blockFreed;
+    pthread_t thread;
+    u32 filledCount;    // NOTE(michiel): Blocks read in and not handed back yet, starting at readIndex
+    b32 readDone;       // NOTE(michiel): The I/O thread got to the end of the data, or could not read further
+    b32 stopping;
 };
 
+#define WAV_READ_AHEAD_SIZE megabytes(8)
+#define WAV_MAP_PAGE_SIZE   kilobytes(64)  // NOTE(michiel): A multiple of every page size madvise could want
+
 struct WavReader
 {
-    Buffer rawData;
+    Buffer rawData;     // NOTE(michiel): Read only mapping of the whole file
+    WavSettings settings;
+    
+    umm dataOffset; // NOTE(michiel): Start of data in rawData
+    u64 dataCount;  // NOTE(michiel): Number of data bytes total
+    u64 readOffset; // NOTE(michiel): Current offset in rawData starting at dataOffset
+    umm readAheadOffset; // NOTE(michiel): End of the part of rawData that was advised to be read in
+};
+
+#define WAV_WRITE_BLOCK_SIZE megabytes(1)
+
+struct WavWriter
+{
+    s32 fd;
     WavSettings settings;
+    b32 reserveDs64;    // NOTE(michiel): The header was written without knowing the data size
+    u32 headerSize;
     
-    u32 dataOffset; // NOTE(michiel): Start of data in rawData
-    u32 dataCount;  // NOTE(michiel): Number of data bytes total
-    u32 readOffset; // NOTE(michiel): Current offset in rawData starting at dataOffset
+    PlatformMemoryBlock *memory; // NOTE(michiel): WAV_WRITE_BLOCK_SIZE bytes of the file, from fileOffset on
+    u32 bufferCount;
+    u64 fileOffset;     // NOTE(michiel): Always a multiple of WAV_WRITE_BLOCK_SIZE
+    u64 dataCount;
+    b32 failed;
 };
 
-// NOTE(michiel): Opens a wav file for streaming input
-internal WavStreamer wav_open_stream(String filename);
+// NOTE(michiel): Opens a wav file for streaming input, a background thread keeps up to `blockCount` blocks
+// read ahead (0 gives WAV_STREAM_DEFAULT_BLOCKS). Returns `true` when the stream is running.
+internal b32 wav_open_stream(WavStreamer *streamer, String filename, u32 blockCount);
 // NOTE(michiel): Stream from wav file
-// `output` should be set to the max read size and a valid data pointer.
-// Returns `true` on successful read.
-internal b32 wav_read_stream(WavStreamer *streamer, Buffer *output);
+// Returns a view of whole sample frames, at most `maxSize` bytes, valid until the next call. Views don't
+// cross blocks, so they can be shorter than asked. An empty view is the end of the data.
+internal Buffer wav_read_stream(WavStreamer *streamer, u32 maxSize);
+internal void wav_close_stream(WavStreamer *streamer);
 
-internal WavReader wav_load_file(MemoryAllocator *allocator, String filename);
+// NOTE(michiel): Maps a wav file, the returned chunks are views into the mapping and stay valid until
+// wav_close_file.
+internal WavReader wav_load_file(String filename);
 internal Buffer wav_read_chunk(WavReader *reader, u32 byteCount);
+internal void wav_close_file(WavReader *reader);
 
+// NOTE(michiel): Puts the container, fmt and data chunk headers in `header` (WAV_MAX_HEADER_SIZE bytes)
+// and returns their size. With `reserveDs64` a RIFF header leaves room to become RF64, so it can be
+// rewritten in place once the final data size is known.
+internal u32 wav_put_header(WavSettings *settings, u64 dataSize, b32 reserveDs64, u8 *header);
+// NOTE(michiel): Opens a wav file for writing. With a `frameCount` the file is preallocated and the header
+// is final from the start, 0 means the count is not known and the sizes get filled in at wav_close_writer.
+internal b32 wav_open_writer(WavWriter *writer, String filename, WavSettings *settings, u64 frameCount);
+// NOTE(michiel): Appends are collected and written out a block at a time
+internal void wav_write_frames(WavWriter *writer, u64 frameCount, void *frames);
+// NOTE(michiel): Writes the last block, patches the header sizes and returns `true` if nothing failed
+internal b32 wav_close_writer(WavWriter *writer);
 internal b32 wav_write_file(String filename, WavSettings *settings, Buffer wavData);
 
 
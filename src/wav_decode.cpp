@@ -1,9 +1,12 @@
 #include "../libberdip/platform.h"
 #include "../libberdip/linux_memory.h"
 
+#include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <pthread.h>
 #include <alsa/asoundlib.h>
 
 #include "./platform_sound.h"
@@ -68,9 +71,8 @@ s32 main(s32 argc, char **argv)
     // NOTE(michiel): Streaming from file directly
     //
     
-    WavStreamer streamer = wav_open_stream(filename);
-    
-    if (streamer.settings.sampleFrequency)
+    WavStreamer streamer;
+    if (wav_open_stream(&streamer, filename, WAV_STREAM_DEFAULT_BLOCKS))
     {
         soundDev->sampleFrequency = streamer.settings.sampleFrequency;
         soundDev->sampleCount = 4096;
@@ -80,7 +82,8 @@ s32 main(s32 argc, char **argv)
         {
             case WavFormat_PCM:
             {
-                switch (streamer.settings.sampleResolution)
+                // NOTE(michiel): The device gets the container, extensible files can have fewer valid bits
+                switch ((streamer.settings.sampleFrameSize / streamer.settings.channelCount) * 8)
                 {
                     case 8:  { soundDev->format = SoundFormat_s8; } break;
                     case 16: { soundDev->format = SoundFormat_s16; } break;
@@ -106,15 +109,14 @@ s32 main(s32 argc, char **argv)
         if (platform_sound_init(soundDev))
         {
             u32 maxSize = soundDev->sampleCount * streamer.settings.sampleFrameSize;
-            u8 *readBlock = allocate_array(u8, maxSize);
             
-            Buffer readBuffer = {maxSize, readBlock};
-            while (wav_read_stream(&streamer, &readBuffer))
+            Buffer readBuffer = wav_read_stream(&streamer, maxSize);
+            while (readBuffer.size)
             {
                 soundDev->sampleCount = readBuffer.size / streamer.settings.sampleFrameSize;
                 if (platform_sound_write(soundDev, readBuffer.data))
                 {
-                    readBuffer = {maxSize, readBlock};
+                    readBuffer = wav_read_stream(&streamer, maxSize);
                 }
                 else
                 {
@@ -127,6 +129,7 @@ s32 main(s32 argc, char **argv)
         {
             // TODO(michiel): Error opening sound device
         }
+        wav_close_stream(&streamer);
     }
     else
     {
@@ -147,7 +150,8 @@ s32 main(s32 argc, char **argv)
         {
             case WavFormat_PCM:
             {
-                switch (reader.settings.sampleResolution)
+                // NOTE(michiel): The device gets the container, extensible files can have fewer valid bits
+                switch ((reader.settings.sampleFrameSize / reader.settings.channelCount) * 8)
                 {
                     case 8:  { soundDev->format = SoundFormat_s8; } break;
                     case 16: { soundDev->format = SoundFormat_s16; } break;
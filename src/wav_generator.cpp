@@ -4,8 +4,10 @@
 
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <pthread.h>
 
 #include "wav.h"
 
@@ -120,72 +122,96 @@ s32 main(s32 argc, char **argv)
     f64 amplitude = pow64(10, ampltIndB / 20.0);
     fprintf(stdout, "Amplitude: %f (%a)\n", amplitude, amplitude);
 
+    //
+    // NOTE(michiel): File write
+    //
+    u8 nameBuf[4096];
+    String filename = {};
+    if (doSweep) {
+        filename = string_fmt(array_count(nameBuf), nameBuf, "sine_%uHz_%uHz_%.1fdBFS@%uHz_%u_%usec.wav",
+                              (u32)frequency, (u32)sweepEndFreq, ampltIndB, settings.sampleFrequency, (u32)settings.sampleResolution, lengthInSecs);
+    } else {
+        filename = string_fmt(array_count(nameBuf), nameBuf, "sine_%uHz_%.1fdBFS@%uHz_%u_%usec.wav",
+                              (u32)frequency, ampltIndB, settings.sampleFrequency, (u32)settings.sampleResolution, lengthInSecs);
+    }
+    
+    WavWriter writer;
+    if (!wav_open_writer(&writer, filename, &settings, sampleCount))
+    {
+        fprintf(stderr, "Could not open '%.*s'\n", STR_FMT(filename));
+        return 1;
+    }
+    
+    // NOTE(michiel): Generated a block at a time, so the length doesn't change the memory use
+    u32 blockFrameCount = WAV_WRITE_BLOCK_SIZE / settings.sampleFrameSize;
     Buffer sampleData = {};
-    sampleData.size = sampleCount * settings.sampleFrameSize;
+    sampleData.size = blockFrameCount * settings.sampleFrameSize;
     sampleData.data = (u8 *)allocate_size(&platformAlloc, sampleData.size, default_memory_alloc());
     
-    Buffer fillAt = sampleData;
     f64 at = 0.0;
     f64 atStep = frequency / (f64)settings.sampleFrequency;
     f64 atTotal = 0.0;
 
-    while (fillAt.size)
+    u32 framesLeft = sampleCount;
+    while (framesLeft)
     {
-        f64 sample = amplitude * sin_pi(F64_TAU * at);
-        for (u32 channel = 0; channel < settings.channelCount; ++channel)
+        u32 frameCount = minimum(framesLeft, blockFrameCount);
+        Buffer fillAt = sampleData;
+        fillAt.size = frameCount * settings.sampleFrameSize;
+        
+        while (fillAt.size)
         {
-            switch (settings.sampleResolution)
+            f64 sample = amplitude * sin_pi(F64_TAU * at);
+            for (u32 channel = 0; channel < settings.channelCount; ++channel)
             {
-                case 16: {
-                    s32 value = (s32)round64((f64)S16_MAX * sample);
-                    *(u16 *)fillAt.data = safe_truncate_to_s16(value);
-                    advance(&fillAt, 2);
-                } break;
-
-                case 24: {
-                    s32 value = (s32)round64((f64)(s32)0x007FFFFF * sample);
-                    fillAt.data[0] = ((value >>  0) & 0xFF);
-                    fillAt.data[1] = ((value >>  8) & 0xFF);
-                    fillAt.data[2] = ((value >> 16) & 0xFF);
-                    advance(&fillAt, 3);
-                } break;
-
-                case 32: {
-                    s32 value = (s32)round64((f64)S32_MAX * sample);
-                    *(u32 *)fillAt.data = value;
-                    advance(&fillAt, 4);
-                } break;
-
-                INVALID_DEFAULT_CASE;
+                switch (settings.sampleResolution)
+                {
+                    case 16: {
+                        s32 value = (s32)round64((f64)S16_MAX * sample);
+                        *(u16 *)fillAt.data = safe_truncate_to_s16(value);
+                        advance(&fillAt, 2);
+                    } break;
+
+                    case 24: {
+                        s32 value = (s32)round64((f64)(s32)0x007FFFFF * sample);
+                        fillAt.data[0] = ((value >>  0) & 0xFF);
+                        fillAt.data[1] = ((value >>  8) & 0xFF);
+                        fillAt.data[2] = ((value >> 16) & 0xFF);
+                        advance(&fillAt, 3);
+                    } break;
+
+                    case 32: {
+                        s32 value = (s32)round64((f64)S32_MAX * sample);
+                        *(u32 *)fillAt.data = value;
+                        advance(&fillAt, 4);
+                    } break;
+
+                    INVALID_DEFAULT_CASE;
+                }
             }
-        }
 
-        if (doSweep) {
-            f64 fNew = exp64(log64(frequency) * (1.0 - atTotal / lengthInSecs) +
-                             log64(sweepEndFreq) * (atTotal / lengthInSecs));
-            atStep = fNew / (f64)settings.sampleFrequency;
-        }
+            if (doSweep) {
+                f64 fNew = exp64(log64(frequency) * (1.0 - atTotal / lengthInSecs) +
+                                 log64(sweepEndFreq) * (atTotal / lengthInSecs));
+                atStep = fNew / (f64)settings.sampleFrequency;
+            }
 
-        at += atStep;
-        atTotal += 1.0 / (f64)settings.sampleFrequency;
-        if (at >= 1.0) {
-            at -= 1.0;
+            at += atStep;
+            atTotal += 1.0 / (f64)settings.sampleFrequency;
+            if (at >= 1.0) {
+                at -= 1.0;
+            }
         }
+        
+        wav_write_frames(&writer, frameCount, sampleData.data);
+        framesLeft -= frameCount;
     }
     
-    //
-    // NOTE(michiel): File write
-    //
-    u8 nameBuf[4096];
-    String filename = {};
-    if (doSweep) {
-        filename = string_fmt(array_count(nameBuf), nameBuf, "sine_%uHz_%uHz_%.1fdBFS@%uHz_%u_%usec.wav",
-                              (u32)frequency, (u32)sweepEndFreq, ampltIndB, settings.sampleFrequency, (u32)settings.sampleResolution, lengthInSecs);
-    } else {
-        filename = string_fmt(array_count(nameBuf), nameBuf, "sine_%uHz_%.1fdBFS@%uHz_%u_%usec.wav",
-                              (u32)frequency, ampltIndB, settings.sampleFrequency, (u32)settings.sampleResolution, lengthInSecs);
+    if (!wav_close_writer(&writer))
+    {
+        fprintf(stderr, "Failed to write '%.*s'\n", STR_FMT(filename));
+        return 1;
     }
-    wav_write_file(filename, &settings, sampleData);
     
     return 0;
 }